@@ -119,6 +119,59 @@ Blockly.Blocks['robot_putar_sudut'] = {
   }
 };
 
+Blockly.Blocks['robot_maju_jarak'] = {
+  init: function() {
+    this.appendValueInput('DISTANCE')
+        .setCheck('Number')
+        .appendField('📏 Maju sejauh');
+    this.appendValueInput('SPEED')
+        .setCheck('Number')
+        .appendField('cm, kecepatan');
+    this.appendDummyInput()
+        .appendField('%');
+    this.setInputsInline(true);
+    this.setPreviousStatement(true, null);
+    this.setNextStatement(true, null);
+    this.setColour(COLORS.MOTOR);
+    this.setTooltip('Robot maju sejauh jarak tertentu lalu berhenti (negatif = mundur)');
+    this.setHelpUrl('');
+  }
+};
+
+Blockly.Blocks['robot_ke_titik'] = {
+  init: function() {
+    this.appendValueInput('X')
+        .setCheck('Number')
+        .appendField('📍 Pergi ke titik x');
+    this.appendValueInput('Y')
+        .setCheck('Number')
+        .appendField('y');
+    this.appendValueInput('SPEED')
+        .setCheck('Number')
+        .appendField('cm, kecepatan');
+    this.appendDummyInput()
+        .appendField('%');
+    this.setInputsInline(true);
+    this.setPreviousStatement(true, null);
+    this.setNextStatement(true, null);
+    this.setColour(COLORS.MOTOR);
+    this.setTooltip('Robot menghadap ke titik (x, y) lalu maju ke sana. Titik (0, 0) adalah posisi awal, x ke depan, y ke kiri');
+    this.setHelpUrl('');
+  }
+};
+
+Blockly.Blocks['robot_reset_posisi'] = {
+  init: function() {
+    this.appendDummyInput()
+        .appendField('🎯 Jadikan posisi ini titik (0, 0)');
+    this.setPreviousStatement(true, null);
+    this.setNextStatement(true, null);
+    this.setColour(COLORS.MOTOR);
+    this.setTooltip('Posisi robot sekarang menjadi titik awal, menghadap sumbu x');
+    this.setHelpUrl('');
+  }
+};
+
 Blockly.Blocks['robot_stop'] = {
   init: function() {
     this.appendDummyInput()
@@ -96,6 +96,23 @@ arduinoGenerator['robot_putar_sudut'] = function(block) {
   return `robotRotate(${angle});\n`
 }
 
+arduinoGenerator['robot_maju_jarak'] = function(block) {
+  const distance = arduinoGenerator.valueToCode(block, 'DISTANCE', arduinoGenerator.ORDER_ATOMIC) || '20'
+  const speed = arduinoGenerator.valueToCode(block, 'SPEED', arduinoGenerator.ORDER_ATOMIC) || '50'
+  return `robotDrive(${distance}, ${speed});\n`
+}
+
+arduinoGenerator['robot_ke_titik'] = function(block) {
+  const x = arduinoGenerator.valueToCode(block, 'X', arduinoGenerator.ORDER_ATOMIC) || '0'
+  const y = arduinoGenerator.valueToCode(block, 'Y', arduinoGenerator.ORDER_ATOMIC) || '0'
+  const speed = arduinoGenerator.valueToCode(block, 'SPEED', arduinoGenerator.ORDER_ATOMIC) || '50'
+  return `robotGoTo(${x}, ${y}, ${speed});\n`
+}
+
+arduinoGenerator['robot_reset_posisi'] = function(block) {
+  return `robotResetPose();\n`
+}
+
 arduinoGenerator['robot_stop'] = function(block) {
   return `robotStop();\n`
 }
@@ -427,6 +444,23 @@ liveGenerator['robot_mundur'] = function(block) {
   return JSON.stringify({ type: 'backward', speed: parseInt(speed) }) + '\n'
 }
 
+liveGenerator['robot_maju_jarak'] = function(block) {
+  const distance = liveGenerator.valueToCode(block, 'DISTANCE', liveGenerator.ORDER_ATOMIC) || '20'
+  const speed = liveGenerator.valueToCode(block, 'SPEED', liveGenerator.ORDER_ATOMIC) || '50'
+  return JSON.stringify({ type: 'drive', distance: parseFloat(distance), speed: parseInt(speed) }) + '\n'
+}
+
+liveGenerator['robot_ke_titik'] = function(block) {
+  const x = liveGenerator.valueToCode(block, 'X', liveGenerator.ORDER_ATOMIC) || '0'
+  const y = liveGenerator.valueToCode(block, 'Y', liveGenerator.ORDER_ATOMIC) || '0'
+  const speed = liveGenerator.valueToCode(block, 'SPEED', liveGenerator.ORDER_ATOMIC) || '50'
+  return JSON.stringify({ type: 'goto', x: parseFloat(x), y: parseFloat(y), speed: parseInt(speed) }) + '\n'
+}
+
+liveGenerator['robot_reset_posisi'] = function(block) {
+  return JSON.stringify({ type: 'pose', action: 'reset' }) + '\n'
+}
+
 liveGenerator['robot_stop'] = function(block) {
   return JSON.stringify({ type: 'stop' }) + '\n'
 }
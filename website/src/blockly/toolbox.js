@@ -88,6 +88,52 @@ export const toolbox = {
             }
           }
         },
+        {
+          kind: 'block',
+          type: 'robot_maju_jarak',
+          inputs: {
+            DISTANCE: {
+              shadow: {
+                type: 'math_number',
+                fields: { NUM: 20 }
+              }
+            },
+            SPEED: {
+              shadow: {
+                type: 'math_number',
+                fields: { NUM: 50 }
+              }
+            }
+          }
+        },
+        {
+          kind: 'block',
+          type: 'robot_ke_titik',
+          inputs: {
+            X: {
+              shadow: {
+                type: 'math_number',
+                fields: { NUM: 50 }
+              }
+            },
+            Y: {
+              shadow: {
+                type: 'math_number',
+                fields: { NUM: 0 }
+              }
+            },
+            SPEED: {
+              shadow: {
+                type: 'math_number',
+                fields: { NUM: 50 }
+              }
+            }
+          }
+        },
+        {
+          kind: 'block',
+          type: 'robot_reset_posisi'
+        },
         {
           kind: 'block',
           type: 'robot_stop'
@@ -0,0 +1,66 @@
+import React, { useEffect, useRef, useState } from 'react'
+import { Monitor, Eye, EyeOff } from 'lucide-react'
+import { useRobot } from '../context/RobotContext'
+
+// Live copy of the robot's OLED, pixel for pixel, for the projector
+function DisplayMirror() {
+  const { connected, displayFrame, watchDisplay } = useRobot()
+  const [watching, setWatching] = useState(false)
+  const canvasRef = useRef(null)
+
+  useEffect(() => {
+    if (!watching || !connected) return
+    watchDisplay(10)
+    return () => watchDisplay(0)
+  }, [watching, connected, watchDisplay])
+
+  useEffect(() => {
+    const canvas = canvasRef.current
+    if (!canvas || !displayFrame) return
+    const { width, height, frame } = displayFrame
+    canvas.width = width
+    canvas.height = height
+    const context = canvas.getContext('2d')
+    const image = context.createImageData(width, height)
+    // SSD1306 order: pages of 8 rows, one byte per column, top row in bit 0
+    for (let y = 0; y < height; y++) {
+      for (let x = 0; x < width; x++) {
+        const lit = (frame[(y >> 3) * width + x] >> (y & 7)) & 1
+        const p = (y * width + x) * 4
+        image.data[p] = lit ? 140 : 0
+        image.data[p + 1] = lit ? 210 : 0
+        image.data[p + 2] = lit ? 255 : 0
+        image.data[p + 3] = 255
+      }
+    }
+    context.putImageData(image, 0, 0)
+  }, [displayFrame])
+
+  return (
+    <div className="p-4 rounded-2xl bg-white/10 border border-white/20">
+      <div className="flex items-center gap-2 mb-3">
+        <Monitor size={20} className="text-cyan-400" />
+        <span className="text-white font-semibold">Layar Robot</span>
+        <button
+          onClick={() => setWatching(!watching)}
+          disabled={!connected}
+          className="ml-auto p-1.5 rounded-lg bg-white/10 hover:bg-white/20 text-white disabled:opacity-40"
+          title={watching ? 'Sembunyikan layar' : 'Tampilkan layar'}
+        >
+          {watching ? <EyeOff size={16} /> : <Eye size={16} />}
+        </button>
+      </div>
+      {watching && (
+        <canvas
+          ref={canvasRef}
+          width={128}
+          height={64}
+          className="w-full rounded-lg bg-black"
+          style={{ imageRendering: 'pixelated', aspectRatio: '2 / 1' }}
+        />
+      )}
+    </div>
+  )
+}
+
+export default DisplayMirror
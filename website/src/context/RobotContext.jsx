@@ -5,6 +5,15 @@ const RobotContext = createContext()
 // API Server for compilation
 const API_SERVER = 'https://involuntary-cryptonymous-delaine.ngrok-free.dev'
 
+// Commands the robot can run from its timeline (see firmware README)
+const TIMELINE_COMMANDS = [
+  'move', 'forward', 'backward', 'stop', 'speed', 'drive', 'goto',
+  'led', 'led_all', 'led_rainbow', 'led_blink', 'led_breathe', 'led_sequence',
+  'tone', 'music_stop', 'display_text', 'display_clear', 'display_image', 'display_bitmap'
+]
+const TIMELINE_BATCH = 24          // Commands per timeline message
+const TIMELINE_LOOKAHEAD_MS = 1500 // Keep this much queued on the robot
+
 export function useRobot() {
   return useContext(RobotContext)
 }
@@ -37,8 +46,15 @@ export function RobotProvider({ children }) {
   const [isLiveMode, setIsLiveMode] = useState(true)
   const [isScanning, setIsScanning] = useState(false)
   const [compileStatus, setCompileStatus] = useState({ status: 'idle', message: '' })
+  const [displayFrame, setDisplayFrame] = useState(null)
   const wsRef = useRef(null)
   const reconnectTimeoutRef = useRef(null)
+  const timelineReplyRef = useRef(null)
+  const timelineDoneRef = useRef(null)
+  const motionDoneRef = useRef(null)
+  const programCancelRef = useRef(false)
+  // Display mirror: the screen as last decoded, and the sequence expected next
+  const mirrorRef = useRef({ fps: 0, frame: null, next: -1 })
 
   // Check if running in Android WebView
   const isAndroidApp = useCallback(() => {
@@ -85,19 +101,92 @@ export function RobotProvider({ children }) {
     }
   }, [isAndroidApp])
 
+  const subscribeMirror = useCallback((fps) => {
+    mirrorRef.current.next = -1
+    if (wsRef.current?.readyState === WebSocket.OPEN) {
+      wsRef.current.send(JSON.stringify({ type: 'display_mirror', enabled: fps > 0, fps: fps || undefined }))
+    }
+  }, [])
+
+  // Applies one display mirror message (see firmware/README.md, Display
+  // Mirror): the XOR against the previous frame, run-length coded. After a
+  // missed message the deltas no longer apply, so the stream is restarted
+  // with a key frame.
+  const handleMirrorMessage = useCallback((buffer) => {
+    const bytes = new Uint8Array(buffer)
+    const mirror = mirrorRef.current
+    if (bytes.length < 6 || bytes[0] !== 0x4d || !mirror.fps) return
+
+    const flags = bytes[1]
+    const sequence = bytes[2] | (bytes[3] << 8)
+    const width = bytes[4]
+    const height = bytes[5]
+    const size = width * height / 8
+    const key = (flags & 0x01) !== 0
+    const raw = (flags & 0x02) !== 0
+    if (!key && !raw && (sequence !== mirror.next || mirror.frame?.length !== size)) {
+      if (mirror.next >= 0) subscribeMirror(mirror.fps)
+      return
+    }
+
+    const payload = bytes.subarray(6)
+    let frame
+    if (raw) {
+      frame = payload.slice()
+    } else {
+      frame = key ? new Uint8Array(size) : mirror.frame.slice()
+      let i = 0
+      let o = 0
+      while (i < payload.length && o <= size) {
+        const code = payload[i++]
+        if (code < 0x80) {
+          o += code + 1
+        } else if (code < 0xc0) {
+          for (let n = (code & 0x3f) + 1; n > 0; n--) frame[o++] ^= payload[i++]
+        } else {
+          const value = payload[i++]
+          for (let n = (code & 0x3f) + 2; n > 0; n--) frame[o++] ^= value
+        }
+      }
+      if (o !== size || i !== payload.length) {
+        subscribeMirror(mirror.fps)
+        return
+      }
+    }
+    if (frame.length !== size) return
+
+    mirror.frame = frame
+    mirror.next = (sequence + 1) & 0xffff
+    setDisplayFrame({ width, height, frame })
+  }, [subscribeMirror])
+
+  // Streams the robot's OLED into displayFrame; 0 stops it
+  const watchDisplay = useCallback((fps = 10) => {
+    mirrorRef.current.fps = fps
+    if (!fps) setDisplayFrame(null)
+    subscribeMirror(fps)
+  }, [subscribeMirror])
+
   // WebSocket connection
   const connectWebSocket = useCallback(() => {
     if (wsRef.current?.readyState === WebSocket.OPEN) return
 
     try {
       wsRef.current = new WebSocket(`ws://${robotIP}/ws`)
+      wsRef.current.binaryType = 'arraybuffer'
 
       wsRef.current.onopen = () => {
         console.log('Connected to robot')
         setConnected(true)
+        // The robot forgets watchers when they disconnect
+        if (mirrorRef.current.fps) subscribeMirror(mirrorRef.current.fps)
       }
 
       wsRef.current.onmessage = (event) => {
+        if (event.data instanceof ArrayBuffer) {
+          handleMirrorMessage(event.data)
+          return
+        }
         try {
           const data = JSON.parse(event.data)
           
@@ -114,6 +203,18 @@ export function RobotProvider({ children }) {
             setAvailableNetworks(data.networks || [])
           } else if (data.type === 'config_saved') {
             console.log('Config saved successfully')
+          } else if (data.type === 'timeline') {
+            if (data.event === 'done') {
+              timelineDoneRef.current?.(data)
+            } else if (data.event === 'underrun') {
+              console.warn('Timeline underrun, slip', data.slipMs, 'ms')
+            } else {
+              timelineReplyRef.current?.(data)
+            }
+          } else if (data.type === 'motion') {
+            motionDoneRef.current?.(data)
+          } else if (data.type === 'display_mirror') {
+            if (data.error) console.warn('Display mirror:', data.error)
           } else {
             // Regular sensor data
             setRobotData(prev => ({ ...prev, ...data }))
@@ -138,7 +239,7 @@ export function RobotProvider({ children }) {
       console.error('Failed to connect:', error)
       setConnected(false)
     }
-  }, [robotIP])
+  }, [robotIP, subscribeMirror, handleMirrorMessage])
 
   const disconnect = useCallback(() => {
     if (reconnectTimeoutRef.current) {
@@ -160,6 +261,88 @@ export function RobotProvider({ children }) {
     return false
   }, [])
 
+  // Send one timeline batch and wait for the robot's status reply
+  const sendTimeline = useCallback((commands, more) => {
+    return new Promise(resolve => {
+      const timeout = setTimeout(() => resolve(null), 3000)
+      timelineReplyRef.current = (status) => {
+        clearTimeout(timeout)
+        timelineReplyRef.current = null
+        resolve(status)
+      }
+      if (!sendCommand({ type: 'timeline', commands, more })) {
+        clearTimeout(timeout)
+        resolve(null)
+      }
+    })
+  }, [sendCommand])
+
+  // Run a program from generateLiveCommands(). Programs made only of
+  // timeline commands and delays are streamed to the robot ahead of time
+  // and run on its clock; anything else is paced from here.
+  const runProgram = useCallback(async (commands) => {
+    programCancelRef.current = false
+    const wait = (ms) => new Promise(resolve => setTimeout(resolve, ms))
+
+    const timed = commands.every(c => c.type === 'delay' || TIMELINE_COMMANDS.includes(c.type))
+    if (!commands.some(c => c.type !== 'delay')) return true
+    if (!timed) {
+      for (const command of commands) {
+        if (programCancelRef.current) return false
+        if (command.type === 'drive' || command.type === 'goto') {
+          // Runs until the robot reports it has arrived
+          const arrived = new Promise(resolve => { motionDoneRef.current = resolve })
+          sendCommand(command)
+          await arrived
+          motionDoneRef.current = null
+          continue
+        }
+        sendCommand(command)
+        await wait(command.type === 'delay' ? command.ms : 100)
+      }
+      return true
+    }
+
+    const done = new Promise(resolve => { timelineDoneRef.current = resolve })
+    let sent = 0
+    let free = TIMELINE_BATCH
+    while (sent < commands.length) {
+      if (programCancelRef.current) return false
+
+      // Take up to `free` commands; delays ride along for free
+      let end = sent
+      let count = 0
+      while (end < commands.length && (commands[end].type === 'delay' || count < free)) {
+        if (commands[end].type !== 'delay') count++
+        end++
+      }
+      const status = await sendTimeline(commands.slice(sent, end), end < commands.length)
+      if (!status || status.error) {
+        console.error('Timeline rejected:', status?.error)
+        return false
+      }
+      sent = end
+      free = Math.min(status.free, TIMELINE_BATCH)
+
+      // Let the robot's queue drain down to the lookahead before topping up
+      if (sent < commands.length) {
+        await wait(Math.max(status.bufferedMs - TIMELINE_LOOKAHEAD_MS, free > 0 ? 0 : 100))
+        if (free === 0) free = 1
+      }
+    }
+    await done
+    timelineDoneRef.current = null
+    return !programCancelRef.current
+  }, [sendCommand, sendTimeline])
+
+  const stopProgram = useCallback(() => {
+    programCancelRef.current = true
+    sendCommand({ type: 'timeline_clear' })
+    sendCommand({ type: 'stop' })
+    timelineDoneRef.current?.(null)
+    motionDoneRef.current?.(null)
+  }, [sendCommand])
+
   // Robot control functions
   const moveRobot = useCallback((x, y) => {
     // x: -100 to 100 (left/right), y: -100 to 100 (backward/forward)
@@ -321,11 +504,15 @@ export function RobotProvider({ children }) {
     isLiveMode,
     isScanning,
     compileStatus,
+    displayFrame,
     isAndroidApp,
     setIsLiveMode,
     connectWebSocket,
     disconnect,
     sendCommand,
+    watchDisplay,
+    runProgram,
+    stopProgram,
     moveRobot,
     stopRobot,
     setSpeed,
@@ -10,6 +10,7 @@ import { useRobot } from '../context/RobotContext'
 import Joystick from '../components/Joystick'
 import SensorDisplay from '../components/SensorDisplay'
 import LEDControl from '../components/LEDControl'
+import DisplayMirror from '../components/DisplayMirror'
 
 function AyoMain() {
   const navigate = useNavigate()
@@ -83,6 +84,9 @@ function AyoMain() {
         {/* Left Panel - Sensors */}
         <div className="w-80 p-4 border-r border-white/10 overflow-y-auto">
           <SensorDisplay data={robotData} />
+          <div className="mt-4">
+            <DisplayMirror />
+          </div>
         </div>
 
         {/* Center - Joystick Control */}
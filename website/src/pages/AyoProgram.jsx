@@ -19,7 +19,7 @@ import {
 
 function AyoProgram({ simple = false, tutorialMode = false, tutorialConfig = null }) {
   const navigate = useNavigate()
-  const { connected, executeCode, uploadCode, sendCommand } = useRobot()
+  const { connected, executeCode, uploadCode, runProgram, stopProgram } = useRobot()
   const blocklyRef = useRef(null)
   const workspaceRef = useRef(null)
   
@@ -69,16 +69,7 @@ function AyoProgram({ simple = false, tutorialMode = false, tutorialConfig = nul
     
     setIsRunning(true)
     const commands = generateLiveCommands(workspaceRef.current)
-    
-    for (const command of commands) {
-      if (!isRunning) break
-      sendCommand(command)
-      if (command.type === 'delay') {
-        await new Promise(resolve => setTimeout(resolve, command.ms))
-      } else {
-        await new Promise(resolve => setTimeout(resolve, 100))
-      }
-    }
+    await runProgram(commands)
     
     setIsRunning(false)
   }
@@ -86,7 +77,7 @@ function AyoProgram({ simple = false, tutorialMode = false, tutorialConfig = nul
   // Handle stop
   const handleStop = () => {
     setIsRunning(false)
-    sendCommand({ type: 'stop' })
+    stopProgram()
   }
 
   // Handle upload
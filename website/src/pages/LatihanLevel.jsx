@@ -234,7 +234,7 @@ const tutorialConfigs = {
 function LatihanLevel() {
   const navigate = useNavigate()
   const { category, level } = useParams()
-  const { connected, sendCommand } = useRobot()
+  const { connected, runProgram } = useRobot()
   
   const blocklyRef = useRef(null)
   const workspaceRef = useRef(null)
@@ -298,14 +298,7 @@ function LatihanLevel() {
 
     // Execute blocks
     const commands = generateLiveCommands(workspaceRef.current)
-    for (const command of commands) {
-      sendCommand(command)
-      if (command.type === 'delay') {
-        await new Promise(resolve => setTimeout(resolve, command.ms))
-      } else {
-        await new Promise(resolve => setTimeout(resolve, 100))
-      }
-    }
+    await runProgram(commands)
 
     // Calculate stars
     let earnedStars = 3
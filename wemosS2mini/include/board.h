@@ -0,0 +1,66 @@
+/*
+ * Sirobo board definitions - Wemos Lolin S2 Mini carrier
+ *
+ * Shared by the firmware and the HAL backends.
+ */
+
+#ifndef SIROBO_BOARD_H
+#define SIROBO_BOARD_H
+
+// =====================================================
+// PIN DEFINITIONS
+// =====================================================
+
+// I2C Pins
+#define I2C_SDA 35
+#define I2C_SCL 36
+
+// Motor Driver L298N
+#define MOTOR_LEFT_EN   9
+#define MOTOR_LEFT_IN1  5
+#define MOTOR_LEFT_IN2  6
+#define MOTOR_RIGHT_EN  10
+#define MOTOR_RIGHT_IN1 7
+#define MOTOR_RIGHT_IN2 8
+
+// WS2812 LEDs
+#define LED_PIN 18
+#define NUM_LEDS 2
+
+// Line Follower Sensors (8 sensors)
+#define LINE_SENSOR_1  1   // Leftmost
+#define LINE_SENSOR_2  2
+#define LINE_SENSOR_3  3
+#define LINE_SENSOR_4  4
+#define LINE_SENSOR_5  11
+#define LINE_SENSOR_6  12
+#define LINE_SENSOR_7  13
+#define LINE_SENSOR_8  14  // Rightmost
+
+// LDR Sensors
+#define LDR_LEFT  15
+#define LDR_RIGHT 21
+
+// Ultrasonic Sensor
+#define ULTRASONIC_TRIG 16
+#define ULTRASONIC_ECHO 17
+
+// Push Buttons
+#define BUTTON_1 37
+#define BUTTON_2 38
+#define BUTTON_3 39
+#define BUTTON_4 40
+
+// Buzzer
+#define BUZZER_PIN 33
+
+// =====================================================
+// DEVICES
+// =====================================================
+
+#define SCREEN_WIDTH 128
+#define SCREEN_HEIGHT 64
+#define OLED_RESET -1
+#define OLED_ADDRESS 0x3C
+
+#endif
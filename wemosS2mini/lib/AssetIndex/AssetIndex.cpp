@@ -0,0 +1,131 @@
+#include "AssetIndex.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Splits off the next space-separated field; nullptr at the end of the line
+static char* nextField(char*& cursor) {
+  if (!*cursor) return nullptr;
+  char* field = cursor;
+  char* space = strchr(cursor, ' ');
+  if (space) {
+    *space = '\0';
+    cursor = space + 1;
+  } else {
+    cursor += strlen(cursor);
+  }
+  return field;
+}
+
+static bool isHex(const char* text, size_t len) {
+  if (strlen(text) != len) return false;
+  for (size_t i = 0; i < len; i++) {
+    char c = text[i];
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))) return false;
+  }
+  return true;
+}
+
+size_t AssetIndex::parse(char* text) {
+  _count = 0;
+  _skipped = 0;
+
+  char* line = text;
+  while (line && *line) {
+    char* end = strchr(line, '\n');
+    if (end) *end = '\0';
+    size_t len = strlen(line);
+    if (len && line[len - 1] == '\r') line[len - 1] = '\0';
+
+    if (*line && *line != '#') {
+      char* cursor = line;
+      char* path = nextField(cursor);
+      char* size = nextField(cursor);
+      char* etag = nextField(cursor);
+      char* flags = nextField(cursor);
+      char* type = *cursor ? cursor : nullptr;
+
+      char* sizeEnd = nullptr;
+      unsigned long bytes = size ? strtoul(size, &sizeEnd, 10) : 0;
+      if (!type || path[0] != '/' || strlen(path) >= ASSET_PATH_MAX || *sizeEnd ||
+          !isHex(etag, ASSET_ETAG_SIZE) || _count == ASSET_MAX_COUNT) {
+        _skipped++;
+      } else {
+        Asset& asset = _assets[_count++];
+        asset.path = path;
+        asset.etag = etag;
+        asset.contentType = type;
+        asset.size = bytes;
+        asset.flags = 0;
+        if (strchr(flags, 'g')) asset.flags |= ASSET_FLAG_GZIP;
+        if (strchr(flags, 'i')) asset.flags |= ASSET_FLAG_IMMUTABLE;
+      }
+    }
+    line = end ? end + 1 : nullptr;
+  }
+  return _count;
+}
+
+const Asset* AssetIndex::find(const char* path) const {
+  for (size_t i = 0; i < _count; i++) {
+    if (strcmp(_assets[i].path, path) == 0) return &_assets[i];
+  }
+  return nullptr;
+}
+
+const Asset* AssetIndex::resolve(const char* path) const {
+  if (strcmp(path, "/") == 0) return find("/index.html");
+
+  const Asset* asset = find(path);
+  if (asset) return asset;
+
+  // The app routes in the browser; only paths that name a file are missing
+  const char* name = strrchr(path, '/');
+  if (!strchr(name ? name : path, '.')) return find("/index.html");
+  return nullptr;
+}
+
+AssetRange parseAssetRange(const char* header, uint32_t size, uint32_t& start, uint32_t& length) {
+  if (!header || strncmp(header, "bytes=", 6) != 0 || strchr(header, ',')) return ASSET_RANGE_NONE;
+  const char* spec = header + 6;
+  char* end;
+
+  if (*spec == '-') {
+    // Suffix: the last n bytes
+    unsigned long n = strtoul(spec + 1, &end, 10);
+    if (end == spec + 1 || *end) return ASSET_RANGE_NONE;
+    if (n == 0 || size == 0) return ASSET_RANGE_UNSATISFIABLE;
+    if (n > size) n = size;
+    start = size - n;
+    length = n;
+    return ASSET_RANGE_OK;
+  }
+
+  unsigned long first = strtoul(spec, &end, 10);
+  if (end == spec || *end != '-') return ASSET_RANGE_NONE;
+  const char* lastSpec = end + 1;
+  unsigned long last = size ? size - 1 : 0;
+  if (*lastSpec) {
+    last = strtoul(lastSpec, &end, 10);
+    if (*end || last < first) return ASSET_RANGE_NONE;
+    if (last >= size) last = size - 1;
+  }
+  if (first >= size) return ASSET_RANGE_UNSATISFIABLE;
+
+  start = first;
+  length = last - first + 1;
+  return ASSET_RANGE_OK;
+}
+
+bool assetEtagMatches(const char* header, const char* etag) {
+  if (!header) return false;
+  if (strcmp(header, "*") == 0) return true;
+
+  size_t len = strlen(etag);
+  for (const char* p = strchr(header, '"'); p; p = strchr(p + 1, '"')) {
+    if (strncmp(p + 1, etag, len) == 0 && p[len + 1] == '"') return true;
+    p = strchr(p + 1, '"');  // Skip to the closing quote
+    if (!p) break;
+  }
+  return false;
+}
@@ -0,0 +1,86 @@
+/*
+ * AssetIndex - manifest of the web app stored in the robot's filesystem
+ *
+ * tools/assetpack copies the built app (website/dist) into data/www: every
+ * file that compresses well is stored gzip-encoded as <path>.gz, the rest
+ * as is, and ASSET_INDEX_PATH lists them. The index is read once at boot,
+ * so a request is answered without touching the filesystem until the body
+ * is sent.
+ *
+ * Index format: text, one asset per line, fields separated by one space,
+ * '#' lines are comments:
+ *
+ *   <path> <size> <etag> <flags> <content type>
+ *
+ *   path          URL path, starting with '/', no spaces
+ *   size          stored bytes (compressed size for gzip assets)
+ *   etag          16 hex digits: first 8 bytes of the SHA-256 of the stored bytes
+ *   flags         any of 'g' (stored gzip-encoded) and 'i' (immutable: the name
+ *                 contains a content hash), or '-'
+ *   content type  rest of the line
+ *
+ * Parsing works in place on the caller's buffer (tokens are NUL-terminated
+ * there), so the buffer must outlive the index. Not thread-safe while
+ * parsing; lookups are read-only.
+ */
+
+#ifndef SIROBO_ASSET_INDEX_H
+#define SIROBO_ASSET_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ASSET_ROOT "/www"
+#define ASSET_INDEX_PATH "/www/assets.idx"
+#define ASSET_INDEX_SIZE 4096      // Largest index the firmware reads, including the NUL
+#define ASSET_MAX_COUNT 64
+#define ASSET_PATH_MAX 96
+#define ASSET_ETAG_SIZE 16
+
+#define ASSET_FLAG_GZIP      0x01
+#define ASSET_FLAG_IMMUTABLE 0x02
+
+struct Asset {
+  const char* path;
+  const char* etag;
+  const char* contentType;
+  uint32_t size;
+  uint8_t flags;
+};
+
+enum AssetRange : uint8_t {
+  ASSET_RANGE_NONE = 0,       // No (usable) Range header: send everything
+  ASSET_RANGE_OK,             // Send [start, start + length)
+  ASSET_RANGE_UNSATISFIABLE   // 416
+};
+
+class AssetIndex {
+public:
+  AssetIndex() : _count(0), _skipped(0) {}
+
+  // Parses text (NUL-terminated, modified in place); returns the asset count
+  size_t parse(char* text);
+  size_t count() const { return _count; }
+  // Lines that were malformed or beyond ASSET_MAX_COUNT
+  size_t skipped() const { return _skipped; }
+  const Asset& at(size_t index) const { return _assets[index]; }
+
+  const Asset* find(const char* path) const;
+  // find(), with "/" meaning "/index.html" and unknown extensionless paths
+  // (client-side routes such as /editor) falling back to "/index.html"
+  const Asset* resolve(const char* path) const;
+
+private:
+  Asset _assets[ASSET_MAX_COUNT];
+  size_t _count;
+  size_t _skipped;
+};
+
+// Single-range "bytes=a-b", "bytes=a-" or "bytes=-n" against size bytes;
+// multiple ranges are answered with the whole body
+AssetRange parseAssetRange(const char* header, uint32_t size, uint32_t& start, uint32_t& length);
+
+// True if an If-None-Match header lists etag (quoted, optionally W/) or is "*"
+bool assetEtagMatches(const char* header, const char* etag);
+
+#endif
@@ -0,0 +1,104 @@
+#include "Discovery.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void put16(uint8_t* p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+  put16(p, v);
+  put16(p + 2, v >> 16);
+}
+
+static uint16_t get16(const uint8_t* p) {
+  return p[0] | p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t* p) {
+  return get16(p) | (uint32_t)get16(p + 2) << 16;
+}
+
+size_t discoveryEncodeQuery(uint8_t flags, uint16_t nonce, uint8_t* out, size_t maxLen) {
+  if (maxLen < DISCOVERY_QUERY_SIZE) return 0;
+  put32(out, DISCOVERY_QUERY_MAGIC);
+  out[4] = DISCOVERY_VERSION;
+  out[5] = flags;
+  put16(out + 6, nonce);
+  return DISCOVERY_QUERY_SIZE;
+}
+
+bool discoveryParseQuery(const uint8_t* data, size_t len, uint8_t& flags, uint16_t& nonce) {
+  // Newer clients may append fields; the first 8 bytes stay the same
+  if (len < DISCOVERY_QUERY_SIZE || get32(data) != DISCOVERY_QUERY_MAGIC || data[4] < DISCOVERY_VERSION) {
+    return false;
+  }
+  flags = data[5];
+  nonce = get16(data + 6);
+  return true;
+}
+
+size_t discoveryEncodeReply(const DiscoveryInfo& info, uint16_t nonce, uint8_t* out, size_t maxLen) {
+  size_t nameLength = strnlen(info.name, DISCOVERY_NAME_MAX);
+  size_t firmwareLength = strnlen(info.firmware, DISCOVERY_FIRMWARE_MAX);
+  size_t len = 22 + nameLength + firmwareLength;
+  if (len > maxLen) return 0;
+
+  put32(out, DISCOVERY_REPLY_MAGIC);
+  out[4] = DISCOVERY_VERSION;
+  out[5] = info.mode;
+  put16(out + 6, nonce);
+  memcpy(out + 8, info.apIp, 4);
+  memcpy(out + 12, info.stationIp, 4);
+  put16(out + 16, info.httpPort);
+  out[18] = info.clients;
+  out[19] = info.maxClients;
+  out[20] = nameLength;
+  memcpy(out + 21, info.name, nameLength);
+  out[21 + nameLength] = firmwareLength;
+  memcpy(out + 22 + nameLength, info.firmware, firmwareLength);
+  return len;
+}
+
+bool discoveryParseReply(const uint8_t* data, size_t len, DiscoveryInfo& info, uint16_t& nonce) {
+  if (len < 22 || get32(data) != DISCOVERY_REPLY_MAGIC || data[4] < DISCOVERY_VERSION) return false;
+  size_t nameLength = data[20];
+  if (nameLength > DISCOVERY_NAME_MAX || 22 + nameLength > len) return false;
+  size_t firmwareLength = data[21 + nameLength];
+  if (firmwareLength > DISCOVERY_FIRMWARE_MAX || 22 + nameLength + firmwareLength > len) return false;
+
+  info.mode = data[5];
+  nonce = get16(data + 6);
+  memcpy(info.apIp, data + 8, 4);
+  memcpy(info.stationIp, data + 12, 4);
+  info.httpPort = get16(data + 16);
+  info.clients = data[18];
+  info.maxClients = data[19];
+  memcpy(info.name, data + 21, nameLength);
+  info.name[nameLength] = '\0';
+  memcpy(info.firmware, data + 22 + nameLength, firmwareLength);
+  info.firmware[firmwareLength] = '\0';
+  return true;
+}
+
+bool discoveryShouldAnswer(const DiscoveryInfo& info, uint8_t flags) {
+  return !(flags & DISCOVERY_FLAG_FREE_ONLY) || info.clients < info.maxClients;
+}
+
+bool discoveryParseIp(const char* text, uint8_t ip[4]) {
+  memset(ip, 0, 4);
+  const char* p = text;
+  for (uint8_t i = 0; i < 4; i++) {
+    char* end;
+    unsigned long part = strtoul(p, &end, 10);
+    if (end == p || part > 255 || (i < 3 ? *end != '.' : *end != '\0')) {
+      memset(ip, 0, 4);
+      return false;
+    }
+    ip[i] = part;
+    p = end + 1;
+  }
+  return true;
+}
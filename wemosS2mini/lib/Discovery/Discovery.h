@@ -0,0 +1,73 @@
+/*
+ * Discovery - UDP robot discovery packets
+ *
+ * A client broadcasts one DiscoveryQuery to DISCOVERY_PORT; every robot
+ * that hears it answers the sender directly with a DiscoveryReply. One
+ * round trip finds a whole lab, instead of an HTTP connection per address.
+ *
+ * Query (8 bytes, all fields little-endian):
+ *   0  u32 magic          "SRDQ" (0x51445253)
+ *   4  u8  version        DISCOVERY_VERSION
+ *   5  u8  flags          DISCOVERY_FLAG_*
+ *   6  u16 nonce          echoed in the reply, to drop stale answers
+ *
+ * Reply (22 bytes + name + version):
+ *   0  u32 magic          "SRDR" (0x52445253)
+ *   4  u8  version        DISCOVERY_VERSION
+ *   5  u8  mode           0 = live, 1 = offline
+ *   6  u16 nonce          from the query
+ *   8  u8  apIp[4]        access point address, a.b.c.d
+ *   12 u8  stationIp[4]   station address, 0.0.0.0 if not connected
+ *   16 u16 httpPort       HTTP and WebSocket (/ws) port
+ *   18 u8  clients        WebSocket clients connected
+ *   19 u8  maxClients     WebSocket clients accepted
+ *   20 u8  nameLength     followed by the name (AP SSID), no NUL
+ *   .. u8  versionLength  followed by the firmware version, no NUL
+ *
+ * Robots also advertise _sirobo._tcp over mDNS (TXT: name, version, mode)
+ * for tools that browse DNS-SD instead.
+ */
+
+#ifndef SIROBO_DISCOVERY_H
+#define SIROBO_DISCOVERY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DISCOVERY_PORT 4210
+#define DISCOVERY_QUERY_MAGIC 0x51445253UL
+#define DISCOVERY_REPLY_MAGIC 0x52445253UL
+#define DISCOVERY_VERSION 1
+#define DISCOVERY_QUERY_SIZE 8
+#define DISCOVERY_REPLY_MAX 96
+#define DISCOVERY_NAME_MAX 32
+#define DISCOVERY_FIRMWARE_MAX 16
+
+// Query flags
+#define DISCOVERY_FLAG_FREE_ONLY 0x01   // Only robots with a free client slot answer
+
+struct DiscoveryInfo {
+  char name[DISCOVERY_NAME_MAX + 1];
+  char firmware[DISCOVERY_FIRMWARE_MAX + 1];
+  uint8_t mode;
+  uint8_t apIp[4];
+  uint8_t stationIp[4];
+  uint16_t httpPort;
+  uint8_t clients;
+  uint8_t maxClients;
+};
+
+size_t discoveryEncodeQuery(uint8_t flags, uint16_t nonce, uint8_t* out, size_t maxLen);
+bool discoveryParseQuery(const uint8_t* data, size_t len, uint8_t& flags, uint16_t& nonce);
+
+// Returns the reply length, 0 if it does not fit
+size_t discoveryEncodeReply(const DiscoveryInfo& info, uint16_t nonce, uint8_t* out, size_t maxLen);
+bool discoveryParseReply(const uint8_t* data, size_t len, DiscoveryInfo& info, uint16_t& nonce);
+
+// Whether a robot in this state answers a query with these flags
+bool discoveryShouldAnswer(const DiscoveryInfo& info, uint8_t flags);
+
+// "a.b.c.d" to bytes; false (and 0.0.0.0) if malformed
+bool discoveryParseIp(const char* text, uint8_t ip[4]);
+
+#endif
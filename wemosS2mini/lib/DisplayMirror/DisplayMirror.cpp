@@ -0,0 +1,147 @@
+#include "DisplayMirror.h"
+
+#include <string.h>
+
+#define MIRROR_SKIP_MAX 128
+#define MIRROR_LITERAL 0x80
+#define MIRROR_LITERAL_MAX 64
+#define MIRROR_REPEAT 0xC0
+#define MIRROR_REPEAT_MIN 3     // Shorter runs go out as literals
+#define MIRROR_REPEAT_MAX 65
+
+static inline uint8_t delta(const uint8_t* frame, const uint8_t* previous, size_t i) {
+  return frame[i] ^ previous[i];
+}
+
+// =====================================================
+// CODING
+// =====================================================
+
+size_t mirrorEncode(const uint8_t* frame, const uint8_t* previous, size_t size, uint8_t* out, size_t capacity) {
+  size_t i = 0, o = 0;
+  while (i < size) {
+    uint8_t d = delta(frame, previous, i);
+    size_t run = 1;
+    while (i + run < size && run < MIRROR_SKIP_MAX && delta(frame, previous, i + run) == d) run++;
+
+    if (d == 0) {
+      if (o + 1 > capacity) return 0;
+      out[o++] = run - 1;
+      i += run;
+      continue;
+    }
+    if (run >= MIRROR_REPEAT_MIN) {
+      if (run > MIRROR_REPEAT_MAX) run = MIRROR_REPEAT_MAX;
+      if (o + 2 > capacity) return 0;
+      out[o++] = MIRROR_REPEAT | (run - 2);
+      out[o++] = d;
+      i += run;
+      continue;
+    }
+
+    // Literals, up to two unchanged bytes or a run worth repeating
+    size_t start = i;
+    while (i < size && i - start < MIRROR_LITERAL_MAX) {
+      if (i + 1 < size) {
+        uint8_t here = delta(frame, previous, i);
+        uint8_t next = delta(frame, previous, i + 1);
+        if (here == 0 && next == 0) break;
+        if (i + 2 < size && here == next && here == delta(frame, previous, i + 2)) break;
+      }
+      i++;
+    }
+    size_t count = i - start;
+    if (o + 1 + count > capacity) return 0;
+    out[o++] = MIRROR_LITERAL | (count - 1);
+    for (size_t k = start; k < i; k++) out[o++] = delta(frame, previous, k);
+  }
+  return o;
+}
+
+bool mirrorUnpack(const uint8_t* message, size_t len, uint8_t* frame, size_t size) {
+  if (len < MIRROR_HEADER || message[0] != MIRROR_KIND || (size_t)message[4] * message[5] / 8 != size) {
+    return false;
+  }
+  uint8_t flags = message[1];
+  const uint8_t* in = message + MIRROR_HEADER;
+  size_t n = len - MIRROR_HEADER;
+  if (flags & MIRROR_RAW) {
+    if (n != size) return false;
+    memcpy(frame, in, size);
+    return true;
+  }
+  if (flags & MIRROR_KEY) memset(frame, 0, size);
+
+  size_t i = 0, o = 0;
+  while (i < n) {
+    uint8_t code = in[i++];
+    if (code < MIRROR_LITERAL) {
+      o += code + 1;
+      if (o > size) return false;
+    } else if (code < MIRROR_REPEAT) {
+      size_t count = (code & 0x3F) + 1;
+      if (i + count > n || o + count > size) return false;
+      while (count--) frame[o++] ^= in[i++];
+    } else {
+      size_t count = (code & 0x3F) + 2;
+      if (i >= n || o + count > size) return false;
+      uint8_t value = in[i++];
+      while (count--) frame[o++] ^= value;
+    }
+  }
+  return o == size;
+}
+
+// =====================================================
+// STREAM
+// =====================================================
+
+DisplayMirror::DisplayMirror()
+  : _width(0), _height(0), _size(0), _sequence(0), _restarts(1), _restarted(0), _frames(0), _keyFrames(0),
+    _bytes(0) {
+  memset(_frame, 0, sizeof(_frame));
+  memset(_previous, 0, sizeof(_previous));
+}
+
+void DisplayMirror::begin(uint8_t width, uint8_t height) {
+  _width = width;
+  _height = height;
+  _size = (size_t)width * height / 8;
+  if (_size > MIRROR_FRAME_MAX) _size = 0;
+  _restarts++;
+}
+
+bool DisplayMirror::changed(const uint8_t* frame) const {
+  return _restarts != _restarted || memcmp(frame, _previous, _size) != 0;
+}
+
+size_t DisplayMirror::pack(const uint8_t* frame, uint8_t* out) {
+  uint32_t restarts = _restarts;
+  bool key = restarts != _restarted;
+  _restarted = restarts;
+
+  // One copy, so the message matches what is kept as sent even if the
+  // frame is drawn into meanwhile
+  memcpy(_frame, frame, _size);
+  if (key) memset(_previous, 0, _size);
+  uint8_t flags = key ? MIRROR_KEY : 0;
+  size_t len = mirrorEncode(_frame, _previous, _size, out + MIRROR_HEADER, _size);
+  if (len == 0 && _size > 0) {
+    memcpy(out + MIRROR_HEADER, _frame, _size);
+    len = _size;
+    flags |= MIRROR_RAW;
+  }
+  memcpy(_previous, _frame, _size);
+
+  out[0] = MIRROR_KIND;
+  out[1] = flags;
+  out[2] = _sequence & 0xFF;
+  out[3] = _sequence >> 8;
+  out[4] = _width;
+  out[5] = _height;
+  _sequence++;
+  _frames++;
+  if (key) _keyFrames++;
+  _bytes += MIRROR_HEADER + len;
+  return MIRROR_HEADER + len;
+}
@@ -0,0 +1,89 @@
+/*
+ * DisplayMirror - the OLED framebuffer as a stream of small messages
+ *
+ * Each message carries the SSD1306 buffer (pages of 8 rows, one byte per
+ * column, least significant bit on top) as the XOR against the frame sent
+ * before it, run-length coded: a changed line of text costs tens of bytes
+ * instead of the whole kilobyte, and an unchanged screen nothing, since
+ * the caller only packs frames that changed.
+ *
+ * Message (all fields little-endian):
+ *
+ *   u8 kind 'M' (0x4D), u8 flags, u16 sequence, u8 width, u8 height,
+ *   then the payload
+ *
+ *   flags  KEY (0x01)  the XOR is against a blank frame: the message stands
+ *                      on its own (the first one, and after restart())
+ *          RAW (0x02)  the payload is the frame itself (when coding would
+ *                      not make it smaller)
+ *
+ * Payload codes, applied in order until the frame is full:
+ *
+ *   0nnnnnnn           n + 1 bytes unchanged
+ *   10nnnnnn, bytes    n + 1 bytes follow, XORed into the frame
+ *   11nnnnnn, byte     the byte XORed into the next n + 2
+ *
+ * The sequence counts messages; a client that sees a gap has missed one
+ * and should ask for a key frame. Messages are at most MIRROR_MESSAGE_MAX
+ * bytes.
+ *
+ * restart() may be called from any task. pack() runs in one task (the
+ * loop); a restart() that gets in while it packs makes the next message a
+ * key frame too.
+ */
+
+#ifndef SIROBO_DISPLAY_MIRROR_H
+#define SIROBO_DISPLAY_MIRROR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MIRROR_KIND 0x4D            // 'M', first byte of a message
+#define MIRROR_HEADER 6
+#define MIRROR_KEY 0x01
+#define MIRROR_RAW 0x02
+#define MIRROR_FRAME_MAX 1024       // 128 x 64
+#define MIRROR_MESSAGE_MAX (MIRROR_HEADER + MIRROR_FRAME_MAX)
+
+// Codes the XOR of frame and previous (size bytes) into out, at most
+// capacity bytes; its length, or 0 if it does not fit
+size_t mirrorEncode(const uint8_t* frame, const uint8_t* previous, size_t size, uint8_t* out, size_t capacity);
+// Applies a message to frame (width * height / 8 bytes); false, with the
+// frame in an unknown state, if the message is bad or of another size
+bool mirrorUnpack(const uint8_t* message, size_t len, uint8_t* frame, size_t size);
+
+class DisplayMirror {
+public:
+  DisplayMirror();
+
+  // Forgets the frame sent; the next message is a key frame
+  void begin(uint8_t width, uint8_t height);
+  // The next message is a key frame (a client joined, or missed one)
+  void restart() { _restarts++; }
+
+  // The frame differs from the one sent, or a key frame is due
+  bool changed(const uint8_t* frame) const;
+  // Packs the message for frame into out (MIRROR_MESSAGE_MAX bytes) and
+  // takes it as sent; its length
+  size_t pack(const uint8_t* frame, uint8_t* out);
+
+  uint16_t sequence() const { return _sequence; }
+  uint32_t frames() const { return _frames; }
+  uint32_t keyFrames() const { return _keyFrames; }
+  uint32_t bytes() const { return _bytes; }
+
+private:
+  uint8_t _width;
+  uint8_t _height;
+  size_t _size;
+  uint16_t _sequence;
+  volatile uint32_t _restarts;
+  uint32_t _restarted;
+  uint32_t _frames;
+  uint32_t _keyFrames;
+  uint32_t _bytes;
+  uint8_t _frame[MIRROR_FRAME_MAX];      // Copy being packed
+  uint8_t _previous[MIRROR_FRAME_MAX];   // Frame the last message made
+};
+
+#endif
@@ -0,0 +1,122 @@
+#include "FlightRecorder.h"
+
+#include <string.h>
+
+FlightRecorder::FlightRecorder(FlightRecord* storage, uint32_t capacity)
+  : _records(storage), _capacity(capacity), _armedEvent(FLIGHT_TRIGGER_NONE), _state(IDLE) {
+  reset(0);
+}
+
+void FlightRecorder::reset(uint32_t periodUs) {
+  _head = 0;
+  _count = 0;
+  _total = 0;
+  _periodUs = periodUs;
+  _postSamples = 0;
+  _postRemaining = 0;
+  _triggerTotal = 0;
+  _triggerSource = FLIGHT_TRIGGER_NONE;
+}
+
+void FlightRecorder::start(uint32_t periodUs) {
+  _state = IDLE;
+  reset(periodUs);
+  _armedEvent = FLIGHT_TRIGGER_NONE;
+  _state = RECORDING;
+}
+
+void FlightRecorder::arm(FlightTrigger event, uint32_t periodUs, uint32_t postSamples) {
+  start(periodUs);
+  // Keep at least the trigger record itself in the ring
+  _postSamples = postSamples < _capacity ? postSamples : _capacity - 1;
+  _armedEvent = event;
+}
+
+void FlightRecorder::trigger(FlightTrigger source) {
+  if (_state != RECORDING || _count == 0) return;
+
+  uint32_t last = (_head + _capacity - 1) % _capacity;
+  _records[last].flags |= FLIGHT_FLAG_TRIGGER;
+  _triggerTotal = _total - 1;
+  _triggerSource = source;
+  _armedEvent = FLIGHT_TRIGGER_NONE;
+  _postRemaining = _postSamples;
+  _state = _postRemaining > 0 ? TRIGGERED : STOPPED;
+}
+
+void FlightRecorder::stop() {
+  if (_state == IDLE) return;
+  _armedEvent = FLIGHT_TRIGGER_NONE;
+  _state = STOPPED;
+}
+
+void FlightRecorder::push(const FlightRecord& record) {
+  if (!isCapturing()) return;
+
+  _records[_head] = record;
+  _head = (_head + 1) % _capacity;
+  if (_count < _capacity) _count++;
+  _total++;
+
+  if (_state == TRIGGERED && --_postRemaining == 0) {
+    _state = STOPPED;
+  }
+}
+
+void FlightRecorder::fillHeader(FlightLogHeader& header) const {
+  memset(&header, 0, sizeof(header));
+  header.magic = FLIGHT_LOG_MAGIC;
+  header.version = FLIGHT_LOG_VERSION;
+  header.recordSize = sizeof(FlightRecord);
+  header.recordCount = _count;
+  header.periodUs = _periodUs;
+  header.triggerSource = _triggerSource;
+
+  uint32_t first = _total - _count;
+  if (_triggerSource != FLIGHT_TRIGGER_NONE && _triggerTotal >= first) {
+    header.triggerIndex = _triggerTotal - first;
+  } else {
+    header.triggerIndex = FLIGHT_LOG_NO_TRIGGER;
+  }
+}
+
+size_t FlightRecorder::logSize() const {
+  return sizeof(FlightLogHeader) + (size_t)_count * sizeof(FlightRecord);
+}
+
+size_t FlightRecorder::readLog(size_t offset, uint8_t* buffer, size_t maxLen) const {
+  size_t total = logSize();
+  if (offset >= total) return 0;
+
+  size_t len = total - offset;
+  if (len > maxLen) len = maxLen;
+  size_t written = 0;
+
+  // Header
+  if (offset < sizeof(FlightLogHeader)) {
+    FlightLogHeader header;
+    fillHeader(header);
+    size_t n = sizeof(header) - offset;
+    if (n > len) n = len;
+    memcpy(buffer, (const uint8_t*)&header + offset, n);
+    written += n;
+    offset += n;
+  }
+
+  // Records, oldest first (the ring starts at _head once it has wrapped)
+  uint32_t oldest = _count < _capacity ? 0 : _head;
+  while (written < len) {
+    size_t pos = offset - sizeof(FlightLogHeader);
+    uint32_t index = pos / sizeof(FlightRecord);
+    size_t within = pos % sizeof(FlightRecord);
+    const uint8_t* src = (const uint8_t*)&_records[(oldest + index) % _capacity];
+
+    size_t n = sizeof(FlightRecord) - within;
+    if (n > len - written) n = len - written;
+    memcpy(buffer + written, src + within, n);
+    written += n;
+    offset += n;
+  }
+
+  return written;
+}
@@ -0,0 +1,146 @@
+/*
+ * FlightRecorder - high-rate telemetry ring buffer
+ *
+ * Captures one fixed-size FlightRecord per control tick into a caller
+ * supplied (preallocated) array. Recording runs as a ring: once full, the
+ * oldest record is overwritten. A trigger (command or event) marks the
+ * current record and freezes the buffer after a configurable number of
+ * post-trigger samples, so a capture holds both the lead-up and the outcome.
+ *
+ * Binary log format (all fields little-endian), as served by GET /log:
+ *
+ *   FlightLogHeader   32 bytes
+ *   FlightRecord      40 bytes x recordCount, oldest first
+ *
+ * FlightLogHeader:
+ *   0  u32 magic          "SRFL" (0x4C465253)
+ *   4  u16 version        FLIGHT_LOG_VERSION
+ *   6  u16 recordSize     sizeof(FlightRecord)
+ *   8  u32 recordCount
+ *   12 u32 periodUs       nominal sample period
+ *   16 u32 triggerIndex   record index of the trigger, FLIGHT_LOG_NO_TRIGGER if none
+ *   20 u8  triggerSource  FlightTrigger
+ *   21 u8  reserved[11]
+ *
+ * FlightRecord:
+ *   0  u32 timeUs         micros() at capture
+ *   4  u16 line[8]        raw line sensor ADC, leftmost first
+ *   20 u16 ldr[2]         raw LDR ADC, left then right
+ *   24 i16 yaw            0.01 deg, -180..180 (relative to yawOffset)
+ *   26 i16 gyroZ          0.01 deg/s
+ *   28 i16 motorLeft      applied motor command (-255..255)
+ *   30 i16 motorRight
+ *   32 i16 error          line follower error (-3500..3500)
+ *   34 u16 distance       ultrasonic distance in cm
+ *   36 u16 flags          FLIGHT_FLAG_*
+ *   38 u16 reserved
+ *
+ * tools/flightlog converts a downloaded log to CSV.
+ */
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FLIGHT_LOG_MAGIC 0x4C465253UL
+#define FLIGHT_LOG_VERSION 1
+#define FLIGHT_LOG_NO_TRIGGER 0xFFFFFFFFUL
+
+// FlightRecord.flags
+#define FLIGHT_FLAG_LINE_FOLLOWER 0x0001  // Line follower enabled
+#define FLIGHT_FLAG_LINE_LOST     0x0002  // No sensor saw the line
+#define FLIGHT_FLAG_TRIGGER       0x0004  // Record that fired the trigger
+
+enum FlightTrigger : uint8_t {
+  FLIGHT_TRIGGER_NONE = 0,
+  FLIGHT_TRIGGER_COMMAND,
+  FLIGHT_TRIGGER_LINE_LOST,
+  FLIGHT_TRIGGER_OBSTACLE,
+  FLIGHT_TRIGGER_LINE_FOLLOWER
+};
+
+#pragma pack(push, 1)
+struct FlightLogHeader {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t recordSize;
+  uint32_t recordCount;
+  uint32_t periodUs;
+  uint32_t triggerIndex;
+  uint8_t triggerSource;
+  uint8_t reserved[11];
+};
+
+struct FlightRecord {
+  uint32_t timeUs;
+  uint16_t line[8];
+  uint16_t ldr[2];
+  int16_t yaw;
+  int16_t gyroZ;
+  int16_t motorLeft;
+  int16_t motorRight;
+  int16_t error;
+  uint16_t distance;
+  uint16_t flags;
+  uint16_t reserved;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(FlightLogHeader) == 32, "FlightLogHeader layout changed");
+static_assert(sizeof(FlightRecord) == 40, "FlightRecord layout changed");
+
+class FlightRecorder {
+public:
+  enum State : uint8_t {
+    IDLE,       // Nothing captured yet
+    RECORDING,  // Capturing into the ring
+    TRIGGERED,  // Capturing post-trigger samples
+    STOPPED     // Frozen, ready for download
+  };
+
+  FlightRecorder(FlightRecord* storage, uint32_t capacity);
+
+  // Clear the buffer and start capturing
+  void start(uint32_t periodUs);
+  // Start capturing and wait for the given event to trigger
+  void arm(FlightTrigger event, uint32_t periodUs, uint32_t postSamples);
+  // Mark the latest record as the trigger; freeze after postSamples more
+  void trigger(FlightTrigger source);
+  // Freeze immediately
+  void stop();
+
+  // Append one record (no-op unless capturing)
+  void push(const FlightRecord& record);
+
+  State state() const { return _state; }
+  bool isCapturing() const { return _state == RECORDING || _state == TRIGGERED; }
+  FlightTrigger armedEvent() const { return _armedEvent; }
+  uint32_t count() const { return _count; }
+  uint32_t capacity() const { return _capacity; }
+
+  // Serialized log: header followed by records, oldest first.
+  // Only consistent while not capturing (call stop() first).
+  size_t logSize() const;
+  size_t readLog(size_t offset, uint8_t* buffer, size_t maxLen) const;
+
+private:
+  void reset(uint32_t periodUs);
+  void fillHeader(FlightLogHeader& header) const;
+
+  FlightRecord* _records;
+  uint32_t _capacity;
+  uint32_t _head;          // Next write slot
+  uint32_t _count;
+  uint32_t _total;         // Records pushed since start
+  uint32_t _periodUs;
+  uint32_t _postSamples;
+  uint32_t _postRemaining;
+  uint32_t _triggerTotal;  // _total value of the trigger record
+  FlightTrigger _triggerSource;
+  FlightTrigger _armedEvent;
+  volatile State _state;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "GroupSync.h"
+
+#include <string.h>
+
+// =====================================================
+// PACKETS
+// =====================================================
+
+void GroupWriter::begin(GroupPacketType type, const char* group) {
+  _length = 0;
+  _ok = true;
+  size_t groupLength = strnlen(group, GROUP_NAME_MAX);
+  u32(GROUP_MAGIC);
+  u8(GROUP_VERSION);
+  u8(type);
+  u8(groupLength);
+  bytes(group, groupLength);
+}
+
+void GroupWriter::u16(uint16_t value) {
+  uint8_t le[2] = { (uint8_t)value, (uint8_t)(value >> 8) };
+  bytes(le, 2);
+}
+
+void GroupWriter::u32(uint32_t value) {
+  u16(value);
+  u16(value >> 16);
+}
+
+void GroupWriter::u64(uint64_t value) {
+  u32(value);
+  u32(value >> 32);
+}
+
+void GroupWriter::bytes(const void* data, size_t len) {
+  if (!_ok || _length + len > _size) {
+    _ok = false;
+    return;
+  }
+  memcpy(_buffer + _length, data, len);
+  _length += len;
+}
+
+bool GroupReader::begin(GroupPacketType& type, char group[GROUP_NAME_MAX + 1]) {
+  if (u32() != GROUP_MAGIC || u8() != GROUP_VERSION) return false;
+  type = (GroupPacketType)u8();
+  uint8_t groupLength = u8();
+  const uint8_t* name = groupLength <= GROUP_NAME_MAX ? bytes(groupLength) : nullptr;
+  if (!name) return false;
+  memcpy(group, name, groupLength);
+  group[groupLength] = '\0';
+  return _ok;
+}
+
+const uint8_t* GroupReader::bytes(size_t len) {
+  if (!_ok || _pos + len > _len) {
+    _ok = false;
+    return nullptr;
+  }
+  const uint8_t* p = _data + _pos;
+  _pos += len;
+  return p;
+}
+
+uint8_t GroupReader::u8() {
+  const uint8_t* p = bytes(1);
+  return p ? p[0] : 0;
+}
+
+uint16_t GroupReader::u16() {
+  const uint8_t* p = bytes(2);
+  return p ? p[0] | p[1] << 8 : 0;
+}
+
+uint32_t GroupReader::u32() {
+  uint32_t low = u16();
+  return low | (uint32_t)u16() << 16;
+}
+
+uint64_t GroupReader::u64() {
+  uint64_t low = u32();
+  return low | (uint64_t)u32() << 32;
+}
+
+size_t groupEncodeShow(const char* group, const GroupShow& show, uint8_t* out, size_t maxLen) {
+  if (show.stepCount > GROUP_SHOW_MAX_STEPS) return 0;
+  GroupWriter writer(out, maxLen);
+  writer.begin(GROUP_SHOW, group);
+  writer.u16(show.id);
+  writer.u64(show.startUs);
+  writer.u8(show.stepCount);
+  for (uint8_t i = 0; i < show.stepCount; i++) {
+    const GroupStep& step = show.steps[i];
+    writer.u32(step.offsetMs);
+    writer.u16(step.length);
+    writer.bytes(step.command, step.length);
+  }
+  return writer.length();
+}
+
+bool groupParseShow(GroupReader& reader, GroupShow& show) {
+  show.id = reader.u16();
+  show.startUs = reader.u64();
+  show.stepCount = reader.u8();
+  if (!reader.ok() || show.stepCount > GROUP_SHOW_MAX_STEPS) return false;
+
+  for (uint8_t i = 0; i < show.stepCount; i++) {
+    GroupStep& step = show.steps[i];
+    step.offsetMs = reader.u32();
+    step.length = reader.u16();
+    step.command = (const char*)reader.bytes(step.length);
+    if (!step.command) return false;
+    // Members run the steps front to back
+    if (i > 0 && step.offsetMs < show.steps[i - 1].offsetMs) return false;
+  }
+  return true;
+}
+
+// =====================================================
+// CLOCK SYNC
+// =====================================================
+
+void ClockSync::reset() {
+  _best = { 0, 0 };
+  _next = 0;
+  _count = 0;
+  _lastSample = 0;
+}
+
+void ClockSync::addSample(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4) {
+  if (t4 < t1 || t3 < t2) return;
+
+  // The time on the wire, assumed the same both ways
+  uint64_t roundTrip = (t4 - t1) - (t3 - t2);
+  Sample sample;
+  sample.offset = ((int64_t)(t2 - t1) + (int64_t)(t3 - t4)) / 2;
+  sample.roundTrip = roundTrip > UINT32_MAX ? UINT32_MAX : (uint32_t)roundTrip;
+
+  _samples[_next] = sample;
+  _next = (_next + 1) % CLOCK_SYNC_WINDOW;
+  if (_count < CLOCK_SYNC_WINDOW) _count++;
+  _lastSample = t4;
+
+  _best = _samples[0];
+  for (uint8_t i = 1; i < _count; i++) {
+    if (_samples[i].roundTrip < _best.roundTrip) _best = _samples[i];
+  }
+}
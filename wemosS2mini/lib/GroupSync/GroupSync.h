@@ -0,0 +1,150 @@
+/*
+ * GroupSync - synchronized command shows for groups of robots
+ *
+ * Robots join a named group and listen on GROUP_MULTICAST_IP:GROUP_PORT.
+ * A controller (tools/groupshow) multicasts beacons; each member answers a
+ * beacon with a time request, and the controller's reply gives an NTP-style
+ * sample of the offset between the two clocks. ClockSync keeps the sample
+ * with the shortest round trip of the last CLOCK_SYNC_WINDOW, so a slow
+ * WiFi retry does not skew the estimate.
+ *
+ * A show is one multicast packet: a start time on the controller's clock
+ * and up to GROUP_SHOW_MAX_STEPS WebSocket commands, each at a millisecond
+ * offset from the start. Members convert the start to their own clock and
+ * run the steps then; after each step a report goes back to the controller,
+ * which can measure the spread between robots. The same show (same id) may
+ * be sent several times against packet loss.
+ *
+ * Packet format (all fields little-endian):
+ *   0  u32 magic          "SRGP" (0x50475253)
+ *   4  u8  version        GROUP_VERSION
+ *   5  u8  type           GroupPacketType
+ *   6  u8  groupLength    followed by the group name, no NUL
+ *   .. body, by type:
+ *      BEACON        u64 controller time
+ *      TIME_REQUEST  u64 t1 (member clock at send)
+ *      TIME_REPLY    u64 t1 (echoed), u64 t2, u64 t3 (controller clock at
+ *                    receive and at send)
+ *      SHOW          u16 id, u64 start (controller clock), u8 stepCount,
+ *                    per step: u32 offset ms, u16 length, command JSON
+ *      REPORT        u16 id, u8 step, u32 lateness us (member clock)
+ *
+ * Times are microseconds since each device booted.
+ */
+
+#ifndef SIROBO_GROUP_SYNC_H
+#define SIROBO_GROUP_SYNC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define GROUP_MULTICAST_IP { 239, 255, 83, 82 }
+#define GROUP_PORT 4211
+#define GROUP_MAGIC 0x50475253UL
+#define GROUP_VERSION 1
+#define GROUP_NAME_MAX 15
+#define GROUP_PACKET_MAX 1024
+#define GROUP_SHOW_MAX_STEPS 32
+#define CLOCK_SYNC_WINDOW 8
+
+enum GroupPacketType : uint8_t {
+  GROUP_BEACON = 1,
+  GROUP_TIME_REQUEST,
+  GROUP_TIME_REPLY,
+  GROUP_SHOW,
+  GROUP_REPORT
+};
+
+// Bounds-checked packet builder; ok() turns false once anything overflowed
+class GroupWriter {
+public:
+  GroupWriter(uint8_t* buffer, size_t size) : _buffer(buffer), _size(size), _length(0), _ok(true) {}
+
+  void begin(GroupPacketType type, const char* group);
+  void u8(uint8_t value) { bytes(&value, 1); }
+  void u16(uint16_t value);
+  void u32(uint32_t value);
+  void u64(uint64_t value);
+  void bytes(const void* data, size_t len);
+
+  size_t length() const { return _ok ? _length : 0; }
+  bool ok() const { return _ok; }
+
+private:
+  uint8_t* _buffer;
+  size_t _size;
+  size_t _length;
+  bool _ok;
+};
+
+// Bounds-checked packet parser; reads past the end return 0 and clear ok()
+class GroupReader {
+public:
+  GroupReader(const uint8_t* data, size_t len) : _data(data), _len(len), _pos(0), _ok(true) {}
+
+  // Magic, version, type and group name (NUL-terminated into group)
+  bool begin(GroupPacketType& type, char group[GROUP_NAME_MAX + 1]);
+  uint8_t u8();
+  uint16_t u16();
+  uint32_t u32();
+  uint64_t u64();
+  const uint8_t* bytes(size_t len);
+
+  bool ok() const { return _ok; }
+
+private:
+  const uint8_t* _data;
+  size_t _len;
+  size_t _pos;
+  bool _ok;
+};
+
+struct GroupStep {
+  uint32_t offsetMs;
+  const char* command;   // Not NUL-terminated; points into the packet
+  uint16_t length;
+};
+
+struct GroupShow {
+  uint16_t id;
+  uint64_t startUs;
+  uint8_t stepCount;
+  GroupStep steps[GROUP_SHOW_MAX_STEPS];
+};
+
+// Returns the packet length, 0 if it does not fit
+size_t groupEncodeShow(const char* group, const GroupShow& show, uint8_t* out, size_t maxLen);
+// Body of a GROUP_SHOW packet, after reader.begin(); steps in offset order
+bool groupParseShow(GroupReader& reader, GroupShow& show);
+
+class ClockSync {
+public:
+  ClockSync() { reset(); }
+
+  void reset();
+  // t1/t4: local send/receive, t2/t3: remote receive/send
+  void addSample(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4);
+
+  bool synced() const { return _count > 0; }
+  // Remote clock minus local clock, and the round trip it was measured with
+  int64_t offset() const { return _best.offset; }
+  uint32_t roundTrip() const { return _best.roundTrip; }
+  uint64_t lastSample() const { return _lastSample; }   // Local time of the last sample
+
+  uint64_t toLocal(uint64_t remoteUs) const { return remoteUs - _best.offset; }
+  uint64_t toRemote(uint64_t localUs) const { return localUs + _best.offset; }
+
+private:
+  struct Sample {
+    int64_t offset;
+    uint32_t roundTrip;
+  };
+
+  Sample _samples[CLOCK_SYNC_WINDOW];
+  Sample _best;
+  uint8_t _next;
+  uint8_t _count;
+  uint64_t _lastSample;
+};
+
+#endif
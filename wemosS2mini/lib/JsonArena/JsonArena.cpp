@@ -0,0 +1,71 @@
+#include "JsonArena.h"
+
+#include <string.h>
+
+static size_t alignUp(size_t size) {
+  return (size + 7) & ~(size_t)7;
+}
+
+JsonArena::JsonArena(uint8_t* buffer, size_t size)
+  : _buffer(buffer), _size(size), _used(0), _last(0), _highWater(0), _live(0), _failures(0) {}
+
+JsonArena::BlockHeader* JsonArena::header(void* ptr) const {
+  return (BlockHeader*)((uint8_t*)ptr - sizeof(BlockHeader));
+}
+
+bool JsonArena::isLast(void* ptr) const {
+  return _live > 0 && (uint8_t*)ptr - sizeof(BlockHeader) == _buffer + _last;
+}
+
+void* JsonArena::allocate(size_t size) {
+  size_t need = sizeof(BlockHeader) + alignUp(size);
+  if (_used + need > _size) {
+    _failures++;
+    return nullptr;
+  }
+
+  BlockHeader* block = (BlockHeader*)(_buffer + _used);
+  block->size = alignUp(size);
+  _last = _used;
+  _used += need;
+  _live++;
+  if (_used > _highWater) _highWater = _used;
+  return block + 1;
+}
+
+void JsonArena::deallocate(void* ptr) {
+  if (!ptr || _live == 0) return;
+
+  if (isLast(ptr)) {
+    _used = _last;  // Earlier blocks are only reclaimed when the arena empties
+  }
+  if (--_live == 0) {
+    _used = 0;
+    _last = 0;
+  }
+}
+
+void* JsonArena::reallocate(void* ptr, size_t newSize) {
+  if (!ptr) return allocate(newSize);
+
+  BlockHeader* block = header(ptr);
+  if (isLast(ptr)) {
+    // Grow or shrink in place
+    size_t need = sizeof(BlockHeader) + alignUp(newSize);
+    if (_last + need > _size) {
+      _failures++;
+      return nullptr;
+    }
+    block->size = alignUp(newSize);
+    _used = _last + need;
+    if (_used > _highWater) _highWater = _used;
+    return ptr;
+  }
+
+  size_t oldSize = block->size;
+  void* moved = allocate(newSize);
+  if (!moved) return nullptr;
+  memcpy(moved, ptr, oldSize < newSize ? oldSize : newSize);
+  deallocate(ptr);
+  return moved;
+}
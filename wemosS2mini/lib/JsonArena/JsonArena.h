@@ -0,0 +1,55 @@
+/*
+ * JsonArena - fixed-buffer allocator for ArduinoJson documents
+ *
+ * A JsonDocument normally takes its pools and strings from the heap every
+ * time it is used. Constructed with a JsonArena, it allocates from a caller
+ * supplied buffer instead: blocks are bumped off the buffer, the last block
+ * can grow or shrink in place, and the whole arena is recycled as soon as
+ * the last block is freed, i.e. when every document on it is destroyed.
+ *
+ * When the buffer is exhausted the allocation fails, ArduinoJson drops the
+ * value and doc.overflowed() turns true; nothing falls back to the heap.
+ *
+ * Not thread-safe: use one arena per task.
+ */
+
+#ifndef SIROBO_JSON_ARENA_H
+#define SIROBO_JSON_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <ArduinoJson.h>
+
+class JsonArena : public ArduinoJson::Allocator {
+public:
+  JsonArena(uint8_t* buffer, size_t size);
+
+  void* allocate(size_t size) override;
+  void deallocate(void* ptr) override;
+  void* reallocate(void* ptr, size_t newSize) override;
+
+  size_t capacity() const { return _size; }
+  size_t used() const { return _used; }
+  size_t highWater() const { return _highWater; }
+  uint32_t failures() const { return _failures; }
+
+private:
+  struct BlockHeader {
+    uint32_t size;      // payload bytes, aligned
+    uint32_t reserved;  // keeps payloads 8-byte aligned
+  };
+
+  BlockHeader* header(void* ptr) const;
+  bool isLast(void* ptr) const;
+
+  uint8_t* _buffer;
+  size_t _size;
+  size_t _used;
+  size_t _last;       // offset of the last block's header
+  size_t _highWater;
+  uint32_t _live;     // blocks not yet freed
+  uint32_t _failures;
+};
+
+#endif
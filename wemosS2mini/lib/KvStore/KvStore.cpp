@@ -0,0 +1,276 @@
+#include "KvStore.h"
+
+#include <string.h>
+
+#include <Hal.h>
+
+struct KvSectorHeader {
+  uint32_t magic;
+  uint32_t sequence;
+  uint32_t eraseCount;
+  uint32_t crc;
+};
+
+struct KvRecordHeader {
+  uint8_t key;
+  uint8_t schema;
+  uint16_t length;
+  uint32_t crc;
+};
+
+static uint32_t crc32Update(uint32_t crc, const void* data, size_t len) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= bytes[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+static uint32_t recordCrc(const KvRecordHeader& header, const void* value) {
+  uint32_t crc = crc32Update(0, &header, 4);  // key, schema, length
+  return crc32Update(crc, value, header.length);
+}
+
+static size_t align4(size_t len) {
+  return (len + 3) & ~(size_t)3;
+}
+
+KvStore::KvStore()
+  : _mounted(false), _sectors(0), _active(0), _sectorSize(0), _writePos(0), _sequence(0),
+    _commits(0), _writes(0), _unchanged(0), _corrupt(0) {
+  memset(_slots, 0, sizeof(_slots));
+  memset(_eraseCounts, 0, sizeof(_eraseCounts));
+}
+
+bool KvStore::begin() {
+  _mounted = false;
+  _sectorSize = hal::flashSectorSize();
+  size_t sectors = _sectorSize ? hal::flashSize() / _sectorSize : 0;
+  _sectors = sectors < KV_MAX_SECTORS ? sectors : KV_MAX_SECTORS;
+  if (_sectors < KV_MIN_SECTORS) return false;
+
+  // The active sector is the valid one with the highest sequence
+  int best = -1;
+  for (uint8_t s = 0; s < _sectors; s++) {
+    uint32_t sequence, eraseCount;
+    if (!readSectorHeader(s, sequence, eraseCount)) continue;
+    _eraseCounts[s] = eraseCount;
+    if (best < 0 || sequence > _sequence) {
+      best = s;
+      _sequence = sequence;
+    }
+  }
+  if (best < 0) return format();
+
+  _active = best;
+  scan();
+  _mounted = true;
+  return true;
+}
+
+KvStore::Slot* KvStore::find(uint8_t key) {
+  for (uint8_t i = 0; i < KV_MAX_KEYS; i++) {
+    if (_slots[i].key == key) return &_slots[i];
+  }
+  return nullptr;
+}
+
+const KvStore::Slot* KvStore::find(uint8_t key) const {
+  for (uint8_t i = 0; i < KV_MAX_KEYS; i++) {
+    if (_slots[i].key == key) return &_slots[i];
+  }
+  return nullptr;
+}
+
+bool KvStore::readSectorHeader(uint8_t sector, uint32_t& sequence, uint32_t& eraseCount) {
+  KvSectorHeader header;
+  if (!hal::flashRead(sector * _sectorSize, &header, sizeof(header))) return false;
+  if (header.magic != KV_MAGIC) return false;
+  if (header.crc != crc32Update(0, &header, offsetof(KvSectorHeader, crc))) return false;
+
+  sequence = header.sequence;
+  eraseCount = header.eraseCount;
+  return true;
+}
+
+bool KvStore::writeSectorHeader(uint8_t sector, uint32_t sequence, uint32_t eraseCount) {
+  KvSectorHeader header = { KV_MAGIC, sequence, eraseCount, 0 };
+  header.crc = crc32Update(0, &header, offsetof(KvSectorHeader, crc));
+  return hal::flashWrite(sector * _sectorSize, &header, sizeof(header));
+}
+
+// Replays the active sector's log into the RAM cache; later records win
+void KvStore::scan() {
+  memset(_slots, 0, sizeof(_slots));
+  size_t base = _active * _sectorSize;
+  size_t pos = sizeof(KvSectorHeader);
+  uint8_t value[KV_MAX_VALUE];
+
+  while (pos + sizeof(KvRecordHeader) <= _sectorSize) {
+    KvRecordHeader header;
+    if (!hal::flashRead(base + pos, &header, sizeof(header))) break;
+    if (header.key == 0xFF && header.schema == 0xFF && header.length == 0xFFFF) break; // End of log
+
+    size_t size = sizeof(header) + align4(header.length);
+    if (header.length > KV_MAX_VALUE || pos + size > _sectorSize) {
+      // Unreadable length: nothing after it can be trusted, compact on next commit
+      _corrupt++;
+      pos = _sectorSize;
+      break;
+    }
+
+    hal::flashRead(base + pos + sizeof(header), value, header.length);
+    if (header.key != 0 && header.crc == recordCrc(header, value)) {
+      Slot* slot = find(header.key);
+      if (!slot) slot = find(0);
+      if (slot) {
+        slot->key = header.key;
+        slot->schema = header.schema;
+        slot->length = header.length;
+        slot->dirty = false;
+        memcpy(slot->value, value, header.length);
+      }
+    } else {
+      _corrupt++;
+    }
+    pos += size;
+  }
+
+  _writePos = pos;
+}
+
+size_t KvStore::get(uint8_t key, void* data, size_t maxLen, uint8_t* schema) const {
+  const Slot* slot = key ? find(key) : nullptr;
+  if (!slot) return 0;
+
+  memcpy(data, slot->value, slot->length < maxLen ? slot->length : maxLen);
+  if (schema) *schema = slot->schema;
+  return slot->length;
+}
+
+bool KvStore::contains(uint8_t key) const {
+  return key && find(key);
+}
+
+bool KvStore::put(uint8_t key, uint8_t schema, const void* data, size_t len) {
+  if (key == 0 || key == 0xFF || len > KV_MAX_VALUE) return false;
+
+  Slot* slot = find(key);
+  if (slot && slot->schema == schema && slot->length == len && memcmp(slot->value, data, len) == 0) {
+    _unchanged++;
+    return true;
+  }
+  if (!slot) slot = find(0);
+  if (!slot) return false;
+
+  slot->key = key;
+  slot->schema = schema;
+  slot->length = len;
+  slot->dirty = true;
+  memcpy(slot->value, data, len);
+  return true;
+}
+
+bool KvStore::dirty() const {
+  for (uint8_t i = 0; i < KV_MAX_KEYS; i++) {
+    if (_slots[i].key && _slots[i].dirty) return true;
+  }
+  return false;
+}
+
+bool KvStore::appendRecord(size_t sectorBase, size_t& pos, const Slot& slot) {
+  uint8_t buffer[sizeof(KvRecordHeader) + KV_MAX_VALUE];
+  KvRecordHeader header = { slot.key, slot.schema, slot.length, 0 };
+  header.crc = recordCrc(header, slot.value);
+
+  size_t size = sizeof(header) + align4(slot.length);
+  memset(buffer, 0xFF, size);
+  memcpy(buffer, &header, sizeof(header));
+  memcpy(buffer + sizeof(header), slot.value, slot.length);
+
+  if (!hal::flashWrite(sectorBase + pos, buffer, size)) return false;
+  pos += size;
+  _writes++;
+  return true;
+}
+
+bool KvStore::commit() {
+  if (!_mounted) return false;
+  if (!dirty()) return true;
+
+  size_t needed = 0;
+  for (uint8_t i = 0; i < KV_MAX_KEYS; i++) {
+    if (_slots[i].key && _slots[i].dirty) needed += sizeof(KvRecordHeader) + align4(_slots[i].length);
+  }
+  if (_writePos + needed > _sectorSize) return compact();
+
+  size_t base = _active * _sectorSize;
+  for (uint8_t i = 0; i < KV_MAX_KEYS; i++) {
+    Slot& slot = _slots[i];
+    if (!slot.key || !slot.dirty) continue;
+    if (!appendRecord(base, _writePos, slot)) return false;
+    slot.dirty = false;
+  }
+  _commits++;
+  return true;
+}
+
+// Writes the live records into the next sector, then makes it active
+bool KvStore::compact() {
+  uint8_t target = (_active + 1) % _sectors;
+  if (!hal::flashErase(target)) return false;
+  _eraseCounts[target]++;
+
+  size_t base = target * _sectorSize;
+  size_t pos = sizeof(KvSectorHeader);
+  for (uint8_t i = 0; i < KV_MAX_KEYS; i++) {
+    if (_slots[i].key && !appendRecord(base, pos, _slots[i])) return false;
+  }
+  // Header last: until it is valid, the old sector stays active
+  if (!writeSectorHeader(target, _sequence + 1, _eraseCounts[target])) return false;
+
+  _active = target;
+  _sequence++;
+  _writePos = pos;
+  for (uint8_t i = 0; i < KV_MAX_KEYS; i++) _slots[i].dirty = false;
+  _commits++;
+  return true;
+}
+
+bool KvStore::format() {
+  _mounted = false;
+  if (_sectors < KV_MIN_SECTORS) return false;
+
+  for (uint8_t s = 0; s < _sectors; s++) {
+    if (!hal::flashErase(s)) return false;
+    _eraseCounts[s]++;
+  }
+  if (!writeSectorHeader(0, 1, _eraseCounts[0])) return false;
+
+  memset(_slots, 0, sizeof(_slots));
+  _active = 0;
+  _sequence = 1;
+  _writePos = sizeof(KvSectorHeader);
+  _mounted = true;
+  return true;
+}
+
+void KvStore::stats(KvStats& out) const {
+  memset(&out, 0, sizeof(out));
+  out.sectors = _sectors;
+  out.activeSector = _active;
+  out.sequence = _sequence;
+  out.used = _writePos;
+  out.sectorSize = _sectorSize;
+  for (uint8_t s = 0; s < _sectors; s++) {
+    if (_eraseCounts[s] > out.maxErases) out.maxErases = _eraseCounts[s];
+  }
+  out.commits = _commits;
+  out.writes = _writes;
+  out.unchanged = _unchanged;
+  out.corrupt = _corrupt;
+}
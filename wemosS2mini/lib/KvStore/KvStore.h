@@ -0,0 +1,118 @@
+/*
+ * KvStore - log-structured key/value store on raw flash
+ *
+ * Small typed records (config, calibration, gains) are appended to the
+ * active flash sector instead of rewriting a whole EEPROM image. When the
+ * sector is full, the latest version of every record is compacted into the
+ * next sector, so erases rotate over the whole region (wear leveling) and
+ * happen once per sector's worth of saves rather than once per save.
+ *
+ * All records are cached in RAM: get() never touches flash, put() only
+ * stages a change (writing an identical value is a no-op) and commit()
+ * appends everything staged in one go.
+ *
+ * Flash layout (all fields little-endian), per sector:
+ *
+ *   KvSectorHeader   16 bytes, written last when a sector is filled by
+ *                    compaction, so a torn compaction leaves the previous
+ *                    sector active
+ *   records          appended back to back, 4-byte aligned
+ *
+ * KvSectorHeader:
+ *   0  u32 magic          "SKV1" (0x31564B53)
+ *   4  u32 sequence       highest valid sequence is the active sector
+ *   8  u32 eraseCount     erases of this sector so far
+ *   12 u32 crc            CRC-32 of bytes 0..11
+ *
+ * Record:
+ *   0  u8  key            1..254 (0xFF is erased flash)
+ *   1  u8  schema         layout version of the value, owned by the caller
+ *   2  u16 length         value bytes
+ *   4  u32 crc            CRC-32 of key, schema, length and value
+ *   8  u8  value[length]  padded with 0xFF to a multiple of 4
+ *
+ * Records with a bad CRC (power lost mid-write) are skipped on mount; the
+ * previous version of the key stays in effect.
+ *
+ * Not thread-safe: use from one task.
+ */
+
+#ifndef SIROBO_KV_STORE_H
+#define SIROBO_KV_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define KV_MAGIC 0x31564B53UL
+#define KV_MAX_KEYS 8
+#define KV_MAX_VALUE 160
+#define KV_MIN_SECTORS 2
+#define KV_MAX_SECTORS 16      // Larger regions use only the first 16 sectors
+
+struct KvStats {
+  uint8_t sectors;
+  uint8_t activeSector;
+  uint32_t sequence;
+  uint32_t used;          // Bytes used in the active sector
+  uint32_t sectorSize;
+  uint32_t maxErases;     // Most erased sector
+  uint32_t commits;       // Commits that wrote to flash
+  uint32_t writes;        // Records written (appended or compacted)
+  uint32_t unchanged;     // put() calls skipped because nothing changed
+  uint32_t corrupt;       // Records dropped at mount for a bad CRC
+};
+
+class KvStore {
+public:
+  KvStore();
+
+  // Mounts the flash region (hal::flash*), formatting it if it holds no store
+  bool begin();
+  bool mounted() const { return _mounted; }
+
+  // Copies up to maxLen bytes of the value; returns its full length, 0 if absent
+  size_t get(uint8_t key, void* data, size_t maxLen, uint8_t* schema = nullptr) const;
+  bool contains(uint8_t key) const;
+
+  // Stages a value for the next commit(); false if it cannot be stored
+  bool put(uint8_t key, uint8_t schema, const void* data, size_t len);
+  bool dirty() const;
+  bool commit();
+
+  // Erases the region and drops every record
+  bool format();
+
+  void stats(KvStats& out) const;
+
+private:
+  struct Slot {
+    uint8_t key;          // 0 = free
+    uint8_t schema;
+    uint16_t length;
+    bool dirty;
+    uint8_t value[KV_MAX_VALUE];
+  };
+
+  Slot* find(uint8_t key);
+  const Slot* find(uint8_t key) const;
+  bool readSectorHeader(uint8_t sector, uint32_t& sequence, uint32_t& eraseCount);
+  bool writeSectorHeader(uint8_t sector, uint32_t sequence, uint32_t eraseCount);
+  void scan();
+  bool appendRecord(size_t sectorBase, size_t& pos, const Slot& slot);
+  bool compact();
+
+  Slot _slots[KV_MAX_KEYS];
+  bool _mounted;
+  uint8_t _sectors;
+  uint8_t _active;
+  size_t _sectorSize;
+  size_t _writePos;
+  uint32_t _sequence;
+  uint32_t _eraseCounts[KV_MAX_SECTORS];
+  uint32_t _commits;
+  uint32_t _writes;
+  uint32_t _unchanged;
+  uint32_t _corrupt;
+};
+
+#endif
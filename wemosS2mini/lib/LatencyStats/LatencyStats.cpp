@@ -0,0 +1,71 @@
+#include "LatencyStats.h"
+
+#include <string.h>
+
+void LatencyHistogram::clear(Window& window) {
+  memset(&window, 0, sizeof(window));
+  window.minUs = UINT32_MAX;
+}
+
+void LatencyHistogram::reset(uint32_t nowMs) {
+  clear(_windows[0]);
+  clear(_windows[1]);
+  _current = 0;
+  _windowStartMs = nowMs;
+}
+
+void LatencyHistogram::record(uint32_t us, uint32_t nowMs) {
+  if (nowMs - _windowStartMs >= LATENCY_WINDOW_MS) {
+    _current ^= 1;
+    clear(_windows[_current]);
+    _windowStartMs = nowMs;
+  }
+
+  Window& w = _windows[_current];
+  w.count++;
+  w.sumUs += us;
+  if (us < w.minUs) w.minUs = us;
+  if (us > w.maxUs) w.maxUs = us;
+  w.histogram[logBucketFor(us, LATENCY_BUCKETS)]++;
+}
+
+// Upper edge of the first bucket at which `target` samples are covered
+uint32_t LatencyHistogram::percentile(uint32_t target) const {
+  uint32_t seen = 0;
+  for (uint32_t b = 0; b < LATENCY_BUCKETS; b++) {
+    seen += _windows[0].histogram[b] + _windows[1].histogram[b];
+    if (seen >= target) {
+      uint64_t upper = logBucketLower(b + 1);
+      return upper > UINT32_MAX ? UINT32_MAX : (uint32_t)upper;
+    }
+  }
+  return UINT32_MAX;
+}
+
+void LatencyHistogram::summary(LatencySummary& out) const {
+  memset(&out, 0, sizeof(out));
+  const Window& a = _windows[0];
+  const Window& b = _windows[1];
+  out.count = a.count + b.count;
+  if (out.count == 0) return;
+
+  out.minUs = a.minUs < b.minUs ? a.minUs : b.minUs;
+  out.maxUs = a.maxUs > b.maxUs ? a.maxUs : b.maxUs;
+  out.sumUs = a.sumUs + b.sumUs;
+
+  // A bucket edge can overshoot the largest sample; the max is exact
+  uint32_t p50 = percentile(out.count - out.count / 2);
+  uint32_t p90 = percentile(out.count - out.count / 10);
+  uint32_t p99 = percentile(out.count - out.count / 100);
+  out.p50Us = p50 < out.maxUs ? p50 : out.maxUs;
+  out.p90Us = p90 < out.maxUs ? p90 : out.maxUs;
+  out.p99Us = p99 < out.maxUs ? p99 : out.maxUs;
+}
+
+uint32_t LatencyHistogram::countBelow(uint32_t us) const {
+  uint32_t count = 0;
+  for (uint32_t b = 0; b < LATENCY_BUCKETS && logBucketLower(b + 1) <= us; b++) {
+    count += _windows[0].histogram[b] + _windows[1].histogram[b];
+  }
+  return count;
+}
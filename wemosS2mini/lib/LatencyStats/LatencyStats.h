@@ -0,0 +1,66 @@
+/*
+ * LatencyStats - rolling latency histograms in microseconds
+ *
+ * Same log-scale buckets as the Profiler (LogBuckets.h, four per power of
+ * two), but fed with microseconds and kept in two windows of
+ * LATENCY_WINDOW_MS. Once the current window is full it replaces the
+ * previous one, so a summary covers the last one to two windows and an old
+ * spike ages out instead of holding the max forever.
+ *
+ * Percentiles are the upper edge of the bucket they fall in (within ~19%).
+ * countBelow() is exact when the bound is a power of two, which is what
+ * the Prometheus histogram in /metrics uses for its "le" bounds.
+ */
+
+#ifndef SIROBO_LATENCY_STATS_H
+#define SIROBO_LATENCY_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <LogBuckets.h>
+
+#define LATENCY_WINDOW_MS 30000
+#define LATENCY_OCTAVES 23           // 2^23 us = ~8 s
+#define LATENCY_SUB_BUCKETS LOG_SUB_BUCKETS
+#define LATENCY_BUCKETS (LATENCY_OCTAVES * LATENCY_SUB_BUCKETS)
+
+struct LatencySummary {
+  uint32_t count;
+  uint32_t minUs;
+  uint32_t p50Us;
+  uint32_t p90Us;
+  uint32_t p99Us;
+  uint32_t maxUs;
+  uint64_t sumUs;
+};
+
+class LatencyHistogram {
+public:
+  LatencyHistogram() { reset(0); }
+
+  void record(uint32_t us, uint32_t nowMs);
+  void reset(uint32_t nowMs);
+
+  // Both windows together
+  void summary(LatencySummary& out) const;
+  uint32_t countBelow(uint32_t us) const;   // Samples under us
+
+private:
+  struct Window {
+    uint32_t count;
+    uint32_t minUs;
+    uint32_t maxUs;
+    uint64_t sumUs;
+    uint32_t histogram[LATENCY_BUCKETS];
+  };
+
+  void clear(Window& window);
+  uint32_t percentile(uint32_t target) const;
+
+  Window _windows[2];
+  uint8_t _current;
+  uint32_t _windowStartMs;
+};
+
+#endif
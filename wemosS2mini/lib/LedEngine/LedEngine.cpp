@@ -0,0 +1,174 @@
+#include "LedEngine.h"
+
+#include <string.h>
+
+#define LED_RAINBOW_STEP_MS 20
+#define LED_RAINBOW_SPREAD 30
+#define LED_BREATHE_MS 1020
+
+static const hal::Rgb BLACK = { 0, 0, 0 };
+static const hal::Rgb WHITE = { 255, 255, 255 };
+
+static bool isBlack(hal::Rgb color) {
+  return color.r == 0 && color.g == 0 && color.b == 0;
+}
+
+static uint8_t mix(uint8_t from, uint8_t to, uint32_t t, uint32_t span) {
+  return (uint8_t)(from + ((int32_t)to - from) * (int32_t)t / (int32_t)span);
+}
+
+LedEngine::LedEngine()
+  : _count(0), _forced(false), _changes(0), _rendered(0), _renders(0), _shows(0) {
+  memset(_channels, 0, sizeof(_channels));
+  memset(_frame, 0, sizeof(_frame));
+  memset(_shown, 0, sizeof(_shown));
+}
+
+void LedEngine::begin(uint8_t count) {
+  _count = count < LED_ENGINE_MAX_LEDS ? count : LED_ENGINE_MAX_LEDS;
+  memset(_channels, 0, sizeof(_channels));
+  memset(_frame, 0, sizeof(_frame));
+  _forced = true;
+  _changes++;
+}
+
+bool LedEngine::range(int index, uint8_t& from, uint8_t& to) const {
+  if (index == LED_ALL) {
+    from = 0;
+    to = _count;
+    return true;
+  }
+  if (index < 0 || index >= _count) return false;
+  from = index;
+  to = index + 1;
+  return true;
+}
+
+void LedEngine::solid(int index, hal::Rgb color) {
+  uint8_t from, to;
+  if (!range(index, from, to)) return;
+  for (uint8_t i = from; i < to; i++) {
+    _channels[i].effect = LED_EFFECT_SOLID;
+    _channels[i].color = color;
+  }
+  _changes++;
+}
+
+void LedEngine::rainbow(int index) {
+  uint8_t from, to;
+  if (!range(index, from, to)) return;
+  uint32_t now = hal::millis();
+  for (uint8_t i = from; i < to; i++) {
+    _channels[i].startMs = now;
+    _channels[i].effect = LED_EFFECT_RAINBOW;
+  }
+  _changes++;
+}
+
+void LedEngine::blink(int index, hal::Rgb color, uint16_t halfPeriodMs) {
+  LedKeyframe frames[2] = { { halfPeriodMs, color, 0 }, { halfPeriodMs, BLACK, 0 } };
+  sequence(index, frames, 2, true);
+}
+
+void LedEngine::breathe(int index) {
+  uint8_t from, to;
+  if (!range(index, from, to)) return;
+  for (uint8_t i = from; i < to; i++) {
+    hal::Rgb color = current(i);
+    breathe(i, isBlack(color) ? WHITE : color);
+  }
+}
+
+void LedEngine::breathe(int index, hal::Rgb color) {
+  LedKeyframe frames[2] = { { LED_BREATHE_MS, color, LED_FADE }, { LED_BREATHE_MS, BLACK, LED_FADE } };
+  sequence(index, frames, 2, true);
+}
+
+bool LedEngine::sequence(int index, const LedKeyframe* frames, uint8_t count, bool loop) {
+  uint8_t from, to;
+  if (count == 0 || count > LED_KEYFRAMES_MAX || !range(index, from, to)) return false;
+  uint32_t length = 0;
+  for (uint8_t k = 0; k < count; k++) length += frames[k].ms;
+
+  uint32_t now = hal::millis();
+  for (uint8_t i = from; i < to; i++) {
+    Channel& channel = _channels[i];
+    memcpy(channel.frames, frames, count * sizeof(LedKeyframe));
+    channel.keyframes = count;
+    channel.loop = loop;
+    channel.lengthMs = length;
+    channel.color = current(i);
+    channel.startMs = now;
+    channel.effect = LED_EFFECT_SEQUENCE;
+  }
+  _changes++;
+  return true;
+}
+
+hal::Rgb LedEngine::current(uint8_t index) const {
+  // A color just set may not be rendered yet
+  return _channels[index].effect == LED_EFFECT_SOLID ? _channels[index].color : _frame[index];
+}
+
+bool LedEngine::animating() const {
+  for (uint8_t i = 0; i < _count; i++) {
+    if (_channels[i].effect != LED_EFFECT_SOLID) return true;
+  }
+  return false;
+}
+
+hal::Rgb LedEngine::renderChannel(const Channel& channel, uint8_t index, uint32_t nowMs) const {
+  uint32_t elapsed = nowMs - channel.startMs;
+  switch (channel.effect) {
+    case LED_EFFECT_SOLID:
+      return channel.color;
+
+    case LED_EFFECT_RAINBOW:
+      return hal::hsv((uint8_t)(elapsed / LED_RAINBOW_STEP_MS + index * LED_RAINBOW_SPREAD), 255, 255);
+
+    case LED_EFFECT_SEQUENCE:
+      break;
+  }
+
+  const LedKeyframe* frames = channel.frames;
+  uint8_t last = channel.keyframes - 1;
+  if (channel.lengthMs == 0) return frames[last].color;
+  if (channel.loop) {
+    elapsed %= channel.lengthMs;
+  } else if (elapsed >= channel.lengthMs) {
+    return frames[last].color;
+  }
+
+  // First pass of a sequence fades from the LED's old color, later loops
+  // from the last keyframe
+  hal::Rgb before = channel.loop && nowMs - channel.startMs >= channel.lengthMs ? frames[last].color
+                                                                                : channel.color;
+  for (uint8_t k = 0; k <= last; k++) {
+    const LedKeyframe& key = frames[k];
+    if (elapsed < key.ms) {
+      if (!(key.flags & LED_FADE)) return key.color;
+      return hal::Rgb{ mix(before.r, key.color.r, elapsed, key.ms), mix(before.g, key.color.g, elapsed, key.ms),
+                       mix(before.b, key.color.b, elapsed, key.ms) };
+    }
+    elapsed -= key.ms;
+    before = key.color;
+  }
+  return frames[last].color;
+}
+
+bool LedEngine::render(uint32_t nowMs) {
+  uint32_t changes = _changes;
+  for (uint8_t i = 0; i < _count; i++) {
+    _frame[i] = renderChannel(_channels[i], i, nowMs);
+  }
+  _renders++;
+  if (changes != _changes) return false;
+  _rendered = changes;
+  return _forced || memcmp(_frame, _shown, _count * sizeof(hal::Rgb)) != 0;
+}
+
+void LedEngine::shown() {
+  memcpy(_shown, _frame, _count * sizeof(hal::Rgb));
+  _forced = false;
+  _shows++;
+}
@@ -0,0 +1,110 @@
+/*
+ * LedEngine - per-LED effects composited into one frame
+ *
+ * Every LED runs its own effect: a solid color, the rainbow, or a sequence
+ * of keyframes (blink and breathe are built-in sequences). render() works
+ * out all of them for one moment into a frame buffer and tells whether the
+ * frame differs from the last one shown, so the strip is only sent frames
+ * that change: solid colors cost nothing after the first show, a blink
+ * two shows a second, and setting both LEDs one show.
+ *
+ * Keyframes: each holds { ms, color, flags }. The LED shows the color for
+ * ms, or with LED_FADE fades to it over ms from the color before (the last
+ * keyframe's when looping, else the color the LED had when the sequence
+ * started). Without loop the last color stays when the sequence ends.
+ *
+ *   blink    { 500, color }, { 500, black }, looping
+ *   breathe  { 1020, color, FADE }, { 1020, black, FADE }, looping
+ *   rainbow  hue advances one step per 20 ms, 30 steps apart per LED
+ *
+ * Brightness is left to the strip (hal::ledsSetBrightness), effects only
+ * change colors.
+ *
+ * Setters may be called from any task. render() runs in one task (the
+ * loop); if a setter gets in while it renders, the frame is dropped and
+ * changed() stays true for the next pass.
+ */
+
+#ifndef SIROBO_LED_ENGINE_H
+#define SIROBO_LED_ENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <Hal.h>
+
+#define LED_ENGINE_MAX_LEDS 8
+#define LED_KEYFRAMES_MAX 16
+#define LED_ALL -1              // Index for every LED
+#define LED_FADE 0x01           // Keyframe flag: fade to the color
+
+struct LedKeyframe {
+  uint16_t ms;
+  hal::Rgb color;
+  uint8_t flags;
+};
+
+enum LedEffect : uint8_t {
+  LED_EFFECT_SOLID = 0,
+  LED_EFFECT_RAINBOW,
+  LED_EFFECT_SEQUENCE
+};
+
+class LedEngine {
+public:
+  LedEngine();
+
+  // All LEDs off; the first render() is shown even if it is all black
+  void begin(uint8_t count);
+
+  void solid(int index, hal::Rgb color);
+  void rainbow(int index);
+  void blink(int index, hal::Rgb color, uint16_t halfPeriodMs = 500);
+  // Breathes the LED's current color, white if it is off
+  void breathe(int index);
+  void breathe(int index, hal::Rgb color);
+  // False (and nothing changes) for an empty or too long list
+  bool sequence(int index, const LedKeyframe* frames, uint8_t count, bool loop);
+
+  // Composites every effect at nowMs; true when the frame should be shown
+  bool render(uint32_t nowMs);
+  // The frame went out
+  void shown();
+
+  const hal::Rgb* frame() const { return _frame; }
+  uint8_t count() const { return _count; }
+  LedEffect effect(uint8_t index) const { return index < _count ? _channels[index].effect : LED_EFFECT_SOLID; }
+  // A setter ran since the last render
+  bool changed() const { return _changes != _rendered; }
+  // Some LED changes color over time
+  bool animating() const;
+  uint32_t renders() const { return _renders; }
+  uint32_t shows() const { return _shows; }
+
+private:
+  struct Channel {
+    LedEffect effect;
+    bool loop;
+    uint8_t keyframes;
+    hal::Rgb color;       // SOLID; SEQUENCE: the color to fade from first
+    uint32_t startMs;
+    uint32_t lengthMs;    // SEQUENCE: sum of the keyframes
+    LedKeyframe frames[LED_KEYFRAMES_MAX];
+  };
+
+  bool range(int index, uint8_t& from, uint8_t& to) const;
+  hal::Rgb current(uint8_t index) const;
+  hal::Rgb renderChannel(const Channel& channel, uint8_t index, uint32_t nowMs) const;
+
+  Channel _channels[LED_ENGINE_MAX_LEDS];
+  hal::Rgb _frame[LED_ENGINE_MAX_LEDS];
+  hal::Rgb _shown[LED_ENGINE_MAX_LEDS];
+  uint8_t _count;
+  bool _forced;
+  volatile uint32_t _changes;
+  uint32_t _rendered;
+  uint32_t _renders;
+  uint32_t _shows;
+};
+
+#endif
@@ -0,0 +1,118 @@
+#include "MotorDriver.h"
+
+#include <math.h>
+
+#include <Hal.h>
+
+#define MOTOR_PWM_CLOCK 80000000UL
+
+uint32_t motorMaxPwmFrequency(uint8_t resolution) {
+  return resolution < 1 || resolution > 20 ? 0 : MOTOR_PWM_CLOCK >> resolution;
+}
+
+void Motor::begin(const MotorPins& pins, const MotorConfig& config) {
+  _pins = pins;
+  hal::pinMode(pins.in1, hal::PIN_OUTPUT);
+  hal::pinMode(pins.in2, hal::PIN_OUTPUT);
+  configure(config);
+  hal::pwmAttach(pins.enable, pins.channel);
+  _target = 0;
+  _output = 0;
+  write(0);
+}
+
+void Motor::configure(const MotorConfig& config) {
+  _config = config;
+  hal::pwmSetup(_pins.channel, config.pwmFrequency, config.pwmResolution);
+
+  // Duties are in the old resolution; force a rewrite
+  _direction = -2;
+  _duty = UINT32_MAX;
+  _rate = 0;
+  write((int)_output);
+}
+
+void Motor::setTarget(int command) {
+  if (command > MOTOR_COMMAND_MAX) command = MOTOR_COMMAND_MAX;
+  if (command < -MOTOR_COMMAND_MAX) command = -MOTOR_COMMAND_MAX;
+  _target = command;
+}
+
+void Motor::stop() {
+  _target = 0;
+  _stopRequested = true;
+}
+
+void Motor::update(uint32_t dtUs) {
+  if (_stopRequested) {
+    _stopRequested = false;
+    _output = 0;
+    _rate = 0;
+    write(0);
+  }
+
+  int target = _target;
+  if (_config.maxAccel == 0) {
+    if (_output != target) {
+      _output = target;
+      write(target);
+    }
+    return;
+  }
+  if (_output == target && _rate == 0) return;
+
+  float dt = dtUs * 1e-6f;
+  float error = target - _output;
+  float rate;
+  if (_config.maxJerk == 0) {
+    rate = error > 0 ? _config.maxAccel : -(float)_config.maxAccel;
+  } else {
+    // Fastest rate from which the jerk limit can still bring the rate to
+    // zero by the target, then move the rate towards it by at most jerk
+    float reachable = sqrtf(2.0f * _config.maxJerk * fabsf(error));
+    float wanted = fminf(_config.maxAccel, reachable);
+    if (error < 0) wanted = -wanted;
+    float step = _config.maxJerk * dt;
+    rate = _rate + fmaxf(-step, fminf(step, wanted - _rate));
+  }
+
+  float next = _output + rate * dt;
+  if ((error > 0 && next >= target) || (error < 0 && next <= target) || error == 0) {
+    next = target;
+    rate = 0;
+  }
+  _output = next;
+  _rate = rate;
+  write((int)lroundf(next));
+}
+
+float Motor::level() const {
+  if (_direction != 1 && _direction != -1) return 0;
+  uint32_t full = (1UL << _config.pwmResolution) - 1;
+  return full ? _direction * (float)_duty / full : 0;
+}
+
+void Motor::write(int command) {
+  int8_t direction = command > 0 ? 1 : command < 0 ? -1 : 0;
+  uint32_t magnitude = command < 0 ? -command : command;
+
+  uint32_t duty = 0;
+  if (magnitude > 0) {
+    uint32_t full = (1UL << _config.pwmResolution) - 1;
+    uint32_t deadband = _config.deadband;
+    uint32_t scaled = deadband + magnitude * (MOTOR_COMMAND_MAX - deadband) / MOTOR_COMMAND_MAX;
+    duty = (scaled * full + MOTOR_COMMAND_MAX / 2) / MOTOR_COMMAND_MAX;
+  }
+
+  if (direction != _direction) {
+    hal::digitalWriteFast(_pins.in1, direction > 0);
+    hal::digitalWriteFast(_pins.in2, direction < 0);
+    _direction = direction;
+    _writes++;
+  }
+  if (duty != _duty) {
+    hal::pwmWrite(_pins.channel, duty);
+    _duty = duty;
+    _writes++;
+  }
+}
@@ -0,0 +1,81 @@
+/*
+ * MotorDriver - one H-bridge channel (L298N: IN1/IN2 pick the direction,
+ * a PWM on EN sets the duty)
+ *
+ * Commands are -255..255 as in setMotorSpeed(). A nonzero command is
+ * mapped past the deadband (the command at which the motor just starts to
+ * turn) and scaled to the configured PWM resolution. The hardware is only
+ * touched when the direction or the duty actually changes: the line
+ * follower commands the motors on every loop pass, mostly with the values
+ * they already have. Direction pins go through hal::digitalWriteFast().
+ *
+ * setTarget() and stop() only record the request; update(), called at the
+ * control rate, does every hardware write. Without a ramp it writes the
+ * target as it is. With maxAccel set it moves the output towards the
+ * target by at most maxAccel command units per second, and maxJerk also
+ * limits how fast that rate may change, for an S-shaped start and stop.
+ * A stop() skips the ramp.
+ *
+ * setTarget() and stop() may be called from any task; update() and
+ * configure() only from the one that owns the motor (the loop), so the
+ * pins and the cached direction and duty never disagree.
+ */
+
+#ifndef SIROBO_MOTOR_DRIVER_H
+#define SIROBO_MOTOR_DRIVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MOTOR_COMMAND_MAX 255
+
+struct MotorPins {
+  uint8_t in1;
+  uint8_t in2;
+  uint8_t enable;
+  uint8_t channel;   // PWM channel driving enable
+};
+
+struct MotorConfig {
+  uint32_t pwmFrequency;   // Hz
+  uint8_t pwmResolution;   // Bits
+  uint8_t deadband;        // Command (0-255) where nonzero commands start
+  uint16_t maxAccel;       // Command units per second, 0 = no ramp
+  uint16_t maxJerk;        // Command units per second^2, 0 = no jerk limit
+};
+
+// Highest PWM frequency at `resolution` bits (the LEDC timer runs off the
+// 80 MHz APB clock)
+uint32_t motorMaxPwmFrequency(uint8_t resolution);
+
+class Motor {
+public:
+  void begin(const MotorPins& pins, const MotorConfig& config);
+  // New PWM settings are set up at once; the output is rewritten
+  void configure(const MotorConfig& config);
+
+  void setTarget(int command);
+  void update(uint32_t dtUs);
+  void stop();
+
+  int target() const { return _target; }
+  int output() const { return (int)_output; }
+  uint32_t duty() const { return _duty; }
+  float level() const;                          // Signed duty written, -1..1
+  uint32_t writes() const { return _writes; }   // Hardware writes so far
+
+private:
+  void write(int command);
+
+  MotorPins _pins;
+  MotorConfig _config;
+  volatile int _target = 0;
+  volatile bool _stopRequested = false;
+  float _output = 0;
+  float _rate = 0;          // Units per second, for the jerk limit
+  int8_t _direction = -2;   // Last written: -1, 0, 1; -2 = unknown
+  uint32_t _duty = UINT32_MAX;
+  uint32_t _writes = 0;
+};
+
+#endif
@@ -0,0 +1,178 @@
+#include "OtaStream.h"
+
+#include <string.h>
+
+OtaStream::OtaStream(OtaSink sink) : _sink(sink) {
+  begin();
+}
+
+void OtaStream::begin(const uint8_t* expectedDigest) {
+  _format = OTA_FORMAT_UNKNOWN;
+  _error = OTA_STREAM_OK;
+  _verified = false;
+  _hasExpected = expectedDigest != nullptr;
+  if (_hasExpected) memcpy(_expected, expectedDigest, sizeof(_expected));
+  memset(_digest, 0, sizeof(_digest));
+  _sha.begin();
+
+  memset(&_header, 0, sizeof(_header));
+  _headerBytes = 0;
+  _received = 0;
+  _written = 0;
+
+  _bits = 0;
+  _bitCount = 0;
+  _windowPos = 0;
+  memset(_window, 0, sizeof(_window));
+  _outputLen = 0;
+}
+
+const char* OtaStream::errorString() const {
+  switch (_error) {
+    case OTA_STREAM_OK: return "no error";
+    case OTA_STREAM_BAD_HEADER: return "unsupported image header";
+    case OTA_STREAM_SINK: return "flash write failed";
+    case OTA_STREAM_OVERFLOW: return "image larger than announced";
+    case OTA_STREAM_TRUNCATED: return "image incomplete";
+    case OTA_STREAM_DIGEST: return "SHA-256 mismatch";
+  }
+  return "unknown error";
+}
+
+size_t OtaStream::imageSize() const {
+  return _format == OTA_FORMAT_PACKED && _headerBytes == sizeof(_header) ? _header.imageSize : 0;
+}
+
+bool OtaStream::fail(OtaStreamError error) {
+  if (!_error) _error = error;
+  return false;
+}
+
+bool OtaStream::parseHeader() {
+  if (_header.version != OTA_IMAGE_VERSION) return fail(OTA_STREAM_BAD_HEADER);
+  if (_header.compression == OTA_COMPRESSION_NONE) {
+    if (_header.payloadSize != _header.imageSize) return fail(OTA_STREAM_BAD_HEADER);
+    return true;
+  }
+  if (_header.compression != OTA_COMPRESSION_HEATSHRINK) return fail(OTA_STREAM_BAD_HEADER);
+  if (_header.windowBits < OTA_MIN_WINDOW_BITS || _header.windowBits > OTA_MAX_WINDOW_BITS ||
+      _header.lookaheadBits < OTA_MIN_LOOKAHEAD_BITS || _header.lookaheadBits > OTA_MAX_LOOKAHEAD_BITS ||
+      _header.lookaheadBits >= _header.windowBits) {
+    return fail(OTA_STREAM_BAD_HEADER);
+  }
+  return true;
+}
+
+// Stored data goes to the sink as received, without a copy
+bool OtaStream::pass(const uint8_t* data, size_t len) {
+  _sha.update(data, len);
+  _written += len;
+  if (!_sink(data, len)) return fail(OTA_STREAM_SINK);
+  return true;
+}
+
+bool OtaStream::flush() {
+  if (!_outputLen) return true;
+  _sha.update(_output, _outputLen);
+  size_t len = _outputLen;
+  _outputLen = 0;
+  if (!_sink(_output, len)) return fail(OTA_STREAM_SINK);
+  return true;
+}
+
+inline bool OtaStream::emit(uint8_t byte) {
+  _window[_windowPos++ & ((1 << _header.windowBits) - 1)] = byte;
+  _output[_outputLen++] = byte;
+  _written++;
+  return _outputLen < OTA_OUTPUT_SIZE || flush();
+}
+
+bool OtaStream::decode(const uint8_t* data, size_t len) {
+  const uint8_t windowBits = _header.windowBits;
+  const uint8_t lookaheadBits = _header.lookaheadBits;
+  const uint8_t backrefBits = 1 + windowBits + lookaheadBits;
+  const size_t windowMask = (1 << windowBits) - 1;
+
+  for (size_t i = 0; i < len; i++) {
+    // At most backrefBits - 1 (20) bits are pending, so 8 more always fit
+    _bits = (_bits << 8) | data[i];
+    _bitCount += 8;
+
+    while (_bitCount) {
+      // Anything after the last image byte is padding
+      if (_written == _header.imageSize) {
+        _bitCount = 0;
+        break;
+      }
+
+      bool literal = (_bits >> (_bitCount - 1)) & 1;
+      uint8_t need = literal ? 9 : backrefBits;
+      if (_bitCount < need) break;
+      _bitCount -= need;
+      uint32_t symbol = (_bits >> _bitCount) & ((1UL << (need - 1)) - 1);
+
+      if (literal) {
+        if (!emit(symbol)) return false;
+        continue;
+      }
+
+      size_t distance = (symbol >> lookaheadBits) + 1;
+      size_t count = (symbol & ((1 << lookaheadBits) - 1)) + 1;
+      if (_written + count > _header.imageSize) return fail(OTA_STREAM_OVERFLOW);
+      for (size_t n = 0; n < count; n++) {
+        if (!emit(_window[(_windowPos - distance) & windowMask])) return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool OtaStream::write(const uint8_t* data, size_t len) {
+  if (_error) return false;
+  _received += len;
+
+  if (_format != OTA_FORMAT_RAW && _headerBytes < sizeof(_header)) {
+    uint8_t* header = (uint8_t*)&_header;
+    while (len && _headerBytes < sizeof(_header)) {
+      header[_headerBytes++] = *data++;
+      len--;
+      if (_headerBytes == sizeof(_header.magic)) {
+        if (_header.magic != OTA_IMAGE_MAGIC) {
+          // Plain image: replay the bytes held back while looking
+          _format = OTA_FORMAT_RAW;
+          if (!pass(header, _headerBytes)) return false;
+          break;
+        }
+        _format = OTA_FORMAT_PACKED;
+      }
+    }
+    if (_format == OTA_FORMAT_PACKED) {
+      if (_headerBytes < sizeof(_header)) return true;
+      if (!parseHeader()) return false;
+    }
+  }
+  if (!len) return true;
+
+  if (_format == OTA_FORMAT_RAW) return pass(data, len);
+
+  if (_received - sizeof(_header) > _header.payloadSize) return fail(OTA_STREAM_OVERFLOW);
+  if (_header.compression == OTA_COMPRESSION_NONE) return pass(data, len);
+  return decode(data, len);
+}
+
+bool OtaStream::finish() {
+  _verified = false;
+  if (_error || !flush()) return false;
+  _sha.finish(_digest);
+
+  if (_format == OTA_FORMAT_UNKNOWN) return fail(OTA_STREAM_TRUNCATED);
+  if (_format == OTA_FORMAT_PACKED) {
+    if (_headerBytes < sizeof(_header) || _written != _header.imageSize) return fail(OTA_STREAM_TRUNCATED);
+    _verified = memcmp(_digest, _header.sha256, SHA256_DIGEST_SIZE) == 0;
+  } else if (_hasExpected) {
+    _verified = memcmp(_digest, _expected, SHA256_DIGEST_SIZE) == 0;
+  } else {
+    return true;
+  }
+  return _verified || fail(OTA_STREAM_DIGEST);
+}
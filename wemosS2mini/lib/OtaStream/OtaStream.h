@@ -0,0 +1,140 @@
+/*
+ * OtaStream - streaming firmware image decoder and verifier
+ *
+ * Sits between the upload handler and the flash writer: every received
+ * chunk goes through write(), which unpacks it (if compressed) and hands
+ * the image bytes to the sink in OTA_OUTPUT_SIZE pieces while hashing
+ * them. finish() flushes the rest and checks the size and SHA-256 digest,
+ * so the caller only commits the new image (Update.end()) when it matches.
+ * Nothing is allocated: the decoder window and output buffer live in the
+ * object (about 5.3 KB), so declare it statically.
+ *
+ * Two inputs are accepted, told apart by the first four bytes:
+ *  - a plain ESP32 image (.bin); its digest, if known, is passed to begin()
+ *  - a packed image from tools/otapack: OtaImageHeader followed by the
+ *    image, stored or heatshrink-compressed
+ *
+ * OtaImageHeader (all fields little-endian):
+ *   0  u32 magic          "SOTA" (0x41544F53)
+ *   4  u8  version        OTA_IMAGE_VERSION
+ *   5  u8  compression    OtaCompression
+ *   6  u8  windowBits     heatshrink window (OTA_MIN..OTA_MAX_WINDOW_BITS)
+ *   7  u8  lookaheadBits  heatshrink lookahead (OTA_MIN..OTA_MAX_LOOKAHEAD_BITS)
+ *   8  u32 imageSize      unpacked image bytes
+ *   12 u32 payloadSize    bytes after the header
+ *   16 u8  sha256[32]     digest of the unpacked image
+ *
+ * Heatshrink stream (LZSS, bits MSB first, compatible with the heatshrink
+ * CLI for the same -w/-l): '1' + 8-bit literal, or '0' + windowBits of
+ * (distance - 1) + lookaheadBits of (length - 1). The window starts out
+ * zero-filled; trailing pad bits after imageSize bytes are ignored.
+ */
+
+#ifndef SIROBO_OTA_STREAM_H
+#define SIROBO_OTA_STREAM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Sha256.h"
+
+#define OTA_IMAGE_MAGIC 0x41544F53UL
+#define OTA_IMAGE_VERSION 1
+#define OTA_MIN_WINDOW_BITS 4
+#define OTA_MAX_WINDOW_BITS 12
+#define OTA_MIN_LOOKAHEAD_BITS 3
+#define OTA_MAX_LOOKAHEAD_BITS 8
+#define OTA_OUTPUT_SIZE 1024      // Bytes per sink call (the last one may be shorter)
+
+enum OtaCompression : uint8_t {
+  OTA_COMPRESSION_NONE = 0,
+  OTA_COMPRESSION_HEATSHRINK = 1
+};
+
+enum OtaFormat : uint8_t {
+  OTA_FORMAT_UNKNOWN = 0,   // Fewer than four bytes seen
+  OTA_FORMAT_RAW,           // Plain image
+  OTA_FORMAT_PACKED         // OtaImageHeader + payload
+};
+
+enum OtaStreamError : uint8_t {
+  OTA_STREAM_OK = 0,
+  OTA_STREAM_BAD_HEADER,    // Unknown version, compression or window size
+  OTA_STREAM_SINK,          // The sink refused a write
+  OTA_STREAM_OVERFLOW,      // More data than the header announced
+  OTA_STREAM_TRUNCATED,     // Less data than the header announced
+  OTA_STREAM_DIGEST         // SHA-256 mismatch
+};
+
+#pragma pack(push, 1)
+struct OtaImageHeader {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t compression;
+  uint8_t windowBits;
+  uint8_t lookaheadBits;
+  uint32_t imageSize;
+  uint32_t payloadSize;
+  uint8_t sha256[SHA256_DIGEST_SIZE];
+};
+#pragma pack(pop)
+
+// Receives image bytes in order; false aborts the stream
+typedef bool (*OtaSink)(const uint8_t* data, size_t len);
+
+class OtaStream {
+public:
+  explicit OtaStream(OtaSink sink);
+
+  // expectedDigest applies to plain images (packed ones carry their own)
+  void begin(const uint8_t* expectedDigest = nullptr);
+  bool write(const uint8_t* data, size_t len);
+  // Flushes and verifies; true only if the whole image reached the sink
+  // and matches its digest (plain images without one are not checked)
+  bool finish();
+
+  OtaFormat format() const { return _format; }
+  OtaCompression compression() const { return (OtaCompression)_header.compression; }
+  OtaStreamError error() const { return _error; }
+  const char* errorString() const;
+  bool verified() const { return _verified; }
+
+  size_t received() const { return _received; }      // Input bytes
+  size_t written() const { return _written; }        // Image bytes produced
+  size_t imageSize() const;                          // 0 while unknown (plain images)
+  // Digest of the image, valid after finish()
+  const uint8_t* digest() const { return _digest; }
+
+private:
+  bool fail(OtaStreamError error);
+  bool parseHeader();
+  bool pass(const uint8_t* data, size_t len);
+  bool emit(uint8_t byte);
+  bool flush();
+  bool decode(const uint8_t* data, size_t len);
+
+  OtaSink _sink;
+  OtaFormat _format;
+  OtaStreamError _error;
+  bool _verified;
+  bool _hasExpected;
+  uint8_t _expected[SHA256_DIGEST_SIZE];
+  uint8_t _digest[SHA256_DIGEST_SIZE];
+  Sha256 _sha;
+
+  OtaImageHeader _header;
+  size_t _headerBytes;
+  size_t _received;
+  size_t _written;
+
+  // Heatshrink decoder
+  uint32_t _bits;
+  uint8_t _bitCount;
+  size_t _windowPos;
+  uint8_t _window[1 << OTA_MAX_WINDOW_BITS];
+
+  uint8_t _output[OTA_OUTPUT_SIZE];
+  size_t _outputLen;
+};
+
+#endif
@@ -0,0 +1,119 @@
+#include "Sha256.h"
+
+#include <string.h>
+
+static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr(uint32_t x, uint8_t n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+void Sha256::begin() {
+  static const uint32_t init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  memcpy(_state, init, sizeof(_state));
+  _length = 0;
+  _buffered = 0;
+}
+
+void Sha256::block(const uint8_t* data) {
+  uint32_t w[64];
+  for (uint8_t i = 0; i < 16; i++) {
+    w[i] = (uint32_t)data[i * 4] << 24 | (uint32_t)data[i * 4 + 1] << 16 |
+           (uint32_t)data[i * 4 + 2] << 8 | data[i * 4 + 3];
+  }
+  for (uint8_t i = 16; i < 64; i++) {
+    uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+  uint32_t e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+  for (uint8_t i = 0; i < 64; i++) {
+    uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+    uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+  _state[0] += a; _state[1] += b; _state[2] += c; _state[3] += d;
+  _state[4] += e; _state[5] += f; _state[6] += g; _state[7] += h;
+}
+
+void Sha256::update(const void* data, size_t len) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  _length += len;
+
+  if (_buffered) {
+    size_t take = 64 - _buffered < len ? 64 - _buffered : len;
+    memcpy(_buffer + _buffered, bytes, take);
+    _buffered += take;
+    bytes += take;
+    len -= take;
+    if (_buffered < 64) return;
+    block(_buffer);
+    _buffered = 0;
+  }
+  // Whole blocks straight from the input
+  while (len >= 64) {
+    block(bytes);
+    bytes += 64;
+    len -= 64;
+  }
+  memcpy(_buffer, bytes, len);
+  _buffered = len;
+}
+
+void Sha256::finish(uint8_t digest[SHA256_DIGEST_SIZE]) {
+  uint64_t bits = _length * 8;
+  static const uint8_t pad[64] = { 0x80 };
+  update(pad, _buffered < 56 ? 56 - _buffered : 120 - _buffered);
+
+  uint8_t lengthBytes[8];
+  for (uint8_t i = 0; i < 8; i++) lengthBytes[i] = bits >> (56 - i * 8);
+  update(lengthBytes, 8);
+
+  for (uint8_t i = 0; i < 8; i++) {
+    digest[i * 4] = _state[i] >> 24;
+    digest[i * 4 + 1] = _state[i] >> 16;
+    digest[i * 4 + 2] = _state[i] >> 8;
+    digest[i * 4 + 3] = _state[i];
+  }
+}
+
+void sha256ToHex(const uint8_t digest[SHA256_DIGEST_SIZE], char out[SHA256_HEX_SIZE]) {
+  static const char digits[] = "0123456789abcdef";
+  for (uint8_t i = 0; i < SHA256_DIGEST_SIZE; i++) {
+    out[i * 2] = digits[digest[i] >> 4];
+    out[i * 2 + 1] = digits[digest[i] & 0x0F];
+  }
+  out[SHA256_DIGEST_SIZE * 2] = '\0';
+}
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+bool sha256FromHex(const char* hex, uint8_t digest[SHA256_DIGEST_SIZE]) {
+  if (strlen(hex) != SHA256_DIGEST_SIZE * 2) return false;
+  for (uint8_t i = 0; i < SHA256_DIGEST_SIZE; i++) {
+    int high = hexValue(hex[i * 2]);
+    int low = hexValue(hex[i * 2 + 1]);
+    if (high < 0 || low < 0) return false;
+    digest[i] = high << 4 | low;
+  }
+  return true;
+}
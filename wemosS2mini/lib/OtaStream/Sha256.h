@@ -0,0 +1,39 @@
+/*
+ * Sha256 - incremental SHA-256 (FIPS 180-4)
+ *
+ * Portable, allocation-free, 108 bytes of state. Used to verify firmware
+ * images as they stream in, and by the host packing tool.
+ */
+
+#ifndef SIROBO_SHA256_H
+#define SIROBO_SHA256_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_HEX_SIZE (SHA256_DIGEST_SIZE * 2 + 1)
+
+class Sha256 {
+public:
+  Sha256() { begin(); }
+
+  void begin();
+  void update(const void* data, size_t len);
+  void finish(uint8_t digest[SHA256_DIGEST_SIZE]);
+
+private:
+  void block(const uint8_t* data);
+
+  uint32_t _state[8];
+  uint64_t _length;
+  uint8_t _buffer[64];
+  size_t _buffered;
+};
+
+// Lowercase hex, NUL-terminated
+void sha256ToHex(const uint8_t digest[SHA256_DIGEST_SIZE], char out[SHA256_HEX_SIZE]);
+// Accepts upper or lower case; false unless exactly 64 hex digits
+bool sha256FromHex(const char* hex, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+#endif
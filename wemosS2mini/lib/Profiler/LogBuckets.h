@@ -0,0 +1,34 @@
+/*
+ * LogBuckets - the log-scale histogram buckets of the Profiler and
+ * LatencyStats
+ *
+ * Four buckets per power of two, so a bucket's upper edge is within ~19%
+ * of any value in it. Values below 4 get a bucket each. Bucket b covers
+ * [logBucketLower(b), logBucketLower(b + 1)): octave b / 4, quarter b % 4.
+ */
+
+#ifndef SIROBO_LOG_BUCKETS_H
+#define SIROBO_LOG_BUCKETS_H
+
+#include <stdint.h>
+
+#define LOG_SUB_BUCKETS 4
+
+// Bucket of a value, the last of `buckets` for anything past it
+inline uint8_t logBucketFor(uint32_t value, uint32_t buckets) {
+  if (value < LOG_SUB_BUCKETS) return value;
+
+  uint8_t octave = 31 - __builtin_clz(value);
+  uint8_t quarter = (value >> (octave - 2)) & 0x3;
+  uint32_t bucket = octave * LOG_SUB_BUCKETS + quarter;
+  return bucket < buckets ? bucket : buckets - 1;
+}
+
+inline uint64_t logBucketLower(uint32_t bucket) {
+  uint32_t octave = bucket / LOG_SUB_BUCKETS;
+  uint32_t quarter = bucket % LOG_SUB_BUCKETS;
+  if (octave < 2) return bucket;
+  return (uint64_t)(LOG_SUB_BUCKETS + quarter) << (octave - 2);
+}
+
+#endif
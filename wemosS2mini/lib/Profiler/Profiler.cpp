@@ -0,0 +1,68 @@
+#include "Profiler.h"
+
+#include <string.h>
+
+Profiler::Profiler(const char* const* names, uint8_t stageCount)
+  : _names(names),
+    _stageCount(stageCount < PROFILER_MAX_STAGES ? stageCount : PROFILER_MAX_STAGES),
+    _resetMs(0) {
+  memset(_stages, 0, sizeof(_stages));
+  for (uint8_t i = 0; i < PROFILER_MAX_STAGES; i++) _stages[i].minCycles = UINT32_MAX;
+}
+
+void Profiler::record(uint8_t stage, uint32_t cycles, uint32_t allocations) {
+  if (stage >= _stageCount) return;
+
+  Stage& s = _stages[stage];
+  s.count++;
+  s.totalCycles += cycles;
+  s.allocations += allocations;
+  if (cycles < s.minCycles) s.minCycles = cycles;
+  if (cycles > s.maxCycles) s.maxCycles = cycles;
+  s.histogram[logBucketFor(cycles, PROFILER_BUCKETS)]++;
+}
+
+void Profiler::reset() {
+  memset(_stages, 0, sizeof(_stages));
+  for (uint8_t i = 0; i < PROFILER_MAX_STAGES; i++) _stages[i].minCycles = UINT32_MAX;
+  _resetMs = hal::millis();
+}
+
+float Profiler::cyclesToUs(uint64_t cycles) const {
+  return cycles * 1e6f / hal::cycleFrequency();
+}
+
+void Profiler::summary(uint8_t stage, ProfileSummary& out) const {
+  memset(&out, 0, sizeof(out));
+  if (stage >= _stageCount || _stages[stage].count == 0) return;
+
+  const Stage& s = _stages[stage];
+  out.count = s.count;
+  out.minUs = cyclesToUs(s.minCycles);
+  out.maxUs = cyclesToUs(s.maxCycles);
+  out.avgUs = cyclesToUs(s.totalCycles) / s.count;
+  out.totalMs = cyclesToUs(s.totalCycles) / 1000;
+  out.allocations = s.allocations;
+
+  // First bucket at which 99% of the calls are covered
+  uint32_t target = s.count - s.count / 100;
+  uint32_t seen = 0;
+  for (uint32_t b = 0; b < PROFILER_BUCKETS; b++) {
+    seen += s.histogram[b];
+    if (seen >= target) {
+      uint64_t upper = logBucketLower(b + 1);
+      out.p99Us = cyclesToUs(upper < s.maxCycles ? upper : s.maxCycles);
+      break;
+    }
+  }
+}
+
+uint32_t Profiler::sinceResetMs() const {
+  return hal::millis() - _resetMs;
+}
+
+float Profiler::rate(uint8_t stage) const {
+  uint32_t elapsed = sinceResetMs();
+  if (stage >= _stageCount || elapsed == 0) return 0;
+  return _stages[stage].count * 1000.0f / elapsed;
+}
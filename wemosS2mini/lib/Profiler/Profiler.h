@@ -0,0 +1,101 @@
+/*
+ * Profiler - per-stage cycle counting for the main loop
+ *
+ * Each stage keeps a call count, total/min/max cycles and a log-scale
+ * histogram (four buckets per power of two) from which the p99 is read.
+ * Timing uses hal::cycleCount(), the Xtensa CCOUNT register on the robot,
+ * so a measurement costs two register reads.
+ *
+ * Instrumentation is compiled in only with -DSIROBO_PROFILE; without it
+ * PROFILE_SCOPE() expands to nothing and the profiler stays empty.
+ *
+ * Durations include time the stage spends preempted by other tasks
+ * (AsyncTCP), which is what the loop actually experiences.
+ *
+ * Each scope also records how many heap allocations happened inside it
+ * (hal::allocationCount(), needs -DSIROBO_HEAP_STATS). The counter is
+ * global, so allocations made by a preempting task land in the stage too.
+ */
+
+#ifndef SIROBO_PROFILER_H
+#define SIROBO_PROFILER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <Hal.h>
+#include <LogBuckets.h>
+
+#define PROFILER_MAX_STAGES 12
+#define PROFILER_OCTAVES 28          // 2^28 cycles = ~1.1 s at 240 MHz
+#define PROFILER_SUB_BUCKETS LOG_SUB_BUCKETS
+#define PROFILER_BUCKETS (PROFILER_OCTAVES * PROFILER_SUB_BUCKETS)
+
+struct ProfileSummary {
+  uint32_t count;
+  float minUs;
+  float avgUs;
+  float maxUs;
+  float p99Us;     // upper edge of the p99 histogram bucket (within ~19%)
+  float totalMs;
+  uint32_t allocations;  // Heap allocations inside the stage
+};
+
+class Profiler {
+public:
+  Profiler(const char* const* names, uint8_t stageCount);
+
+  void record(uint8_t stage, uint32_t cycles, uint32_t allocations = 0);
+  void reset();
+
+  uint8_t stageCount() const { return _stageCount; }
+  const char* stageName(uint8_t stage) const { return _names[stage]; }
+  void summary(uint8_t stage, ProfileSummary& out) const;
+
+  // Calls of `stage` per second since the last reset (loop iteration rate)
+  float rate(uint8_t stage) const;
+  uint32_t sinceResetMs() const;
+
+private:
+  struct Stage {
+    uint32_t count;
+    uint64_t totalCycles;
+    uint32_t minCycles;
+    uint32_t maxCycles;
+    uint32_t allocations;
+    uint32_t histogram[PROFILER_BUCKETS];
+  };
+
+  float cyclesToUs(uint64_t cycles) const;
+
+  const char* const* _names;
+  uint8_t _stageCount;
+  uint32_t _resetMs;
+  Stage _stages[PROFILER_MAX_STAGES];
+};
+
+// Times the enclosing scope into one profiler stage
+class ProfileScope {
+public:
+  ProfileScope(Profiler& profiler, uint8_t stage)
+    : _profiler(profiler), _stage(stage),
+      _allocations(hal::allocationCount()), _start(hal::cycleCount()) {}
+  ~ProfileScope() {
+    uint32_t cycles = hal::cycleCount() - _start;
+    _profiler.record(_stage, cycles, hal::allocationCount() - _allocations);
+  }
+
+private:
+  Profiler& _profiler;
+  uint8_t _stage;
+  uint32_t _allocations;
+  uint32_t _start;
+};
+
+#ifdef SIROBO_PROFILE
+#define PROFILE_SCOPE(profiler, stage) ProfileScope profileScope_##stage(profiler, stage)
+#else
+#define PROFILE_SCOPE(profiler, stage) do {} while (0)
+#endif
+
+#endif
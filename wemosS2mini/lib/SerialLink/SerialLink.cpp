@@ -0,0 +1,90 @@
+#include "SerialLink.h"
+
+#include <string.h>
+
+static uint16_t crcUpdate(uint16_t crc, uint8_t byte) {
+  crc ^= (uint16_t)byte << 8;
+  for (uint8_t bit = 0; bit < 8; bit++) {
+    crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+uint16_t linkCrc(uint8_t kind, const uint8_t* payload, size_t len) {
+  uint16_t crc = 0xFFFF;
+  crc = crcUpdate(crc, kind);
+  crc = crcUpdate(crc, len & 0xFF);
+  crc = crcUpdate(crc, len >> 8);
+  for (size_t i = 0; i < len; i++) crc = crcUpdate(crc, payload[i]);
+  return crc;
+}
+
+void linkHeader(uint8_t kind, const uint8_t* payload, size_t len, uint8_t header[LINK_HEADER]) {
+  uint16_t crc = linkCrc(kind, payload, len);
+  header[0] = LINK_SYNC;
+  header[1] = kind;
+  header[2] = len & 0xFF;
+  header[3] = len >> 8;
+  header[4] = crc & 0xFF;
+  header[5] = crc >> 8;
+}
+
+LinkReader::LinkReader() {
+  reset();
+  _frames = 0;
+  _errors = 0;
+  _skipped = 0;
+}
+
+void LinkReader::reset() {
+  _count = 0;
+  _frameLength = 0;
+}
+
+bool LinkReader::push(uint8_t byte) {
+  // Bytes after the frame last returned may already hold the next one
+  if (_frameLength) {
+    _count -= _frameLength;
+    memmove(_buffer, _buffer + _frameLength, _count);
+    _frameLength = 0;
+  }
+  _buffer[_count++] = byte;
+  return check();
+}
+
+// Drops the first byte, which cannot start a good frame, and everything up
+// to the next sync byte
+void LinkReader::skip() {
+  size_t next = 1;
+  while (next < _count && _buffer[next] != LINK_SYNC) next++;
+  _count -= next;
+  memmove(_buffer, _buffer + next, _count);
+}
+
+bool LinkReader::check() {
+  while (_count > 0) {
+    if (_buffer[0] != LINK_SYNC) {
+      _skipped++;
+      skip();
+      continue;
+    }
+    if (_count < LINK_HEADER) return false;
+    size_t length = _buffer[2] | (size_t)_buffer[3] << 8;
+    if ((_buffer[1] != LINK_TEXT && _buffer[1] != LINK_BINARY) || length > LINK_PAYLOAD_MAX) {
+      _errors++;
+      skip();
+      continue;
+    }
+    if (_count < LINK_HEADER + length) return false;
+    uint16_t crc = _buffer[4] | (uint16_t)_buffer[5] << 8;
+    if (crc == linkCrc(_buffer[1], _buffer + LINK_HEADER, length)) {
+      _frameLength = LINK_HEADER + length;
+      _frames++;
+      return true;
+    }
+    // The sync byte may have been payload; look again from the next one
+    _errors++;
+    skip();
+  }
+  return false;
+}
@@ -0,0 +1,71 @@
+/*
+ * SerialLink - framing for commands and replies over a byte stream
+ *
+ * Carries the same messages as the WebSocket over a serial line (the USB
+ * CDC port): JSON text and binary messages, each in one frame. A frame
+ * holds its length and a checksum, so a receiver that starts in the middle
+ * of the stream, or sees a frame cut short, skips ahead to the next good
+ * frame.
+ *
+ * Frame (all fields little-endian):
+ *
+ *   u8 sync 0xA5, u8 kind, u16 length, u16 crc, payload[length]
+ *
+ *   kind   'T' (0x54)  JSON text, a command or a reply
+ *          'B' (0x42)  binary message, as sent over the WebSocket (the
+ *                      first byte tells which)
+ *   crc    CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) over kind,
+ *          length and payload
+ *
+ * Payloads are at most LINK_PAYLOAD_MAX bytes. Nothing here depends on the
+ * board, so host tools frame and parse with the same code.
+ *
+ * Not thread-safe: a LinkReader is fed from one task.
+ */
+
+#ifndef SIROBO_SERIAL_LINK_H
+#define SIROBO_SERIAL_LINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LINK_SYNC 0xA5
+#define LINK_HEADER 6
+#define LINK_TEXT 0x54          // 'T'
+#define LINK_BINARY 0x42        // 'B'
+#define LINK_PAYLOAD_MAX 2048   // A base64 display_bitmap upload fits
+
+uint16_t linkCrc(uint8_t kind, const uint8_t* payload, size_t len);
+// The header for a frame around payload; send the two back to back
+void linkHeader(uint8_t kind, const uint8_t* payload, size_t len, uint8_t header[LINK_HEADER]);
+
+class LinkReader {
+public:
+  LinkReader();
+
+  // Takes the next received byte; true when it completes a good frame,
+  // which stays readable until the next push()
+  bool push(uint8_t byte);
+  void reset();
+
+  uint8_t kind() const { return _buffer[1]; }
+  const uint8_t* payload() const { return _buffer + LINK_HEADER; }
+  size_t length() const { return _frameLength - LINK_HEADER; }
+
+  uint32_t frames() const { return _frames; }
+  uint32_t errors() const { return _errors; }      // Bad length or checksum
+  uint32_t skipped() const { return _skipped; }    // Bytes outside any frame
+
+private:
+  bool check();
+  void skip();
+
+  uint8_t _buffer[LINK_HEADER + LINK_PAYLOAD_MAX];
+  size_t _count;
+  size_t _frameLength;    // Of the frame last returned, 0 if none
+  uint32_t _frames;
+  uint32_t _errors;
+  uint32_t _skipped;
+};
+
+#endif
@@ -0,0 +1,276 @@
+#include "SessionRecorder.h"
+
+#include <string.h>
+
+#include <Hal.h>
+
+#define SESSION_INLINE_DT_MAX 63
+
+struct SessionHeader {
+  uint32_t magic;
+  uint32_t length;
+  uint32_t durationMs;
+  uint32_t crc;
+};
+
+static uint32_t crc32Update(uint32_t crc, const void* data, size_t len) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= bytes[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+static bool putVarint(uint8_t*& out, uint8_t* end, uint32_t value) {
+  do {
+    if (out >= end) return false;
+    uint8_t byte = value & 0x7F;
+    value >>= 7;
+    *out++ = value ? byte | 0x80 : byte;
+  } while (value);
+  return true;
+}
+
+static bool putSigned(uint8_t*& out, uint8_t* end, int32_t value) {
+  return putVarint(out, end, ((uint32_t)value << 1) ^ (uint32_t)(value >> 31));
+}
+
+static bool getVarint(const uint8_t* data, size_t len, size_t& pos, uint32_t& value) {
+  value = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    if (pos >= len) return false;
+    uint8_t byte = data[pos++];
+    value |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+static bool getSigned(const uint8_t* data, size_t len, size_t& pos, int32_t& value) {
+  uint32_t raw;
+  if (!getVarint(data, len, pos, raw)) return false;
+  value = (int32_t)(raw >> 1) ^ -(int32_t)(raw & 1);
+  return true;
+}
+
+// =====================================================
+// WRITER
+// =====================================================
+
+SessionWriter::SessionWriter()
+  : _buffer(nullptr), _capacity(0), _size(0), _events(0), _lastMs(0), _left(0), _right(0), _heading(0) {}
+
+void SessionWriter::begin(uint8_t* buffer, size_t capacity) {
+  _buffer = buffer;
+  _capacity = buffer ? capacity : 0;
+  _size = 0;
+  _events = 0;
+  _lastMs = 0;
+  _left = _right = 0;
+  _heading = 0;
+}
+
+bool SessionWriter::head(uint8_t*& out, uint8_t* end, uint32_t timeMs, SessionEventKind kind) {
+  uint32_t dt = timeMs > _lastMs ? timeMs - _lastMs : 0;
+  if (out >= end) return false;
+  if (dt < SESSION_INLINE_DT_MAX) {
+    *out++ = (uint8_t)(dt << 2) | kind;
+    return true;
+  }
+  *out++ = (SESSION_INLINE_DT_MAX << 2) | kind;
+  return putVarint(out, end, dt - SESSION_INLINE_DT_MAX);
+}
+
+bool SessionWriter::motor(uint32_t timeMs, int16_t left, int16_t right, bool bridge) {
+  uint8_t* out = _buffer + _size;
+  uint8_t* end = _buffer + _capacity;
+  if (!head(out, end, timeMs, bridge ? SESSION_BRIDGE : SESSION_MOTOR) ||
+      !putSigned(out, end, left - _left) || !putSigned(out, end, right - _right)) {
+    return false;
+  }
+  _size = out - _buffer;
+  _events++;
+  _lastMs = timeMs > _lastMs ? timeMs : _lastMs;
+  _left = left;
+  _right = right;
+  return true;
+}
+
+bool SessionWriter::heading(uint32_t timeMs, int32_t heading) {
+  uint8_t* out = _buffer + _size;
+  uint8_t* end = _buffer + _capacity;
+  if (!head(out, end, timeMs, SESSION_HEADING) || !putSigned(out, end, heading - _heading)) {
+    return false;
+  }
+  _size = out - _buffer;
+  _events++;
+  _lastMs = timeMs > _lastMs ? timeMs : _lastMs;
+  _heading = heading;
+  return true;
+}
+
+bool SessionWriter::action(uint32_t timeMs, const char* text, size_t len) {
+  if (len == 0 || len > SESSION_ACTION_MAX) return false;
+  uint8_t* out = _buffer + _size;
+  uint8_t* end = _buffer + _capacity;
+  if (!head(out, end, timeMs, SESSION_ACTION) || end - out < (ptrdiff_t)(len + 1)) return false;
+  *out++ = (uint8_t)len;
+  memcpy(out, text, len);
+  out += len;
+  _size = out - _buffer;
+  _events++;
+  _lastMs = timeMs > _lastMs ? timeMs : _lastMs;
+  return true;
+}
+
+// =====================================================
+// READER
+// =====================================================
+
+SessionReader::SessionReader()
+  : _data(nullptr), _len(0), _pos(0), _corrupt(false), _timeMs(0), _left(0), _right(0), _heading(0) {}
+
+void SessionReader::begin(const uint8_t* data, size_t len) {
+  _data = data;
+  _len = data ? len : 0;
+  _pos = 0;
+  _corrupt = false;
+  _timeMs = 0;
+  _left = _right = 0;
+  _heading = 0;
+}
+
+bool SessionReader::next(SessionEvent& event) {
+  if (_corrupt || _pos >= _len) return false;
+
+  uint8_t head = _data[_pos++];
+  uint32_t dt = head >> 2;
+  bool ok = true;
+  if (dt == SESSION_INLINE_DT_MAX) {
+    uint32_t more;
+    ok = getVarint(_data, _len, _pos, more);
+    dt += more;
+  }
+
+  event.kind = (SessionEventKind)(head & 0x03);
+  event.text = nullptr;
+  event.textLength = 0;
+  int32_t a = 0, b = 0;
+  switch (event.kind) {
+    case SESSION_MOTOR:
+    case SESSION_BRIDGE:
+      ok = ok && getSigned(_data, _len, _pos, a) && getSigned(_data, _len, _pos, b);
+      a += _left;
+      b += _right;
+      ok = ok && a >= -255 && a <= 255 && b >= -255 && b <= 255;
+      if (ok) {
+        _left = a;
+        _right = b;
+      }
+      break;
+    case SESSION_HEADING:
+      ok = ok && getSigned(_data, _len, _pos, a);
+      if (ok) _heading += a;
+      break;
+    case SESSION_ACTION:
+      ok = ok && _pos < _len && _data[_pos] > 0 && _pos + 1 + _data[_pos] <= _len;
+      if (ok) {
+        event.textLength = _data[_pos];
+        event.text = (const char*)_data + _pos + 1;
+        _pos += 1 + event.textLength;
+      }
+      break;
+  }
+  if (!ok) {
+    _corrupt = true;
+    return false;
+  }
+
+  _timeMs += dt;
+  event.timeMs = _timeMs;
+  event.left = _left;
+  event.right = _right;
+  event.heading = _heading;
+  return true;
+}
+
+// =====================================================
+// FLASH
+// =====================================================
+
+size_t sessionFlashCapacity() {
+  size_t size = hal::flashSize(hal::FLASH_SESSION);
+  return size > SESSION_HEADER_SIZE ? size - SESSION_HEADER_SIZE : 0;
+}
+
+SessionSaver::SessionSaver()
+  : _data(nullptr), _len(0), _durationMs(0), _sector(0), _busy(false), _failed(false) {}
+
+bool SessionSaver::begin(const uint8_t* data, size_t len, uint32_t durationMs) {
+  _busy = false;
+  _failed = len > sessionFlashCapacity() || hal::flashSectorSize() == 0;
+  if (_failed) return false;
+  _data = data;
+  _len = len;
+  _durationMs = durationMs;
+  _sector = 0;
+  _busy = true;
+  return true;
+}
+
+void SessionSaver::step() {
+  if (!_busy) return;
+  size_t sectorSize = hal::flashSectorSize();
+  size_t end = SESSION_HEADER_SIZE + _len;
+  size_t sectors = (end + sectorSize - 1) / sectorSize;
+
+  if (_sector < sectors) {
+    // The stream's share of this sector; the header's bytes stay erased
+    size_t from = _sector * sectorSize;
+    size_t to = from + sectorSize < end ? from + sectorSize : end;
+    if (from < SESSION_HEADER_SIZE) from = SESSION_HEADER_SIZE;
+    bool ok = hal::flashErase(_sector, hal::FLASH_SESSION);
+    if (ok && to > from) {
+      ok = hal::flashWrite(from, _data + from - SESSION_HEADER_SIZE, to - from, hal::FLASH_SESSION);
+    }
+    if (!ok) {
+      _busy = false;
+      _failed = true;
+    }
+    _sector++;
+    return;
+  }
+
+  SessionHeader header = { SESSION_MAGIC, (uint32_t)_len, _durationMs, crc32Update(0, _data, _len) };
+  _failed = !hal::flashWrite(0, &header, sizeof(header), hal::FLASH_SESSION);
+  _busy = false;
+}
+
+static bool readHeader(SessionHeader& header) {
+  return hal::flashRead(0, &header, sizeof(header), hal::FLASH_SESSION) && header.magic == SESSION_MAGIC &&
+         header.length <= sessionFlashCapacity();
+}
+
+bool sessionSavedInfo(size_t& len, uint32_t& durationMs) {
+  SessionHeader header;
+  if (!readHeader(header)) return false;
+  len = header.length;
+  durationMs = header.durationMs;
+  return true;
+}
+
+bool sessionLoad(uint8_t* buffer, size_t capacity, size_t& len, uint32_t& durationMs) {
+  SessionHeader header;
+  if (!readHeader(header) || header.length > capacity) return false;
+  if (header.length && !hal::flashRead(SESSION_HEADER_SIZE, buffer, header.length, hal::FLASH_SESSION)) {
+    return false;
+  }
+  if (crc32Update(0, buffer, header.length) != header.crc) return false;
+  len = header.length;
+  durationMs = header.durationMs;
+  return true;
+}
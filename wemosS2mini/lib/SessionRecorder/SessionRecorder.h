@@ -0,0 +1,149 @@
+/*
+ * SessionRecorder - compact recording of a live driving session
+ *
+ * While a student drives the robot live, the loop samples the motor
+ * setpoints actually applied (whoever set them: joystick, drive primitives,
+ * behaviors) and the heading, and notes LED, buzzer and display commands.
+ * Only changes are kept, as a stream of timestamped, delta-coded events in
+ * a caller supplied buffer. The stream is saved to its own flash region
+ * and replayed by the loop with the recorded timing, no client needed.
+ *
+ * Event stream, one event after the other:
+ *
+ *   u8 head           bits 0..1 kind (SessionEventKind), bits 2..7 the
+ *                     time since the previous event in ms; 63 means the
+ *                     time follows as a varint, minus 63
+ *   [varint dt - 63]
+ *   payload           MOTOR, BRIDGE  zigzag varint left - previous left,
+ *                                    zigzag varint right - previous right
+ *                     HEADING        zigzag varint heading - previous
+ *                                    heading, 0.1 deg
+ *                     ACTION         u8 length, command JSON (no NUL)
+ *
+ * Varints are little-endian base 128. Joystick driving sampled every
+ * 10 ms comes to about 3 bytes per change.
+ *
+ * A BRIDGE is a setpoint that arrived in a burst after a WiFi stall: the
+ * joystick moved on while the robot held its last setpoint, then the
+ * queued commands came in at once. Replay ramps from the previous setpoint
+ * to it over the stall instead of holding and jumping.
+ *
+ * Flash region (all fields little-endian):
+ *
+ *   SessionHeader    16 bytes, written last, so a torn save leaves no
+ *                    session rather than a broken one
+ *     0  u32 magic        "SRS1" (0x31535253)
+ *     4  u32 length       stream bytes
+ *     8  u32 durationMs   recording time, the replay ends here
+ *     12 u32 crc          CRC-32 of the stream
+ *   stream[length]
+ *
+ * Not thread-safe: record, save and replay from one task (the loop).
+ */
+
+#ifndef SIROBO_SESSION_RECORDER_H
+#define SIROBO_SESSION_RECORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SESSION_MAGIC 0x31535253UL
+#define SESSION_HEADER_SIZE 16
+#define SESSION_ACTION_MAX 95       // Longest command JSON an ACTION holds
+
+enum SessionEventKind : uint8_t {
+  SESSION_MOTOR = 0,
+  SESSION_BRIDGE,       // Setpoint to ramp to (see above)
+  SESSION_HEADING,
+  SESSION_ACTION
+};
+
+struct SessionEvent {
+  SessionEventKind kind;
+  uint32_t timeMs;      // Since the start of the recording
+  int16_t left;         // MOTOR, BRIDGE: applied setpoints, -255..255
+  int16_t right;
+  int32_t heading;      // HEADING: 0.1 deg, counter-clockwise, from the start
+  const char* text;     // ACTION: command JSON in the stream, not terminated
+  uint8_t textLength;
+};
+
+class SessionWriter {
+public:
+  SessionWriter();
+
+  void begin(uint8_t* buffer, size_t capacity);
+
+  // Each appends one event at timeMs (not before the previous one); false
+  // when the buffer is full, which leaves the stream as it was
+  bool motor(uint32_t timeMs, int16_t left, int16_t right, bool bridge);
+  bool heading(uint32_t timeMs, int32_t heading);
+  bool action(uint32_t timeMs, const char* text, size_t len);
+
+  const uint8_t* data() const { return _buffer; }
+  size_t size() const { return _size; }
+  size_t capacity() const { return _capacity; }
+  uint16_t events() const { return _events; }
+
+private:
+  bool head(uint8_t*& out, uint8_t* end, uint32_t timeMs, SessionEventKind kind);
+
+  uint8_t* _buffer;
+  size_t _capacity;
+  size_t _size;
+  uint16_t _events;
+  uint32_t _lastMs;
+  int16_t _left, _right;
+  int32_t _heading;
+};
+
+class SessionReader {
+public:
+  SessionReader();
+
+  void begin(const uint8_t* data, size_t len);
+  // The next event; false at the end of the stream or on a corrupt event
+  bool next(SessionEvent& event);
+  bool corrupt() const { return _corrupt; }
+
+private:
+  const uint8_t* _data;
+  size_t _len;
+  size_t _pos;
+  bool _corrupt;
+  uint32_t _timeMs;
+  int16_t _left, _right;
+  int32_t _heading;
+};
+
+// Saves a stream to the flash region a sector per step(), so the loop is
+// never held for a whole erase of the region
+class SessionSaver {
+public:
+  SessionSaver();
+
+  // Starts saving; data must stay unchanged until done(). False if it
+  // does not fit the region.
+  bool begin(const uint8_t* data, size_t len, uint32_t durationMs);
+  // Erases and writes the next sector, the header last
+  void step();
+  bool busy() const { return _busy; }
+  bool failed() const { return _failed; }
+
+private:
+  const uint8_t* _data;
+  size_t _len;
+  uint32_t _durationMs;
+  size_t _sector;
+  bool _busy;
+  bool _failed;
+};
+
+// Header of the saved session; false if there is none (or it is torn)
+bool sessionSavedInfo(size_t& len, uint32_t& durationMs);
+// Reads the saved session into buffer and checks its CRC
+bool sessionLoad(uint8_t* buffer, size_t capacity, size_t& len, uint32_t& durationMs);
+// Largest stream the flash region holds, 0 without one
+size_t sessionFlashCapacity();
+
+#endif
@@ -0,0 +1,176 @@
+#include "Behaviors.h"
+
+#include <string.h>
+
+static const char* const BEHAVIOR_NAMES[BEHAVIOR_COUNT] = {
+  "stop_on_line", "avoid_obstacle", "follow_wall", "line_follow", "follow_light"
+};
+
+// Default priorities, the order of the table above
+static const uint8_t BEHAVIOR_DEFAULT_PRIORITY[BEHAVIOR_COUNT] = { 50, 40, 30, 20, 10 };
+
+static int clampInt(int value, int low, int high) {
+  return value < low ? low : (value > high ? high : value);
+}
+
+static int percentToCommand(int percent) {
+  return clampInt(percent, -100, 100) * 255 / 100;
+}
+
+BehaviorId parseBehavior(const char* name) {
+  if (!name) return BEHAVIOR_NONE;
+  for (uint8_t i = 0; i < BEHAVIOR_COUNT; i++) {
+    if (strcmp(name, BEHAVIOR_NAMES[i]) == 0) return (BehaviorId)i;
+  }
+  return BEHAVIOR_NONE;
+}
+
+const char* behaviorName(BehaviorId id) {
+  return id < BEHAVIOR_COUNT ? BEHAVIOR_NAMES[id] : "none";
+}
+
+BehaviorEngine::BehaviorEngine()
+  : stopOnLine{ 1 },
+    avoidObstacle{ 20, 50, 300, 400, 1 },
+    followWall{ 15, 40, 6.0f, 1 },
+    followLight{ 40, 0.1f, 300 },
+    _owner(BEHAVIOR_NONE),
+    _avoiding(false),
+    _avoidStartMs(0),
+    _line{ true, 0, 0, 0 },
+    _lineHeld(false),
+    _lineLeft(0),
+    _lineRight(0) {
+  for (uint8_t i = 0; i < BEHAVIOR_COUNT; i++) {
+    _enabled[i] = false;
+    _priority[i] = BEHAVIOR_DEFAULT_PRIORITY[i];
+  }
+}
+
+void BehaviorEngine::setEnabled(BehaviorId id, bool enabled) {
+  if (id >= BEHAVIOR_COUNT) return;
+  _enabled[id] = enabled;
+  if (!enabled && id == BEHAVIOR_AVOID_OBSTACLE) _avoiding = false;
+  if (!enabled && id == BEHAVIOR_LINE_FOLLOW) _lineHeld = false;
+}
+
+bool BehaviorEngine::anyEnabled() const {
+  for (uint8_t i = 0; i < BEHAVIOR_COUNT; i++) {
+    if (_enabled[i]) return true;
+  }
+  return false;
+}
+
+void BehaviorEngine::setPriority(BehaviorId id, uint8_t priority) {
+  if (id < BEHAVIOR_COUNT) _priority[id] = priority;
+}
+
+BehaviorId BehaviorEngine::step(const BehaviorInput& input, const LineFollowerParams& line,
+                                int& left, int& right) {
+  // Enabled behaviors, highest priority first (insertion sort of five)
+  uint8_t order[BEHAVIOR_COUNT];
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < BEHAVIOR_COUNT; i++) {
+    if (!_enabled[i]) continue;
+    uint8_t at = count++;
+    while (at > 0 && _priority[order[at - 1]] < _priority[i]) {
+      order[at] = order[at - 1];
+      at--;
+    }
+    order[at] = i;
+  }
+
+  _owner = BEHAVIOR_NONE;
+  for (uint8_t i = 0; i < count; i++) {
+    BehaviorId id = (BehaviorId)order[i];
+    if (run(id, input, line, left, right)) {
+      _owner = id;
+      break;
+    }
+  }
+  return _owner;
+}
+
+bool BehaviorEngine::run(BehaviorId id, const BehaviorInput& input, const LineFollowerParams& line,
+                         int& left, int& right) {
+  switch (id) {
+    case BEHAVIOR_STOP_ON_LINE: {
+      uint8_t seen = 0;
+      for (int i = 0; i < LINE_SENSOR_COUNT; i++) {
+        if (input.lineSensors[i] > input.lineThreshold) seen++;
+      }
+      if (seen < stopOnLine.minSensors || seen == 0) return false;
+      left = right = 0;
+      return true;
+    }
+
+    case BEHAVIOR_AVOID_OBSTACLE: {
+      const AvoidObstacleParams& p = avoidObstacle;
+      bool blocked = input.distanceCm > 0 && input.distanceCm < p.distanceCm;
+      if (!_avoiding) {
+        if (!blocked) return false;
+        _avoiding = true;
+        _avoidStartMs = input.nowMs;
+      }
+
+      uint32_t elapsed = input.nowMs - _avoidStartMs;
+      int speed = percentToCommand(p.speed);
+      if (elapsed < p.backMs) {
+        left = right = -speed;
+      } else if (elapsed < (uint32_t)p.backMs + p.turnMs) {
+        left = p.turn >= 0 ? speed : -speed;
+        right = -left;
+      } else if (blocked) {
+        // Still in the way: start over
+        _avoidStartMs = input.nowMs;
+        left = right = -speed;
+      } else {
+        _avoiding = false;
+        return false;
+      }
+      return true;
+    }
+
+    case BEHAVIOR_FOLLOW_WALL: {
+      const FollowWallParams& p = followWall;
+      // Nothing within three times the distance: no wall to follow
+      if (input.distanceCm <= 0 || input.distanceCm >= p.distanceCm * 3 ||
+          input.distanceCm >= BEHAVIOR_NO_ECHO_CM) {
+        return false;
+      }
+      // Too far steers towards the wall, too close away from it
+      int turn = (int)(p.side * p.gain * (input.distanceCm - p.distanceCm));
+      int speed = percentToCommand(p.speed);
+      turn = clampInt(turn, -speed, speed);
+      left = clampInt(speed + turn, -255, 255);
+      right = clampInt(speed - turn, -255, 255);
+      return true;
+    }
+
+    case BEHAVIOR_LINE_FOLLOW: {
+      _line = lineFollowerStep(input.lineSensors, line);
+      if (!_line.lineLost) {
+        _lineHeld = true;
+        _lineLeft = _line.left;
+        _lineRight = _line.right;
+      }
+      if (!_lineHeld) return false;
+      left = _lineLeft;
+      right = _lineRight;
+      return true;
+    }
+
+    case BEHAVIOR_FOLLOW_LIGHT: {
+      const FollowLightParams& p = followLight;
+      if (input.ldrLeft < p.minLight && input.ldrRight < p.minLight) return false;
+      int speed = percentToCommand(p.speed);
+      int turn = clampInt((int)(p.gain * (input.ldrRight - input.ldrLeft)), -speed, speed);
+      left = clampInt(speed + turn, -255, 255);
+      right = clampInt(speed - turn, -255, 255);
+      return true;
+    }
+
+    default:
+      return false;
+  }
+}
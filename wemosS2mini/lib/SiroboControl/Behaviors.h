@@ -0,0 +1,124 @@
+/*
+ * Reactive behaviors with priority arbitration
+ *
+ * Each behavior looks at one frame of sensor readings and either leaves
+ * the motors alone or asks for a pair of motor commands. Every control
+ * tick the engine asks the enabled behaviors from the highest priority
+ * down, and the first one that wants the motors gets them (subsumption:
+ * avoiding an obstacle overrides following a line, which overrides
+ * following the light). Like LineFollower, the engine is free of Arduino
+ * globals, so the replay and benchmark tools can run it too.
+ *
+ *   stop_on_line    stops while the line sensors see a line (table edge,
+ *                   boundary tape)
+ *   avoid_obstacle  something closer than distanceCm: backs off for backMs,
+ *                   then turns for turnMs
+ *   follow_wall     keeps distanceCm from a wall on `side`, with the
+ *                   ultrasonic sensor turned to face it
+ *   line_follow     lineFollowerStep(); keeps its last command over gaps
+ *   follow_light    steers towards the brighter LDR once either one reads
+ *                   at least minLight
+ *
+ * Speeds are percent (0-100), motor commands -255..255.
+ */
+
+#ifndef SIROBO_BEHAVIORS_H
+#define SIROBO_BEHAVIORS_H
+
+#include <stdint.h>
+
+#include "LineFollower.h"
+
+#define BEHAVIOR_NO_ECHO_CM 400   // Distance reading when nothing echoed
+
+enum BehaviorId : uint8_t {
+  BEHAVIOR_STOP_ON_LINE = 0,
+  BEHAVIOR_AVOID_OBSTACLE,
+  BEHAVIOR_FOLLOW_WALL,
+  BEHAVIOR_LINE_FOLLOW,
+  BEHAVIOR_FOLLOW_LIGHT,
+  BEHAVIOR_COUNT,
+  BEHAVIOR_NONE = 0xFF
+};
+
+struct BehaviorInput {
+  const int* lineSensors;   // LINE_SENSOR_COUNT raw values
+  int lineThreshold;
+  int ldrLeft;
+  int ldrRight;
+  int distanceCm;
+  uint32_t nowMs;
+};
+
+struct StopOnLineParams {
+  uint8_t minSensors;      // Sensors that must see the line
+};
+
+struct AvoidObstacleParams {
+  int distanceCm;
+  int speed;
+  uint16_t backMs;
+  uint16_t turnMs;
+  int8_t turn;             // 1 = turn right, -1 = left
+};
+
+struct FollowWallParams {
+  int distanceCm;
+  int speed;
+  float gain;              // Motor command per cm of error
+  int8_t side;             // 1 = wall on the right, -1 = left
+};
+
+struct FollowLightParams {
+  int speed;
+  float gain;              // Motor command per ADC count of difference
+  int minLight;
+};
+
+// "stop_on_line", ... -> BehaviorId (BEHAVIOR_NONE if unknown)
+BehaviorId parseBehavior(const char* name);
+const char* behaviorName(BehaviorId id);   // "none" for BEHAVIOR_NONE
+
+class BehaviorEngine {
+public:
+  BehaviorEngine();
+
+  // Parameters, set directly; line_follow takes its from step()
+  StopOnLineParams stopOnLine;
+  AvoidObstacleParams avoidObstacle;
+  FollowWallParams followWall;
+  FollowLightParams followLight;
+
+  void setEnabled(BehaviorId id, bool enabled);
+  bool enabled(BehaviorId id) const { return id < BEHAVIOR_COUNT && _enabled[id]; }
+  bool anyEnabled() const;
+  // Higher wins; ties go to the lower id
+  void setPriority(BehaviorId id, uint8_t priority);
+  uint8_t priority(BehaviorId id) const { return id < BEHAVIOR_COUNT ? _priority[id] : 0; }
+
+  // One control tick. Returns the behavior that owns the motors (left and
+  // right are set), or BEHAVIOR_NONE.
+  BehaviorId step(const BehaviorInput& input, const LineFollowerParams& line, int& left, int& right);
+  BehaviorId owner() const { return _owner; }
+  // line_follow's last lineFollowerStep() (from the last tick it was asked)
+  const LineFollowerOutput& lineOutput() const { return _line; }
+
+private:
+  bool run(BehaviorId id, const BehaviorInput& input, const LineFollowerParams& line, int& left, int& right);
+
+  bool _enabled[BEHAVIOR_COUNT];
+  uint8_t _priority[BEHAVIOR_COUNT];
+  BehaviorId _owner;
+
+  // avoid_obstacle maneuver in progress
+  bool _avoiding;
+  uint32_t _avoidStartMs;
+
+  // line_follow's last command, held while the line is lost
+  LineFollowerOutput _line;
+  bool _lineHeld;
+  int _lineLeft;
+  int _lineRight;
+};
+
+#endif
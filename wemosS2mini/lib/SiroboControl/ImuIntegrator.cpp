@@ -0,0 +1,17 @@
+#include "ImuIntegrator.h"
+
+#include <math.h>
+
+Attitude ImuIntegrator::update(const ImuReading& r, float dt) {
+  Attitude att;
+
+  att.yawRate = r.gz * (180.0 / M_PI);
+  _gyroYaw += att.yawRate * dt;
+  att.yaw = _gyroYaw;
+
+  // Pitch and roll from accelerometer
+  att.pitch = atan2(r.ax, sqrt(r.ay * r.ay + r.az * r.az)) * 180.0 / M_PI;
+  att.roll = atan2(r.ay, r.az) * 180.0 / M_PI;
+
+  return att;
+}
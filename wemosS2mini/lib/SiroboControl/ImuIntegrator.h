@@ -0,0 +1,31 @@
+/*
+ * IMU integration - yaw from the gyro, pitch/roll from the accelerometer
+ */
+
+#ifndef SIROBO_IMU_INTEGRATOR_H
+#define SIROBO_IMU_INTEGRATOR_H
+
+struct ImuReading {
+  float ax, ay, az;  // m/s^2
+  float gx, gy, gz;  // rad/s
+};
+
+struct Attitude {
+  float yaw;      // deg, integrated since reset()
+  float pitch;    // deg
+  float roll;     // deg
+  float yawRate;  // deg/s
+};
+
+class ImuIntegrator {
+public:
+  ImuIntegrator() : _gyroYaw(0) {}
+
+  void reset(float yaw = 0) { _gyroYaw = yaw; }
+  Attitude update(const ImuReading& reading, float dt);
+
+private:
+  float _gyroYaw;
+};
+
+#endif
@@ -0,0 +1,426 @@
+#include "LapLearner.h"
+
+#include <math.h>
+#include <string.h>
+
+#define LAP_MAX_LENGTH_MM 60000       // Learning gives up beyond this
+#define LAP_SEGMENT_TOLERANCE 25.0f   // deg/m a bin may differ from its segment
+#define LAP_MIN_SEGMENT_BINS 3        // Shorter segments merge into the previous
+#define LAP_SMOOTH_MM 240             // Curvature is averaged over this much line,
+                                      // longer than the follower's weave
+#define LAP_SYNC_WINDOW_MM 120        // Bend entry is looked for over this distance
+#define LAP_SYNC_RANGE_MM 250         // ... and snapped to a map entry this close
+#define LAP_SYNC_MIN_TURN 60.0f       // deg/m that counts as a bend for syncing
+
+static const char* const LAP_STATE_NAMES[] = {
+  "idle", "wait_learn", "learning", "wait_race", "racing"
+};
+
+const char* lapStateName(LapState state) {
+  return state <= LAP_RACING ? LAP_STATE_NAMES[state] : "idle";
+}
+
+static int16_t clampInt16(float value) {
+  return value > 32767 ? 32767 : (value < -32768 ? -32768 : (int16_t)lroundf(value));
+}
+
+// Direction of the line under the array, deg: the robot's heading plus the
+// angle to where the array sees the line. Cancels most of the follower's
+// weave, which the heading alone would record as bends.
+static float lineHeading(const LapInput& input) {
+  if (input.lineLost) return input.yaw;
+  float offset = input.lineError / 1000.0f * LAP_SENSOR_PITCH_MM;
+  return input.yaw + atan2f(offset, LAP_SENSOR_OFFSET_MM) * (180.0f / (float)M_PI);
+}
+
+// deg/m of a segment
+static float segmentTurnPerM(const LapSegment& segment) {
+  return segment.lengthMm ? segment.turn * 0.1f * 1000.0f / segment.lengthMm : 0;
+}
+
+LapLearner::LapLearner()
+  : params{ 90, 1.2f, 1500, 150, 630, 60 },
+    _state(LAP_IDLE),
+    _events(0),
+    _lastMs(0),
+    _speedMmS(0),
+    _position(0),
+    _lapTravel(0),
+    _scale(1),
+    _command(0),
+    _onMarker(false),
+    _offMarkerMm(LAP_MARKER_REARM_MM),
+    _binCount(0),
+    _binMm(LAP_BIN_MM),
+    _binStart(0),
+    _binYaw(0),
+    _yaw(0),
+    _learnSpeed(0),
+    _syncTurnPerM(LAP_SYNC_MIN_TURN),
+    _windowStart(0),
+    _windowYaw(0),
+    _windowTurn(0),
+    _lastSync(0),
+    _lapStartMs(0),
+    _lastLapMs(0),
+    _bestLapMs(0),
+    _laps(0),
+    _syncs(0) {
+  memset(&_map, 0, sizeof(_map));
+}
+
+void LapLearner::setParams(const LapParams& p) {
+  params = p;
+  if (hasMap()) prepare();
+}
+
+void LapLearner::learn() {
+  _state = LAP_WAIT_LEARN;
+  _onMarker = false;
+  _offMarkerMm = LAP_MARKER_REARM_MM;
+  _lastMs = 0;
+}
+
+bool LapLearner::race() {
+  if (!hasMap()) return false;
+  prepare();
+  _state = LAP_WAIT_RACE;
+  _onMarker = false;
+  _offMarkerMm = LAP_MARKER_REARM_MM;
+  _lastMs = 0;
+  return true;
+}
+
+void LapLearner::stop() {
+  _state = LAP_IDLE;
+  _speedMmS = 0;
+}
+
+uint8_t LapLearner::takeEvents() {
+  uint8_t events = _events;
+  _events = 0;
+  return events;
+}
+
+bool LapLearner::setMap(const LapMap& map) {
+  memset(&_map, 0, sizeof(_map));
+  if (map.count == 0 || map.count > LAP_MAX_SEGMENTS) return false;
+  if (map.learnSpeed == 0 || map.learnSpeed > 100) return false;
+
+  uint32_t length = 0;
+  for (uint8_t i = 0; i < map.count; i++) {
+    if (map.segments[i].lengthMm == 0) return false;
+    length += map.segments[i].lengthMm;
+  }
+  if (length != map.lengthMm || length < LAP_MIN_LENGTH_MM) return false;
+
+  _map = map;
+  prepare();
+  return true;
+}
+
+uint8_t LapLearner::segmentAt(float position) const {
+  uint8_t i = 0;
+  while (i + 1 < _map.count && position >= _segmentStart[i + 1]) i++;
+  return i;
+}
+
+void LapLearner::startLap(uint32_t nowMs) {
+  _lapStartMs = nowMs;
+  _position = 0;
+  _lapTravel = 0;
+  _windowStart = 0;
+  _windowYaw = _yaw;
+  _windowTurn = 0;
+  _lastSync = 0;
+  _syncs = 0;
+}
+
+bool LapLearner::marker(const LapInput& input, float travelled) {
+  uint8_t seen = 0;
+  for (int i = 0; i < LINE_SENSOR_COUNT; i++) {
+    if (input.lineSensors[i] > input.lineThreshold) seen++;
+  }
+
+  if (seen >= LAP_MARKER_SENSORS) {
+    bool rising = !_onMarker && _offMarkerMm >= LAP_MARKER_REARM_MM;
+    _onMarker = true;
+    _offMarkerMm = 0;
+    return rising;
+  }
+  _onMarker = false;
+  _offMarkerMm += travelled;
+  return false;
+}
+
+int LapLearner::step(const LapInput& input, int speed) {
+  if (_state == LAP_IDLE) return speed;
+
+  // Distance from the speed commanded on the last tick, lagged like the motors
+  float dt = _lastMs ? (input.nowMs - _lastMs) / 1000.0f : 0;
+  _lastMs = input.nowMs;
+  float commanded = _command * params.fullSpeed / 100.0f;
+  float lag = params.lagMs / 1000.0f;
+  _speedMmS += (commanded - _speedMmS) * (lag + dt > 0 ? dt / (lag + dt) : 1);
+  float travelled = _speedMmS * dt * _scale;
+  _position += travelled;
+  _lapTravel += travelled;
+  _yaw = lineHeading(input);
+
+  bool crossed = marker(input, travelled);
+  switch (_state) {
+    case LAP_WAIT_LEARN:
+      _command = speed;
+      if (crossed) {
+        _events |= LAP_EVENT_MARKER;
+        _learnSpeed = speed < 1 ? 1 : (speed > 100 ? 100 : speed);
+        _scale = 1;
+        _binCount = 0;
+        _binMm = LAP_BIN_MM;
+        _binStart = 0;
+        _binYaw = _yaw;
+        startLap(input.nowMs);
+        _state = LAP_LEARNING;
+      }
+      break;
+
+    case LAP_LEARNING:
+      _command = speed;
+      if (crossed && _position >= LAP_MIN_LENGTH_MM) {
+        _events |= LAP_EVENT_MARKER;
+        if (buildMap()) {
+          _events |= LAP_EVENT_LEARNED;
+          _laps = 0;
+          _lastLapMs = input.nowMs - _lapStartMs;
+          _bestLapMs = 0;
+          prepare();
+          startLap(input.nowMs);
+          _state = LAP_RACING;
+        } else {
+          _events |= LAP_EVENT_FAILED;
+          _state = LAP_IDLE;
+        }
+      } else if (_position > LAP_MAX_LENGTH_MM) {
+        _events |= LAP_EVENT_FAILED;
+        _state = LAP_IDLE;
+      } else {
+        record(_yaw);
+      }
+      break;
+
+    case LAP_WAIT_RACE:
+      _command = speed;
+      if (crossed) {
+        _events |= LAP_EVENT_MARKER;
+        startLap(input.nowMs);
+        _state = LAP_RACING;
+      }
+      break;
+
+    case LAP_RACING: {
+      float length = _map.lengthMm;
+      if (crossed && _position >= length / 2) {
+        _events |= LAP_EVENT_MARKER | LAP_EVENT_LAP;
+        _laps++;
+        _lastLapMs = input.nowMs - _lapStartMs;
+        if (_bestLapMs == 0 || _lastLapMs < _bestLapMs) _bestLapMs = _lastLapMs;
+        // Halfway towards the scale that would have measured the lap right
+        if (_lapTravel > 0) {
+          float corrected = _scale * length / _lapTravel;
+          _scale = fminf(2.0f, fmaxf(0.5f, (_scale + corrected) / 2));
+        }
+        startLap(input.nowMs);
+      } else if (_position > length * 1.5f) {
+        // Missed the marker; carry on into the next lap
+        _position -= length;
+        _windowStart -= length;
+        _lastSync -= length;
+      }
+
+      if (_position - _windowStart >= LAP_SYNC_WINDOW_MM) {
+        float turn = (_yaw - _windowYaw) * 1000.0f / (_position - _windowStart);
+        if (fabsf(turn) >= _syncTurnPerM && fabsf(_windowTurn) < _syncTurnPerM / 2) {
+          syncPosition(turn);
+        }
+        _windowTurn = turn;
+        _windowStart = _position;
+        _windowYaw = _yaw;
+      }
+
+      float target = targetSpeed(_speedMmS) * 100.0f / params.fullSpeed;
+      if (!input.lineLost && fabsf(input.lineError) > LAP_ERROR_LIMIT && target > _map.learnSpeed) {
+        target = _map.learnSpeed;
+      }
+      _command = (int)lroundf(target);
+      break;
+    }
+
+    default:
+      break;
+  }
+  return _command;
+}
+
+// Heading change per bin while learning; halves the resolution when full
+void LapLearner::record(float yaw) {
+  while (_position - _binStart >= _binMm) {
+    if (_binCount == LAP_MAX_BINS) {
+      for (uint16_t i = 0; i < LAP_MAX_BINS / 2; i++) {
+        _bins[i] = clampInt16((float)_bins[2 * i] + _bins[2 * i + 1]);
+      }
+      _binCount = LAP_MAX_BINS / 2;
+      _binMm *= 2;
+    }
+    // The yaw change since the last bin, spread over the bins passed
+    float bins = (_position - _binStart) / _binMm;
+    float turn = (yaw - _binYaw) / bins;
+    _bins[_binCount++] = clampInt16(turn * 100);
+    _binStart += _binMm;
+    _binYaw += turn;
+  }
+}
+
+bool LapLearner::buildMap() {
+  if (_binCount < LAP_MIN_SEGMENT_BINS) return false;
+
+  // Curvature per bin (deg/m) averaged over LAP_SMOOTH_MM around it, to
+  // group by; segment turns add up the raw bins so the total heading
+  // change is kept
+  static float curvature[LAP_MAX_BINS];
+  int reach = (int)(LAP_SMOOTH_MM / 2 / _binMm);
+  if (reach * 2 + 1 > _binCount) reach = (_binCount - 1) / 2;
+  float toPerM = 1000.0f / (_binMm * 100.0f * (2 * reach + 1));
+  long sum = 0;
+  for (int k = -reach; k <= reach; k++) sum += _bins[(k + _binCount) % _binCount];
+  for (uint16_t i = 0; i < _binCount; i++) {
+    curvature[i] = sum * toPerM;
+    sum += _bins[(i + reach + 1) % _binCount] - _bins[(i + _binCount - reach) % _binCount];
+  }
+
+  float tolerance = LAP_SEGMENT_TOLERANCE;
+  for (int attempt = 0; attempt < 8; attempt++, tolerance *= 1.5f) {
+    LapMap map;
+    memset(&map, 0, sizeof(map));
+    float turnSum[LAP_MAX_SEGMENTS];
+    float curveSum[LAP_MAX_SEGMENTS];
+    uint16_t binsIn[LAP_MAX_SEGMENTS];
+    bool fits = true;
+
+    for (uint16_t i = 0; i < _binCount && fits; i++) {
+      int s = map.count - 1;
+      bool join = false;
+      if (s >= 0) {
+        float mean = curveSum[s] / binsIn[s];
+        float allowed = fmaxf(tolerance, fabsf(mean) / 4);
+        join = fabsf(curvature[i] - mean) <= allowed || binsIn[s] < LAP_MIN_SEGMENT_BINS;
+      }
+      if (!join) {
+        if (map.count == LAP_MAX_SEGMENTS) {
+          fits = false;
+          break;
+        }
+        s = map.count++;
+        turnSum[s] = curveSum[s] = 0;
+        binsIn[s] = 0;
+      }
+      turnSum[s] += _bins[i] / 100.0f;
+      curveSum[s] += curvature[i];
+      binsIn[s]++;
+    }
+    if (!fits) continue;
+
+    // The partial bin before the marker goes to the last segment
+    float rest = _position - _binStart;
+    if (rest < 0) rest = 0;
+    uint32_t total = 0;
+    for (uint8_t s = 0; s < map.count; s++) {
+      float length = binsIn[s] * _binMm + (s + 1 == map.count ? rest : 0);
+      float turn = turnSum[s] + (s + 1 == map.count ? _yaw - _binYaw : 0);
+      map.segments[s].lengthMm = (uint16_t)lroundf(length);
+      map.segments[s].turn = clampInt16(turn * 10);
+      total += map.segments[s].lengthMm;
+    }
+    map.lengthMm = (uint16_t)total;
+    map.learnSpeed = _learnSpeed;
+    return setMap(map);
+  }
+  return false;
+}
+
+// Segment starts and speeds for the current map and parameters
+void LapLearner::prepare() {
+  float tightest = 0;
+  float start = 0;
+  for (uint8_t i = 0; i < _map.count; i++) {
+    _segmentStart[i] = start;
+    start += _map.segments[i].lengthMm;
+    tightest = fmaxf(tightest, fabsf(segmentTurnPerM(_map.segments[i])));
+  }
+
+  // v^2 * curvature is the lateral acceleration; the tightest bend gets
+  // `grip` times what it had on the learning lap
+  float learn = _map.learnSpeed * params.fullSpeed / 100.0f;
+  float budget = params.grip * learn * learn * tightest;
+  float fastest = params.maxSpeed * params.fullSpeed / 100.0f;
+  for (uint8_t i = 0; i < _map.count; i++) {
+    float turn = fabsf(segmentTurnPerM(_map.segments[i]));
+    float speed = turn > 0 ? sqrtf(budget / turn) : fastest;
+    _segmentSpeed[i] = fminf(fastest, speed);
+  }
+  _syncTurnPerM = fmaxf(LAP_SYNC_MIN_TURN, tightest / 3);
+}
+
+// A bend was entered: snap to the nearest bend entry of the same sense
+void LapLearner::syncPosition(float turnPerM) {
+  if (_position - _lastSync < LAP_SYNC_RANGE_MM) return;
+
+  float length = _map.lengthMm;
+  float best = LAP_SYNC_RANGE_MM;
+  float snapped = -1;
+  for (uint8_t i = 0; i < _map.count; i++) {
+    float turn = segmentTurnPerM(_map.segments[i]);
+    float before = segmentTurnPerM(_map.segments[i ? i - 1 : _map.count - 1]);
+    bool entry = fabsf(turn) >= _syncTurnPerM && (turn > 0) == (turnPerM > 0) &&
+                 (fabsf(before) < _syncTurnPerM / 2 || (before > 0) != (turn > 0));
+    if (!entry) continue;
+
+    // The window saw the bend somewhere in it; take its middle
+    float expected = _segmentStart[i] + LAP_SYNC_WINDOW_MM / 2;
+    float offset = _position - expected;
+    if (offset > length / 2) offset -= length;
+    if (offset < -length / 2) offset += length;
+    if (fabsf(offset) < best) {
+      best = fabsf(offset);
+      snapped = _position - offset;
+    }
+  }
+  if (snapped < 0) return;
+
+  _windowStart += snapped - _position;
+  _position = snapped;
+  _lastSync = snapped;
+  _syncs++;
+}
+
+// Fastest speed (mm/s) from which every segment ahead can still be entered
+// at its own speed
+float LapLearner::targetSpeed(float speedMmS) const {
+  float length = _map.lengthMm;
+  float position = fmodf(_position, length);
+  if (position < 0) position += length;
+  float lookahead = speedMmS * params.lookaheadMs / 1000.0f;
+  float fastest = params.maxSpeed * params.fullSpeed / 100.0f;
+  float horizon = fastest * fastest / (2.0f * params.brake) + lookahead;
+
+  uint8_t current = segmentAt(position);
+  float bestSq = _segmentSpeed[current] * _segmentSpeed[current];
+  float distance = _segmentStart[current] + _map.segments[current].lengthMm - position;
+  for (uint8_t n = 1; n < _map.count && distance < horizon; n++) {
+    uint8_t i = (current + n) % _map.count;
+    float braking = distance > lookahead ? distance - lookahead : 0;
+    float reachSq = _segmentSpeed[i] * _segmentSpeed[i] + 2.0f * params.brake * braking;
+    if (reachSq < bestSq) bestSq = reachSq;
+    distance += _map.segments[i].lengthMm;
+  }
+  return sqrtf(bestSq);
+}
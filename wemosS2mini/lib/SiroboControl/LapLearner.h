@@ -0,0 +1,177 @@
+/*
+ * Lap learning - a segment map of a closed course and a lookahead speed
+ * profile for the laps after it
+ *
+ * The course has a start marker: a bar across the line, at least as wide
+ * as the sensor array, so that (nearly) every sensor sees it at once.
+ *
+ *   1. learn(): the robot follows the line at its normal speed until it
+ *      crosses the marker, then records one lap: the heading change of the
+ *      line (integrated gyro yaw, corrected by where the array sees the
+ *      line) over every LAP_BIN_MM of distance.
+ *   2. At the next marker the bins are merged into at most
+ *      LAP_MAX_SEGMENTS segments of similar curvature (a LapMap, small
+ *      enough for one store record), and racing starts.
+ *   3. Racing: each segment gets a speed from a lateral acceleration
+ *      budget, the learning speed in the tightest bend times sqrt(grip)
+ *      and up to maxSpeed on the straights. Looking ahead along the map,
+ *      the robot brakes at `brake` mm/s^2 so it enters every bend at that
+ *      bend's speed.
+ *
+ * There are no wheel encoders: distance is the commanded speed
+ * (fullSpeed mm/s at 100 %, through a first-order lag like the motors')
+ * integrated over time. To keep it from drifting, the position snaps to
+ * the map where a bend is entered, and every marker restarts the lap and
+ * rescales the estimate by how far off the last lap's length was. A line
+ * error beyond LAP_ERROR_LIMIT drops back to the learning speed at once.
+ *
+ * Free of Arduino globals like LineFollower; speeds are percent as in
+ * LineFollowerParams.
+ */
+
+#ifndef SIROBO_LAP_LEARNER_H
+#define SIROBO_LAP_LEARNER_H
+
+#include <stdint.h>
+
+#include "LineFollower.h"
+
+#define LAP_MAX_SEGMENTS 32
+#define LAP_BIN_MM 20                // Learning resolution (doubles on long laps)
+#define LAP_MAX_BINS 256
+#define LAP_MARKER_SENSORS 7         // Sensors on the line that make a marker
+#define LAP_MARKER_REARM_MM 150      // Off the marker this long before the next
+#define LAP_MIN_LENGTH_MM 500        // Shortest lap; earlier markers are ignored
+#define LAP_ERROR_LIMIT 2500         // Line error (of 3500) that drops to learning speed
+#define LAP_SENSOR_PITCH_MM 9.5f     // Between line sensors
+#define LAP_SENSOR_OFFSET_MM 60.0f   // From the axle to the sensor array
+
+// Events reported by LapLearner::takeEvents()
+#define LAP_EVENT_MARKER 0x01        // Crossed the start marker
+#define LAP_EVENT_LEARNED 0x02       // Map built; racing from here
+#define LAP_EVENT_LAP 0x04           // Racing lap completed
+#define LAP_EVENT_FAILED 0x08        // Learning lap too short or too long
+
+enum LapState : uint8_t {
+  LAP_IDLE = 0,
+  LAP_WAIT_LEARN,    // Following at the given speed until the marker
+  LAP_LEARNING,
+  LAP_WAIT_RACE,     // Map loaded; following until the marker
+  LAP_RACING
+};
+
+struct LapSegment {
+  uint16_t lengthMm;
+  int16_t turn;      // Heading change over the segment, 0.1 deg (gyro sign)
+};
+
+// First half of the LapRecord store record (STORE_KEY_LAP), ahead of the
+// LapParams: its layout is fixed
+struct LapMap {
+  uint16_t lengthMm;
+  uint8_t count;
+  uint8_t learnSpeed;   // Percent the lap was learned at
+  LapSegment segments[LAP_MAX_SEGMENTS];
+};
+
+// Second half of the LapRecord (STORE_KEY_LAP); append fields only
+struct LapParams {
+  uint8_t maxSpeed;     // Percent, on straights
+  float grip;           // Lateral acceleration relative to the learning lap
+  uint16_t brake;       // mm/s^2
+  uint16_t lookaheadMs; // Reaction time allowed for before braking
+  uint16_t fullSpeed;   // mm/s at 100 % (motor deadband set, see motor_config)
+  uint16_t lagMs;       // Motor time constant, for the distance estimate
+};
+
+struct LapInput {
+  uint32_t nowMs;
+  float yaw;                 // Integrated gyro yaw, deg
+  const int* lineSensors;    // LINE_SENSOR_COUNT raw values
+  int lineThreshold;
+  bool lineLost;
+  float lineError;
+};
+
+const char* lapStateName(LapState state);
+
+class LapLearner {
+public:
+  LapLearner();
+
+  LapParams params;   // Call setParams() to apply changes while racing
+
+  void setParams(const LapParams& p);
+  void learn();
+  bool race();        // With the current map; false without one
+  void stop();
+
+  // One control tick; returns the speed for the line follower. `speed` is
+  // the normal one, used until the map is learned.
+  int step(const LapInput& input, int speed);
+  uint8_t takeEvents();
+
+  LapState state() const { return _state; }
+  bool hasMap() const { return _map.count > 0; }
+  const LapMap& map() const { return _map; }
+  bool setMap(const LapMap& map);   // False (and no map) if it does not check out
+
+  uint16_t laps() const { return _laps; }
+  uint32_t lastLapMs() const { return _lastLapMs; }
+  uint32_t bestLapMs() const { return _bestLapMs; }
+  float position() const { return _position; }   // mm since the marker
+  float scale() const { return _scale; }
+  uint16_t syncs() const { return _syncs; }       // Position snaps this lap
+  uint8_t segmentAt(float position) const;
+
+private:
+  void startLap(uint32_t nowMs);
+  bool marker(const LapInput& input, float travelled);
+  void record(float yaw);
+  bool buildMap();
+  void prepare();
+  void syncPosition(float turnPerM);
+  float targetSpeed(float speedMmS) const;
+
+  LapState _state;
+  LapMap _map;
+  uint8_t _events;
+
+  // Distance estimate
+  uint32_t _lastMs;
+  float _speedMmS;      // Lagged commanded speed
+  float _position;
+  float _lapTravel;     // Estimated this lap, without snaps
+  float _scale;
+  int _command;         // Speed returned by the last step
+
+  // Marker detection
+  bool _onMarker;
+  float _offMarkerMm;
+
+  // Learning bins: heading change in 0.01 deg per bin
+  int16_t _bins[LAP_MAX_BINS];
+  uint16_t _binCount;
+  float _binMm;
+  float _binStart;
+  float _binYaw;
+  float _yaw;
+  uint8_t _learnSpeed;
+
+  // Racing: prepared per segment
+  float _segmentStart[LAP_MAX_SEGMENTS];
+  float _segmentSpeed[LAP_MAX_SEGMENTS];   // mm/s
+  float _syncTurnPerM;                     // Bend entry threshold, deg/m
+  float _windowStart;
+  float _windowYaw;
+  float _windowTurn;                       // Last window's, deg/m
+  float _lastSync;
+
+  uint32_t _lapStartMs;
+  uint32_t _lastLapMs;
+  uint32_t _bestLapMs;
+  uint16_t _laps;
+  uint16_t _syncs;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#include "LineFollower.h"
+
+#include <string.h>
+
+static int clampInt(int value, int low, int high) {
+  return value < low ? low : (value > high ? high : value);
+}
+
+LineFollowerOutput lineFollowerStep(const int sensors[LINE_SENSOR_COUNT],
+                                    const LineFollowerParams& params) {
+  LineFollowerOutput out = { true, 0, 0, 0 };
+
+  // Calculate line position (weighted average)
+  long weightedSum = 0;
+  long totalValue = 0;
+  int seen = 0;
+
+  for (int i = 0; i < LINE_SENSOR_COUNT; i++) {
+    int value = sensors[i] > params.threshold ? 1000 : 0;
+    weightedSum += (long)value * (i * 1000);
+    totalValue += value;
+    if (value) seen++;
+  }
+
+  if (totalValue == 0) {
+    // No line detected - could be at intersection or lost
+    return out;
+  }
+
+  bool wide = params.straightOnWide && seen > LINE_MAX_WIDTH_SENSORS;
+  float position = wide ? LINE_POSITION_CENTER : (float)weightedSum / totalValue;
+  out.lineLost = false;
+  out.error = position - LINE_POSITION_CENTER;
+
+  // P control
+  int correction = out.error * params.kp;
+
+  int baseSpd = params.speed * 200 / 100;
+  out.left = clampInt(baseSpd + correction, -255, 255);
+  out.right = clampInt(baseSpd - correction, -255, 255);
+
+  return out;
+}
+
+IntersectionType parseIntersectionType(const char* name) {
+  if (!name) return INTERSECTION_NONE;
+  if (strcmp(name, "left") == 0) return INTERSECTION_LEFT;
+  if (strcmp(name, "right") == 0) return INTERSECTION_RIGHT;
+  if (strcmp(name, "t") == 0) return INTERSECTION_T;
+  if (strcmp(name, "cross") == 0) return INTERSECTION_CROSS;
+  return INTERSECTION_NONE;
+}
+
+const char* intersectionName(IntersectionType type) {
+  switch (type) {
+    case INTERSECTION_LEFT: return "left";
+    case INTERSECTION_RIGHT: return "right";
+    case INTERSECTION_T: return "t";
+    case INTERSECTION_CROSS: return "cross";
+    default: return "none";
+  }
+}
+
+bool intersectionMatches(const int sensors[LINE_SENSOR_COUNT], IntersectionType type,
+                         int threshold) {
+  bool leftEdge = sensors[0] > threshold;
+  bool rightEdge = sensors[LINE_SENSOR_COUNT - 1] > threshold;
+  bool center = false;
+
+  for (int i = 2; i < 6; i++) {
+    if (sensors[i] > threshold) {
+      center = true;
+      break;
+    }
+  }
+
+  switch (type) {
+    case INTERSECTION_LEFT: return leftEdge && center && !rightEdge;
+    case INTERSECTION_RIGHT: return rightEdge && center && !leftEdge;
+    case INTERSECTION_T:
+    case INTERSECTION_CROSS: return leftEdge && rightEdge && center;
+    default: return false;
+  }
+}
+
+IntersectionType classifyIntersection(const int sensors[LINE_SENSOR_COUNT], int threshold) {
+  if (intersectionMatches(sensors, INTERSECTION_CROSS, threshold)) return INTERSECTION_CROSS;
+  if (intersectionMatches(sensors, INTERSECTION_LEFT, threshold)) return INTERSECTION_LEFT;
+  if (intersectionMatches(sensors, INTERSECTION_RIGHT, threshold)) return INTERSECTION_RIGHT;
+  return INTERSECTION_NONE;
+}
@@ -0,0 +1,62 @@
+/*
+ * Line follower and intersection logic
+ *
+ * Pure functions over a frame of 8 raw line sensor values (leftmost first),
+ * free of Arduino globals so the same code runs on the robot and in the
+ * native replay tools.
+ */
+
+#ifndef SIROBO_LINE_FOLLOWER_H
+#define SIROBO_LINE_FOLLOWER_H
+
+#include <stdint.h>
+
+#define LINE_SENSOR_COUNT 8
+#define LINE_SENSOR_THRESHOLD 500   // Raw value above which a sensor sees the line
+#define LINE_POSITION_CENTER 3500   // Center of the 0..7000 weighted position
+#define LINE_MAX_WIDTH_SENSORS 4    // More sensors on the line: a crossing or marker
+
+struct LineFollowerParams {
+  int speed;       // Base speed in percent (0-100)
+  float kp;        // Proportional gain on position error
+  int threshold;   // LINE_SENSOR_THRESHOLD unless tuned
+  bool straightOnWide; // Drive straight over frames wider than a line
+};
+
+struct LineFollowerOutput {
+  bool lineLost;   // No sensor saw the line; left/right are not valid
+  float error;     // Position error (-3500..3500)
+  int left;        // Motor commands (-255..255)
+  int right;
+};
+
+enum IntersectionType : uint8_t {
+  INTERSECTION_NONE = 0,
+  INTERSECTION_LEFT,
+  INTERSECTION_RIGHT,
+  INTERSECTION_T,
+  INTERSECTION_CROSS
+};
+
+// One proportional control step. With straightOnWide, a frame wider than
+// a line (a crossing or a start marker) drives straight on instead of
+// steering towards the wider side; lap learning sets it to cross its
+// marker. Otherwise the weighted centroid is followed, which takes corners
+// and branches.
+LineFollowerOutput lineFollowerStep(const int sensors[LINE_SENSOR_COUNT],
+                                    const LineFollowerParams& params);
+
+// "left", "right", "t", "cross" -> IntersectionType (INTERSECTION_NONE if unknown)
+IntersectionType parseIntersectionType(const char* name);
+const char* intersectionName(IntersectionType type);
+
+// True when the frame matches the requested intersection shape
+bool intersectionMatches(const int sensors[LINE_SENSOR_COUNT], IntersectionType type,
+                         int threshold = LINE_SENSOR_THRESHOLD);
+
+// Shape currently under the sensors (T and cross look identical to the array
+// and are both reported as INTERSECTION_CROSS)
+IntersectionType classifyIntersection(const int sensors[LINE_SENSOR_COUNT],
+                                      int threshold = LINE_SENSOR_THRESHOLD);
+
+#endif
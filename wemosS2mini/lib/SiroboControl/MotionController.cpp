@@ -0,0 +1,128 @@
+#include "MotionController.h"
+
+#include <math.h>
+
+#define RAD_TO_DEG_F (180.0f / (float)M_PI)
+#define MOTION_MAX_CROSS_DEG 30.0f   // Cap on the steer back onto the path
+#define MOTION_AIM_MIN_MM 50.0f      // Closer than this, goTo() stops aiming
+
+static const char* const MOTION_STATE_NAMES[] = { "idle", "turn", "drive" };
+
+const char* motionStateName(MotionState state) {
+  return state <= MOTION_DRIVE ? MOTION_STATE_NAMES[state] : "idle";
+}
+
+static int clampInt(int value, int low, int high) {
+  return value < low ? low : (value > high ? high : value);
+}
+
+static int percentToCommand(int percent) {
+  return clampInt(percent, 0, 100) * 255 / 100;
+}
+
+MotionController::MotionController()
+  : params{ 4.0f, 0.3f, 150.0f, 60, 5.0f },
+    _state(MOTION_IDLE),
+    _command(0),
+    _startX(0), _startY(0),
+    _targetX(0), _targetY(0),
+    _pathX(1), _pathY(0),
+    _length(0),
+    _remaining(0),
+    _steerAtTarget(false),
+    _turnSign(1) {}
+
+void MotionController::drive(const Pose& from, float distanceMm, int speed) {
+  float heading = from.theta / RAD_TO_DEG_F;
+  _targetX = from.x + distanceMm * cosf(heading);
+  _targetY = from.y + distanceMm * sinf(heading);
+  _command = distanceMm < 0 ? -percentToCommand(speed) : percentToCommand(speed);
+  _steerAtTarget = false;
+  startPath(from);
+  _state = MOTION_DRIVE;
+}
+
+void MotionController::goTo(const Pose& from, float x, float y, int speed) {
+  _targetX = x;
+  _targetY = y;
+  _command = percentToCommand(speed);
+  _steerAtTarget = true;
+  startPath(from);
+
+  float error = wrapDegrees(atan2f(_pathY, _pathX) * RAD_TO_DEG_F - from.theta);
+  _turnSign = error < 0 ? -1 : 1;
+  _state = _length > 0 ? MOTION_TURN : MOTION_IDLE;
+}
+
+void MotionController::startPath(const Pose& from) {
+  _startX = from.x;
+  _startY = from.y;
+  float dx = _targetX - from.x, dy = _targetY - from.y;
+  _length = sqrtf(dx * dx + dy * dy);
+  _remaining = _length;
+  if (_length > 0) {
+    _pathX = dx / _length;
+    _pathY = dy / _length;
+  } else {
+    float heading = from.theta / RAD_TO_DEG_F;
+    _pathX = cosf(heading);
+    _pathY = sinf(heading);
+  }
+}
+
+bool MotionController::step(const Pose& pose, float speedMmS, float lagS, int& left, int& right) {
+  left = right = 0;
+  if (_state == MOTION_IDLE) return false;
+
+  int cruise = _command < 0 ? -_command : _command;
+  int slowest = params.minCommand < cruise ? params.minCommand : cruise;
+
+  if (_state == MOTION_TURN) {
+    float error = wrapDegrees(atan2f(_targetY - pose.y, _targetX - pose.x) * RAD_TO_DEG_F - pose.theta);
+    // Facing it, or swung past: drive from here
+    if (fabsf(error) <= params.turnToleranceDeg || error * _turnSign < 0) {
+      startPath(pose);
+      _state = MOTION_DRIVE;
+    } else {
+      int turn = clampInt((int)(params.headingGain * fabsf(error)), slowest, cruise);
+      if (error < 0) turn = -turn;
+      left = -turn;
+      right = turn;
+      return false;
+    }
+  }
+
+  float ox = pose.x - _startX, oy = pose.y - _startY;
+  _remaining = _length - (ox * _pathX + oy * _pathY);
+  float lateral = _pathX * oy - _pathY * ox;   // mm, left of the path positive
+
+  // What the robot still rolls through the lag, once the motors let go
+  if (_remaining <= fabsf(speedMmS) * lagS || _length <= 0) {
+    _state = MOTION_IDLE;
+    return true;
+  }
+
+  float course;
+  float tx = _targetX - pose.x, ty = _targetY - pose.y;
+  if (_steerAtTarget && _remaining > MOTION_AIM_MIN_MM) {
+    course = atan2f(ty, tx) * RAD_TO_DEG_F;
+  } else {
+    float cross = params.crossGain * lateral;
+    if (cross > MOTION_MAX_CROSS_DEG) cross = MOTION_MAX_CROSS_DEG;
+    if (cross < -MOTION_MAX_CROSS_DEG) cross = -MOTION_MAX_CROSS_DEG;
+    course = atan2f(_pathY, _pathX) * RAD_TO_DEG_F - cross;
+  }
+  // Backing up, the robot faces away from the way it goes
+  float facing = _command < 0 ? course + 180.0f : course;
+  float error = wrapDegrees(facing - pose.theta);
+
+  int base = cruise;
+  if (_remaining < params.slowdownMm) {
+    base = clampInt((int)(cruise * _remaining / params.slowdownMm), slowest, cruise);
+  }
+  int turn = clampInt((int)(params.headingGain * error), -base, base);
+  if (_command < 0) base = -base;
+  left = clampInt(base - turn, -255, 255);
+  right = clampInt(base + turn, -255, 255);
+  return false;
+}
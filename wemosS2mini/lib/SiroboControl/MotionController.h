@@ -0,0 +1,76 @@
+/*
+ * Motion primitives on the dead-reckoned pose
+ *
+ *   drive   straight ahead (or back, for a negative distance) by a distance,
+ *           holding the heading it started with and steering back onto the
+ *           line it started on
+ *   goTo    turns on the spot towards a point, then drives to it, steering
+ *           at the point all the way
+ *
+ * Both slow down over the last slowdownMm and let go of the motors early by
+ * the distance the robot still coasts through the motor lag, so they stop
+ * on the mark rather than past it.
+ *
+ * Positions are mm and headings deg as in PoseEstimator; speeds percent
+ * (0-100), motor commands -255..255.
+ */
+
+#ifndef SIROBO_MOTION_CONTROLLER_H
+#define SIROBO_MOTION_CONTROLLER_H
+
+#include <stdint.h>
+
+#include "PoseEstimator.h"
+
+enum MotionState : uint8_t {
+  MOTION_IDLE = 0,
+  MOTION_TURN,       // goTo(): facing the point
+  MOTION_DRIVE
+};
+
+struct MotionParams {
+  float headingGain;       // Motor command per degree of heading error
+  float crossGain;         // Degrees of heading per mm off the path
+  float slowdownMm;        // Ramp down over this much of the end
+  int minCommand;          // Slowest command that still moves the robot
+  float turnToleranceDeg;  // goTo() drives once it faces the point this well
+};
+
+const char* motionStateName(MotionState state);
+
+class MotionController {
+public:
+  MotionController();
+
+  MotionParams params;
+
+  void drive(const Pose& from, float distanceMm, int speed);
+  void goTo(const Pose& from, float x, float y, int speed);
+  void cancel() { _state = MOTION_IDLE; }
+
+  // One control tick with the current pose and speed (mm/s) and the motor
+  // lag (s). Returns true on the tick the motion ends; left = right = 0
+  // then and whenever idle.
+  bool step(const Pose& pose, float speedMmS, float lagS, int& left, int& right);
+
+  MotionState state() const { return _state; }
+  bool active() const { return _state != MOTION_IDLE; }
+  float targetX() const { return _targetX; }
+  float targetY() const { return _targetY; }
+  float remaining() const { return _remaining; }   // mm along the path
+
+private:
+  void startPath(const Pose& from);
+
+  MotionState _state;
+  int _command;        // Cruise command, signed: negative drives backwards
+  float _startX, _startY;
+  float _targetX, _targetY;
+  float _pathX, _pathY;    // Unit vector from start to target
+  float _length;
+  float _remaining;
+  bool _steerAtTarget;     // goTo(): aim at the point, not along the path
+  float _turnSign;         // Sign of the heading error the turn started with
+};
+
+#endif
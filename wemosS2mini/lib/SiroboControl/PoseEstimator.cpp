@@ -0,0 +1,241 @@
+#include "PoseEstimator.h"
+
+#include <math.h>
+
+#define DEG_TO_RAD_F ((float)M_PI / 180.0f)
+
+// Motor commands of the calibration runs, slowest first
+static const int SPEED_CAL_COMMANDS[SPEED_CAL_LEVELS] = { 100, 150, 200, 250 };
+
+static const char* const SPEED_CAL_STATE_NAMES[] = {
+  "idle", "run", "back", "pause", "done", "failed"
+};
+
+SpeedModel defaultSpeedModel() {
+  // TT gear motor, 65 mm wheel, ~6 V
+  return { 900.0f, 0.15f, 60, 0 };
+}
+
+float speedModelVelocity(const SpeedModel& model, float duty) {
+  float magnitude = fabsf(duty);
+  if (magnitude <= model.deadband) return 0;
+  float speed = model.gain * (magnitude - model.deadband);
+  return duty < 0 ? -speed : speed;
+}
+
+bool speedModelFit(const float* duties, const float* speeds, uint8_t count, SpeedModel& model) {
+  if (count < 2) return false;
+
+  float meanDuty = 0, meanSpeed = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    meanDuty += duties[i];
+    meanSpeed += speeds[i];
+  }
+  meanDuty /= count;
+  meanSpeed /= count;
+
+  float sxx = 0, sxy = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    float dx = duties[i] - meanDuty;
+    sxx += dx * dx;
+    sxy += dx * (speeds[i] - meanSpeed);
+  }
+  if (sxx < 1e-6f) return false;
+
+  float gain = sxy / sxx;
+  if (gain <= 0) return false;
+  float deadband = meanDuty - meanSpeed / gain;
+
+  model.gain = gain;
+  model.deadband = deadband < 0 ? 0 : (deadband > 0.9f ? 0.9f : deadband);
+  model.runs = count;
+  return true;
+}
+
+float wrapDegrees(float deg) {
+  deg = fmodf(deg + 180.0f, 360.0f);
+  if (deg < 0) deg += 360.0f;
+  return deg - 180.0f;
+}
+
+// =====================================================
+// POSE ESTIMATOR
+// =====================================================
+
+PoseEstimator::PoseEstimator()
+  : model(defaultSpeedModel()),
+    _pose{ 0, 0, 0 },
+    _lastYaw(0),
+    _bias(0),
+    _speed(0),
+    _odometer(0),
+    _restMs(0) {}
+
+void PoseEstimator::reset(float x, float y, float theta, float yaw) {
+  _pose = { x, y, wrapDegrees(theta) };
+  _lastYaw = yaw;
+  _odometer = 0;
+}
+
+void PoseEstimator::update(float dt, float leftDuty, float rightDuty, float yaw) {
+  if (dt <= 0) return;
+
+  // Both wheels through the model, then the motors' lag
+  float target = (speedModelVelocity(model, leftDuty) + speedModelVelocity(model, rightDuty)) / 2;
+  float lag = model.lagMs / 1000.0f;
+  _speed += (target - _speed) * (dt / (lag + dt));
+
+  // At rest a slow yaw change is gyro drift: learn it instead of turning
+  float yawRate = (yaw - _lastYaw) / dt;
+  _lastYaw = yaw;
+  if (leftDuty == 0 && rightDuty == 0) {
+    uint32_t ms = (uint32_t)(dt * 1000 + 0.5f);
+    _restMs = _restMs + ms < _restMs ? UINT32_MAX : _restMs + ms;
+  } else {
+    _restMs = 0;
+  }
+  float turn = yawRate - _bias;
+  if (resting() && fabsf(turn) < POSE_REST_MAX_RATE) {
+    _bias += turn * (dt / (POSE_BIAS_TAU + dt));
+    turn = 0;
+  }
+
+  // Midpoint heading over the tick (the gyro's yaw is clockwise)
+  float theta = wrapDegrees(_pose.theta - turn * dt);
+  float heading = (_pose.theta + wrapDegrees(theta - _pose.theta) / 2) * DEG_TO_RAD_F;
+  float step = _speed * dt;
+  _pose.x += step * cosf(heading);
+  _pose.y += step * sinf(heading);
+  _pose.theta = theta;
+  _odometer += fabsf(step);
+}
+
+// =====================================================
+// SPEED CALIBRATION
+// =====================================================
+
+const char* speedCalStateName(SpeedCalState state) {
+  return state <= SPEED_CAL_FAILED ? SPEED_CAL_STATE_NAMES[state] : "idle";
+}
+
+SpeedCalibrator::SpeedCalibrator()
+  : _state(SPEED_CAL_IDLE),
+    _level(0),
+    _phaseMs(0),
+    _runMs(0),
+    _lastCm(0),
+    _samples(0),
+    _sumT(0), _sumD(0), _sumTT(0), _sumTD(0),
+    _sumDuty(0),
+    _runs(0),
+    _result(defaultSpeedModel()),
+    _error(nullptr) {}
+
+static bool wallInRange(int distanceCm, int nearCm) {
+  return distanceCm >= nearCm && distanceCm <= SPEED_CAL_MAX_CM;
+}
+
+bool SpeedCalibrator::start(uint32_t nowMs, int distanceCm) {
+  if (!wallInRange(distanceCm, SPEED_CAL_MIN_START_CM)) return false;
+  _level = 0;
+  _runs = 0;
+  _error = nullptr;
+  _lastCm = distanceCm;
+  beginRun(nowMs);
+  return true;
+}
+
+void SpeedCalibrator::stop() {
+  if (running()) {
+    _state = SPEED_CAL_FAILED;
+    _error = "stopped";
+  }
+}
+
+void SpeedCalibrator::beginRun(uint32_t nowMs) {
+  _state = SPEED_CAL_RUN;
+  _phaseMs = nowMs;
+  _samples = 0;
+  _sumT = _sumD = _sumTT = _sumTD = 0;
+  _sumDuty = 0;
+}
+
+void SpeedCalibrator::sample(uint32_t nowMs, int distanceCm, float duty) {
+  if (distanceCm > 0) _lastCm = distanceCm;
+  if (_state != SPEED_CAL_RUN) return;
+
+  uint32_t elapsed = nowMs - _phaseMs;
+  if (elapsed >= SPEED_CAL_SETTLE_MS && wallInRange(distanceCm, 1)) {
+    float t = elapsed / 1000.0f;
+    float d = distanceCm * 10.0f;
+    _samples++;
+    _sumT += t;
+    _sumD += d;
+    _sumTT += t * t;
+    _sumTD += t * d;
+    _sumDuty += fabsf(duty);
+  }
+  if (distanceCm > 0 && distanceCm <= SPEED_CAL_STOP_CM) endRun(nowMs);
+}
+
+void SpeedCalibrator::endRun(uint32_t nowMs) {
+  _runMs = nowMs - _phaseMs;
+
+  float n = _samples;
+  float denom = n * _sumTT - _sumT * _sumT;
+  if (_samples >= SPEED_CAL_MIN_SAMPLES && denom > 1e-6f) {
+    // The wall comes closer: speed is minus the slope
+    float speed = -(n * _sumTD - _sumT * _sumD) / denom;
+    if (speed > 0) {
+      _duties[_runs] = _sumDuty / n;
+      _speeds[_runs] = speed;
+      _runs++;
+    }
+  }
+
+  _state = SPEED_CAL_BACK;
+  _phaseMs = nowMs;
+}
+
+void SpeedCalibrator::finish() {
+  SpeedModel model = _result;
+  model.lagMs = defaultSpeedModel().lagMs;
+  if (speedModelFit(_duties, _speeds, _runs, model)) {
+    _result = model;
+    _state = SPEED_CAL_DONE;
+  } else {
+    _state = SPEED_CAL_FAILED;
+    _error = _runs ? "too few runs" : "no runs";
+  }
+}
+
+int SpeedCalibrator::step(uint32_t nowMs) {
+  uint32_t elapsed = nowMs - _phaseMs;
+  switch (_state) {
+    case SPEED_CAL_RUN:
+      if (elapsed >= SPEED_CAL_MAX_RUN_MS) {
+        endRun(nowMs);
+        return 0;
+      }
+      return SPEED_CAL_COMMANDS[_level];
+
+    case SPEED_CAL_BACK:
+      // Back as long as the run went forward, at the same command
+      if (elapsed < _runMs) return -SPEED_CAL_COMMANDS[_level];
+      _state = SPEED_CAL_PAUSE;
+      _phaseMs = nowMs;
+      return 0;
+
+    case SPEED_CAL_PAUSE:
+      if (elapsed < SPEED_CAL_PAUSE_MS) return 0;
+      if (++_level >= SPEED_CAL_LEVELS || !wallInRange(_lastCm, SPEED_CAL_MIN_START_CM)) {
+        finish();
+        return 0;
+      }
+      beginRun(nowMs);
+      return SPEED_CAL_COMMANDS[_level];
+
+    default:
+      return 0;
+  }
+}
@@ -0,0 +1,151 @@
+/*
+ * Dead reckoning - x/y/heading from the gyro and a calibrated speed model
+ *
+ * There are no wheel encoders. The heading is the integrated gyro yaw; the
+ * speed comes from the duty the motors are actually driven at, through a
+ * per-robot SpeedModel (mm/s per unit of duty above the deadband, and the
+ * motors' lag), averaged over both wheels. The gyro does the turning, so a
+ * left/right mismatch only costs heading-hold effort, not position.
+ *
+ * An uncompensated gyro drifts by a fraction of a degree per second, which
+ * over a lesson turns squares into spirals. While the motors are off (and
+ * the robot has stopped rolling) the estimator takes any slow yaw change
+ * for drift: it holds the heading and learns the gyro's bias, which it
+ * then takes off while driving. A faster turn at rest is the robot being
+ * picked up and turned, and is followed.
+ *
+ * The model is learned with SpeedCalibrator: the robot faces a wall and
+ * drives at it at a few duty levels, backing off between runs. The
+ * ultrasonic distance over time gives the speed of each run, and a
+ * least-squares line through (duty, speed) gives the model.
+ *
+ * Free of Arduino globals like LineFollower; headings are degrees, counter-
+ * clockwise positive from the x axis (the gyro's yaw reads clockwise
+ * positive, as for robotRotate()).
+ */
+
+#ifndef SIROBO_POSE_ESTIMATOR_H
+#define SIROBO_POSE_ESTIMATOR_H
+
+#include <stdint.h>
+
+#define POSE_REST_MS 250              // Motors off this long: at rest
+#define POSE_REST_MAX_RATE 3.0f       // deg/s; faster at rest is a real turn
+#define POSE_BIAS_TAU 1.0f            // s, gyro bias filter
+
+#define SPEED_CAL_LEVELS 4            // Runs at the commands below
+#define SPEED_CAL_MIN_START_CM 60     // Closer to the wall than this: no run
+#define SPEED_CAL_STOP_CM 25          // A run ends this close to the wall
+#define SPEED_CAL_MAX_CM 200          // Readings beyond are ignored
+#define SPEED_CAL_SETTLE_MS 300       // Speeding up; not used for the fit
+#define SPEED_CAL_MAX_RUN_MS 3000
+#define SPEED_CAL_PAUSE_MS 500        // Standing still between runs
+#define SPEED_CAL_MIN_SAMPLES 4       // Readings a run needs to count
+
+// Store record (STORE_KEY_SPEED_MODEL); append fields only
+struct SpeedModel {
+  float gain;        // mm/s per unit of duty (0..1) above the deadband
+  float deadband;    // Duty below which the wheels do not turn
+  uint16_t lagMs;    // Motor time constant
+  uint8_t runs;      // Calibration runs it was fitted from, 0 = default
+};
+
+struct Pose {
+  float x, y;        // mm
+  float theta;       // deg, -180..180
+};
+
+SpeedModel defaultSpeedModel();
+
+// Steady speed at a signed duty (-1..1), mm/s
+float speedModelVelocity(const SpeedModel& model, float duty);
+
+// Least-squares speed = gain * (duty - deadband) through `count` runs.
+// False with fewer than two distinct duties or a slope that is not positive.
+bool speedModelFit(const float* duties, const float* speeds, uint8_t count, SpeedModel& model);
+
+float wrapDegrees(float deg);   // -180..180
+
+class PoseEstimator {
+public:
+  PoseEstimator();
+
+  SpeedModel model;
+
+  // The robot is at (x, y) facing theta; yaw is the gyro's now
+  void reset(float x, float y, float theta, float yaw);
+  // One tick of dt seconds at wheel duties -1..1
+  void update(float dt, float leftDuty, float rightDuty, float yaw);
+
+  const Pose& pose() const { return _pose; }
+  float speed() const { return _speed; }          // mm/s, signed
+  float odometer() const { return _odometer; }    // mm driven since reset()
+  float gyroBias() const { return _bias; }         // deg/s of yaw, learned at rest
+  bool resting() const { return _restMs >= POSE_REST_MS; }
+
+private:
+  Pose _pose;
+  float _lastYaw;
+  float _bias;
+  float _speed;
+  float _odometer;
+  uint32_t _restMs;
+};
+
+enum SpeedCalState : uint8_t {
+  SPEED_CAL_IDLE = 0,
+  SPEED_CAL_RUN,       // Driving at the wall
+  SPEED_CAL_BACK,      // Backing off
+  SPEED_CAL_PAUSE,
+  SPEED_CAL_DONE,
+  SPEED_CAL_FAILED
+};
+
+const char* speedCalStateName(SpeedCalState state);
+
+class SpeedCalibrator {
+public:
+  SpeedCalibrator();
+
+  // False (nothing started) unless a wall is SPEED_CAL_MIN_START_CM..
+  // SPEED_CAL_MAX_CM ahead
+  bool start(uint32_t nowMs, int distanceCm);
+  void stop();
+
+  // Every new ultrasonic reading, with the duty (0..1) the wheels run at
+  void sample(uint32_t nowMs, int distanceCm, float duty);
+  // Motor command for both wheels, -255..255
+  int step(uint32_t nowMs);
+
+  SpeedCalState state() const { return _state; }
+  bool running() const { return _state >= SPEED_CAL_RUN && _state <= SPEED_CAL_PAUSE; }
+  uint8_t runs() const { return _runs; }
+  float runDuty(uint8_t i) const { return _duties[i]; }
+  float runSpeed(uint8_t i) const { return _speeds[i]; }
+  const SpeedModel& result() const { return _result; }   // When DONE
+  const char* error() const { return _error; }           // When FAILED
+
+private:
+  void beginRun(uint32_t nowMs);
+  void endRun(uint32_t nowMs);
+  void finish();
+
+  SpeedCalState _state;
+  uint8_t _level;
+  uint32_t _phaseMs;
+  uint32_t _runMs;
+  int _lastCm;
+
+  // Regression of distance (mm) over time (s) for the current run
+  uint8_t _samples;
+  float _sumT, _sumD, _sumTT, _sumTD;
+  float _sumDuty;
+
+  uint8_t _runs;
+  float _duties[SPEED_CAL_LEVELS];
+  float _speeds[SPEED_CAL_LEVELS];
+  SpeedModel _result;
+  const char* _error;
+};
+
+#endif
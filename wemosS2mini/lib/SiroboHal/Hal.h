@@ -0,0 +1,387 @@
+/*
+ * Sirobo HAL - hardware abstraction layer
+ *
+ * Everything the firmware needs from the board goes through this header:
+ * GPIO, ADC, PWM, I2C devices (IMU, OLED), the LED strip, persistent
+ * storage, OTA, time, logging, the network transport (WiFi, HTTP and
+ * WebSocket) and the USB serial port.
+ *
+ * Two backends implement it:
+ *   HalEsp32.cpp  - Arduino-ESP32 core, Adafruit drivers, the RMT for the
+ *                   LED strip, ESPAsyncWebServer (built when ARDUINO is
+ *                   defined)
+ *   HalSim*.cpp   - simulated board for the native build; see HalSim.h
+ */
+
+#ifndef SIROBO_HAL_H
+#define SIROBO_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#include <soc/gpio_struct.h>
+#else
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Arduino language helpers used by the firmware core
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+long map(long x, long inMin, long inMax, long outMin, long outMax);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+#endif
+
+namespace hal {
+
+// =====================================================
+// TIME
+// =====================================================
+
+uint32_t millis();
+uint32_t micros();
+uint64_t micros64();   // Does not wrap (micros() does after 71 minutes)
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+// Free-running cycle counter for profiling (wraps, compare differences only).
+// Xtensa CCOUNT on the robot; host nanoseconds in the simulator, where the
+// counter always follows the host clock, even in virtual time.
+#ifdef ARDUINO
+inline uint32_t cycleCount() { return ESP.getCycleCount(); }
+inline uint32_t cycleFrequency() { return ESP.getCpuFreqMHz() * 1000000UL; }
+#else
+uint32_t cycleCount();
+uint32_t cycleFrequency();
+#endif
+
+// =====================================================
+// GPIO / ADC / PWM
+// =====================================================
+
+enum PinMode : uint8_t {
+  PIN_INPUT,
+  PIN_OUTPUT,
+  PIN_INPUT_PULLUP
+};
+
+void pinMode(uint8_t pin, PinMode mode);
+void digitalWrite(uint8_t pin, bool level);
+bool digitalRead(uint8_t pin);
+
+// One store to the GPIO set/clear register on the robot, skipping
+// digitalWrite()'s pin checks; the pin must already be an output
+#ifdef ARDUINO
+inline void digitalWriteFast(uint8_t pin, bool level) {
+  if (pin < 32) {
+    if (level) GPIO.out_w1ts = 1UL << pin;
+    else GPIO.out_w1tc = 1UL << pin;
+  } else {
+    if (level) GPIO.out1_w1ts.val = 1UL << (pin - 32);
+    else GPIO.out1_w1tc.val = 1UL << (pin - 32);
+  }
+}
+#else
+void digitalWriteFast(uint8_t pin, bool level);
+#endif
+
+int analogRead(uint8_t pin);
+
+// Width of a pulse on pin in microseconds, 0 on timeout
+uint32_t pulseIn(uint8_t pin, bool level, uint32_t timeoutUs);
+
+void pwmSetup(uint8_t channel, uint32_t frequency, uint8_t resolution);
+void pwmAttach(uint8_t pin, uint8_t channel);
+void pwmWrite(uint8_t channel, uint32_t duty);
+
+void tone(uint8_t pin, unsigned int frequency, unsigned long durationMs);
+void noTone(uint8_t pin);
+
+// =====================================================
+// I2C DEVICES
+// =====================================================
+
+void i2cBegin(int sda, int scl);
+
+struct ImuSample {
+  float ax, ay, az;  // m/s^2
+  float gx, gy, gz;  // rad/s
+};
+
+bool imuBegin();
+bool imuRead(ImuSample& sample);
+
+enum DisplayColor : uint16_t {
+  BLACK = 0,
+  WHITE = 1
+};
+
+// 128x64 monochrome OLED with the subset of the Adafruit GFX API the
+// firmware uses. The framebuffer uses the SSD1306 page layout: one byte
+// per 8 vertical pixels, SCREEN_WIDTH bytes per page.
+class Display {
+public:
+  virtual ~Display() {}
+
+  virtual bool begin() = 0;
+  virtual void clearDisplay() = 0;
+  virtual void display() = 0;
+  virtual uint8_t* getBuffer() = 0;
+
+  virtual void setTextSize(uint8_t size) = 0;
+  virtual void setTextColor(uint16_t color) = 0;
+  virtual void setCursor(int16_t x, int16_t y) = 0;
+  virtual void print(const char* text) = 0;
+  virtual void print(int value) = 0;
+  virtual void print(float value, int digits) = 0;
+  virtual void println(const char* text = "") = 0;
+  virtual void println(int value) = 0;
+
+  virtual void drawPixel(int16_t x, int16_t y, uint16_t color) = 0;
+  virtual void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) = 0;
+  virtual void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) = 0;
+  virtual void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) = 0;
+  virtual void drawCircle(int16_t x, int16_t y, int16_t r, uint16_t color) = 0;
+  virtual void fillCircle(int16_t x, int16_t y, int16_t r, uint16_t color) = 0;
+  virtual void fillTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1,
+                            int16_t x2, int16_t y2, uint16_t color) = 0;
+};
+
+Display& display();
+
+// =====================================================
+// LED STRIP
+// =====================================================
+
+struct Rgb {
+  uint8_t r, g, b;
+};
+
+void ledsBegin(uint8_t count);
+// Starts sending a frame and returns while it goes out; waits first if the
+// previous frame is still being sent. Brightness is applied on the way.
+void ledsShow(const Rgb* pixels, uint8_t count);
+bool ledsBusy();
+void ledsSetBrightness(uint8_t brightness);
+Rgb hsv(uint8_t hue, uint8_t saturation, uint8_t value);
+
+// =====================================================
+// STORAGE (EEPROM emulation)
+// =====================================================
+
+void storageBegin(size_t size);
+void storageRead(size_t address, void* data, size_t len);
+void storageWrite(size_t address, const void* data, size_t len);
+bool storageCommit();
+
+// =====================================================
+// FLASH (raw regions for the key/value store, saved sessions and sprites)
+// =====================================================
+
+// NOR semantics: erase sets a whole sector to 0xFF, writes can only clear
+// bits. On the robot each region is a data partition (partitions.csv):
+// "store", "session" and "sprites".
+enum FlashRegion : uint8_t {
+  FLASH_STORE = 0,      // lib/KvStore
+  FLASH_SESSION,        // Recorded driving session (lib/SessionRecorder)
+  FLASH_SPRITES         // OLED images (lib/SpriteCache)
+};
+
+size_t flashSize(FlashRegion region = FLASH_STORE);   // Bytes, 0 if there is none
+size_t flashSectorSize();
+bool flashRead(size_t offset, void* data, size_t len, FlashRegion region = FLASH_STORE);
+bool flashWrite(size_t offset, const void* data, size_t len, FlashRegion region = FLASH_STORE);
+bool flashErase(size_t sector, FlashRegion region = FLASH_STORE);
+
+// =====================================================
+// FILESYSTEM (read-only: LittleFS on the robot)
+// =====================================================
+
+// Mounts the "spiffs" partition (written with `pio run -t uploadfs`); the
+// simulator serves a host directory instead (--data, default data/)
+bool fsBegin();
+// Reads up to maxLen bytes of a file; returns the count, 0 if missing
+size_t fsRead(const char* path, void* data, size_t maxLen);
+
+// =====================================================
+// SYSTEM
+// =====================================================
+
+uint32_t freeHeap();
+uint32_t minFreeHeap();        // Lowest free heap since boot
+uint32_t largestFreeBlock();   // Biggest allocation that can currently succeed
+// malloc/calloc/realloc/new calls since boot. Counted only when built with
+// -DSIROBO_HEAP_STATS and the matching -Wl,--wrap flags (platformio.ini),
+// 0 otherwise. Approximate while several tasks allocate at once.
+uint32_t allocationCount();
+const char* chipModel();
+void restart();
+
+// Firmware update (streamed)
+bool otaBegin();
+bool otaWrite(const uint8_t* data, size_t len);
+bool otaEnd();
+// Discards a partly written image; the running firmware stays active
+void otaAbort();
+bool otaHasError();
+const char* otaErrorString();
+
+// Debug log (Serial1 on the robot, stdout in the simulator)
+class Logger {
+public:
+  void begin(unsigned long baud);
+  void print(const char* text);
+  void print(int value);
+  void println(const char* text = "");
+  void println(int value);
+  void printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+extern Logger logger;
+
+// =====================================================
+// NETWORK - WiFi
+// =====================================================
+
+struct WifiNetwork {
+  char ssid[33];
+  int32_t rssi;
+  bool secured;
+};
+
+void wifiStartStation(const char* ssid, const char* password);
+bool wifiStationConnected();
+void wifiStartAccessPoint(const char* ssid, const char* password, bool keepStation);
+void wifiAccessPointIp(char* out, size_t len);
+void wifiStationIp(char* out, size_t len);
+
+// Scans run in the background (the radio still leaves the AP channel for
+// 1-3 s): start one, then poll wifiScanComplete() until it stops returning
+// WIFI_SCAN_BUSY. Results stay readable until wifiScanDelete().
+enum WifiScanStatus : int {
+  WIFI_SCAN_BUSY = -1,
+  WIFI_SCAN_ERROR = -2
+};
+
+bool wifiScanStart();
+int wifiScanComplete();   // Number of networks found, or a WifiScanStatus
+bool wifiScanResult(int index, WifiNetwork& network);
+void wifiScanDelete();
+
+// =====================================================
+// NETWORK - WebSocket
+// =====================================================
+
+enum WsEventType : uint8_t {
+  WS_EVENT_CONNECT,
+  WS_EVENT_DISCONNECT,
+  WS_EVENT_TEXT,    // One complete text message, NUL-terminated
+  WS_EVENT_BINARY   // One complete binary message, up to WS_BINARY_MAX bytes
+};
+
+#define WS_BINARY_MAX 1280
+
+typedef void (*WsEventHandler)(WsEventType type, uint32_t clientId, uint8_t* data, size_t len);
+
+void wsBegin(const char* path, WsEventHandler handler);
+void wsTextAll(const char* text, size_t len);
+void wsText(uint32_t clientId, const char* text, size_t len);
+void wsBinary(uint32_t clientId, const uint8_t* data, size_t len);
+// False while the client's send queue is full
+bool wsWritable(uint32_t clientId);
+size_t wsCount();
+void wsCleanup();
+
+// =====================================================
+// NETWORK - UDP and mDNS
+// =====================================================
+
+#define UDP_MAX_SOCKETS 4
+
+// Called for each datagram a socket receives: on the robot from the
+// AsyncUDP task, in the simulator from poll(). ip is a.b.c.d.
+typedef void (*UdpHandler)(const uint8_t* data, size_t len, const uint8_t ip[4], uint16_t port);
+
+// Listens on all interfaces (the simulator: 127.0.0.1), broadcasts
+// included; port 0 picks a free one. Returns the socket, -1 on failure.
+int udpBegin(uint16_t port, UdpHandler handler);
+// Receives datagrams sent to group:port (and unicast to port); any number
+// of sockets, also in other processes, may listen on the same group
+int udpBeginMulticast(const uint8_t group[4], uint16_t port, UdpHandler handler);
+bool udpSend(int socket, const uint8_t ip[4], uint16_t port, const uint8_t* data, size_t len);
+
+// Advertises <hostname>.local and DNS-SD services (e.g. "_sirobo", "_tcp");
+// the simulator only logs them
+bool mdnsBegin(const char* hostname);
+void mdnsAddService(const char* service, const char* proto, uint16_t port);
+void mdnsAddServiceTxt(const char* service, const char* proto, const char* key, const char* value);
+
+// =====================================================
+// USB - CDC serial
+// =====================================================
+
+// The native USB port as a serial line to a host (the simulator: a pty).
+// Reads and writes never block; bytes that do not fit are dropped.
+bool usbBegin();
+// A host has the port open
+bool usbConnected();
+size_t usbRead(uint8_t* data, size_t len);
+// Writes header then data as one piece that no other usbWrite() splits,
+// so any task may call it; false if not all of it went out
+bool usbWrite(const uint8_t* header, size_t headerLen, const uint8_t* data, size_t len);
+
+// =====================================================
+// NETWORK - HTTP
+// =====================================================
+
+enum HttpMethod : uint8_t {
+  HTTP_METHOD_GET,
+  HTTP_METHOD_POST
+};
+
+struct HttpHeader {
+  const char* name;
+  const char* value;
+};
+
+struct HttpRequest;
+
+typedef void (*HttpHandler)(HttpRequest* request);
+typedef void (*HttpUploadHandler)(HttpRequest* request, const char* filename, size_t index,
+                                  uint8_t* data, size_t len, bool final);
+// Fills buffer with response bytes starting at index, returns 0 when done
+typedef size_t (*HttpChunkFiller)(uint8_t* buffer, size_t maxLen, size_t index);
+
+void httpDefaultHeader(const char* name, const char* value);
+void httpOn(const char* path, HttpMethod method, HttpHandler handler);
+void httpOnUpload(const char* path, HttpHandler onComplete, HttpUploadHandler onUpload);
+// Requests no route matched (any method)
+void httpOnNotFound(HttpHandler handler);
+void httpBegin();
+
+// Request parameter (query string, or form body when post is true)
+bool httpParam(HttpRequest* request, const char* name, bool post, char* out, size_t len);
+size_t httpContentLength(HttpRequest* request);
+// URL path without the query string
+void httpPath(HttpRequest* request, char* out, size_t len);
+bool httpHeader(HttpRequest* request, const char* name, char* out, size_t len);
+
+void httpSend(HttpRequest* request, int code, const char* contentType, const char* body,
+              const HttpHeader* headers = nullptr, size_t headerCount = 0);
+void httpSendChunked(HttpRequest* request, const char* contentType, HttpChunkFiller filler,
+                     const HttpHeader* headers = nullptr, size_t headerCount = 0);
+// Streams length bytes of a file from offset (Content-Length set); 404 if
+// the file cannot be opened
+void httpSendFile(HttpRequest* request, int code, const char* path, size_t offset, size_t length,
+                  const char* contentType, const HttpHeader* headers = nullptr, size_t headerCount = 0);
+
+}  // namespace hal
+
+// Firmware log output
+#define LOG hal::logger
+
+#endif
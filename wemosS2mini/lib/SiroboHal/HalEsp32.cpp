@@ -0,0 +1,658 @@
+/*
+ * Sirobo HAL - ESP32 backend (Arduino-ESP32 core)
+ */
+
+#ifdef ARDUINO
+
+#include "Hal.h"
+
+#include <WiFi.h>
+#include <AsyncTCP.h>
+#include <AsyncUDP.h>
+#include <ESPmDNS.h>
+#include <ESPAsyncWebServer.h>
+#include <USB.h>
+#include <Wire.h>
+#define NO_ADAFRUIT_SSD1306_COLOR_COMPATIBILITY
+#include <Adafruit_GFX.h>
+#include <Adafruit_SSD1306.h>
+#include <Adafruit_MPU6050.h>
+#include <Adafruit_Sensor.h>
+#include <FastLED.h>
+#include <EEPROM.h>
+#include <LittleFS.h>
+#include <Update.h>
+#include <esp_partition.h>
+#include <esp_timer.h>
+#include <driver/rmt.h>
+
+#include <board.h>
+
+// =====================================================
+// HEAP STATISTICS
+// =====================================================
+
+// Counts every libc allocation in the image, including the core, WiFi and
+// AsyncTCP; requires -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+#ifdef SIROBO_HEAP_STATS
+static volatile uint32_t allocations = 0;
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+  allocations++;
+  return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+  allocations++;
+  return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+  if (size) allocations++;
+  return __real_realloc(ptr, size);
+}
+}
+#endif
+
+namespace hal {
+
+static AsyncWebServer server(80);
+static AsyncUDP udpSockets[UDP_MAX_SOCKETS];
+static int udpSocketCount = 0;
+static AsyncWebSocket* ws = nullptr;
+static Adafruit_MPU6050 mpu;
+// Our own CDC interface; the core's Serial stays off (ARDUINO_USB_CDC_ON_BOOT=0)
+static USBCDC usbSerial;
+static StaticSemaphore_t usbLockBuffer;
+static SemaphoreHandle_t usbLock = nullptr;
+
+// =====================================================
+// TIME
+// =====================================================
+
+uint32_t millis() { return ::millis(); }
+uint32_t micros() { return ::micros(); }
+uint64_t micros64() { return esp_timer_get_time(); }
+void delay(uint32_t ms) { ::delay(ms); }
+void delayMicroseconds(uint32_t us) { ::delayMicroseconds(us); }
+void yield() { ::yield(); }
+
+// =====================================================
+// GPIO / ADC / PWM
+// =====================================================
+
+void pinMode(uint8_t pin, PinMode mode) {
+  static const uint8_t modes[] = { INPUT, OUTPUT, INPUT_PULLUP };
+  ::pinMode(pin, modes[mode]);
+}
+
+void digitalWrite(uint8_t pin, bool level) { ::digitalWrite(pin, level ? HIGH : LOW); }
+bool digitalRead(uint8_t pin) { return ::digitalRead(pin) == HIGH; }
+int analogRead(uint8_t pin) { return ::analogRead(pin); }
+
+uint32_t pulseIn(uint8_t pin, bool level, uint32_t timeoutUs) {
+  return ::pulseIn(pin, level ? HIGH : LOW, timeoutUs);
+}
+
+void pwmSetup(uint8_t channel, uint32_t frequency, uint8_t resolution) {
+  ledcSetup(channel, frequency, resolution);
+}
+
+void pwmAttach(uint8_t pin, uint8_t channel) { ledcAttachPin(pin, channel); }
+void pwmWrite(uint8_t channel, uint32_t duty) { ledcWrite(channel, duty); }
+
+void tone(uint8_t pin, unsigned int frequency, unsigned long durationMs) {
+  ::tone(pin, frequency, durationMs);
+}
+
+void noTone(uint8_t pin) { ::noTone(pin); }
+
+// =====================================================
+// I2C DEVICES
+// =====================================================
+
+void i2cBegin(int sda, int scl) { Wire.begin(sda, scl); }
+
+bool imuBegin() {
+  if (!mpu.begin()) return false;
+
+  mpu.setAccelerometerRange(MPU6050_RANGE_2_G);
+  mpu.setGyroRange(MPU6050_RANGE_250_DEG);
+  mpu.setFilterBandwidth(MPU6050_BAND_21_HZ);
+  return true;
+}
+
+bool imuRead(ImuSample& sample) {
+  sensors_event_t a, g, temp;
+  if (!mpu.getEvent(&a, &g, &temp)) return false;
+
+  sample.ax = a.acceleration.x;
+  sample.ay = a.acceleration.y;
+  sample.az = a.acceleration.z;
+  sample.gx = g.gyro.x;
+  sample.gy = g.gyro.y;
+  sample.gz = g.gyro.z;
+  return true;
+}
+
+class Ssd1306Display : public Display {
+public:
+  Ssd1306Display() : _oled(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET) {}
+
+  bool begin() override { return _oled.begin(SSD1306_SWITCHCAPVCC, OLED_ADDRESS); }
+  void clearDisplay() override { _oled.clearDisplay(); }
+  void display() override { _oled.display(); }
+  uint8_t* getBuffer() override { return _oled.getBuffer(); }
+
+  void setTextSize(uint8_t size) override { _oled.setTextSize(size); }
+  void setTextColor(uint16_t color) override { _oled.setTextColor(color); }
+  void setCursor(int16_t x, int16_t y) override { _oled.setCursor(x, y); }
+  void print(const char* text) override { _oled.print(text); }
+  void print(int value) override { _oled.print(value); }
+  void print(float value, int digits) override { _oled.print(value, digits); }
+  void println(const char* text) override { _oled.println(text); }
+  void println(int value) override { _oled.println(value); }
+
+  void drawPixel(int16_t x, int16_t y, uint16_t color) override { _oled.drawPixel(x, y, color); }
+  void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) override {
+    _oled.drawLine(x0, y0, x1, y1, color);
+  }
+  void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override {
+    _oled.drawRect(x, y, w, h, color);
+  }
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override {
+    _oled.fillRect(x, y, w, h, color);
+  }
+  void drawCircle(int16_t x, int16_t y, int16_t r, uint16_t color) override {
+    _oled.drawCircle(x, y, r, color);
+  }
+  void fillCircle(int16_t x, int16_t y, int16_t r, uint16_t color) override {
+    _oled.fillCircle(x, y, r, color);
+  }
+  void fillTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1,
+                    int16_t x2, int16_t y2, uint16_t color) override {
+    _oled.fillTriangle(x0, y0, x1, y1, x2, y2, color);
+  }
+
+private:
+  Adafruit_SSD1306 _oled;
+};
+
+Display& display() {
+  static Ssd1306Display oled;
+  return oled;
+}
+
+// =====================================================
+// LED STRIP
+// =====================================================
+
+// WS2812 bits as RMT items: 25 ns ticks (80 MHz APB / 2), one item per
+// bit, then the 50 us low that latches the frame. A frame of NUM_LEDS fits
+// the channel's 64-item block, so the RMT sends it without the CPU.
+#define LED_RMT_CHANNEL RMT_CHANNEL_0
+#define LED_T0H 16      // 0.4 us
+#define LED_T0L 34      // 0.85 us
+#define LED_T1H 32      // 0.8 us
+#define LED_T1L 18      // 0.45 us
+#define LED_LATCH 2000  // 50 us
+
+static rmt_item32_t ledItems[NUM_LEDS * 24 + 1];
+static uint8_t ledCount = 0;
+static uint8_t ledBrightness = 255;
+static bool ledReady = false;
+
+void ledsBegin(uint8_t count) {
+  ledCount = count < NUM_LEDS ? count : NUM_LEDS;
+  rmt_config_t config = RMT_DEFAULT_CONFIG_TX((gpio_num_t)LED_PIN, LED_RMT_CHANNEL);
+  config.clk_div = 2;
+  ledReady = rmt_config(&config) == ESP_OK && rmt_driver_install(LED_RMT_CHANNEL, 0, 0) == ESP_OK;
+}
+
+void ledsShow(const Rgb* pixels, uint8_t count) {
+  if (!ledReady) return;
+  rmt_item32_t* item = ledItems;
+  for (int i = 0; i < count && i < ledCount; i++) {
+    // Green, red, blue, most significant bit first
+    uint8_t bytes[3] = { pixels[i].g, pixels[i].r, pixels[i].b };
+    for (uint8_t value : bytes) {
+      value = (uint16_t)value * (ledBrightness + 1) >> 8;
+      for (uint8_t bit = 0x80; bit; bit >>= 1) {
+        bool one = value & bit;
+        item->level0 = 1;
+        item->duration0 = one ? LED_T1H : LED_T0H;
+        item->level1 = 0;
+        item->duration1 = one ? LED_T1L : LED_T0L;
+        item++;
+      }
+    }
+  }
+  item->level0 = 0;
+  item->duration0 = LED_LATCH;
+  item->level1 = 0;
+  item->duration1 = 0;
+  item++;
+
+  // Waits for the previous frame only; this one goes out in the background
+  rmt_write_items(LED_RMT_CHANNEL, ledItems, item - ledItems, false);
+}
+
+bool ledsBusy() { return ledReady && rmt_wait_tx_done(LED_RMT_CHANNEL, 0) != ESP_OK; }
+
+void ledsSetBrightness(uint8_t brightness) { ledBrightness = brightness; }
+
+Rgb hsv(uint8_t hue, uint8_t saturation, uint8_t value) {
+  CRGB rgb = CHSV(hue, saturation, value);
+  return { rgb.r, rgb.g, rgb.b };
+}
+
+// =====================================================
+// STORAGE
+// =====================================================
+
+void storageBegin(size_t size) { EEPROM.begin(size); }
+void storageRead(size_t address, void* data, size_t len) { EEPROM.readBytes(address, data, len); }
+void storageWrite(size_t address, const void* data, size_t len) { EEPROM.writeBytes(address, data, len); }
+bool storageCommit() { return EEPROM.commit(); }
+
+// =====================================================
+// FILESYSTEM
+// =====================================================
+
+bool fsBegin() { return LittleFS.begin(false); }
+
+size_t fsRead(const char* path, void* data, size_t maxLen) {
+  File file = LittleFS.open(path, "r");
+  if (!file) return 0;
+  size_t n = file.read((uint8_t*)data, maxLen);
+  file.close();
+  return n;
+}
+
+// =====================================================
+// FLASH
+// =====================================================
+
+#define STORE_PARTITION_SUBTYPE 0x40
+#define SESSION_PARTITION_SUBTYPE 0x41
+#define SPRITES_PARTITION_SUBTYPE 0x42
+
+static const esp_partition_t* regionPartition(FlashRegion region) {
+  static const esp_partition_t* store = esp_partition_find_first(
+    ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)STORE_PARTITION_SUBTYPE, "store");
+  static const esp_partition_t* session = esp_partition_find_first(
+    ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)SESSION_PARTITION_SUBTYPE, "session");
+  static const esp_partition_t* sprites = esp_partition_find_first(
+    ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)SPRITES_PARTITION_SUBTYPE, "sprites");
+  switch (region) {
+    case FLASH_SESSION: return session;
+    case FLASH_SPRITES: return sprites;
+    default: return store;
+  }
+}
+
+size_t flashSize(FlashRegion region) {
+  const esp_partition_t* partition = regionPartition(region);
+  return partition ? partition->size : 0;
+}
+
+size_t flashSectorSize() { return SPI_FLASH_SEC_SIZE; }
+
+bool flashRead(size_t offset, void* data, size_t len, FlashRegion region) {
+  const esp_partition_t* partition = regionPartition(region);
+  return partition && esp_partition_read(partition, offset, data, len) == ESP_OK;
+}
+
+bool flashWrite(size_t offset, const void* data, size_t len, FlashRegion region) {
+  const esp_partition_t* partition = regionPartition(region);
+  return partition && esp_partition_write(partition, offset, data, len) == ESP_OK;
+}
+
+bool flashErase(size_t sector, FlashRegion region) {
+  const esp_partition_t* partition = regionPartition(region);
+  return partition &&
+         esp_partition_erase_range(partition, sector * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE) == ESP_OK;
+}
+
+// =====================================================
+// SYSTEM
+// =====================================================
+
+uint32_t freeHeap() { return ESP.getFreeHeap(); }
+uint32_t minFreeHeap() { return ESP.getMinFreeHeap(); }
+uint32_t largestFreeBlock() { return ESP.getMaxAllocHeap(); }
+
+uint32_t allocationCount() {
+#ifdef SIROBO_HEAP_STATS
+  return allocations;
+#else
+  return 0;
+#endif
+}
+
+const char* chipModel() { return ESP.getChipModel(); }
+void restart() { ESP.restart(); }
+
+bool otaBegin() { return Update.begin(UPDATE_SIZE_UNKNOWN); }
+bool otaWrite(const uint8_t* data, size_t len) { return Update.write((uint8_t*)data, len) == len; }
+bool otaEnd() { return Update.end(true); }
+void otaAbort() { Update.abort(); }
+bool otaHasError() { return Update.hasError(); }
+const char* otaErrorString() { return Update.errorString(); }
+
+Logger logger;
+
+void Logger::begin(unsigned long baud) { Serial1.begin(baud); }
+void Logger::print(const char* text) { Serial1.print(text); }
+void Logger::print(int value) { Serial1.print(value); }
+void Logger::println(const char* text) { Serial1.println(text); }
+void Logger::println(int value) { Serial1.println(value); }
+
+void Logger::printf(const char* format, ...) {
+  char buffer[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  Serial1.print(buffer);
+}
+
+// =====================================================
+// NETWORK - WiFi
+// =====================================================
+
+void wifiStartStation(const char* ssid, const char* password) {
+  WiFi.mode(WIFI_AP_STA);
+  WiFi.begin(ssid, password);
+}
+
+bool wifiStationConnected() { return WiFi.status() == WL_CONNECTED; }
+
+void wifiStartAccessPoint(const char* ssid, const char* password, bool keepStation) {
+  if (!keepStation) WiFi.mode(WIFI_AP);
+  WiFi.softAP(ssid, password);
+}
+
+void wifiAccessPointIp(char* out, size_t len) {
+  strlcpy(out, WiFi.softAPIP().toString().c_str(), len);
+}
+
+void wifiStationIp(char* out, size_t len) {
+  strlcpy(out, WiFi.localIP().toString().c_str(), len);
+}
+
+bool wifiScanStart() { return WiFi.scanNetworks(true) == WIFI_SCAN_RUNNING; }
+
+int wifiScanComplete() {
+  int16_t result = WiFi.scanComplete();
+  if (result == WIFI_SCAN_RUNNING) return WIFI_SCAN_BUSY;
+  return result < 0 ? WIFI_SCAN_ERROR : result;
+}
+
+bool wifiScanResult(int index, WifiNetwork& network) {
+  if (index < 0 || index >= WiFi.scanComplete()) return false;
+  strlcpy(network.ssid, WiFi.SSID(index).c_str(), sizeof(network.ssid));
+  network.rssi = WiFi.RSSI(index);
+  network.secured = WiFi.encryptionType(index) != WIFI_AUTH_OPEN;
+  return true;
+}
+
+void wifiScanDelete() { WiFi.scanDelete(); }
+
+// =====================================================
+// NETWORK - WebSocket
+// =====================================================
+
+static WsEventHandler wsHandler = nullptr;
+// A binary frame may arrive over several TCP segments; one is put back
+// together at a time
+static uint8_t wsIncoming[WS_BINARY_MAX];
+static uint32_t wsIncomingClient = 0;
+static size_t wsIncomingReceived = 0;
+
+void wsBegin(const char* path, WsEventHandler handler) {
+  wsHandler = handler;
+  ws = new AsyncWebSocket(path);
+  ws->onEvent([](AsyncWebSocket *server, AsyncWebSocketClient *client,
+                 AwsEventType type, void *arg, uint8_t *data, size_t len) {
+    switch (type) {
+      case WS_EVT_CONNECT:
+        wsHandler(WS_EVENT_CONNECT, client->id(), nullptr, 0);
+        break;
+      case WS_EVT_DISCONNECT:
+        wsHandler(WS_EVENT_DISCONNECT, client->id(), nullptr, 0);
+        break;
+      case WS_EVT_DATA: {
+        // Only single-frame messages are supported; text in one segment
+        AwsFrameInfo *info = (AwsFrameInfo*)arg;
+        if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
+          data[len] = 0;
+          wsHandler(WS_EVENT_TEXT, client->id(), data, len);
+        } else if (info->final && info->num == 0 && info->opcode == WS_BINARY && info->len <= WS_BINARY_MAX) {
+          if (info->index == 0) {
+            wsIncomingClient = client->id();
+            wsIncomingReceived = 0;
+          }
+          if (client->id() != wsIncomingClient || info->index != wsIncomingReceived) break;
+          memcpy(wsIncoming + info->index, data, len);
+          wsIncomingReceived += len;
+          if (wsIncomingReceived == info->len) {
+            wsHandler(WS_EVENT_BINARY, client->id(), wsIncoming, info->len);
+          }
+        }
+        break;
+      }
+      case WS_EVT_PONG:
+      case WS_EVT_ERROR:
+        break;
+    }
+  });
+  server.addHandler(ws);
+}
+
+void wsTextAll(const char* text, size_t len) { ws->textAll(text, len); }
+void wsText(uint32_t clientId, const char* text, size_t len) { ws->text(clientId, text, len); }
+void wsBinary(uint32_t clientId, const uint8_t* data, size_t len) {
+  ws->binary(clientId, const_cast<uint8_t*>(data), len);
+}
+bool wsWritable(uint32_t clientId) { return ws && ws->availableForWrite(clientId); }
+size_t wsCount() { return ws ? ws->count() : 0; }
+void wsCleanup() { ws->cleanupClients(); }
+
+// =====================================================
+// NETWORK - UDP and mDNS
+// =====================================================
+
+static int udpListening(AsyncUDP& udp, UdpHandler handler) {
+  udp.onPacket([handler](AsyncUDPPacket packet) {
+    IPAddress remote = packet.remoteIP();
+    uint8_t ip[4] = { remote[0], remote[1], remote[2], remote[3] };
+    handler(packet.data(), packet.length(), ip, packet.remotePort());
+  });
+  return udpSocketCount++;
+}
+
+int udpBegin(uint16_t port, UdpHandler handler) {
+  if (udpSocketCount == UDP_MAX_SOCKETS) return -1;
+  AsyncUDP& udp = udpSockets[udpSocketCount];
+  if (!udp.listen(port)) return -1;
+  return udpListening(udp, handler);
+}
+
+int udpBeginMulticast(const uint8_t group[4], uint16_t port, UdpHandler handler) {
+  if (udpSocketCount == UDP_MAX_SOCKETS) return -1;
+  AsyncUDP& udp = udpSockets[udpSocketCount];
+  // Joins on every interface, so members are found through the AP and the station
+  if (!udp.listenMulticast(IPAddress(group[0], group[1], group[2], group[3]), port)) return -1;
+  return udpListening(udp, handler);
+}
+
+bool udpSend(int socket, const uint8_t ip[4], uint16_t port, const uint8_t* data, size_t len) {
+  if (socket < 0 || socket >= udpSocketCount) return false;
+  return udpSockets[socket].writeTo(data, len, IPAddress(ip[0], ip[1], ip[2], ip[3]), port) == len;
+}
+
+bool mdnsBegin(const char* hostname) { return MDNS.begin(hostname); }
+
+void mdnsAddService(const char* service, const char* proto, uint16_t port) {
+  MDNS.addService(service, proto, port);
+}
+
+void mdnsAddServiceTxt(const char* service, const char* proto, const char* key, const char* value) {
+  MDNS.addServiceTxt(service, proto, key, value);
+}
+
+// =====================================================
+// USB - CDC serial
+// =====================================================
+
+#define USB_RX_BUFFER 2048      // One full frame while the loop is busy
+#define USB_TX_TIMEOUT_MS 5     // A stalled host costs at most this per write
+
+bool usbBegin() {
+  usbLock = xSemaphoreCreateMutexStatic(&usbLockBuffer);
+  usbSerial.setRxBufferSize(USB_RX_BUFFER);
+  usbSerial.setTxTimeoutMs(USB_TX_TIMEOUT_MS);
+  usbSerial.begin();
+  return USB.begin();
+}
+
+// DTR: set while a host program has the port open
+bool usbConnected() { return usbSerial; }
+
+size_t usbRead(uint8_t* data, size_t len) {
+  size_t available = usbSerial.available();
+  if (available == 0) return 0;
+  return usbSerial.read(data, available < len ? available : len);
+}
+
+// The loop and the AsyncTCP task both send; the lock keeps frames whole.
+// A write cut short by the timeout leaves a partial frame, which the host
+// skips by its checksum.
+bool usbWrite(const uint8_t* header, size_t headerLen, const uint8_t* data, size_t len) {
+  if (!usbLock || !usbSerial) return false;
+  xSemaphoreTake(usbLock, portMAX_DELAY);
+  bool sent = usbSerial.write(header, headerLen) == headerLen && usbSerial.write(data, len) == len;
+  xSemaphoreGive(usbLock);
+  return sent;
+}
+
+// =====================================================
+// NETWORK - HTTP
+// =====================================================
+
+// The async server hands out its own request objects; the HAL request is
+// the same pointer under an opaque type
+static AsyncWebServerRequest* native(HttpRequest* request) {
+  return reinterpret_cast<AsyncWebServerRequest*>(request);
+}
+
+static HttpRequest* wrap(AsyncWebServerRequest* request) {
+  return reinterpret_cast<HttpRequest*>(request);
+}
+
+static WebRequestMethod nativeMethod(HttpMethod method) {
+  return method == HTTP_METHOD_POST ? HTTP_POST : HTTP_GET;
+}
+
+void httpDefaultHeader(const char* name, const char* value) {
+  DefaultHeaders::Instance().addHeader(name, value);
+}
+
+void httpOn(const char* path, HttpMethod method, HttpHandler handler) {
+  server.on(path, nativeMethod(method), [handler](AsyncWebServerRequest *request) {
+    handler(wrap(request));
+  });
+}
+
+void httpOnUpload(const char* path, HttpHandler onComplete, HttpUploadHandler onUpload) {
+  server.on(path, HTTP_POST,
+    [onComplete](AsyncWebServerRequest *request) {
+      onComplete(wrap(request));
+    },
+    [onUpload](AsyncWebServerRequest *request, String filename, size_t index,
+               uint8_t *data, size_t len, bool final) {
+      onUpload(wrap(request), filename.c_str(), index, data, len, final);
+    });
+}
+
+// The async server keeps every request header for the catch-all handler
+void httpOnNotFound(HttpHandler handler) {
+  server.onNotFound([handler](AsyncWebServerRequest *request) {
+    handler(wrap(request));
+  });
+}
+
+void httpBegin() { server.begin(); }
+
+bool httpParam(HttpRequest* request, const char* name, bool post, char* out, size_t len) {
+  AsyncWebServerRequest* req = native(request);
+  if (!req->hasParam(name, post)) return false;
+  strlcpy(out, req->getParam(name, post)->value().c_str(), len);
+  return true;
+}
+
+size_t httpContentLength(HttpRequest* request) {
+  return native(request)->contentLength();
+}
+
+void httpPath(HttpRequest* request, char* out, size_t len) {
+  strlcpy(out, native(request)->url().c_str(), len);
+}
+
+bool httpHeader(HttpRequest* request, const char* name, char* out, size_t len) {
+  AsyncWebServerRequest* req = native(request);
+  if (!req->hasHeader(name)) return false;
+  strlcpy(out, req->header(name).c_str(), len);
+  return true;
+}
+
+static void addHeaders(AsyncWebServerResponse* response, const HttpHeader* headers, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    response->addHeader(headers[i].name, headers[i].value);
+  }
+}
+
+void httpSend(HttpRequest* request, int code, const char* contentType, const char* body,
+              const HttpHeader* headers, size_t headerCount) {
+  AsyncWebServerResponse *response = native(request)->beginResponse(code, contentType, body);
+  addHeaders(response, headers, headerCount);
+  native(request)->send(response);
+}
+
+void httpSendChunked(HttpRequest* request, const char* contentType, HttpChunkFiller filler,
+                     const HttpHeader* headers, size_t headerCount) {
+  AsyncWebServerResponse *response = native(request)->beginChunkedResponse(contentType,
+    [filler](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+      return filler(buffer, maxLen, index);
+    });
+  addHeaders(response, headers, headerCount);
+  native(request)->send(response);
+}
+
+void httpSendFile(HttpRequest* request, int code, const char* path, size_t offset, size_t length,
+                  const char* contentType, const HttpHeader* headers, size_t headerCount) {
+  File file = LittleFS.open(path, "r");
+  if (!file || !file.seek(offset)) {
+    native(request)->send(404, "text/plain", "Not found");
+    return;
+  }
+  // The response owns the file handle; it closes when the response is freed
+  AsyncWebServerResponse *response = native(request)->beginResponse(contentType, length,
+    [file, length](uint8_t *buffer, size_t maxLen, size_t index) mutable -> size_t {
+      size_t n = length - index < maxLen ? length - index : maxLen;
+      return file.read(buffer, n);
+    });
+  response->setCode(code);
+  addHeaders(response, headers, headerCount);
+  native(request)->send(response);
+}
+
+}  // namespace hal
+
+#endif
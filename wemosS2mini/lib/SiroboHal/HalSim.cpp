@@ -0,0 +1,641 @@
+/*
+ * Sirobo HAL - simulated backend: time, pins, devices, storage, system
+ */
+
+#ifndef ARDUINO
+
+#include "HalSim.h"
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+// =====================================================
+// HEAP STATISTICS
+// =====================================================
+
+// With SIROBO_HEAP_STATS the firmware's mallocs are wrapped
+// (-Wl,--wrap=malloc,...) and operator new is routed through them, so every
+// allocation made by code linked into the program is counted. Free heap is
+// then modelled as SIM_HEAP_SIZE minus the bytes in use.
+#ifdef SIROBO_HEAP_STATS
+static uint32_t allocations = 0;
+static int64_t bytesInUse = 0;
+static int64_t peakBytesInUse = 0;
+
+static void countAllocation(void* ptr) {
+  if (!ptr) return;
+  allocations++;
+  bytesInUse += malloc_usable_size(ptr);
+  if (bytesInUse > peakBytesInUse) peakBytesInUse = bytesInUse;
+}
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+
+void* __wrap_malloc(size_t size) {
+  void* ptr = __real_malloc(size);
+  countAllocation(ptr);
+  return ptr;
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+  void* ptr = __real_calloc(count, size);
+  countAllocation(ptr);
+  return ptr;
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+  if (ptr) bytesInUse -= malloc_usable_size(ptr);
+  void* result = __real_realloc(ptr, size);
+  if (result) {
+    countAllocation(result);
+  } else if (ptr && size) {
+    bytesInUse += malloc_usable_size(ptr);  // Failed, the old block stays
+  }
+  return result;
+}
+
+void __wrap_free(void* ptr) {
+  if (ptr) bytesInUse -= malloc_usable_size(ptr);
+  __real_free(ptr);
+}
+}
+
+void* operator new(size_t size) {
+  void* ptr = malloc(size ? size : 1);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+#endif
+
+// =====================================================
+// ARDUINO HELPERS
+// =====================================================
+
+static std::mt19937 randomEngine(1);
+
+long map(long x, long inMin, long inMax, long outMin, long outMax) {
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+long random(long howsmall, long howbig) {
+  if (howsmall >= howbig) return howsmall;
+  return howsmall + (long)(randomEngine() % (unsigned long)(howbig - howsmall));
+}
+
+void randomSeed(unsigned long seed) {
+  if (seed != 0) randomEngine.seed(seed);
+}
+
+namespace hal {
+namespace sim {
+
+struct PwmChannel {
+  uint32_t frequency;
+  uint8_t resolution;
+  uint32_t duty;
+};
+
+struct ScriptEvent {
+  uint64_t timeUs;
+  std::string command;
+};
+
+static int analogValues[SIM_PIN_COUNT];
+static bool digitalLevels[SIM_PIN_COUNT];
+static bool digitalOutputs[SIM_PIN_COUNT];
+static uint32_t pulseWidths[SIM_PIN_COUNT];
+static int8_t pinChannels[SIM_PIN_COUNT];
+static PwmChannel pwmChannels[SIM_PWM_CHANNELS];
+static unsigned int currentTone = 0;
+
+static ImuSample imuSample = { 0, 0, 9.81f, 0, 0, 0 };
+static bool imuPresent = true;
+
+static Rgb ledPixels[16];
+static uint8_t ledCount = 0;
+static uint8_t brightness = 255;
+static uint32_t showCount = 0;
+static uint64_t ledSentAt = 0;     // micros64() when the last frame is out
+
+static bool virtualClock = false;
+static uint64_t virtualMicros = 0;
+static TimeHook timeHook = nullptr;
+static struct timespec startTime;
+static bool startTimeSet = false;
+
+static std::vector<ScriptEvent> script;
+static size_t scriptIndex = 0;
+static bool quit = false;
+
+static std::vector<uint8_t> storage;
+static std::string storagePath = "sirobo_storage.bin";
+
+static std::vector<uint8_t> flash;
+static std::string flashPath = "sirobo_flash.bin";
+static uint32_t flashErases[SIM_FLASH_SIZE / SIM_FLASH_SECTOR];
+
+static std::string dataDir = "data";
+
+static FILE* otaFile = nullptr;
+static bool otaError = false;
+
+static int restartArgc = 0;
+static char** restartArgv = nullptr;
+
+static void initPins() {
+  static bool initialized = false;
+  if (initialized) return;
+  initialized = true;
+
+  for (int i = 0; i < SIM_PIN_COUNT; i++) {
+    // Inputs idle high like pulled-up buttons
+    digitalLevels[i] = true;
+    pinChannels[i] = -1;
+  }
+}
+
+// =====================================================
+// INPUTS / OUTPUTS
+// =====================================================
+
+void setAnalog(uint8_t pin, int value) { if (pin < SIM_PIN_COUNT) analogValues[pin] = value; }
+void setDigital(uint8_t pin, bool level) { initPins(); if (pin < SIM_PIN_COUNT) digitalLevels[pin] = level; }
+void setPulse(uint8_t pin, uint32_t widthUs) { if (pin < SIM_PIN_COUNT) pulseWidths[pin] = widthUs; }
+void setImu(const ImuSample& sample) { imuSample = sample; }
+
+bool digitalOutput(uint8_t pin) { return pin < SIM_PIN_COUNT && digitalOutputs[pin]; }
+uint32_t pwmDuty(uint8_t channel) { return channel < SIM_PWM_CHANNELS ? pwmChannels[channel].duty : 0; }
+uint8_t pwmResolution(uint8_t channel) { return channel < SIM_PWM_CHANNELS ? pwmChannels[channel].resolution : 0; }
+int8_t pwmChannelForPin(uint8_t pin) { initPins(); return pin < SIM_PIN_COUNT ? pinChannels[pin] : -1; }
+unsigned int toneFrequency() { return currentTone; }
+Rgb ledPixel(uint8_t index) { return index < ledCount ? ledPixels[index] : Rgb{ 0, 0, 0 }; }
+uint8_t ledBrightness() { return brightness; }
+uint32_t ledShowCount() { return showCount; }
+
+// =====================================================
+// TIME
+// =====================================================
+
+void useVirtualTime(bool enabled) { virtualClock = enabled; }
+bool virtualTime() { return virtualClock; }
+
+void advanceMicros(uint64_t us) {
+  virtualMicros += us;
+  if (timeHook) timeHook(virtualMicros);
+  runScript();
+}
+
+void setTimeHook(TimeHook hook) { timeHook = hook; }
+
+uint64_t nowMicros() {
+  if (virtualClock) return virtualMicros;
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (!startTimeSet) {
+    startTime = now;
+    startTimeSet = true;
+  }
+  return (uint64_t)(now.tv_sec - startTime.tv_sec) * 1000000ULL +
+         (now.tv_nsec - startTime.tv_nsec) / 1000;
+}
+
+// =====================================================
+// SCRIPT
+// =====================================================
+
+bool loadScript(const char* path) {
+  FILE* in = fopen(path, "r");
+  if (!in) {
+    perror(path);
+    return false;
+  }
+
+  char line[1024];
+  while (fgets(line, sizeof(line), in)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    char* p = line;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '\0' || *p == '#') continue;
+
+    char* rest;
+    double timeMs = strtod(p, &rest);
+    while (*rest == ' ' || *rest == '\t') rest++;
+    script.push_back({ (uint64_t)(timeMs * 1000.0), rest });
+  }
+  fclose(in);
+
+  std::stable_sort(script.begin(), script.end(),
+                   [](const ScriptEvent& a, const ScriptEvent& b) { return a.timeUs < b.timeUs; });
+  return true;
+}
+
+static void runScriptCommand(const char* command) {
+  char name[16];
+  int consumed = 0;
+  if (sscanf(command, "%15s %n", name, &consumed) != 1) return;
+  const char* args = command + consumed;
+
+  int pin, value;
+  if (strcmp(name, "adc") == 0 && sscanf(args, "%d %d", &pin, &value) == 2) {
+    setAnalog(pin, value);
+  } else if (strcmp(name, "digital") == 0 && sscanf(args, "%d %d", &pin, &value) == 2) {
+    setDigital(pin, value != 0);
+  } else if (strcmp(name, "pulse") == 0 && sscanf(args, "%d %d", &pin, &value) == 2) {
+    setPulse(pin, value);
+  } else if (strcmp(name, "imu") == 0) {
+    ImuSample s;
+    if (sscanf(args, "%f %f %f %f %f %f", &s.ax, &s.ay, &s.az, &s.gx, &s.gy, &s.gz) == 6) {
+      setImu(s);
+    }
+  } else if (strcmp(name, "ws") == 0) {
+    injectWsText(0, args);
+  } else if (strcmp(name, "quit") == 0) {
+    quit = true;
+  } else {
+    fprintf(stderr, "sim: unknown script command: %s\n", command);
+  }
+}
+
+void runScript() {
+  uint64_t now = nowMicros();
+  while (scriptIndex < script.size() && script[scriptIndex].timeUs <= now) {
+    runScriptCommand(script[scriptIndex].command.c_str());
+    scriptIndex++;
+  }
+}
+
+bool quitRequested() { return quit; }
+void requestQuit() { quit = true; }
+
+void setStoragePath(const char* path) { storagePath = path; }
+void setFlashPath(const char* path) { flashPath = path; }
+void setDataPath(const char* path) { dataDir = path; }
+const char* dataPath() { return dataDir.c_str(); }
+
+uint32_t flashEraseCount(size_t sector) {
+  return sector < SIM_FLASH_SIZE / SIM_FLASH_SECTOR ? flashErases[sector] : 0;
+}
+
+void setRestartArgs(int argc, char** argv) {
+  restartArgc = argc;
+  restartArgv = argv;
+}
+
+}  // namespace sim
+
+using namespace sim;
+
+// =====================================================
+// TIME
+// =====================================================
+
+uint32_t millis() { return (uint32_t)(nowMicros() / 1000); }
+uint32_t micros() { return (uint32_t)nowMicros(); }
+uint64_t micros64() { return nowMicros(); }
+
+uint32_t cycleCount() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint32_t)((uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+
+uint32_t cycleFrequency() { return 1000000000UL; }
+
+void delay(uint32_t ms) { delayMicroseconds(ms * 1000); }
+
+void delayMicroseconds(uint32_t us) {
+  if (virtualClock) {
+    advanceMicros(us);
+    return;
+  }
+  struct timespec ts = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000 };
+  nanosleep(&ts, nullptr);
+}
+
+void yield() {}
+
+// =====================================================
+// GPIO / ADC / PWM
+// =====================================================
+
+void pinMode(uint8_t pin, PinMode mode) { initPins(); }
+
+void digitalWrite(uint8_t pin, bool level) {
+  if (pin < SIM_PIN_COUNT) digitalOutputs[pin] = level;
+}
+
+void digitalWriteFast(uint8_t pin, bool level) { digitalWrite(pin, level); }
+
+bool digitalRead(uint8_t pin) {
+  initPins();
+  return pin < SIM_PIN_COUNT && digitalLevels[pin];
+}
+
+int analogRead(uint8_t pin) { return pin < SIM_PIN_COUNT ? analogValues[pin] : 0; }
+
+uint32_t pulseIn(uint8_t pin, bool level, uint32_t timeoutUs) {
+  if (pin >= SIM_PIN_COUNT) return 0;
+  uint32_t width = pulseWidths[pin];
+  return width > timeoutUs ? 0 : width;
+}
+
+void pwmSetup(uint8_t channel, uint32_t frequency, uint8_t resolution) {
+  if (channel >= SIM_PWM_CHANNELS) return;
+  pwmChannels[channel].frequency = frequency;
+  pwmChannels[channel].resolution = resolution;
+}
+
+void pwmAttach(uint8_t pin, uint8_t channel) {
+  initPins();
+  if (pin < SIM_PIN_COUNT) pinChannels[pin] = channel;
+}
+
+void pwmWrite(uint8_t channel, uint32_t duty) {
+  if (channel < SIM_PWM_CHANNELS) pwmChannels[channel].duty = duty;
+}
+
+void tone(uint8_t pin, unsigned int frequency, unsigned long durationMs) { currentTone = frequency; }
+void noTone(uint8_t pin) { currentTone = 0; }
+
+// =====================================================
+// I2C DEVICES
+// =====================================================
+
+void i2cBegin(int sda, int scl) {}
+
+bool imuBegin() { return imuPresent; }
+
+bool imuRead(ImuSample& sample) {
+  sample = imuSample;
+  return imuPresent;
+}
+
+// =====================================================
+// LED STRIP
+// =====================================================
+
+void ledsBegin(uint8_t count) {
+  ledCount = count < 16 ? count : 16;
+}
+
+void ledsShow(const Rgb* pixels, uint8_t count) {
+  for (int i = 0; i < count && i < ledCount; i++) {
+    ledPixels[i] = pixels[i];
+  }
+  showCount++;
+  // 30 us per LED at 800 kHz, then the 50 us latch
+  uint64_t now = micros64();
+  ledSentAt = (ledSentAt > now ? ledSentAt : now) + ledCount * 30 + 50;
+}
+
+bool ledsBusy() { return micros64() < ledSentAt; }
+
+void ledsSetBrightness(uint8_t value) { brightness = value; }
+
+Rgb hsv(uint8_t hue, uint8_t saturation, uint8_t value) {
+  // Six-sector HSV to RGB on 0-255 scales
+  uint8_t region = hue / 43;
+  uint8_t remainder = (hue - region * 43) * 6;
+  uint8_t p = (value * (255 - saturation)) >> 8;
+  uint8_t q = (value * (255 - ((saturation * remainder) >> 8))) >> 8;
+  uint8_t t = (value * (255 - ((saturation * (255 - remainder)) >> 8))) >> 8;
+
+  switch (region) {
+    case 0: return { value, t, p };
+    case 1: return { q, value, p };
+    case 2: return { p, value, t };
+    case 3: return { p, q, value };
+    case 4: return { t, p, value };
+    default: return { value, p, q };
+  }
+}
+
+// =====================================================
+// STORAGE
+// =====================================================
+
+void storageBegin(size_t size) {
+  // Erased flash reads as 0xFF
+  storage.assign(size, 0xFF);
+
+  FILE* in = fopen(storagePath.c_str(), "rb");
+  if (in) {
+    size_t n = fread(storage.data(), 1, size, in);
+    (void)n;
+    fclose(in);
+  }
+}
+
+void storageRead(size_t address, void* data, size_t len) {
+  if (address + len > storage.size()) return;
+  memcpy(data, storage.data() + address, len);
+}
+
+void storageWrite(size_t address, const void* data, size_t len) {
+  if (address + len > storage.size()) return;
+  memcpy(storage.data() + address, data, len);
+}
+
+bool storageCommit() {
+  FILE* out = fopen(storagePath.c_str(), "wb");
+  if (!out) return false;
+  bool ok = fwrite(storage.data(), 1, storage.size(), out) == storage.size();
+  fclose(out);
+  return ok;
+}
+
+// =====================================================
+// FILESYSTEM
+// =====================================================
+
+bool fsBegin() {
+  struct stat st;
+  return stat(dataDir.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+size_t fsRead(const char* path, void* data, size_t maxLen) {
+  FILE* in = fopen((dataDir + path).c_str(), "rb");
+  if (!in) return 0;
+  size_t n = fread(data, 1, maxLen, in);
+  fclose(in);
+  return n;
+}
+
+// =====================================================
+// FLASH
+// =====================================================
+
+static void flashLoad() {
+  if (!flash.empty()) return;
+  flash.assign(SIM_FLASH_SIZE + SIM_SESSION_FLASH_SIZE + SIM_SPRITE_FLASH_SIZE, 0xFF);
+
+  FILE* in = fopen(flashPath.c_str(), "rb");
+  if (in) {
+    size_t n = fread(flash.data(), 1, flash.size(), in);
+    (void)n;
+    fclose(in);
+  }
+}
+
+static bool flashSave() {
+  FILE* out = fopen(flashPath.c_str(), "wb");
+  if (!out) return false;
+  bool ok = fwrite(flash.data(), 1, flash.size(), out) == flash.size();
+  fclose(out);
+  return ok;
+}
+
+// The regions live in one image: store, session, sprites
+static size_t regionBase(FlashRegion region) {
+  switch (region) {
+    case FLASH_SESSION: return SIM_FLASH_SIZE;
+    case FLASH_SPRITES: return SIM_FLASH_SIZE + SIM_SESSION_FLASH_SIZE;
+    default: return 0;
+  }
+}
+
+size_t flashSize(FlashRegion region) {
+  switch (region) {
+    case FLASH_SESSION: return SIM_SESSION_FLASH_SIZE;
+    case FLASH_SPRITES: return SIM_SPRITE_FLASH_SIZE;
+    default: return SIM_FLASH_SIZE;
+  }
+}
+
+size_t flashSectorSize() { return SIM_FLASH_SECTOR; }
+
+bool flashRead(size_t offset, void* data, size_t len, FlashRegion region) {
+  flashLoad();
+  if (offset + len > flashSize(region)) return false;
+  memcpy(data, flash.data() + regionBase(region) + offset, len);
+  return true;
+}
+
+bool flashWrite(size_t offset, const void* data, size_t len, FlashRegion region) {
+  flashLoad();
+  if (offset + len > flashSize(region)) return false;
+  // Like NOR flash, a write can only clear bits
+  const uint8_t* bytes = (const uint8_t*)data;
+  uint8_t* target = flash.data() + regionBase(region) + offset;
+  for (size_t i = 0; i < len; i++) target[i] &= bytes[i];
+  return flashSave();
+}
+
+bool flashErase(size_t sector, FlashRegion region) {
+  flashLoad();
+  if ((sector + 1) * SIM_FLASH_SECTOR > flashSize(region)) return false;
+  memset(flash.data() + regionBase(region) + sector * SIM_FLASH_SECTOR, 0xFF, SIM_FLASH_SECTOR);
+  if (region == FLASH_STORE) flashErases[sector]++;
+  return flashSave();
+}
+
+// =====================================================
+// SYSTEM
+// =====================================================
+
+uint32_t freeHeap() {
+#ifdef SIROBO_HEAP_STATS
+  int64_t available = (int64_t)SIM_HEAP_SIZE - bytesInUse;
+  return available < 0 ? 0 : (uint32_t)available;
+#else
+  struct mallinfo2 info = mallinfo2();
+  return (uint32_t)info.fordblks;
+#endif
+}
+
+uint32_t minFreeHeap() {
+#ifdef SIROBO_HEAP_STATS
+  int64_t available = (int64_t)SIM_HEAP_SIZE - peakBytesInUse;
+  return available < 0 ? 0 : (uint32_t)available;
+#else
+  return freeHeap();
+#endif
+}
+
+// The host allocator does not fragment like the ESP32 heap
+uint32_t largestFreeBlock() { return freeHeap(); }
+
+uint32_t allocationCount() {
+#ifdef SIROBO_HEAP_STATS
+  return allocations;
+#else
+  return 0;
+#endif
+}
+
+const char* chipModel() { return "Simulator"; }
+
+void restart() {
+  fflush(stdout);
+  if (restartArgv) {
+    execv("/proc/self/exe", restartArgv);
+    perror("sim: restart");
+  }
+  exit(0);
+}
+
+bool otaBegin() {
+  otaFile = fopen("sirobo_ota.bin", "wb");
+  otaError = otaFile == nullptr;
+  return !otaError;
+}
+
+bool otaWrite(const uint8_t* data, size_t len) {
+  if (!otaFile || fwrite(data, 1, len, otaFile) != len) otaError = true;
+  return !otaError;
+}
+
+bool otaEnd() {
+  if (otaFile) fclose(otaFile);
+  otaFile = nullptr;
+  return !otaError;
+}
+
+void otaAbort() {
+  if (otaFile) fclose(otaFile);
+  otaFile = nullptr;
+  remove("sirobo_ota.bin");
+  otaError = true;
+}
+
+bool otaHasError() { return otaError; }
+const char* otaErrorString() { return otaError ? "write failed" : "no error"; }
+
+Logger logger;
+
+void Logger::begin(unsigned long baud) { setvbuf(stdout, nullptr, _IOLBF, 0); }
+void Logger::print(const char* text) { fputs(text, stdout); }
+void Logger::print(int value) { fprintf(stdout, "%d", value); }
+void Logger::println(const char* text) { fprintf(stdout, "%s\n", text); }
+void Logger::println(int value) { fprintf(stdout, "%d\n", value); }
+
+void Logger::printf(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  vfprintf(stdout, format, args);
+  va_end(args);
+}
+
+}  // namespace hal
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ * Sirobo HAL - simulated board (native build)
+ *
+ * The simulated backend keeps every pin, the IMU, the OLED framebuffer,
+ * the LED strip and the storage in memory. Test drivers and simulators
+ * set inputs and inspect outputs through this header; the firmware only
+ * ever sees Hal.h.
+ *
+ * Time runs off the host clock by default. In virtual time it only moves
+ * when advanceMicros() is called (or the firmware calls delay()), so the
+ * firmware can run many times faster than real time and deterministically.
+ *
+ * Sensor script (--script): one event per line, "<time_ms> <command> <args>",
+ * applied when the simulated clock reaches time_ms. '#' starts a comment.
+ *   adc <pin> <value>            analogRead() result
+ *   digital <pin> <0|1>          digitalRead() level
+ *   pulse <pin> <us>             pulseIn() width (e.g. ultrasonic echo)
+ *   imu <ax> <ay> <az> <gx> <gy> <gz>
+ *   ws <json>                    WebSocket text message from client 0
+ *   quit                         stop the simulation
+ */
+
+#ifndef SIROBO_HAL_SIM_H
+#define SIROBO_HAL_SIM_H
+
+#ifndef ARDUINO
+
+#include "Hal.h"
+
+namespace hal {
+namespace sim {
+
+#define SIM_PIN_COUNT 64
+#define SIM_PWM_CHANNELS 8
+#define SIM_WS_BROADCAST 0xFFFFFFFFUL  // clientId seen by the send hook for wsTextAll()
+#define SIM_HEAP_SIZE (192 * 1024UL)   // Free heap of a booted robot, for the heap model
+#define SIM_WIFI_SCAN_MS 2000          // Duration of a simulated WiFi scan
+#define SIM_FLASH_SIZE (16 * 1024UL)   // Key/value store region, like the robot's partition
+#define SIM_SESSION_FLASH_SIZE (16 * 1024UL)   // Session region, after it in the image
+#define SIM_SPRITE_FLASH_SIZE (32 * 1024UL)    // Sprite region, after that
+#define SIM_FLASH_SECTOR 4096
+
+// Inputs
+void setAnalog(uint8_t pin, int value);
+void setDigital(uint8_t pin, bool level);
+void setPulse(uint8_t pin, uint32_t widthUs);
+void setImu(const ImuSample& sample);
+
+// Outputs
+bool digitalOutput(uint8_t pin);
+uint32_t pwmDuty(uint8_t channel);
+uint8_t pwmResolution(uint8_t channel);
+int8_t pwmChannelForPin(uint8_t pin);
+unsigned int toneFrequency();
+Rgb ledPixel(uint8_t index);
+uint8_t ledBrightness();
+uint32_t ledShowCount();
+const uint8_t* displayFrame();   // Last buffer pushed with display()
+uint32_t displayFlushCount();
+
+// Time
+void useVirtualTime(bool enabled);
+bool virtualTime();
+void advanceMicros(uint64_t us);
+uint64_t nowMicros();
+// Called whenever virtual time moves, including inside delay(), so a
+// physics model can keep the inputs in step with the firmware
+typedef void (*TimeHook)(uint64_t nowUs);
+void setTimeHook(TimeHook hook);
+
+// Script
+bool loadScript(const char* path);
+void runScript();
+bool quitRequested();
+void requestQuit();
+
+// Storage image on disk (loaded by storageBegin, written on commit)
+void setStoragePath(const char* path);
+// Flash image on disk (loaded on first access, written on change): the
+// store region, then the session region
+void setFlashPath(const char* path);
+uint32_t flashEraseCount(size_t sector);   // Of the store region
+// Host directory standing in for the robot's filesystem (default "data",
+// PlatformIO's data_dir); fsRead("/www/x") reads <path>/www/x
+void setDataPath(const char* path);
+const char* dataPath();
+
+// Network stand-in: HTTP and WebSocket on localhost, 0 disables
+void setNetworkPort(uint16_t port);
+// Port for udpBegin() calls that ask for a fixed one (discovery), so
+// several simulators can run side by side; 0 = the firmware's port.
+// UDP is off when the network is.
+void setUdpPort(uint16_t port);
+void poll();
+// Deliver a WebSocket text message as if client clientId had sent it
+void injectWsText(uint32_t clientId, const char* text);
+// Observe messages sent to clients (including injected client 0)
+typedef void (*WsSendHook)(uint32_t clientId, const char* text, size_t len);
+void setWsSendHook(WsSendHook hook);
+typedef void (*WsBinaryHook)(uint32_t clientId, const uint8_t* data, size_t len);
+void setWsBinaryHook(WsBinaryHook hook);
+// USB serial stand-in: a pty whose slave is linked at path (e.g.
+// /tmp/sirobo-usb) for a host program to open; unset, the port stays closed
+void setUsbPath(const char* path);
+
+// Called by restart(); defaults to re-executing the process
+void setRestartArgs(int argc, char** argv);
+
+}  // namespace sim
+}  // namespace hal
+
+#endif
+#endif
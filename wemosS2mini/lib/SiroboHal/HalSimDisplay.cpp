@@ -0,0 +1,316 @@
+/*
+ * Sirobo HAL - simulated SSD1306 OLED
+ *
+ * A 128x64 framebuffer in SSD1306 page layout with the drawing primitives
+ * of Adafruit GFX (same circle/triangle algorithms, 6x8 text cells).
+ */
+
+#ifndef ARDUINO
+
+#include "HalSim.h"
+
+#include <stdio.h>
+
+#include <board.h>
+
+namespace hal {
+
+// Classic 5x7 font, ASCII 0x20-0x7E, one byte per column (LSB on top)
+static const uint8_t font5x7[][5] = {
+  {0x00,0x00,0x00,0x00,0x00}, {0x00,0x00,0x5F,0x00,0x00}, {0x00,0x07,0x00,0x07,0x00}, {0x14,0x7F,0x14,0x7F,0x14},
+  {0x24,0x2A,0x7F,0x2A,0x12}, {0x23,0x13,0x08,0x64,0x62}, {0x36,0x49,0x55,0x22,0x50}, {0x00,0x05,0x03,0x00,0x00},
+  {0x00,0x1C,0x22,0x41,0x00}, {0x00,0x41,0x22,0x1C,0x00}, {0x14,0x08,0x3E,0x08,0x14}, {0x08,0x08,0x3E,0x08,0x08},
+  {0x00,0x50,0x30,0x00,0x00}, {0x08,0x08,0x08,0x08,0x08}, {0x00,0x60,0x60,0x00,0x00}, {0x20,0x10,0x08,0x04,0x02},
+  {0x3E,0x51,0x49,0x45,0x3E}, {0x00,0x42,0x7F,0x40,0x00}, {0x42,0x61,0x51,0x49,0x46}, {0x21,0x41,0x45,0x4B,0x31},
+  {0x18,0x14,0x12,0x7F,0x10}, {0x27,0x45,0x45,0x45,0x39}, {0x3C,0x4A,0x49,0x49,0x30}, {0x01,0x71,0x09,0x05,0x03},
+  {0x36,0x49,0x49,0x49,0x36}, {0x06,0x49,0x49,0x29,0x1E}, {0x00,0x36,0x36,0x00,0x00}, {0x00,0x56,0x36,0x00,0x00},
+  {0x08,0x14,0x22,0x41,0x00}, {0x14,0x14,0x14,0x14,0x14}, {0x00,0x41,0x22,0x14,0x08}, {0x02,0x01,0x51,0x09,0x06},
+  {0x32,0x49,0x79,0x41,0x3E}, {0x7E,0x11,0x11,0x11,0x7E}, {0x7F,0x49,0x49,0x49,0x36}, {0x3E,0x41,0x41,0x41,0x22},
+  {0x7F,0x41,0x41,0x22,0x1C}, {0x7F,0x49,0x49,0x49,0x41}, {0x7F,0x09,0x09,0x09,0x01}, {0x3E,0x41,0x49,0x49,0x7A},
+  {0x7F,0x08,0x08,0x08,0x7F}, {0x00,0x41,0x7F,0x41,0x00}, {0x20,0x40,0x41,0x3F,0x01}, {0x7F,0x08,0x14,0x22,0x41},
+  {0x7F,0x40,0x40,0x40,0x40}, {0x7F,0x02,0x0C,0x02,0x7F}, {0x7F,0x04,0x08,0x10,0x7F}, {0x3E,0x41,0x41,0x41,0x3E},
+  {0x7F,0x09,0x09,0x09,0x06}, {0x3E,0x41,0x51,0x21,0x5E}, {0x7F,0x09,0x19,0x29,0x46}, {0x46,0x49,0x49,0x49,0x31},
+  {0x01,0x01,0x7F,0x01,0x01}, {0x3F,0x40,0x40,0x40,0x3F}, {0x1F,0x20,0x40,0x20,0x1F}, {0x3F,0x40,0x38,0x40,0x3F},
+  {0x63,0x14,0x08,0x14,0x63}, {0x07,0x08,0x70,0x08,0x07}, {0x61,0x51,0x49,0x45,0x43}, {0x00,0x7F,0x41,0x41,0x00},
+  {0x02,0x04,0x08,0x10,0x20}, {0x00,0x41,0x41,0x7F,0x00}, {0x04,0x02,0x01,0x02,0x04}, {0x40,0x40,0x40,0x40,0x40},
+  {0x00,0x01,0x02,0x04,0x00}, {0x20,0x54,0x54,0x54,0x78}, {0x7F,0x48,0x44,0x44,0x38}, {0x38,0x44,0x44,0x44,0x20},
+  {0x38,0x44,0x44,0x48,0x7F}, {0x38,0x54,0x54,0x54,0x18}, {0x08,0x7E,0x09,0x01,0x02}, {0x0C,0x52,0x52,0x52,0x3E},
+  {0x7F,0x08,0x04,0x04,0x78}, {0x00,0x44,0x7D,0x40,0x00}, {0x20,0x40,0x44,0x3D,0x00}, {0x7F,0x10,0x28,0x44,0x00},
+  {0x00,0x41,0x7F,0x40,0x00}, {0x7C,0x04,0x18,0x04,0x78}, {0x7C,0x08,0x04,0x04,0x78}, {0x38,0x44,0x44,0x44,0x38},
+  {0x7C,0x14,0x14,0x14,0x08}, {0x08,0x14,0x14,0x18,0x7C}, {0x7C,0x08,0x04,0x04,0x08}, {0x48,0x54,0x54,0x54,0x20},
+  {0x04,0x3F,0x44,0x40,0x20}, {0x3C,0x40,0x40,0x20,0x7C}, {0x1C,0x20,0x40,0x20,0x1C}, {0x3C,0x40,0x30,0x40,0x3C},
+  {0x44,0x28,0x10,0x28,0x44}, {0x0C,0x50,0x50,0x50,0x3C}, {0x44,0x64,0x54,0x4C,0x44}, {0x00,0x08,0x36,0x41,0x00},
+  {0x00,0x00,0x7F,0x00,0x00}, {0x00,0x41,0x36,0x08,0x00}, {0x10,0x08,0x08,0x10,0x08}
+};
+
+#define SIM_DISPLAY_BYTES (SCREEN_WIDTH * SCREEN_HEIGHT / 8)
+
+class SimDisplay : public Display {
+public:
+  SimDisplay() : _textSize(1), _textColor(WHITE), _cursorX(0), _cursorY(0), _flushes(0) {
+    memset(_buffer, 0, sizeof(_buffer));
+    memset(_panel, 0, sizeof(_panel));
+  }
+
+  bool begin() override { return true; }
+  void clearDisplay() override { memset(_buffer, 0, sizeof(_buffer)); }
+
+  void display() override {
+    memcpy(_panel, _buffer, sizeof(_panel));
+    _flushes++;
+  }
+
+  uint8_t* getBuffer() override { return _buffer; }
+  const uint8_t* panel() const { return _panel; }
+  uint32_t flushes() const { return _flushes; }
+
+  void setTextSize(uint8_t size) override { _textSize = size > 0 ? size : 1; }
+  void setTextColor(uint16_t color) override { _textColor = color; }
+  void setCursor(int16_t x, int16_t y) override { _cursorX = x; _cursorY = y; }
+
+  void print(const char* text) override {
+    while (*text) write(*text++);
+  }
+
+  void print(int value) override {
+    char buffer[12];
+    snprintf(buffer, sizeof(buffer), "%d", value);
+    print(buffer);
+  }
+
+  void print(float value, int digits) override {
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+    print(buffer);
+  }
+
+  void println(const char* text) override {
+    print(text);
+    write('\n');
+  }
+
+  void println(int value) override {
+    print(value);
+    write('\n');
+  }
+
+  void drawPixel(int16_t x, int16_t y, uint16_t color) override {
+    if (x < 0 || y < 0 || x >= SCREEN_WIDTH || y >= SCREEN_HEIGHT) return;
+    uint8_t& b = _buffer[x + (y / 8) * SCREEN_WIDTH];
+    if (color == WHITE) b |= (1 << (y & 7));
+    else b &= ~(1 << (y & 7));
+  }
+
+  void drawLine(int16_t x0, int16_t y0, int16_t x1, int16_t y1, uint16_t color) override {
+    // Bresenham
+    bool steep = abs(y1 - y0) > abs(x1 - x0);
+    if (steep) { swap(x0, y0); swap(x1, y1); }
+    if (x0 > x1) { swap(x0, x1); swap(y0, y1); }
+
+    int16_t dx = x1 - x0;
+    int16_t dy = abs(y1 - y0);
+    int16_t err = dx / 2;
+    int16_t ystep = y0 < y1 ? 1 : -1;
+
+    for (; x0 <= x1; x0++) {
+      if (steep) drawPixel(y0, x0, color);
+      else drawPixel(x0, y0, color);
+      err -= dy;
+      if (err < 0) {
+        y0 += ystep;
+        err += dx;
+      }
+    }
+  }
+
+  void drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override {
+    hLine(x, y, w, color);
+    hLine(x, y + h - 1, w, color);
+    vLine(x, y, h, color);
+    vLine(x + w - 1, y, h, color);
+  }
+
+  void fillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color) override {
+    for (int16_t i = x; i < x + w; i++) vLine(i, y, h, color);
+  }
+
+  void drawCircle(int16_t x0, int16_t y0, int16_t r, uint16_t color) override {
+    int16_t f = 1 - r;
+    int16_t ddFx = 1;
+    int16_t ddFy = -2 * r;
+    int16_t x = 0;
+    int16_t y = r;
+
+    drawPixel(x0, y0 + r, color);
+    drawPixel(x0, y0 - r, color);
+    drawPixel(x0 + r, y0, color);
+    drawPixel(x0 - r, y0, color);
+
+    while (x < y) {
+      if (f >= 0) {
+        y--;
+        ddFy += 2;
+        f += ddFy;
+      }
+      x++;
+      ddFx += 2;
+      f += ddFx;
+
+      drawPixel(x0 + x, y0 + y, color);
+      drawPixel(x0 - x, y0 + y, color);
+      drawPixel(x0 + x, y0 - y, color);
+      drawPixel(x0 - x, y0 - y, color);
+      drawPixel(x0 + y, y0 + x, color);
+      drawPixel(x0 - y, y0 + x, color);
+      drawPixel(x0 + y, y0 - x, color);
+      drawPixel(x0 - y, y0 - x, color);
+    }
+  }
+
+  void fillCircle(int16_t x0, int16_t y0, int16_t r, uint16_t color) override {
+    vLine(x0, y0 - r, 2 * r + 1, color);
+
+    int16_t f = 1 - r;
+    int16_t ddFx = 1;
+    int16_t ddFy = -2 * r;
+    int16_t x = 0;
+    int16_t y = r;
+    int16_t px = x;
+    int16_t py = y;
+
+    while (x < y) {
+      if (f >= 0) {
+        y--;
+        ddFy += 2;
+        f += ddFy;
+      }
+      x++;
+      ddFx += 2;
+      f += ddFx;
+
+      if (x < y + 1) {
+        vLine(x0 + x, y0 - y, 2 * y + 1, color);
+        vLine(x0 - x, y0 - y, 2 * y + 1, color);
+      }
+      if (y != py) {
+        vLine(x0 + py, y0 - px, 2 * px + 1, color);
+        vLine(x0 - py, y0 - px, 2 * px + 1, color);
+        py = y;
+      }
+      px = x;
+    }
+  }
+
+  void fillTriangle(int16_t x0, int16_t y0, int16_t x1, int16_t y1,
+                    int16_t x2, int16_t y2, uint16_t color) override {
+    // Sort by y (y2 >= y1 >= y0), then scan-fill
+    if (y0 > y1) { swap(y0, y1); swap(x0, x1); }
+    if (y1 > y2) { swap(y2, y1); swap(x2, x1); }
+    if (y0 > y1) { swap(y0, y1); swap(x0, x1); }
+
+    if (y0 == y2) {
+      int16_t a = x0, b = x0;
+      if (x1 < a) a = x1; else if (x1 > b) b = x1;
+      if (x2 < a) a = x2; else if (x2 > b) b = x2;
+      hLine(a, y0, b - a + 1, color);
+      return;
+    }
+
+    int32_t dx01 = x1 - x0, dy01 = y1 - y0;
+    int32_t dx02 = x2 - x0, dy02 = y2 - y0;
+    int32_t dx12 = x2 - x1, dy12 = y2 - y1;
+    int32_t sa = 0, sb = 0;
+    int16_t last = y1 == y2 ? y1 : y1 - 1;
+    int16_t y;
+
+    for (y = y0; y <= last; y++) {
+      int16_t a = x0 + sa / dy01;
+      int16_t b = x0 + sb / dy02;
+      sa += dx01;
+      sb += dx02;
+      if (a > b) swap(a, b);
+      hLine(a, y, b - a + 1, color);
+    }
+
+    sa = dx12 * (y - y1);
+    sb = dx02 * (y - y0);
+    for (; y <= y2; y++) {
+      int16_t a = x1 + sa / dy12;
+      int16_t b = x0 + sb / dy02;
+      sa += dx12;
+      sb += dx02;
+      if (a > b) swap(a, b);
+      hLine(a, y, b - a + 1, color);
+    }
+  }
+
+private:
+  static void swap(int16_t& a, int16_t& b) {
+    int16_t t = a;
+    a = b;
+    b = t;
+  }
+
+  void hLine(int16_t x, int16_t y, int16_t w, uint16_t color) {
+    for (int16_t i = 0; i < w; i++) drawPixel(x + i, y, color);
+  }
+
+  void vLine(int16_t x, int16_t y, int16_t h, uint16_t color) {
+    for (int16_t i = 0; i < h; i++) drawPixel(x, y + i, color);
+  }
+
+  void write(char c) {
+    if (c == '\n') {
+      _cursorX = 0;
+      _cursorY += _textSize * 8;
+      return;
+    }
+    if (c == '\r') return;
+
+    // Wrap like Adafruit GFX
+    if (_cursorX + _textSize * 6 > SCREEN_WIDTH) {
+      _cursorX = 0;
+      _cursorY += _textSize * 8;
+    }
+    drawChar(_cursorX, _cursorY, c);
+    _cursorX += _textSize * 6;
+  }
+
+  void drawChar(int16_t x, int16_t y, char c) {
+    // Bytes outside printable ASCII (UTF-8 symbols) render as blanks
+    if (c < 0x20 || c > 0x7E) return;
+    const uint8_t* glyph = font5x7[c - 0x20];
+
+    for (int8_t col = 0; col < 5; col++) {
+      uint8_t bits = glyph[col];
+      for (int8_t row = 0; row < 8; row++, bits >>= 1) {
+        if (!(bits & 1)) continue;
+        if (_textSize == 1) drawPixel(x + col, y + row, _textColor);
+        else fillRect(x + col * _textSize, y + row * _textSize, _textSize, _textSize, _textColor);
+      }
+    }
+  }
+
+  uint8_t _buffer[SIM_DISPLAY_BYTES];
+  uint8_t _panel[SIM_DISPLAY_BYTES];
+  uint8_t _textSize;
+  uint16_t _textColor;
+  int16_t _cursorX;
+  int16_t _cursorY;
+  uint32_t _flushes;
+};
+
+static SimDisplay simDisplay;
+
+Display& display() { return simDisplay; }
+
+namespace sim {
+
+const uint8_t* displayFrame() { return simDisplay.panel(); }
+uint32_t displayFlushCount() { return simDisplay.flushes(); }
+
+}  // namespace sim
+
+}  // namespace hal
+
+#endif
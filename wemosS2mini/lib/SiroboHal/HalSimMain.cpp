@@ -0,0 +1,147 @@
+/*
+ * Sirobo HAL - native entry point
+ *
+ * Runs the firmware's setup() once and loop() forever against the
+ * simulated board.
+ *
+ * Usage: program [options]
+ *   --port <n>          HTTP/WebSocket port on 127.0.0.1 (default 8080, 0 = off)
+ *   --udp-port <n>      discovery UDP port (default: the firmware's, 4210)
+ *   --script <file>     sensor script, see HalSim.h
+ *   --virtual [us]      virtual time, advancing <us> per loop() (default 1000)
+ *   --duration <ms>     stop after this much simulated time
+ *   --storage <file>    EEPROM image (default sirobo_storage.bin)
+ *   --flash <file>      key/value store flash image (default sirobo_flash.bin)
+ *   --data <dir>        filesystem contents (default data, see `assetpack`)
+ *   --usb <path>        USB serial port as a pty linked at <path> (default off)
+ *   --check-allocations <ms>
+ *                       count heap allocations made by loop() and scripted
+ *                       WebSocket commands after <ms> of warm-up, exit 1 if
+ *                       there are any (needs -DSIROBO_HEAP_STATS)
+ *
+ * On exit prints the number of loop() iterations and their mean host cost.
+ *
+ * Test drivers that bring their own main() (tools/trackbench) build with
+ * SIROBO_SIM_CUSTOM_MAIN.
+ */
+
+#if !defined(ARDUINO) && !defined(SIROBO_SIM_CUSTOM_MAIN)
+
+#include "HalSim.h"
+
+#include <stdio.h>
+#include <signal.h>
+#include <time.h>
+
+void setup();
+void loop();
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void onSignal(int) { interrupted = 1; }
+
+static uint64_t hostNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int main(int argc, char** argv) {
+  using namespace hal;
+
+  uint64_t stepUs = 0;
+  uint64_t durationUs = 0;
+  bool checkAllocations = false;
+  uint64_t warmupUs = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (strcmp(arg, "--port") == 0 && hasValue) {
+      sim::setNetworkPort(atoi(argv[++i]));
+    } else if (strcmp(arg, "--udp-port") == 0 && hasValue) {
+      sim::setUdpPort(atoi(argv[++i]));
+    } else if (strcmp(arg, "--script") == 0 && hasValue) {
+      if (!sim::loadScript(argv[++i])) return 1;
+    } else if (strcmp(arg, "--virtual") == 0) {
+      stepUs = 1000;
+      if (hasValue && argv[i + 1][0] != '-') stepUs = strtoull(argv[++i], nullptr, 10);
+    } else if (strcmp(arg, "--duration") == 0 && hasValue) {
+      durationUs = strtoull(argv[++i], nullptr, 10) * 1000;
+    } else if (strcmp(arg, "--storage") == 0 && hasValue) {
+      sim::setStoragePath(argv[++i]);
+    } else if (strcmp(arg, "--flash") == 0 && hasValue) {
+      sim::setFlashPath(argv[++i]);
+    } else if (strcmp(arg, "--data") == 0 && hasValue) {
+      sim::setDataPath(argv[++i]);
+    } else if (strcmp(arg, "--usb") == 0 && hasValue) {
+      sim::setUsbPath(argv[++i]);
+    } else if (strcmp(arg, "--check-allocations") == 0 && hasValue) {
+      checkAllocations = true;
+      warmupUs = strtoull(argv[++i], nullptr, 10) * 1000;
+    } else {
+      fprintf(stderr, "unknown argument: %s\n", arg);
+      return 2;
+    }
+  }
+
+  sim::useVirtualTime(stepUs > 0);
+  sim::setRestartArgs(argc, argv);
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  sim::runScript();
+  setup();
+
+  uint64_t iterations = 0;
+  uint64_t loopNanos = 0;
+  uint32_t steadyAllocations = 0;
+  uint64_t steadyIterations = 0;
+
+  while (!interrupted && !sim::quitRequested()) {
+    sim::poll();
+
+    // The socket stand-in (poll) is host code and stays outside the count
+    bool steady = checkAllocations && sim::nowMicros() >= warmupUs;
+    uint32_t allocations = allocationCount();
+
+    sim::runScript();
+
+    uint64_t start = hostNanos();
+    loop();
+    loopNanos += hostNanos() - start;
+    iterations++;
+
+    if (steady) {
+      steadyAllocations += allocationCount() - allocations;
+      steadyIterations++;
+    }
+
+    if (stepUs > 0) {
+      sim::advanceMicros(stepUs);
+    } else {
+      // Real time: do not spin a host core at 100%
+      struct timespec ts = { 0, 100000 };
+      nanosleep(&ts, nullptr);
+    }
+
+    if (durationUs > 0 && sim::nowMicros() >= durationUs) break;
+  }
+
+  fprintf(stderr, "sim: %llu loop iterations in %.3f s simulated, mean loop() cost %.2f us\n",
+          (unsigned long long)iterations, sim::nowMicros() / 1e6,
+          iterations ? loopNanos / 1000.0 / iterations : 0.0);
+
+  if (checkAllocations) {
+#ifndef SIROBO_HEAP_STATS
+    fprintf(stderr, "sim: --check-allocations needs a -DSIROBO_HEAP_STATS build\n");
+    return 2;
+#endif
+    fprintf(stderr, "sim: %u heap allocations in %llu steady-state iterations, min free heap %u\n",
+            (unsigned)steadyAllocations, (unsigned long long)steadyIterations, (unsigned)minFreeHeap());
+    if (steadyIterations == 0 || steadyAllocations > 0) return 1;
+  }
+  return 0;
+}
+
+#endif
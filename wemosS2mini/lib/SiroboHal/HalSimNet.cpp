@@ -0,0 +1,809 @@
+/*
+ * Sirobo HAL - simulated network
+ *
+ * WiFi is faked; HTTP, WebSocket and UDP are served for real on 127.0.0.1 so
+ * the web app (or curl / any WebSocket client) can talk to the native build
+ * exactly as it would to a robot. mDNS is only logged. Everything runs on the firmware thread
+ * from sim::poll(), between loop() iterations.
+ */
+
+#ifndef ARDUINO
+
+#include "HalSim.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+
+namespace hal {
+
+// =====================================================
+// WiFi
+// =====================================================
+
+static const WifiNetwork simNetworks[] = {
+  { "Sekolah", -48, true },
+  { "Lab-Robotik", -61, true },
+  { "Tamu", -75, false }
+};
+static int scanCount = WIFI_SCAN_ERROR;  // No scan yet, like the ESP32
+static uint64_t scanDoneUs = 0;
+
+void wifiStartStation(const char* ssid, const char* password) {}
+bool wifiStationConnected() { return false; }
+void wifiStartAccessPoint(const char* ssid, const char* password, bool keepStation) {}
+void wifiAccessPointIp(char* out, size_t len) { snprintf(out, len, "127.0.0.1"); }
+void wifiStationIp(char* out, size_t len) { snprintf(out, len, "0.0.0.0"); }
+
+bool wifiScanStart() {
+  scanCount = WIFI_SCAN_BUSY;
+  scanDoneUs = sim::nowMicros() + SIM_WIFI_SCAN_MS * 1000ULL;
+  return true;
+}
+
+int wifiScanComplete() {
+  if (scanCount == WIFI_SCAN_BUSY && sim::nowMicros() >= scanDoneUs) {
+    scanCount = sizeof(simNetworks) / sizeof(simNetworks[0]);
+  }
+  return scanCount;
+}
+
+bool wifiScanResult(int index, WifiNetwork& network) {
+  if (index < 0 || index >= scanCount) return false;
+  network = simNetworks[index];
+  return true;
+}
+
+void wifiScanDelete() { scanCount = WIFI_SCAN_ERROR; }
+
+// =====================================================
+// CONNECTIONS
+// =====================================================
+
+struct Connection {
+  int fd;
+  std::string input;
+  bool websocket;
+  bool closed;
+  uint32_t clientId;
+};
+
+struct Route {
+  std::string path;
+  HttpMethod method;
+  HttpHandler handler;
+  HttpUploadHandler upload;
+};
+
+struct HttpRequest {
+  Connection* connection;
+  HttpMethod method;
+  std::string path;
+  std::string query;
+  std::string contentType;
+  std::string head;
+  std::string body;
+  bool responded;
+};
+
+static uint16_t networkPort = 8080;
+static int listenFd = -1;
+static std::vector<Connection*> connections;
+static std::vector<Route> routes;
+static HttpHandler notFoundHandler = nullptr;
+static std::vector<std::pair<std::string, std::string>> defaultHeaders;
+static std::string wsPath;
+static WsEventHandler wsHandler = nullptr;
+static sim::WsSendHook wsSendHook = nullptr;
+static sim::WsBinaryHook wsBinaryHook = nullptr;
+static uint32_t nextClientId = 1;
+static bool injectedClientConnected = false;
+static uint16_t udpPortOverride = 0;
+
+struct UdpSocket {
+  int fd;
+  UdpHandler handler;
+};
+
+static UdpSocket udpSockets[UDP_MAX_SOCKETS];
+static int udpSocketCount = 0;
+
+static void sendAll(int fd, const void* data, size_t len) {
+  const uint8_t* p = (const uint8_t*)data;
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        struct pollfd pfd = { fd, POLLOUT, 0 };
+        ::poll(&pfd, 1, 100);
+        continue;
+      }
+      return;
+    }
+    p += n;
+    len -= n;
+  }
+}
+
+static void sendString(int fd, const std::string& s) { sendAll(fd, s.data(), s.size()); }
+
+// =====================================================
+// SHA-1 / BASE64 (WebSocket handshake)
+// =====================================================
+
+static uint32_t rol(uint32_t v, int bits) { return (v << bits) | (v >> (32 - bits)); }
+
+static void sha1(const uint8_t* data, size_t len, uint8_t digest[20]) {
+  uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+  std::vector<uint8_t> msg(data, data + len);
+  uint64_t bitLen = (uint64_t)len * 8;
+  msg.push_back(0x80);
+  while (msg.size() % 64 != 56) msg.push_back(0);
+  for (int i = 7; i >= 0; i--) msg.push_back((uint8_t)(bitLen >> (i * 8)));
+
+  for (size_t chunk = 0; chunk < msg.size(); chunk += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+      const uint8_t* p = &msg[chunk + i * 4];
+      w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+    for (int i = 16; i < 80; i++) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+      else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+      else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+      else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+      uint32_t t = rol(a, 5) + f + e + k + w[i];
+      e = d; d = c; c = rol(b, 30); b = a; a = t;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+  }
+
+  for (int i = 0; i < 5; i++) {
+    digest[i * 4] = h[i] >> 24;
+    digest[i * 4 + 1] = h[i] >> 16;
+    digest[i * 4 + 2] = h[i] >> 8;
+    digest[i * 4 + 3] = h[i];
+  }
+}
+
+static std::string base64(const uint8_t* data, size_t len) {
+  static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < len; i += 3) {
+    uint32_t v = data[i] << 16;
+    if (i + 1 < len) v |= data[i + 1] << 8;
+    if (i + 2 < len) v |= data[i + 2];
+    out += table[(v >> 18) & 63];
+    out += table[(v >> 12) & 63];
+    out += i + 1 < len ? table[(v >> 6) & 63] : '=';
+    out += i + 2 < len ? table[v & 63] : '=';
+  }
+  return out;
+}
+
+// =====================================================
+// HTTP PARSING
+// =====================================================
+
+static std::string headerValue(const std::string& head, const char* name) {
+  size_t nameLen = strlen(name);
+  size_t pos = head.find("\r\n");
+  while (pos != std::string::npos && pos + 2 < head.size()) {
+    size_t start = pos + 2;
+    size_t end = head.find("\r\n", start);
+    if (end == std::string::npos) end = head.size();
+    if (end - start > nameLen && head[start + nameLen] == ':' &&
+        strncasecmp(head.c_str() + start, name, nameLen) == 0) {
+      size_t v = start + nameLen + 1;
+      while (v < end && head[v] == ' ') v++;
+      return head.substr(v, end - v);
+    }
+    pos = end;
+  }
+  return "";
+}
+
+static std::string urlDecode(const std::string& s) {
+  std::string out;
+  for (size_t i = 0; i < s.size(); i++) {
+    if (s[i] == '+') out += ' ';
+    else if (s[i] == '%' && i + 2 < s.size()) {
+      out += (char)strtol(s.substr(i + 1, 2).c_str(), nullptr, 16);
+      i += 2;
+    } else out += s[i];
+  }
+  return out;
+}
+
+static bool findParam(const std::string& params, const char* name, std::string& value) {
+  size_t nameLen = strlen(name);
+  size_t pos = 0;
+  while (pos <= params.size()) {
+    size_t end = params.find('&', pos);
+    if (end == std::string::npos) end = params.size();
+    if (end - pos >= nameLen && params.compare(pos, nameLen, name) == 0 &&
+        (end - pos == nameLen || params[pos + nameLen] == '=')) {
+      size_t v = pos + nameLen + 1;
+      value = v <= end ? urlDecode(params.substr(v, end - v)) : "";
+      return true;
+    }
+    pos = end + 1;
+  }
+  return false;
+}
+
+static const char* statusText(int code) {
+  switch (code) {
+    case 200: return "OK";
+    case 206: return "Partial Content";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 406: return "Not Acceptable";
+    case 416: return "Range Not Satisfiable";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    default: return "Status";
+  }
+}
+
+static std::string responseHead(int code, const char* contentType,
+                                const HttpHeader* headers, size_t headerCount) {
+  char line[64];
+  snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", code, statusText(code));
+  std::string head = line;
+  head += "Content-Type: ";
+  head += contentType;
+  head += "\r\nConnection: close\r\n";
+  for (auto& h : defaultHeaders) head += h.first + ": " + h.second + "\r\n";
+  for (size_t i = 0; i < headerCount; i++) {
+    head += headers[i].name;
+    head += ": ";
+    head += headers[i].value;
+    head += "\r\n";
+  }
+  return head;
+}
+
+// Multipart uploads carry the file as the first part
+static bool extractUpload(const HttpRequest& req, std::string& filename, size_t& offset, size_t& len) {
+  filename = "upload.bin";
+  offset = 0;
+  len = req.body.size();
+
+  size_t b = req.contentType.find("boundary=");
+  if (req.contentType.compare(0, 19, "multipart/form-data") != 0 || b == std::string::npos) {
+    return true;
+  }
+
+  std::string boundary = "\r\n--" + req.contentType.substr(b + 9);
+  size_t partHead = req.body.find("\r\n\r\n");
+  if (partHead == std::string::npos) return false;
+
+  size_t fn = req.body.find("filename=\"");
+  if (fn != std::string::npos && fn < partHead) {
+    size_t end = req.body.find('"', fn + 10);
+    filename = req.body.substr(fn + 10, end - fn - 10);
+  }
+
+  offset = partHead + 4;
+  size_t end = req.body.find(boundary, offset);
+  if (end == std::string::npos) return false;
+  len = end - offset;
+  return true;
+}
+
+static void handleHttp(Connection* conn, const std::string& head, const std::string& body) {
+  char method[8] = "";
+  char target[1024] = "";
+  sscanf(head.c_str(), "%7s %1023s", method, target);
+
+  HttpRequest req;
+  req.connection = conn;
+  req.method = strcmp(method, "POST") == 0 ? HTTP_METHOD_POST : HTTP_METHOD_GET;
+  req.path = target;
+  size_t q = req.path.find('?');
+  if (q != std::string::npos) {
+    req.query = req.path.substr(q + 1);
+    req.path.resize(q);
+  }
+  req.contentType = headerValue(head, "Content-Type");
+  req.head = head;
+  req.body = body;
+  req.responded = false;
+
+  if (strcmp(method, "OPTIONS") == 0) {
+    httpSend(&req, 200, "text/plain", "");
+    return;
+  }
+
+  for (Route& route : routes) {
+    if (route.path != req.path || route.method != req.method) continue;
+
+    if (route.upload) {
+      std::string filename;
+      size_t offset, len;
+      if (extractUpload(req, filename, offset, len)) {
+        route.upload(&req, filename.c_str(), 0, (uint8_t*)&req.body[offset], len, true);
+      }
+    }
+    route.handler(&req);
+    if (!req.responded) httpSend(&req, 500, "text/plain", "No response");
+    return;
+  }
+
+  if (notFoundHandler) {
+    notFoundHandler(&req);
+    if (!req.responded) httpSend(&req, 500, "text/plain", "No response");
+    return;
+  }
+  httpSend(&req, 404, "text/plain", "Not found");
+}
+
+// =====================================================
+// WEBSOCKET FRAMING
+// =====================================================
+
+static void wsSendFrame(int fd, uint8_t opcode, const void* data, size_t len) {
+  uint8_t header[10];
+  size_t headerLen = 2;
+  header[0] = 0x80 | opcode;
+  if (len < 126) {
+    header[1] = len;
+  } else if (len < 65536) {
+    header[1] = 126;
+    header[2] = len >> 8;
+    header[3] = len;
+    headerLen = 4;
+  } else {
+    header[1] = 127;
+    for (int i = 0; i < 8; i++) header[2 + i] = (uint8_t)((uint64_t)len >> ((7 - i) * 8));
+    headerLen = 10;
+  }
+  sendAll(fd, header, headerLen);
+  if (len) sendAll(fd, data, len);
+}
+
+static void wsUpgrade(Connection* conn, const std::string& head) {
+  std::string key = headerValue(head, "Sec-WebSocket-Key") + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+  uint8_t digest[20];
+  sha1((const uint8_t*)key.data(), key.size(), digest);
+
+  sendString(conn->fd, "HTTP/1.1 101 Switching Protocols\r\n"
+                       "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+                       "Sec-WebSocket-Accept: " + base64(digest, 20) + "\r\n\r\n");
+
+  conn->websocket = true;
+  conn->clientId = nextClientId++;
+  if (wsHandler) wsHandler(WS_EVENT_CONNECT, conn->clientId, nullptr, 0);
+}
+
+static void closeConnection(Connection* conn) {
+  if (conn->closed) return;
+  conn->closed = true;
+  close(conn->fd);
+  if (conn->websocket && wsHandler) wsHandler(WS_EVENT_DISCONNECT, conn->clientId, nullptr, 0);
+}
+
+// Returns false once no complete frame is buffered
+static bool wsProcessFrame(Connection* conn) {
+  const std::string& in = conn->input;
+  if (in.size() < 2) return false;
+
+  uint8_t b0 = in[0], b1 = in[1];
+  bool fin = b0 & 0x80;
+  uint8_t opcode = b0 & 0x0F;
+  bool masked = b1 & 0x80;
+  uint64_t len = b1 & 0x7F;
+  size_t pos = 2;
+
+  if (len == 126) {
+    if (in.size() < 4) return false;
+    len = ((uint8_t)in[2] << 8) | (uint8_t)in[3];
+    pos = 4;
+  } else if (len == 127) {
+    if (in.size() < 10) return false;
+    len = 0;
+    for (int i = 0; i < 8; i++) len = (len << 8) | (uint8_t)in[2 + i];
+    pos = 10;
+  }
+
+  uint8_t mask[4] = { 0, 0, 0, 0 };
+  if (masked) {
+    if (in.size() < pos + 4) return false;
+    memcpy(mask, in.data() + pos, 4);
+    pos += 4;
+  }
+  if (in.size() < pos + len) return false;
+
+  // Payload plus room for the NUL terminator handed to the firmware
+  std::vector<uint8_t> payload(len + 1);
+  for (uint64_t i = 0; i < len; i++) payload[i] = in[pos + i] ^ mask[i & 3];
+  payload[len] = 0;
+  conn->input.erase(0, pos + len);
+
+  switch (opcode) {
+    case 0x1:  // Text (single-frame only, like the ESP32 backend)
+      if (fin && wsHandler) wsHandler(WS_EVENT_TEXT, conn->clientId, payload.data(), len);
+      break;
+    case 0x2:  // Binary
+      if (fin && wsHandler && len <= WS_BINARY_MAX) wsHandler(WS_EVENT_BINARY, conn->clientId, payload.data(), len);
+      break;
+    case 0x8:  // Close
+      wsSendFrame(conn->fd, 0x8, nullptr, 0);
+      closeConnection(conn);
+      return false;
+    case 0x9:  // Ping
+      wsSendFrame(conn->fd, 0xA, payload.data(), len);
+      break;
+    default:
+      break;
+  }
+  return true;
+}
+
+static void processInput(Connection* conn) {
+  if (conn->websocket) {
+    while (!conn->closed && wsProcessFrame(conn)) {}
+    return;
+  }
+
+  size_t headEnd = conn->input.find("\r\n\r\n");
+  if (headEnd == std::string::npos) return;
+  std::string head = conn->input.substr(0, headEnd);
+
+  size_t contentLength = strtoul(headerValue(head, "Content-Length").c_str(), nullptr, 10);
+  if (conn->input.size() < headEnd + 4 + contentLength) return;
+  std::string body = conn->input.substr(headEnd + 4, contentLength);
+  conn->input.clear();
+
+  char target[1024] = "";
+  sscanf(head.c_str(), "%*s %1023s", target);
+  if (strcasecmp(headerValue(head, "Upgrade").c_str(), "websocket") == 0 && wsPath == target) {
+    wsUpgrade(conn, head);
+    return;
+  }
+
+  handleHttp(conn, head, body);
+  closeConnection(conn);
+}
+
+// =====================================================
+// SIM CONTROL
+// =====================================================
+
+namespace sim {
+
+void setNetworkPort(uint16_t port) { networkPort = port; }
+void setUdpPort(uint16_t port) { udpPortOverride = port; }
+void setWsSendHook(WsSendHook hook) { wsSendHook = hook; }
+void setWsBinaryHook(WsBinaryHook hook) { wsBinaryHook = hook; }
+
+void injectWsText(uint32_t clientId, const char* text) {
+  if (!wsHandler) return;
+  if (clientId == 0 && !injectedClientConnected) {
+    injectedClientConnected = true;
+    wsHandler(WS_EVENT_CONNECT, 0, nullptr, 0);
+  }
+
+  // Reused across calls so injected commands do not allocate once warm
+  static std::vector<uint8_t> data;
+  size_t len = strlen(text);
+  data.assign(text, text + len + 1);
+  wsHandler(WS_EVENT_TEXT, clientId, data.data(), len);
+}
+
+static void pollUdp() {
+  uint8_t buffer[1500];
+  for (int i = 0; i < udpSocketCount; i++) {
+    while (true) {
+      struct sockaddr_in from;
+      socklen_t fromLen = sizeof(from);
+      ssize_t n = recvfrom(udpSockets[i].fd, buffer, sizeof(buffer), 0, (struct sockaddr*)&from, &fromLen);
+      if (n < 0) break;
+      uint8_t ip[4];
+      memcpy(ip, &from.sin_addr.s_addr, 4);
+      udpSockets[i].handler(buffer, n, ip, ntohs(from.sin_port));
+    }
+  }
+}
+
+void poll() {
+  pollUdp();
+  if (listenFd < 0) return;
+
+  while (true) {
+    int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) break;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    connections.push_back(new Connection{ fd, "", false, false, 0 });
+  }
+
+  char buffer[4096];
+  for (size_t i = 0; i < connections.size(); i++) {
+    Connection* conn = connections[i];
+    while (!conn->closed) {
+      ssize_t n = recv(conn->fd, buffer, sizeof(buffer), 0);
+      if (n > 0) {
+        conn->input.append(buffer, n);
+        processInput(conn);
+      } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        closeConnection(conn);
+      } else {
+        break;
+      }
+    }
+  }
+
+  wsCleanup();
+}
+
+}  // namespace sim
+
+// =====================================================
+// WEBSOCKET
+// =====================================================
+
+void wsBegin(const char* path, WsEventHandler handler) {
+  wsPath = path;
+  wsHandler = handler;
+}
+
+void wsTextAll(const char* text, size_t len) {
+  for (Connection* conn : connections) {
+    if (conn->websocket && !conn->closed) wsSendFrame(conn->fd, 0x1, text, len);
+  }
+  if (wsSendHook) wsSendHook(SIM_WS_BROADCAST, text, len);
+}
+
+void wsText(uint32_t clientId, const char* text, size_t len) {
+  for (Connection* conn : connections) {
+    if (conn->websocket && !conn->closed && conn->clientId == clientId) {
+      wsSendFrame(conn->fd, 0x1, text, len);
+    }
+  }
+  if (wsSendHook) wsSendHook(clientId, text, len);
+}
+
+void wsBinary(uint32_t clientId, const uint8_t* data, size_t len) {
+  for (Connection* conn : connections) {
+    if (conn->websocket && !conn->closed && conn->clientId == clientId) {
+      wsSendFrame(conn->fd, 0x2, data, len);
+    }
+  }
+  if (wsBinaryHook) wsBinaryHook(clientId, data, len);
+}
+
+// Sockets are written straight away, so there is no queue to fill
+bool wsWritable(uint32_t clientId) { return true; }
+
+size_t wsCount() {
+  size_t count = injectedClientConnected ? 1 : 0;
+  for (Connection* conn : connections) {
+    if (conn->websocket && !conn->closed) count++;
+  }
+  return count;
+}
+
+void wsCleanup() {
+  for (size_t i = 0; i < connections.size();) {
+    if (connections[i]->closed) {
+      delete connections[i];
+      connections.erase(connections.begin() + i);
+    } else {
+      i++;
+    }
+  }
+}
+
+// =====================================================
+// UDP / MDNS
+// =====================================================
+
+static int udpOpen(uint16_t port, uint32_t address, UdpHandler handler) {
+  if (networkPort == 0 || udpSocketCount == UDP_MAX_SOCKETS) return -1;
+
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int one = 1;
+  // Group members in other simulators share the port
+  if (address == INADDR_ANY) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(address);
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("sim: udp bind");
+    close(fd);
+    return -1;
+  }
+  // Multicast leaves through loopback, where the other simulators listen
+  struct in_addr loopback = { htonl(INADDR_LOOPBACK) };
+  setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &loopback, sizeof(loopback));
+
+  udpSockets[udpSocketCount] = { fd, handler };
+  return udpSocketCount++;
+}
+
+int udpBegin(uint16_t port, UdpHandler handler) {
+  if (port && udpPortOverride) port = udpPortOverride;
+  int socket = udpOpen(port, INADDR_LOOPBACK, handler);
+  if (socket >= 0 && port) printf("sim: udp 127.0.0.1:%u\n", port);
+  return socket;
+}
+
+int udpBeginMulticast(const uint8_t group[4], uint16_t port, UdpHandler handler) {
+  int socket = udpOpen(port, INADDR_ANY, handler);
+  if (socket < 0) return -1;
+
+  struct ip_mreq membership;
+  memcpy(&membership.imr_multiaddr.s_addr, group, 4);
+  membership.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+  if (setsockopt(udpSockets[socket].fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0) {
+    perror("sim: multicast join");
+  }
+  printf("sim: udp multicast %u.%u.%u.%u:%u\n", group[0], group[1], group[2], group[3], port);
+  return socket;
+}
+
+bool udpSend(int socket, const uint8_t ip[4], uint16_t port, const uint8_t* data, size_t len) {
+  if (socket < 0 || socket >= udpSocketCount) return false;
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  memcpy(&addr.sin_addr.s_addr, ip, 4);
+  return sendto(udpSockets[socket].fd, data, len, 0, (struct sockaddr*)&addr, sizeof(addr)) == (ssize_t)len;
+}
+
+bool mdnsBegin(const char* hostname) {
+  printf("sim: mDNS %s.local (not advertised)\n", hostname);
+  return true;
+}
+
+void mdnsAddService(const char* service, const char* proto, uint16_t port) {
+  printf("sim: mDNS service %s.%s port %u\n", service, proto, port);
+}
+
+void mdnsAddServiceTxt(const char* service, const char* proto, const char* key, const char* value) {}
+
+// =====================================================
+// HTTP
+// =====================================================
+
+void httpDefaultHeader(const char* name, const char* value) {
+  defaultHeaders.push_back({ name, value });
+}
+
+void httpOn(const char* path, HttpMethod method, HttpHandler handler) {
+  routes.push_back({ path, method, handler, nullptr });
+}
+
+void httpOnUpload(const char* path, HttpHandler onComplete, HttpUploadHandler onUpload) {
+  routes.push_back({ path, HTTP_METHOD_POST, onComplete, onUpload });
+}
+
+void httpOnNotFound(HttpHandler handler) { notFoundHandler = handler; }
+
+void httpBegin() {
+  if (networkPort == 0) return;
+
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(networkPort);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  if (bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, 16) < 0) {
+    perror("sim: http listen");
+    close(listenFd);
+    listenFd = -1;
+    return;
+  }
+  fcntl(listenFd, F_SETFL, O_NONBLOCK);
+  // The listening socket must not leak into a re-executed process on restart()
+  fcntl(listenFd, F_SETFD, FD_CLOEXEC);
+  printf("sim: serving http://127.0.0.1:%u (WebSocket %s)\n", networkPort, wsPath.c_str());
+}
+
+bool httpParam(HttpRequest* request, const char* name, bool post, char* out, size_t len) {
+  std::string value;
+  const std::string& params = post ? request->body : request->query;
+  if (!findParam(params, name, value)) return false;
+  snprintf(out, len, "%s", value.c_str());
+  return true;
+}
+
+size_t httpContentLength(HttpRequest* request) { return request->body.size(); }
+
+void httpPath(HttpRequest* request, char* out, size_t len) {
+  snprintf(out, len, "%s", request->path.c_str());
+}
+
+bool httpHeader(HttpRequest* request, const char* name, char* out, size_t len) {
+  std::string value = headerValue(request->head, name);
+  if (value.empty()) return false;
+  snprintf(out, len, "%s", value.c_str());
+  return true;
+}
+
+void httpSend(HttpRequest* request, int code, const char* contentType, const char* body,
+              const HttpHeader* headers, size_t headerCount) {
+  size_t len = strlen(body);
+  std::string head = responseHead(code, contentType, headers, headerCount);
+  head += "Content-Length: " + std::to_string(len) + "\r\n\r\n";
+  sendString(request->connection->fd, head);
+  sendAll(request->connection->fd, body, len);
+  request->responded = true;
+}
+
+void httpSendChunked(HttpRequest* request, const char* contentType, HttpChunkFiller filler,
+                     const HttpHeader* headers, size_t headerCount) {
+  int fd = request->connection->fd;
+  std::string head = responseHead(200, contentType, headers, headerCount);
+  head += "Transfer-Encoding: chunked\r\n\r\n";
+  sendString(fd, head);
+
+  uint8_t buffer[1460];
+  size_t index = 0;
+  size_t n;
+  while ((n = filler(buffer, sizeof(buffer), index)) > 0) {
+    char size[24];
+    snprintf(size, sizeof(size), "%zx\r\n", n);
+    sendString(fd, size);
+    sendAll(fd, buffer, n);
+    sendString(fd, "\r\n");
+    index += n;
+  }
+  sendString(fd, "0\r\n\r\n");
+  request->responded = true;
+}
+
+void httpSendFile(HttpRequest* request, int code, const char* path, size_t offset, size_t length,
+                  const char* contentType, const HttpHeader* headers, size_t headerCount) {
+  FILE* in = fopen((std::string(sim::dataPath()) + path).c_str(), "rb");
+  if (!in || fseek(in, offset, SEEK_SET) != 0) {
+    if (in) fclose(in);
+    httpSend(request, 404, "text/plain", "Not found");
+    return;
+  }
+
+  int fd = request->connection->fd;
+  std::string head = responseHead(code, contentType, headers, headerCount);
+  head += "Content-Length: " + std::to_string(length) + "\r\n\r\n";
+  sendString(fd, head);
+
+  uint8_t buffer[1460];
+  while (length > 0) {
+    size_t n = fread(buffer, 1, length < sizeof(buffer) ? length : sizeof(buffer), in);
+    if (n == 0) break;
+    sendAll(fd, buffer, n);
+    length -= n;
+  }
+  fclose(in);
+  request->responded = true;
+}
+
+}  // namespace hal
+
+#endif
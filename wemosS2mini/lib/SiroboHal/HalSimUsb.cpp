@@ -0,0 +1,95 @@
+/*
+ * Sirobo HAL - simulated USB CDC port
+ *
+ * The USB serial line is a pseudo-terminal: the firmware holds the master
+ * side, and a host program opens the slave through the path given to
+ * setUsbPath() (a symlink to /dev/pts/N), exactly as it would open
+ * /dev/ttyACM0 for a robot. A host "has the port open" while the slave is
+ * open. Without a path the port stays closed.
+ */
+
+#ifndef ARDUINO
+
+#include "HalSim.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <string>
+
+namespace hal {
+
+static std::string usbPath;
+static int usbMaster = -1;
+
+namespace sim {
+
+void setUsbPath(const char* path) { usbPath = path; }
+
+}  // namespace sim
+
+bool usbBegin() {
+  if (usbPath.empty()) return false;
+  usbMaster = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (usbMaster < 0 || grantpt(usbMaster) != 0 || unlockpt(usbMaster) != 0) {
+    fprintf(stderr, "sim: no pseudo-terminal for USB\n");
+    return false;
+  }
+  const char* slave = ptsname(usbMaster);
+
+  // Raw bytes, no echo; the setting outlives this first open, and closing
+  // it leaves the master hung up until a host opens the slave
+  int fd = open(slave, O_RDWR | O_NOCTTY);
+  if (fd >= 0) {
+    struct termios tio;
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+    close(fd);
+  }
+
+  unlink(usbPath.c_str());
+  if (symlink(slave, usbPath.c_str()) != 0) {
+    fprintf(stderr, "sim: cannot link %s to %s\n", usbPath.c_str(), slave);
+    return false;
+  }
+  printf("sim: USB serial %s (%s)\n", usbPath.c_str(), slave);
+  return true;
+}
+
+bool usbConnected() {
+  if (usbMaster < 0) return false;
+  struct pollfd fd = { usbMaster, 0, 0 };
+  poll(&fd, 1, 0);
+  return !(fd.revents & POLLHUP);
+}
+
+size_t usbRead(uint8_t* data, size_t len) {
+  if (usbMaster < 0) return 0;
+  ssize_t n = read(usbMaster, data, len);
+  return n > 0 ? n : 0;
+}
+
+static bool usbWriteAll(const uint8_t* data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(usbMaster, data, len);
+    if (n <= 0) return false;   // Host not reading: the rest is dropped
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+// Only the firmware thread sends in the simulator
+bool usbWrite(const uint8_t* header, size_t headerLen, const uint8_t* data, size_t len) {
+  if (!usbConnected()) return false;
+  return usbWriteAll(header, headerLen) && usbWriteAll(data, len);
+}
+
+}  // namespace hal
+
+#endif
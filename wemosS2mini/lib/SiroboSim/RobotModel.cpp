@@ -0,0 +1,101 @@
+#ifndef ARDUINO
+
+#include "RobotModel.h"
+
+#include <math.h>
+
+DriveParams defaultDriveParams() {
+  DriveParams p;
+  p.wheelBase = 130;
+  p.maxSpeed = 800;      // TT gear motor, 65 mm wheel, ~6 V
+  p.deadband = 0.15f;
+  p.timeConstant = 0.06f;
+  p.leftGain = 1.0f;
+  p.rightGain = 0.95f;
+  return p;
+}
+
+SensorParams defaultSensorParams() {
+  SensorParams p;
+  p.lineOffset = 60;
+  p.linePitch = 9.5f;
+  p.lineSpot = 4;
+  p.lineDark = 3200;
+  p.lineLight = 300;
+  p.lineNoise = 40;
+  p.sonarOffset = 50;
+  p.sonarRange = 4000;
+  p.gyroBias = 0.5f * (float)M_PI / 180.0f;
+  p.gyroNoise = 0.1f * (float)M_PI / 180.0f;
+  return p;
+}
+
+RobotModel::RobotModel(const DriveParams& drive, const SensorParams& sensors, uint32_t seed)
+  : _drive(drive), _sensors(sensors), _pose{ 0, 0, 0 }, _left(0), _right(0), _accel(0),
+    _rng(seed), _normal(0.0f, 1.0f) {}
+
+void RobotModel::reset(const TrackPose& pose) {
+  _pose = pose;
+  _left = _right = 0;
+  _accel = 0;
+}
+
+float RobotModel::wheelTarget(MotorInput input, float gain) const {
+  if (input.direction == 0 || input.duty <= _drive.deadband) return 0;
+  float effective = (input.duty - _drive.deadband) / (1 - _drive.deadband);
+  return input.direction * effective * _drive.maxSpeed * gain;
+}
+
+void RobotModel::step(float dt, MotorInput left, MotorInput right) {
+  float before = speed();
+
+  // First-order lag towards the commanded wheel speeds
+  float alpha = dt / (_drive.timeConstant + dt);
+  _left += (wheelTarget(left, _drive.leftGain) - _left) * alpha;
+  _right += (wheelTarget(right, _drive.rightGain) - _right) * alpha;
+
+  // Midpoint integration of the unicycle model
+  float v = speed();
+  float w = turnRate();
+  float heading = _pose.heading + w * dt / 2;
+  _pose.x += v * cosf(heading) * dt;
+  _pose.y += v * sinf(heading) * dt;
+  _pose.heading = remainderf(_pose.heading + w * dt, 2 * (float)M_PI);
+
+  _accel = dt > 0 ? (v - before) / dt : 0;
+}
+
+float RobotModel::turnRate() const {
+  return (_right - _left) / _drive.wheelBase;
+}
+
+Vec2 RobotModel::lineArrayCenter() const {
+  return { _pose.x + _sensors.lineOffset * cosf(_pose.heading),
+           _pose.y + _sensors.lineOffset * sinf(_pose.heading) };
+}
+
+void RobotModel::readLine(const Track& track, int out[ROBOT_LINE_SENSORS]) {
+  Vec2 center = lineArrayCenter();
+  // Unit vector pointing to the robot's right
+  float rx = sinf(_pose.heading), ry = -cosf(_pose.heading);
+
+  for (int i = 0; i < ROBOT_LINE_SENSORS; i++) {
+    float offset = (i - (ROBOT_LINE_SENSORS - 1) / 2.0f) * _sensors.linePitch;
+    float r = track.reflectance(center.x + rx * offset, center.y + ry * offset, _sensors.lineSpot);
+    float raw = _sensors.lineDark + (_sensors.lineLight - _sensors.lineDark) * r +
+                _normal(_rng) * _sensors.lineNoise;
+    out[i] = raw < 0 ? 0 : (raw > 4095 ? 4095 : (int)raw);
+  }
+}
+
+float RobotModel::readSonar(const Track& track) const {
+  Vec2 origin = { _pose.x + _sensors.sonarOffset * cosf(_pose.heading),
+                  _pose.y + _sensors.sonarOffset * sinf(_pose.heading) };
+  return track.rayDistance(origin, _pose.heading, _sensors.sonarRange);
+}
+
+float RobotModel::readGyroZ() {
+  return -turnRate() + _sensors.gyroBias + _normal(_rng) * _sensors.gyroNoise;
+}
+
+#endif
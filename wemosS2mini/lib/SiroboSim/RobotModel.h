@@ -0,0 +1,95 @@
+/*
+ * Differential-drive robot model
+ *
+ * Two DC motors behind an L298N: each wheel follows its commanded speed
+ * through a first-order lag, duty below the deadband does not move the
+ * wheel, and per-side gains model the left/right mismatch that
+ * motorLeftCalibration/motorRightCalibration are meant to cancel.
+ *
+ * Sensors are evaluated against a Track: the 8-sensor line array across the
+ * front, the ultrasonic sensor looking straight ahead and the MPU6050 gyro
+ * with bias and white noise. The gyro is mounted z-down, so clockwise
+ * rotation reads positive, matching robotRotate().
+ *
+ * Deterministic for a given seed.
+ */
+
+#ifndef SIROBO_SIM_ROBOT_MODEL_H
+#define SIROBO_SIM_ROBOT_MODEL_H
+
+#ifndef ARDUINO
+
+#include <stdint.h>
+
+#include <random>
+
+#include "Track.h"
+
+#define ROBOT_LINE_SENSORS 8
+
+struct DriveParams {
+  float wheelBase;      // mm between the wheels
+  float maxSpeed;       // mm/s at full duty
+  float deadband;       // duty fraction (0..1) that does not move the wheel
+  float timeConstant;   // s, motor lag
+  float leftGain;       // mismatch, 1.0 = nominal
+  float rightGain;
+};
+
+struct SensorParams {
+  float lineOffset;     // mm from the axle to the line array
+  float linePitch;      // mm between line sensors
+  float lineSpot;       // mm, footprint of one sensor
+  int lineDark;         // raw reading over the line
+  int lineLight;        // raw reading over the floor
+  float lineNoise;      // raw, rms
+  float sonarOffset;    // mm from the axle to the ultrasonic sensor
+  float sonarRange;     // mm, no echo beyond
+  float gyroBias;       // rad/s
+  float gyroNoise;      // rad/s, rms
+};
+
+DriveParams defaultDriveParams();
+SensorParams defaultSensorParams();
+
+// One L298N channel: IN1/IN2 direction and EN duty
+struct MotorInput {
+  int direction;  // 1 forward, -1 reverse, 0 brake
+  float duty;     // 0..1
+};
+
+class RobotModel {
+public:
+  RobotModel(const DriveParams& drive, const SensorParams& sensors, uint32_t seed);
+
+  void reset(const TrackPose& pose);
+  void step(float dt, MotorInput left, MotorInput right);
+
+  const TrackPose& pose() const { return _pose; }
+  float leftSpeed() const { return _left; }      // mm/s
+  float rightSpeed() const { return _right; }
+  float speed() const { return (_left + _right) / 2; }
+  float turnRate() const;                        // rad/s, CCW
+  float acceleration() const { return _accel; }  // mm/s^2, forward
+  Vec2 lineArrayCenter() const;
+
+  // Raw readings, leftmost first
+  void readLine(const Track& track, int out[ROBOT_LINE_SENSORS]);
+  // mm to the first obstacle ahead, -1 when out of range
+  float readSonar(const Track& track) const;
+  float readGyroZ();                              // rad/s, z-down
+
+private:
+  float wheelTarget(MotorInput input, float gain) const;
+
+  DriveParams _drive;
+  SensorParams _sensors;
+  TrackPose _pose;
+  float _left, _right;
+  float _accel;
+  std::mt19937 _rng;
+  std::normal_distribution<float> _normal;
+};
+
+#endif
+#endif
@@ -0,0 +1,94 @@
+#ifndef ARDUINO
+
+#include "SimWorld.h"
+
+#include <HalSim.h>
+#include <board.h>
+
+static const uint8_t LINE_PINS[ROBOT_LINE_SENSORS] = {
+  LINE_SENSOR_1, LINE_SENSOR_2, LINE_SENSOR_3, LINE_SENSOR_4,
+  LINE_SENSOR_5, LINE_SENSOR_6, LINE_SENSOR_7, LINE_SENSOR_8
+};
+
+static SimWorld* attachedWorld = nullptr;
+
+static void onTime(uint64_t nowUs) {
+  if (attachedWorld) attachedWorld->update(nowUs);
+}
+
+static MotorInput readMotor(uint8_t in1, uint8_t in2, uint8_t enable) {
+  using namespace hal::sim;
+
+  MotorInput input = { 0, 0 };
+  bool a = digitalOutput(in1), b = digitalOutput(in2);
+  if (a != b) input.direction = a ? 1 : -1;
+
+  int8_t channel = pwmChannelForPin(enable);
+  if (channel >= 0) {
+    uint32_t full = (1UL << pwmResolution(channel)) - 1;
+    input.duty = full ? (float)pwmDuty(channel) / full : 0;
+    if (input.duty > 1) input.duty = 1;
+  }
+  return input;
+}
+
+SimWorld::SimWorld(const Track& track, const DriveParams& drive, const SensorParams& sensors,
+                   uint32_t seed)
+  : _track(track), _robot(drive, sensors, seed), _timeUs(0) {
+  _robot.reset(track.start());
+}
+
+void SimWorld::attach() {
+  _timeUs = hal::sim::nowMicros();
+  attachedWorld = this;
+  hal::sim::setTimeHook(onTime);
+  publishSensors();
+}
+
+void SimWorld::detach() {
+  if (attachedWorld == this) {
+    attachedWorld = nullptr;
+    hal::sim::setTimeHook(nullptr);
+  }
+}
+
+void SimWorld::update(uint64_t nowUs) {
+  if (nowUs < _timeUs + SIM_PHYSICS_STEP_US) return;
+
+  MotorInput left = readMotor(MOTOR_LEFT_IN1, MOTOR_LEFT_IN2, MOTOR_LEFT_EN);
+  MotorInput right = readMotor(MOTOR_RIGHT_IN1, MOTOR_RIGHT_IN2, MOTOR_RIGHT_EN);
+
+  while (nowUs >= _timeUs + SIM_PHYSICS_STEP_US) {
+    _robot.step(SIM_PHYSICS_STEP_US / 1e6f, left, right);
+    _timeUs += SIM_PHYSICS_STEP_US;
+  }
+  publishSensors();
+}
+
+void SimWorld::publishSensors() {
+  using namespace hal::sim;
+
+  int line[ROBOT_LINE_SENSORS];
+  _robot.readLine(_track, line);
+  for (int i = 0; i < ROBOT_LINE_SENSORS; i++) {
+    setAnalog(LINE_PINS[i], line[i]);
+  }
+
+  setAnalog(LDR_LEFT, SIM_LDR_AMBIENT);
+  setAnalog(LDR_RIGHT, SIM_LDR_AMBIENT);
+
+  // Echo width as the firmware decodes it (0.034 cm/us, both ways), 0 = no echo
+  float sonar = _robot.readSonar(_track);
+  setPulse(ULTRASONIC_ECHO, sonar < 0 ? 0 : (uint32_t)(sonar / 10 * 2 / 0.034f));
+
+  hal::ImuSample imu;
+  imu.ax = _robot.acceleration() / 1000;
+  imu.ay = 0;
+  imu.az = 9.81f;
+  imu.gx = 0;
+  imu.gy = 0;
+  imu.gz = _robot.readGyroZ();
+  setImu(imu);
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * Simulated world - couples a RobotModel on a Track to the simulated board
+ *
+ * attach() hooks virtual time (hal::sim::setTimeHook), so every time the
+ * firmware's clock moves, including inside delay(), the physics advances in
+ * fixed steps: motor outputs are read from the L298N pins, the robot moves,
+ * and the line, LDR, ultrasonic and IMU inputs are updated. Only one world
+ * can be attached at a time.
+ */
+
+#ifndef SIROBO_SIM_WORLD_H
+#define SIROBO_SIM_WORLD_H
+
+#ifndef ARDUINO
+
+#include "RobotModel.h"
+#include "Track.h"
+
+#define SIM_PHYSICS_STEP_US 500
+#define SIM_LDR_AMBIENT 2000
+
+class SimWorld {
+public:
+  SimWorld(const Track& track, const DriveParams& drive, const SensorParams& sensors,
+           uint32_t seed);
+
+  void attach();
+  void detach();
+
+  // Catch up to nowUs (called from the time hook)
+  void update(uint64_t nowUs);
+
+  const Track& track() const { return _track; }
+  RobotModel& robot() { return _robot; }
+  uint64_t timeUs() const { return _timeUs; }
+
+private:
+  void publishSensors();
+
+  const Track& _track;
+  RobotModel _robot;
+  uint64_t _timeUs;
+};
+
+#endif
+#endif
@@ -0,0 +1,453 @@
+#ifndef ARDUINO
+
+#include "Track.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define TRACK_POINT_SPACING 5.0f   // mm between generated centerline points
+#define TRACK_ARENA_MARGIN 300.0f  // mm from the line to the walls
+#define TRACK_SEARCH_WINDOW 64     // segments searched either side of the hint
+#define TRACK_MARKER_LENGTH 120.0f // mm, start marker bar across the line
+#define TRACK_BUILTIN_MARKER 150.0f // mm along the line: just ahead of the start
+
+// =====================================================
+// BUILT-IN TRACKS
+// =====================================================
+
+static const char* const BUILTIN_NAMES[] = {
+  "oval", "circle", "rounded_square", "hairpin", "wavy", nullptr
+};
+
+static void appendLine(std::vector<Vec2>& points, Vec2 to) {
+  if (points.empty()) {
+    points.push_back(to);
+    return;
+  }
+  Vec2 from = points.back();
+  float length = hypotf(to.x - from.x, to.y - from.y);
+  int steps = (int)ceilf(length / TRACK_POINT_SPACING);
+  for (int i = 1; i <= steps; i++) {
+    float t = (float)i / steps;
+    points.push_back({ from.x + (to.x - from.x) * t, from.y + (to.y - from.y) * t });
+  }
+}
+
+static void appendArc(std::vector<Vec2>& points, Vec2 center, float radius,
+                      float fromDeg, float toDeg) {
+  float sweep = (toDeg - fromDeg) * (float)M_PI / 180.0f;
+  int steps = (int)ceilf(fabsf(sweep) * radius / TRACK_POINT_SPACING);
+  for (int i = 0; i <= steps; i++) {
+    float a = fromDeg * (float)M_PI / 180.0f + sweep * i / steps;
+    Vec2 p = { center.x + radius * cosf(a), center.y + radius * sinf(a) };
+    if (i == 0 && !points.empty()) {
+      appendLine(points, p);
+    } else {
+      points.push_back(p);
+    }
+  }
+}
+
+// Two straights joined by semicircles, driven counter-clockwise from the
+// middle of the bottom straight
+static void makeStadium(std::vector<Vec2>& points, float cx, float cy,
+                        float straight, float radius) {
+  float half = straight / 2;
+  points.push_back({ cx, cy - radius });
+  appendLine(points, { cx + half, cy - radius });
+  appendArc(points, { cx + half, cy }, radius, -90, 90);
+  appendLine(points, { cx - half, cy + radius });
+  appendArc(points, { cx - half, cy }, radius, 90, 270);
+  appendLine(points, { cx - TRACK_POINT_SPACING, cy - radius });
+}
+
+bool Track::loadBuiltin(const char* name, bool marker) {
+  clear();
+  _name = name;
+
+  if (strcmp(name, "oval") == 0 || strcmp(name, "hairpin") == 0) {
+    bool hairpin = name[0] == 'h';
+    float straight = hairpin ? 1400 : 1000;
+    float radius = hairpin ? 160 : 350;
+    _width = straight + 2 * radius + 2 * TRACK_ARENA_MARGIN;
+    _height = 2 * radius + 2 * TRACK_ARENA_MARGIN;
+    makeStadium(_line, _width / 2, _height / 2, straight, radius);
+  } else if (strcmp(name, "circle") == 0) {
+    float radius = 450;
+    _width = _height = 2 * radius + 2 * TRACK_ARENA_MARGIN;
+    appendArc(_line, { _width / 2, _height / 2 }, radius, -90, 270 - 0.5f);
+  } else if (strcmp(name, "rounded_square") == 0) {
+    float side = 1000, r = 120, half = side / 2;
+    _width = _height = side + 2 * TRACK_ARENA_MARGIN;
+    float cx = _width / 2, cy = _height / 2;
+    _line.push_back({ cx, cy - half });
+    appendArc(_line, { cx + half - r, cy - half + r }, r, -90, 0);
+    appendArc(_line, { cx + half - r, cy + half - r }, r, 0, 90);
+    appendArc(_line, { cx - half + r, cy + half - r }, r, 90, 180);
+    appendArc(_line, { cx - half + r, cy - half + r }, r, 180, 270);
+    appendLine(_line, { cx - TRACK_POINT_SPACING, cy - half });
+  } else if (strcmp(name, "wavy") == 0) {
+    // r(a) = 600 + 150 sin(3a): alternating left and right bends
+    float base = 600, amplitude = 150;
+    _width = _height = 2 * (base + amplitude) + 2 * TRACK_ARENA_MARGIN;
+    float cx = _width / 2, cy = _height / 2;
+    for (int i = 0; i < 720; i++) {
+      float a = (-90.0f + i * 0.5f) * (float)M_PI / 180.0f;
+      float r = base + amplitude * sinf(3 * a);
+      _line.push_back({ cx + r * cosf(a), cy + r * sinf(a) });
+    }
+  } else {
+    return false;
+  }
+
+  if (marker) _markers.push_back(TRACK_BUILTIN_MARKER);
+  addArena();
+  finish();
+  rasterize();
+  return true;
+}
+
+const char* const* Track::builtinNames() { return BUILTIN_NAMES; }
+
+void Track::loadArena(float width, float height, const TrackPose& start) {
+  clear();
+  _name = "arena";
+  _width = width;
+  _height = height;
+  _start = start;
+  _hasStart = true;
+  addArena();
+  finish();
+  rasterize();
+}
+
+// =====================================================
+// TRACK FILES
+// =====================================================
+
+static bool parsePoints(const char* text, std::vector<Vec2>& out) {
+  const char* p = text;
+  while (*p) {
+    char* end;
+    float x = strtof(p, &end);
+    if (end == p || *end != ',') return *p == '\0' || *p == '\n';
+    float y = strtof(end + 1, &end);
+    out.push_back({ x, y });
+    p = end;
+    while (*p == ' ' || *p == '\t') p++;
+  }
+  return true;
+}
+
+bool Track::load(const char* path) {
+  FILE* in = fopen(path, "r");
+  if (!in) {
+    perror(path);
+    return false;
+  }
+
+  clear();
+  _name = path;
+  std::string bitmapPath;
+
+  char line[4096];
+  int lineNumber = 0;
+  bool ok = true;
+  while (ok && fgets(line, sizeof(line), in)) {
+    lineNumber++;
+    char* comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+    line[strcspn(line, "\r\n")] = '\0';
+
+    char keyword[16];
+    int consumed = 0;
+    if (sscanf(line, "%15s %n", keyword, &consumed) != 1) continue;
+    const char* args = line + consumed;
+
+    if (strcmp(keyword, "name") == 0) {
+      _name = args;
+    } else if (strcmp(keyword, "size") == 0) {
+      ok = sscanf(args, "%f %f", &_width, &_height) == 2;
+    } else if (strcmp(keyword, "resolution") == 0) {
+      ok = sscanf(args, "%f", &_resolution) == 1 && _resolution > 0;
+    } else if (strcmp(keyword, "line_width") == 0) {
+      ok = sscanf(args, "%f", &_lineWidth) == 1;
+    } else if (strcmp(keyword, "line") == 0) {
+      ok = parsePoints(args, _line);
+    } else if (strcmp(keyword, "open") == 0) {
+      _closed = false;
+    } else if (strcmp(keyword, "obstacle") == 0) {
+      std::vector<Vec2> polygon;
+      ok = parsePoints(args, polygon) && polygon.size() >= 2;
+      if (ok) _obstacles.push_back(polygon);
+    } else if (strcmp(keyword, "start") == 0) {
+      float headingDeg;
+      ok = sscanf(args, "%f %f %f", &_start.x, &_start.y, &headingDeg) == 3;
+      _start.heading = headingDeg * (float)M_PI / 180.0f;
+      _hasStart = true;
+    } else if (strcmp(keyword, "marker") == 0) {
+      float arc;
+      ok = sscanf(args, "%f", &arc) == 1 && arc >= 0;
+      if (ok) _markers.push_back(arc);
+    } else if (strcmp(keyword, "bitmap") == 0) {
+      bitmapPath = args;
+    } else {
+      ok = false;
+    }
+  }
+  fclose(in);
+
+  if (!ok) {
+    fprintf(stderr, "%s:%d: invalid track directive\n", path, lineNumber);
+    return false;
+  }
+
+  if (!bitmapPath.empty()) {
+    // Relative to the track file
+    if (bitmapPath[0] != '/') {
+      const char* slash = strrchr(path, '/');
+      if (slash) bitmapPath = std::string(path, slash + 1 - path) + bitmapPath;
+    }
+    if (!loadPgm(bitmapPath.c_str())) return false;
+  }
+
+  if (_width <= 0 || _height <= 0) {
+    fprintf(stderr, "%s: missing size\n", path);
+    return false;
+  }
+
+  addArena();
+  finish();
+  if (!_bitmapLoaded) rasterize();
+  return true;
+}
+
+bool Track::loadPgm(const char* path) {
+  FILE* in = fopen(path, "rb");
+  if (!in) {
+    perror(path);
+    return false;
+  }
+
+  int maxValue = 0;
+  bool ok = fscanf(in, "P5 %d %d %d", &_columns, &_rows, &maxValue) == 3 &&
+            _columns > 0 && _rows > 0 && maxValue > 0 && maxValue < 256 &&
+            fgetc(in) != EOF;
+  if (ok) {
+    std::vector<uint8_t> pixels((size_t)_columns * _rows);
+    ok = fread(pixels.data(), 1, pixels.size(), in) == pixels.size();
+
+    // Image row 0 is the top of the arena
+    _bitmap.resize(pixels.size());
+    for (int row = 0; row < _rows; row++) {
+      for (int col = 0; col < _columns; col++) {
+        int v = pixels[(size_t)(_rows - 1 - row) * _columns + col] * 255 / maxValue;
+        _bitmap[(size_t)row * _columns + col] = (uint8_t)v;
+      }
+    }
+  }
+  fclose(in);
+
+  if (!ok) {
+    fprintf(stderr, "%s: not a binary 8-bit PGM\n", path);
+    return false;
+  }
+
+  _width = _columns * _resolution;
+  _height = _rows * _resolution;
+  _bitmapLoaded = true;
+  return true;
+}
+
+// =====================================================
+// GEOMETRY
+// =====================================================
+
+Track::Track() { clear(); }
+
+void Track::clear() {
+  _name.clear();
+  _width = _height = 0;
+  _resolution = 2;
+  _lineWidth = 19;
+  _closed = true;
+  _hasStart = false;
+  _start = { 0, 0, 0 };
+  _line.clear();
+  _arcLength.clear();
+  _obstacles.clear();
+  _markers.clear();
+  _columns = _rows = 0;
+  _bitmap.clear();
+  _bitmapLoaded = false;
+}
+
+void Track::addArena() {
+  _obstacles.push_back({ { 0, 0 }, { _width, 0 }, { _width, _height }, { 0, _height } });
+}
+
+void Track::finish() {
+  size_t segments = _closed ? _line.size() : (_line.size() ? _line.size() - 1 : 0);
+  _arcLength.assign(1, 0.0f);
+  for (size_t i = 0; i < segments; i++) {
+    const Vec2& a = _line[i];
+    const Vec2& b = _line[(i + 1) % _line.size()];
+    _arcLength.push_back(_arcLength.back() + hypotf(b.x - a.x, b.y - a.y));
+  }
+  if (_line.size() < 2) _arcLength.clear();
+
+  if (!_hasStart && _line.size() >= 2) {
+    _start.x = _line[0].x;
+    _start.y = _line[0].y;
+    _start.heading = atan2f(_line[1].y - _line[0].y, _line[1].x - _line[0].x);
+  }
+}
+
+void Track::rasterize() {
+  _columns = (int)ceilf(_width / _resolution);
+  _rows = (int)ceilf(_height / _resolution);
+  _bitmap.assign((size_t)_columns * _rows, 255);
+
+  float half = _lineWidth / 2;
+  size_t segments = _arcLength.empty() ? 0 : _arcLength.size() - 1;
+  for (size_t i = 0; i < segments; i++) {
+    drawBar(_line[i], _line[(i + 1) % _line.size()], half);
+  }
+
+  for (float arc : _markers) {
+    Vec2 p;
+    float heading;
+    if (!pointAt(arc, p, heading)) continue;
+    float nx = -sinf(heading) * TRACK_MARKER_LENGTH / 2;
+    float ny = cosf(heading) * TRACK_MARKER_LENGTH / 2;
+    drawBar({ p.x - nx, p.y - ny }, { p.x + nx, p.y + ny }, half);
+  }
+}
+
+// Paints everything within half of the segment a-b as line
+void Track::drawBar(Vec2 a, Vec2 b, float half) {
+  int col0 = (int)floorf((fminf(a.x, b.x) - half) / _resolution);
+  int col1 = (int)ceilf((fmaxf(a.x, b.x) + half) / _resolution);
+  int row0 = (int)floorf((fminf(a.y, b.y) - half) / _resolution);
+  int row1 = (int)ceilf((fmaxf(a.y, b.y) + half) / _resolution);
+
+  float ex = b.x - a.x, ey = b.y - a.y;
+  float lengthSq = ex * ex + ey * ey;
+  for (int row = row0 < 0 ? 0 : row0; row <= row1 && row < _rows; row++) {
+    for (int col = col0 < 0 ? 0 : col0; col <= col1 && col < _columns; col++) {
+      float px = (col + 0.5f) * _resolution - a.x, py = (row + 0.5f) * _resolution - a.y;
+      float t = lengthSq > 0 ? (px * ex + py * ey) / lengthSq : 0;
+      t = t < 0 ? 0 : (t > 1 ? 1 : t);
+      if (hypotf(px - ex * t, py - ey * t) <= half) {
+        _bitmap[(size_t)row * _columns + col] = 0;
+      }
+    }
+  }
+}
+
+// Centerline point and direction `arc` mm from its start
+bool Track::pointAt(float arc, Vec2& point, float& heading) const {
+  size_t segments = _arcLength.empty() ? 0 : _arcLength.size() - 1;
+  for (size_t i = 0; i < segments; i++) {
+    if (arc > _arcLength[i + 1] && i + 1 < segments) continue;
+    const Vec2& a = _line[i];
+    const Vec2& b = _line[(i + 1) % _line.size()];
+    float span = _arcLength[i + 1] - _arcLength[i];
+    float t = span > 0 ? (arc - _arcLength[i]) / span : 0;
+    t = t < 0 ? 0 : (t > 1 ? 1 : t);
+    point = { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t };
+    heading = atan2f(b.y - a.y, b.x - a.x);
+    return true;
+  }
+  return false;
+}
+
+float Track::reflectance(float x, float y, float spot) const {
+  // Supersample the spot on a 3x3 grid
+  int sum = 0;
+  for (int dy = -1; dy <= 1; dy++) {
+    for (int dx = -1; dx <= 1; dx++) {
+      int col = (int)floorf((x + dx * spot / 3) / _resolution);
+      int row = (int)floorf((y + dy * spot / 3) / _resolution);
+      if (col < 0 || row < 0 || col >= _columns || row >= _rows) {
+        sum += 255;
+      } else {
+        sum += _bitmap[(size_t)row * _columns + col];
+      }
+    }
+  }
+  return sum / (9 * 255.0f);
+}
+
+float Track::rayDistance(Vec2 origin, float heading, float maxRange) const {
+  float dx = cosf(heading), dy = sinf(heading);
+  float best = maxRange;
+  bool hit = false;
+
+  for (const std::vector<Vec2>& polygon : _obstacles) {
+    for (size_t i = 0; i < polygon.size(); i++) {
+      const Vec2& a = polygon[i];
+      const Vec2& b = polygon[(i + 1) % polygon.size()];
+      float ex = b.x - a.x, ey = b.y - a.y;
+      float denom = dx * ey - dy * ex;
+      if (fabsf(denom) < 1e-9f) continue;
+
+      float wx = a.x - origin.x, wy = a.y - origin.y;
+      float t = (wx * ey - wy * ex) / denom;   // along the ray
+      float u = (wx * dy - wy * dx) / denom;   // along the edge
+      if (t >= 0 && u >= 0 && u <= 1 && t < best) {
+        best = t;
+        hit = true;
+      }
+    }
+  }
+  return hit ? best : -1;
+}
+
+float Track::nearestOnSegment(size_t i, Vec2 p, float& arc) const {
+  const Vec2& a = _line[i];
+  const Vec2& b = _line[(i + 1) % _line.size()];
+  float ex = b.x - a.x, ey = b.y - a.y;
+  float lengthSq = ex * ex + ey * ey;
+  float t = lengthSq > 0 ? ((p.x - a.x) * ex + (p.y - a.y) * ey) / lengthSq : 0;
+  t = t < 0 ? 0 : (t > 1 ? 1 : t);
+  float nx = a.x + ex * t, ny = a.y + ey * t;
+  arc = _arcLength[i] + t * (_arcLength[i + 1] - _arcLength[i]);
+  return hypotf(p.x - nx, p.y - ny);
+}
+
+float Track::project(Vec2 p, size_t& segmentHint, float& arc) const {
+  size_t segments = _arcLength.empty() ? 0 : _arcLength.size() - 1;
+  if (segments == 0) {
+    arc = 0;
+    return -1;
+  }
+
+  size_t first = 0, count = segments;
+  if (segmentHint < segments && segments > 2 * TRACK_SEARCH_WINDOW + 1) {
+    count = 2 * TRACK_SEARCH_WINDOW + 1;
+    if (_closed) {
+      first = (segmentHint + segments - TRACK_SEARCH_WINDOW) % segments;
+    } else {
+      first = segmentHint > TRACK_SEARCH_WINDOW ? segmentHint - TRACK_SEARCH_WINDOW : 0;
+      if (first + count > segments) count = segments - first;
+    }
+  }
+
+  float best = -1;
+  for (size_t k = 0; k < count; k++) {
+    size_t i = (first + k) % segments;
+    float segmentArc;
+    float d = nearestOnSegment(i, p, segmentArc);
+    if (best < 0 || d < best) {
+      best = d;
+      arc = segmentArc;
+      segmentHint = i;
+    }
+  }
+  return best;
+}
+
+#endif
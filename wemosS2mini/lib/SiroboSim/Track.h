@@ -0,0 +1,113 @@
+/*
+ * Simulated track - a line bitmap, its centerline and obstacles
+ *
+ * World coordinates are millimetres with x to the right, y up and headings
+ * in radians counter-clockwise from +x. The line sensors sample the bitmap;
+ * the centerline is only used for lap and cross-track-error metrics, and
+ * the obstacle polygons (plus the arena walls) for the ultrasonic sensor.
+ *
+ * Track files (.track), one directive per line, '#' starts a comment:
+ *   name <text>
+ *   size <width_mm> <height_mm>       arena, walls on all four sides
+ *   resolution <mm_per_pixel>         bitmap resolution (default 2)
+ *   line_width <mm>                   default 19 (electrical tape)
+ *   line <x,y> <x,y> ...              centerline points, repeatable
+ *   open                              centerline does not close on itself
+ *   obstacle <x,y> <x,y> ...          closed polygon
+ *   start <x> <y> <heading_deg>       default: first centerline point
+ *   marker <arc_mm>                   start marker: a bar across the line,
+ *                                     wider than the sensor array, this far
+ *                                     along the centerline; repeatable
+ *   bitmap <file.pgm>                 use a binary PGM (P5) instead of
+ *                                     rasterizing the centerline; dark = line
+ */
+
+#ifndef SIROBO_SIM_TRACK_H
+#define SIROBO_SIM_TRACK_H
+
+#ifndef ARDUINO
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#define TRACK_NO_HINT ((size_t)-1)  // project(): search the whole centerline
+
+struct Vec2 {
+  float x, y;
+};
+
+struct TrackPose {
+  float x, y;
+  float heading;  // rad, CCW from +x
+};
+
+class Track {
+public:
+  Track();
+
+  // Built-in standard tracks, see builtinNames(); with `marker`, a start
+  // marker just ahead of the start (for lap learning)
+  bool loadBuiltin(const char* name, bool marker = false);
+  static const char* const* builtinNames();  // nullptr-terminated
+
+  bool load(const char* path);
+
+  // Empty floor with walls only, the robot starting at `start`
+  void loadArena(float width, float height, const TrackPose& start);
+
+  const char* name() const { return _name.c_str(); }
+  float width() const { return _width; }
+  float height() const { return _height; }
+  float lineWidth() const { return _lineWidth; }
+  const TrackPose& start() const { return _start; }
+  size_t markerCount() const { return _markers.size(); }
+
+  // 0 = black line .. 1 = white floor, averaged over a square spot
+  float reflectance(float x, float y, float spot) const;
+
+  // Distance to the nearest obstacle or wall along a ray, or -1 beyond maxRange
+  float rayDistance(Vec2 origin, float heading, float maxRange) const;
+
+  // Centerline metrics
+  bool hasCenterline() const { return _line.size() >= 2; }
+  bool closed() const { return _closed; }
+  float length() const { return _arcLength.empty() ? 0 : _arcLength.back(); }
+  // Distance from p to the centerline and the arc length of the nearest point.
+  // segmentHint carries the last segment between calls to keep the search
+  // local; start with TRACK_NO_HINT.
+  float project(Vec2 p, size_t& segmentHint, float& arc) const;
+
+private:
+  void clear();
+  void addArena();
+  void finish();
+  void rasterize();
+  bool loadPgm(const char* path);
+
+  float nearestOnSegment(size_t i, Vec2 p, float& arc) const;
+  void drawBar(Vec2 a, Vec2 b, float half);
+  bool pointAt(float arc, Vec2& point, float& heading) const;
+
+  std::string _name;
+  float _width, _height;
+  float _resolution;
+  float _lineWidth;
+  bool _closed;
+  bool _hasStart;
+  TrackPose _start;
+
+  std::vector<Vec2> _line;
+  std::vector<float> _arcLength;        // cumulative, one per point (+ closing segment)
+  std::vector<std::vector<Vec2>> _obstacles;
+  std::vector<float> _markers;          // arc lengths
+
+  int _columns, _rows;
+  std::vector<uint8_t> _bitmap;         // reflectance 0..255, row 0 at y = 0
+  bool _bitmapLoaded;
+};
+
+#endif
+#endif
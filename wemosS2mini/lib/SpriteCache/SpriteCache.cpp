@@ -0,0 +1,315 @@
+#include "SpriteCache.h"
+
+#include <string.h>
+
+#include <Hal.h>
+
+#define SPRITE_SECTOR_HEADER 8
+
+struct SpriteEntry {
+  uint32_t id;
+  uint8_t width;
+  uint8_t height;
+  uint8_t encoding;
+  uint8_t params;
+  uint16_t length;
+  uint16_t state;
+};
+
+#define SPRITE_ENTRY_WRITTEN 0x0000
+#define SPRITE_ENTRY_ERASED 0xFFFF
+
+static size_t entrySize(uint16_t length) {
+  return (sizeof(SpriteEntry) + length + 3) & ~(size_t)3;
+}
+
+// =====================================================
+// BITMAPS
+// =====================================================
+
+size_t spriteBytes(uint8_t width, uint8_t height) {
+  return (size_t)(width + 7) / 8 * height;
+}
+
+static bool decodeRle(const uint8_t* in, size_t len, uint8_t* out, size_t size) {
+  size_t i = 0, o = 0;
+  while (i < len) {
+    uint8_t control = in[i++];
+    if (control < 128) {
+      size_t count = control + 1;
+      if (i + count > len || o + count > size) return false;
+      memcpy(out + o, in + i, count);
+      i += count;
+      o += count;
+    } else {
+      size_t count = control - 126;
+      if (i >= len || o + count > size) return false;
+      memset(out + o, in[i++], count);
+      o += count;
+    }
+  }
+  return o == size;
+}
+
+struct BitReader {
+  const uint8_t* data;
+  size_t len;
+  size_t pos;
+  uint8_t mask;
+
+  // Most significant bit first; -1 past the end
+  int32_t read(uint8_t count) {
+    int32_t value = 0;
+    while (count--) {
+      if (pos >= len) return -1;
+      value = (value << 1) | ((data[pos] & mask) ? 1 : 0);
+      mask >>= 1;
+      if (!mask) {
+        mask = 0x80;
+        pos++;
+      }
+    }
+    return value;
+  }
+};
+
+static bool decodeHeatshrink(const uint8_t* in, size_t len, uint8_t params, uint8_t* out, size_t size) {
+  uint8_t windowBits = params >> 4;
+  uint8_t lookaheadBits = params & 0x0F;
+  if (windowBits < 4 || lookaheadBits < 3 || lookaheadBits >= windowBits) return false;
+
+  BitReader bits = { in, len, 0, 0x80 };
+  size_t o = 0;
+  while (o < size) {
+    int32_t tag = bits.read(1);
+    if (tag < 0) return false;
+    if (tag) {
+      int32_t literal = bits.read(8);
+      if (literal < 0) return false;
+      out[o++] = literal;
+      continue;
+    }
+    int32_t index = bits.read(windowBits);
+    int32_t count = bits.read(lookaheadBits);
+    if (index < 0 || count < 0) return false;
+    size_t distance = index + 1;
+    if (o + count + 1 > size) return false;
+    // The decoder's window starts out zeroed, as in heatshrink
+    for (int32_t k = 0; k <= count; k++, o++) {
+      out[o] = distance <= o ? out[o - distance] : 0;
+    }
+  }
+  return true;
+}
+
+bool spriteDecode(const SpriteInfo& info, const uint8_t* data, uint8_t* bits) {
+  if (info.width == 0 || info.width > SPRITE_WIDTH_MAX || info.height == 0 || info.height > SPRITE_HEIGHT_MAX) {
+    return false;
+  }
+  size_t size = spriteBytes(info.width, info.height);
+  switch (info.encoding) {
+    case SPRITE_RAW:
+      if (info.length != size) return false;
+      memcpy(bits, data, size);
+      return true;
+    case SPRITE_RLE:
+      return decodeRle(data, info.length, bits, size);
+    case SPRITE_HEATSHRINK:
+      return decodeHeatshrink(data, info.length, info.params, bits, size);
+  }
+  return false;
+}
+
+uint32_t spriteHash(uint8_t width, uint8_t height, const uint8_t* bits) {
+  uint32_t hash = 0x811C9DC5UL;
+  hash = (hash ^ width) * 0x01000193UL;
+  hash = (hash ^ height) * 0x01000193UL;
+  size_t size = spriteBytes(width, height);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bits[i]) * 0x01000193UL;
+  }
+  return hash == SPRITE_NONE ? SPRITE_NONE - 1 : hash;
+}
+
+void spriteBlit(uint8_t* frame, int16_t frameWidth, int16_t frameHeight, const uint8_t* bits, uint8_t width,
+                uint8_t height, int16_t x, int16_t y) {
+  size_t stride = (width + 7) / 8;
+  for (int16_t row = 0; row < height; row++) {
+    int16_t py = y + row;
+    if (py < 0 || py >= frameHeight) continue;
+    uint8_t* page = frame + (py / 8) * frameWidth;
+    uint8_t mask = 1 << (py & 7);
+    const uint8_t* source = bits + row * stride;
+    for (int16_t col = 0; col < width; col++) {
+      int16_t px = x + col;
+      if (px < 0 || px >= frameWidth) continue;
+      if (source[col >> 3] & (0x80 >> (col & 7))) {
+        page[px] |= mask;
+      } else {
+        page[px] &= ~mask;
+      }
+    }
+  }
+}
+
+static int8_t base64Value(char c) {
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+bool base64Decode(const char* text, uint8_t* out, size_t capacity, size_t& len) {
+  len = 0;
+  uint32_t buffer = 0;
+  uint8_t bits = 0;
+  for (const char* p = text; *p && *p != '='; p++) {
+    int8_t value = base64Value(*p);
+    if (value < 0) return false;
+    buffer = (buffer << 6) | value;
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      if (len >= capacity) return false;
+      out[len++] = (uint8_t)(buffer >> bits);
+    }
+  }
+  return true;
+}
+
+// =====================================================
+// CACHE
+// =====================================================
+
+SpriteCache::SpriteCache()
+  : _count(0), _sectors(0), _sectorSize(0), _sector(0), _offset(0), _sequence(0) {}
+
+size_t SpriteCache::capacity() const {
+  return _sectors * _sectorSize;
+}
+
+int SpriteCache::find(uint32_t id) const {
+  for (int i = _count - 1; i >= 0; i--) {
+    if (_slots[i].id == id) return i;
+  }
+  return -1;
+}
+
+bool SpriteCache::contains(uint32_t id) const {
+  return find(id) >= 0;
+}
+
+// Slots stay oldest first; when they run out the oldest is forgotten
+void SpriteCache::remember(uint32_t id, uint32_t offset) {
+  int slot = find(id);
+  if (slot >= 0) forget(slot);
+  if (_count == SPRITE_INDEX_SIZE) forget(0);
+  _slots[_count++] = { id, offset };
+}
+
+void SpriteCache::forget(uint8_t slot) {
+  memmove(_slots + slot, _slots + slot + 1, (_count - slot - 1) * sizeof(Slot));
+  _count--;
+}
+
+void SpriteCache::begin() {
+  _count = 0;
+  _offset = 0;
+  _sequence = 0;
+  _sectorSize = hal::flashSectorSize();
+  _sectors = _sectorSize ? hal::flashSize(hal::FLASH_SPRITES) / _sectorSize : 0;
+  if (_sectors == 0) return;
+
+  // Oldest sector first, so later entries win in the index
+  uint32_t after = 0;
+  for (size_t round = 0; round < _sectors; round++) {
+    size_t oldest = _sectors;
+    uint32_t oldestSequence = 0;
+    for (size_t sector = 0; sector < _sectors; sector++) {
+      uint32_t header[2];
+      if (!hal::flashRead(sector * _sectorSize, header, sizeof(header), hal::FLASH_SPRITES) ||
+          header[0] != SPRITE_MAGIC || header[1] <= after) {
+        continue;
+      }
+      if (oldest == _sectors || header[1] < oldestSequence) {
+        oldest = sector;
+        oldestSequence = header[1];
+      }
+    }
+    if (oldest == _sectors) break;
+    after = oldestSequence;
+
+    size_t base = oldest * _sectorSize;
+    size_t offset = SPRITE_SECTOR_HEADER;
+    while (offset + sizeof(SpriteEntry) <= _sectorSize) {
+      SpriteEntry entry;
+      if (!hal::flashRead(base + offset, &entry, sizeof(entry), hal::FLASH_SPRITES)) break;
+      if (entry.id == SPRITE_NONE && entry.length == SPRITE_ENTRY_ERASED) break;
+      if (entry.length > SPRITE_DATA_MAX || offset + entrySize(entry.length) > _sectorSize) {
+        offset = _sectorSize;    // Unreadable from here on: fill no further
+        break;
+      }
+      if (entry.state == SPRITE_ENTRY_WRITTEN) remember(entry.id, base + offset);
+      offset += entrySize(entry.length);
+    }
+    _sector = oldest;
+    _offset = offset;
+    _sequence = oldestSequence;
+  }
+}
+
+bool SpriteCache::load(uint32_t id, uint8_t* bits, SpriteInfo& info) {
+  int slot = find(id);
+  if (slot < 0) return false;
+  SpriteEntry entry;
+  uint32_t offset = _slots[slot].offset;
+  if (!hal::flashRead(offset, &entry, sizeof(entry), hal::FLASH_SPRITES) || entry.id != id ||
+      entry.length > SPRITE_DATA_MAX ||
+      !hal::flashRead(offset + sizeof(entry), _data, entry.length, hal::FLASH_SPRITES)) {
+    return false;
+  }
+  info = { entry.id, entry.width, entry.height, (SpriteEncoding)entry.encoding, entry.params, entry.length };
+  return spriteDecode(info, _data, bits);
+}
+
+bool SpriteCache::nextSector() {
+  size_t sector = _offset == 0 ? 0 : (_sector + 1) % _sectors;
+  if (!hal::flashErase(sector, hal::FLASH_SPRITES)) return false;
+  for (int i = _count - 1; i >= 0; i--) {
+    if (_slots[i].offset / _sectorSize == sector) forget(i);
+  }
+  uint32_t header[2] = { SPRITE_MAGIC, _sequence + 1 };
+  if (!hal::flashWrite(sector * _sectorSize, header, sizeof(header), hal::FLASH_SPRITES)) return false;
+  _sector = sector;
+  _offset = SPRITE_SECTOR_HEADER;
+  _sequence++;
+  return true;
+}
+
+SpriteStoreResult SpriteCache::store(const SpriteInfo& info, const uint8_t* data) {
+  if (contains(info.id)) return SPRITE_KNOWN;
+  size_t size = entrySize(info.length);
+  if (_sectors == 0 || info.length > SPRITE_DATA_MAX || size > _sectorSize - SPRITE_SECTOR_HEADER) {
+    return SPRITE_FAILED;
+  }
+  if ((_offset == 0 || _offset + size > _sectorSize) && !nextSector()) {
+    _offset = _sectorSize;   // Try a fresh sector next time
+    return SPRITE_FAILED;
+  }
+
+  // Header, data, then the state that makes the entry count
+  uint32_t offset = _sector * _sectorSize + _offset;
+  SpriteEntry entry = { info.id, info.width, info.height, info.encoding, info.params, info.length,
+                        SPRITE_ENTRY_ERASED };
+  _offset += size;
+  uint16_t written = SPRITE_ENTRY_WRITTEN;
+  if (!hal::flashWrite(offset, &entry, sizeof(entry), hal::FLASH_SPRITES) ||
+      !hal::flashWrite(offset + sizeof(entry), data, info.length, hal::FLASH_SPRITES) ||
+      !hal::flashWrite(offset + offsetof(SpriteEntry, state), &written, sizeof(written), hal::FLASH_SPRITES)) {
+    return SPRITE_FAILED;
+  }
+  remember(info.id, offset);
+  return SPRITE_STORED;
+}
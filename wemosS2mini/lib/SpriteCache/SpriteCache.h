@@ -0,0 +1,123 @@
+/*
+ * SpriteCache - 1-bpp images for the OLED, kept in their own flash region
+ *
+ * A sprite is a monochrome bitmap up to the full 128x64 screen, uploaded
+ * once and then drawn by its ID. The ID is a hash of the image, so a
+ * client can work it out itself, try the ID first and only upload the
+ * image when the robot does not have it; an upload of an image already
+ * stored writes nothing.
+ *
+ * Bitmap: row-major, 1 bit per pixel, most significant bit leftmost, each
+ * row padded to whole bytes ((width + 7) / 8 bytes per row; the layout of
+ * Adafruit GFX drawBitmap() and image2cpp "horizontal"). Set bits are lit.
+ *
+ * ID: FNV-1a 32 over width, height and the bitmap bytes (offset basis
+ * 0x811C9DC5, prime 0x01000193); 0xFFFFFFFF becomes 0xFFFFFFFE.
+ *
+ * Encodings of the bitmap as uploaded and stored:
+ *
+ *   RAW         the bitmap bytes
+ *   RLE         runs: u8 n < 128: n + 1 literal bytes follow;
+ *                     u8 n >= 128: the next byte, repeated n - 126 times
+ *   HEATSHRINK  heatshrink (LZSS) stream with window bits W and lookahead
+ *               bits L (params = W << 4 | L; heatshrink -w W -l L)
+ *
+ * Flash region, a ring of sectors (all fields little-endian):
+ *
+ *   sector     u32 magic "SPR1" (0x31525053), u32 sequence (newest wins)
+ *              then entries, each 4-byte aligned, up to the erased space:
+ *   entry      u32 id, u8 width, u8 height, u8 encoding, u8 params,
+ *              u16 length, u16 state (0 once the data is written; a torn
+ *              entry is skipped), data[length]
+ *
+ * When the current sector is full the next one is erased, which drops the
+ * oldest sprites. Not thread-safe: use from one task (the loop).
+ */
+
+#ifndef SIROBO_SPRITE_CACHE_H
+#define SIROBO_SPRITE_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SPRITE_MAGIC 0x31525053UL
+#define SPRITE_NONE 0xFFFFFFFFUL
+#define SPRITE_WIDTH_MAX 128
+#define SPRITE_HEIGHT_MAX 64
+#define SPRITE_BYTES_MAX (SPRITE_WIDTH_MAX / 8 * SPRITE_HEIGHT_MAX)
+#define SPRITE_DATA_MAX 1024        // Largest encoded sprite; send RAW if it compresses worse
+#define SPRITE_INDEX_SIZE 64        // Sprites findable at once
+
+enum SpriteEncoding : uint8_t {
+  SPRITE_RAW = 0,
+  SPRITE_RLE,
+  SPRITE_HEATSHRINK
+};
+
+enum SpriteStoreResult : uint8_t {
+  SPRITE_STORED = 0,
+  SPRITE_KNOWN,     // Already stored, nothing written
+  SPRITE_FAILED     // No region, or the flash write failed
+};
+
+struct SpriteInfo {
+  uint32_t id;
+  uint8_t width;
+  uint8_t height;
+  SpriteEncoding encoding;
+  uint8_t params;     // HEATSHRINK: window bits << 4 | lookahead bits
+  uint16_t length;    // Encoded bytes
+};
+
+// Bitmap bytes of a width x height sprite
+size_t spriteBytes(uint8_t width, uint8_t height);
+// Decodes info.length bytes of data into bits (spriteBytes() long); false
+// if the data does not decode to exactly that size
+bool spriteDecode(const SpriteInfo& info, const uint8_t* data, uint8_t* bits);
+uint32_t spriteHash(uint8_t width, uint8_t height, const uint8_t* bits);
+// Draws the bitmap at (x, y) into an SSD1306 framebuffer (pages of 8
+// rows, one byte per column), clipped to the screen; unset bits go dark
+void spriteBlit(uint8_t* frame, int16_t frameWidth, int16_t frameHeight, const uint8_t* bits, uint8_t width,
+                uint8_t height, int16_t x, int16_t y);
+// Standard base64 with padding; false on a bad character or overflow
+bool base64Decode(const char* text, uint8_t* out, size_t capacity, size_t& len);
+
+class SpriteCache {
+public:
+  SpriteCache();
+
+  // Indexes the sprites in the flash region
+  void begin();
+
+  bool contains(uint32_t id) const;
+  // Reads and decodes a sprite into bits (SPRITE_BYTES_MAX long)
+  bool load(uint32_t id, uint8_t* bits, SpriteInfo& info);
+  // Stores an encoded sprite under info.id, unless it is already there;
+  // may erase a sector (tens of ms)
+  SpriteStoreResult store(const SpriteInfo& info, const uint8_t* data);
+
+  uint8_t count() const { return _count; }
+  size_t capacity() const;
+
+private:
+  struct Slot {
+    uint32_t id;
+    uint32_t offset;    // Entry in the region
+  };
+
+  int find(uint32_t id) const;
+  void remember(uint32_t id, uint32_t offset);
+  void forget(uint8_t slot);
+  bool nextSector();
+
+  Slot _slots[SPRITE_INDEX_SIZE];
+  uint8_t _count;
+  size_t _sectors;
+  size_t _sectorSize;
+  size_t _sector;       // Being filled
+  size_t _offset;       // Next entry in it; 0 before the first sector
+  uint32_t _sequence;
+  uint8_t _data[SPRITE_DATA_MAX];
+};
+
+#endif
@@ -31,94 +31,256 @@
  * - OFFLINE: Runs compiled code autonomously
  */
 
-#include <Arduino.h>
-#include <WiFi.h>
-#include <AsyncTCP.h>
-#include <ESPAsyncWebServer.h>
+#include <atomic>
+
 #include <ArduinoJson.h>
-#include <Wire.h>
-#include <Adafruit_GFX.h>
-#include <Adafruit_SSD1306.h>
-#include <Adafruit_MPU6050.h>
-#include <Adafruit_Sensor.h>
-#include <FastLED.h>
-#include <EEPROM.h>
-#include <Update.h>
-
-// Use Serial1 for logging (hardware UART)
-#define LOG Serial1
-
-// =====================================================
-// PIN DEFINITIONS
-// =====================================================
-
-// I2C Pins
-#define I2C_SDA 35
-#define I2C_SCL 36
-
-// Motor Driver L298N
-#define MOTOR_LEFT_EN   9
-#define MOTOR_LEFT_IN1  5
-#define MOTOR_LEFT_IN2  6
-#define MOTOR_RIGHT_EN  10
-#define MOTOR_RIGHT_IN1 7
-#define MOTOR_RIGHT_IN2 8
-
-// WS2812 LEDs
-#define LED_PIN 18
-#define NUM_LEDS 2
-
-// Line Follower Sensors (8 sensors)
-#define LINE_SENSOR_1  1   // Leftmost
-#define LINE_SENSOR_2  2
-#define LINE_SENSOR_3  3
-#define LINE_SENSOR_4  4
-#define LINE_SENSOR_5  11
-#define LINE_SENSOR_6  12
-#define LINE_SENSOR_7  13
-#define LINE_SENSOR_8  14  // Rightmost
-
-// LDR Sensors
-#define LDR_LEFT  15
-#define LDR_RIGHT 21
-
-// Ultrasonic Sensor
-#define ULTRASONIC_TRIG 16
-#define ULTRASONIC_ECHO 17
-
-// Push Buttons
-#define BUTTON_1 37
-#define BUTTON_2 38
-#define BUTTON_3 39
-#define BUTTON_4 40
-
-// Buzzer
-#define BUZZER_PIN 33
+#include <Hal.h>
+#include <board.h>
+#include <FlightRecorder.h>
+#include <LineFollower.h>
+#include <Behaviors.h>
+#include <LapLearner.h>
+#include <PoseEstimator.h>
+#include <MotionController.h>
+#include <SessionRecorder.h>
+#include <LedEngine.h>
+#include <SpriteCache.h>
+#include <DisplayMirror.h>
+#include <SerialLink.h>
+#include <ImuIntegrator.h>
+#include <JsonArena.h>
+#include <KvStore.h>
+#include <OtaStream.h>
+#include <AssetIndex.h>
+#include <Discovery.h>
+#include <GroupSync.h>
+#include <LatencyStats.h>
+#include <MotorDriver.h>
+#include <Profiler.h>
 
 // =====================================================
 // CONSTANTS
 // =====================================================
 
-#define SCREEN_WIDTH 128
-#define SCREEN_HEIGHT 64
-#define OLED_RESET -1
-
-#define PWM_FREQUENCY 5000
-#define PWM_RESOLUTION 8
+// Motor output defaults (lib/MotorDriver), until a "motor_config" is
+// saved: 20 kHz is above hearing, 10 bits gives 4x the steps of 8
+#define MOTOR_PWM_FREQUENCY 20000
+#define MOTOR_PWM_RESOLUTION 10
+#define MOTOR_LEFT_CHANNEL 0
+#define MOTOR_RIGHT_CHANNEL 1
+#define MOTOR_BENCH_CALLS 1000
 
+// Pre-store EEPROM layout: migrated once, and used on robots whose
+// partition table has no "store" partition yet
 #define EEPROM_SIZE 512
 #define EEPROM_CALIBRATION_ADDR 0
 #define EEPROM_CONFIG_ADDR 10
 #define EEPROM_CONFIG_MAGIC 0xABCD
 
+// Key/value store records. Append fields at the end of a record struct
+// (older records load with defaults for them); any other layout change
+// bumps the schema and needs a conversion in the load function.
+enum StoreKey : uint8_t {
+  STORE_KEY_CONFIG = 1,             // RobotConfig
+  STORE_KEY_MOTOR_TRIM = 2,         // MotorTrim
+  STORE_KEY_LINE_CALIBRATION = 3,   // LineCalibration
+  STORE_KEY_PID_GAINS = 4,          // PidGains
+  STORE_KEY_GROUP = 5,              // GroupConfig
+  STORE_KEY_MOTOR_CONFIG = 6,       // MotorConfig (lib/MotorDriver)
+  STORE_KEY_LAP = 7,                // LapRecord
+  STORE_KEY_SPEED_MODEL = 8         // SpeedModel (lib/SiroboControl)
+};
+#define STORE_SCHEMA_CONFIG 1
+#define STORE_SCHEMA_MOTOR_TRIM 1
+#define STORE_SCHEMA_LINE_CALIBRATION 1
+#define STORE_SCHEMA_PID_GAINS 1
+#define STORE_SCHEMA_GROUP 1
+#define STORE_SCHEMA_MOTOR_CONFIG 1
+#define STORE_SCHEMA_LAP 1
+#define STORE_SCHEMA_SPEED_MODEL 1
+
+// Saves are batched: changes are committed once they stop for this long
+#define STORE_COMMIT_DELAY_MS 2000
+
+// OTA progress bar redraw interval (each redraw is a full I2C frame)
+#define OTA_PROGRESS_INTERVAL_MS 250
+
+// Minimum raw span between floor and line for a sensor to count in calibration
+#define LINE_CALIBRATION_MIN_SPAN 200
+
+// Flight recorder: one record per IMU tick (10ms), ~10s by default
+#ifndef FLIGHT_RECORDER_CAPACITY
+#define FLIGHT_RECORDER_CAPACITY 1024
+#endif
+#define FLIGHT_RECORDER_PERIOD_US 10000
+#define FLIGHT_RECORDER_OBSTACLE_CM 10
+
+// WiFi scan: results are cached for a while and scans are rate-limited
+#define WIFI_SCAN_CACHE_MS 30000
+#define WIFI_SCAN_MIN_INTERVAL_MS 10000
+#define WIFI_SCAN_MAX_NETWORKS 32
+#define WIFI_SCAN_QUEUE_SIZE 8
+
+// Group shows (lib/GroupSync): packets are queued for the loop, which runs
+// the steps; a show is only accepted with a clock sample this recent
+#define GROUP_RX_SLOTS 4
+#define GROUP_SYNC_STALE_MS 10000
+#define GROUP_CLIENT_ID 0xFFFFFFFFUL   // processCommand() caller for show steps
+
+// Command timeline: batches of commands run on schedule by the loop
+#define TIMELINE_CAPACITY 64
+#define TIMELINE_COMMAND_MAX 96         // Serialized command, including the NUL
+#define TIMELINE_CLIENT_ID 0xFFFFFFFEUL // processCommand() caller for timeline steps
+
+// Serialized "profile" reply: every stage, the heap and the arenas
+#define PROFILE_REPLY_SIZE 3072
+
+// Per-task JSON arenas (4 KB each on the robot); documents never touch the heap
+#ifndef JSON_ARENA_SIZE
+#define JSON_ARENA_SIZE (1024 * sizeof(void*))
+#endif
+
+// Ultrasonic sampling: every DISTANCE_PERIOD_MS, or as fast as the
+// HC-SR04 allows (its echo line stays high ~38 ms without an echo) while
+// a behavior steers by distance, then only waiting for echoes up to ~2 m
+#define DISTANCE_PERIOD_MS 100
+#define DISTANCE_FAST_PERIOD_MS 40
+#define DISTANCE_TIMEOUT_US 30000
+#define DISTANCE_FAST_TIMEOUT_US 12000
+
+// Dead reckoning: pose updated at the IMU rate; a drive or go-to that has
+// not arrived by then gives up
+#define POSE_PERIOD_MS 10
+#define MOTION_TIMEOUT_MS 20000
+
+// Driving sessions (lib/SessionRecorder): setpoints sampled at the sensor
+// rate, the heading while moving. A setpoint change after a stall, in a
+// burst of "move" commands, is a WiFi hiccup: replay ramps over it.
+#define SESSION_BUFFER_SIZE (16 * 1024)   // The "session" partition's worth
+#define SESSION_TICK_MS 20
+#define SESSION_HEADING_MS 100
+#define SESSION_STALL_MS 200
+#define SESSION_BURST_MOVES 3             // In one tick; the joystick sends ~60/s
+#define SESSION_BRIDGE_MAX_MS 1000        // Longest ramp over a stall
+#define SESSION_HEADING_GAIN 3.0f         // Command per degree off the recording
+#define SESSION_ACTION_QUEUE 8
+#define SESSION_CLIENT_ID 0xFFFFFFFDUL    // processCommand() caller for replayed actions
+
+// OLED sprites (lib/SpriteCache): "display_bitmap" is drawn by the loop,
+// which also owns the flash region
+#define SPRITE_FRAMES_MAX 16          // Animation frames in one command
+#define SPRITE_FRAME_MS_MIN 40        // The OLED takes ~25 ms per frame
+#define SPRITE_BINARY_KIND 0x42       // 'B', first byte of a binary upload
+#define SPRITE_BINARY_HEADER 10
+#define SPRITE_BINARY_KEEP 0x01       // Binary upload flags
+#define SPRITE_BINARY_AT 0x02
+
+// Display mirror: the OLED streamed to clients that ask for it
+#define MIRROR_FPS_DEFAULT 10
+#define MIRROR_FPS_MAX 25             // The OLED itself manages ~40
+
+// USB serial (lib/SerialLink): the WebSocket's messages, framed, from a
+// host that has the CDC port open; the loop runs its commands
+#define USB_CLIENT_ID 0xFFFFFFFCUL    // processCommand() caller for USB commands
+#define USB_READ_CHUNK 256            // Per loop(); the CDC buffer keeps the rest
+#define DRIVE_BINARY_KIND 0x44        // 'D', binary "move": i8 x, i8 y
+#define DRIVE_BINARY_LENGTH 3
+
+// tools/microbench (-DSIROBO_MICROBENCH) sends its commands as this client:
+// in the loop, with a frame stamp that no latency histogram reads
+#define MICROBENCH_CLIENT_ID 0xFFFFFFFBUL
+
+// LED effects (lib/LedEngine) move at most once per frame; a new color is
+// shown on the next loop pass
+#define LED_FRAME_MS 20
+
+// Background boot (see updateBoot())
+#define BOOT_STATION_TIMEOUT_MS 10000
+#define BOOT_IMU_SETTLE_MS 100
+#define BOOT_IMU_SETTLE_SAMPLES 10
+
+// Boot milestones, timestamped in bootTimes and reported by /info
+enum BootPhase : uint8_t {
+  BOOT_SETUP = 0,   // setup() entered
+  BOOT_READY,       // AP, web server and WebSocket serving
+  BOOT_IMU,         // IMU settled (or found missing)
+  BOOT_WELCOME,     // Welcome animation finished
+  BOOT_STATION,     // Station connected, given up or not configured
+  BOOT_DONE,
+  BOOT_PHASE_COUNT
+};
+
+// Driving session state, owned by the loop; commands ask through
+// sessionRequest
+enum SessionState : uint8_t {
+  SESSION_IDLE = 0,
+  SESSION_RECORDING,
+  SESSION_SAVING,      // A sector per loop pass
+  SESSION_REPLAYING
+};
+
+enum SessionRequest : uint8_t {
+  SESSION_REQUEST_NONE = 0,
+  SESSION_REQUEST_RECORD,
+  SESSION_REQUEST_PLAY,
+  SESSION_REQUEST_STOP,
+  SESSION_REQUEST_CANCEL   // A manual drive command during a replay
+};
+
+// "drive", "goto" and "speed_calibrate", and the end of a motion that any
+// other drive command implies; the loop applies them
+enum MotionRequest : uint8_t {
+  MOTION_REQUEST_NONE = 0,
+  MOTION_REQUEST_CANCEL,      // The command drives the motors itself
+  MOTION_REQUEST_STOP,        // Cancel and stop the motors
+  MOTION_REQUEST_DRIVE,
+  MOTION_REQUEST_GOTO,
+  MOTION_REQUEST_CALIBRATE
+};
+
+// "lap" actions; the learner steps on the loop, which applies them
+enum LapRequest : uint8_t {
+  LAP_REQUEST_NONE = 0,
+  LAP_REQUEST_STATUS,
+  LAP_REQUEST_LEARN,
+  LAP_REQUEST_RACE,
+  LAP_REQUEST_STOP,
+  LAP_REQUEST_CLEAR
+};
+
+// Loop profiling stages (instrumented with -DSIROBO_PROFILE)
+enum ProfileStage : uint8_t {
+  PROFILE_LOOP = 0,
+  PROFILE_READ_SENSORS,
+  PROFILE_UPDATE_IMU,
+  PROFILE_BEHAVIORS,
+  PROFILE_UPDATE_LEDS,
+  PROFILE_UPDATE_BUZZER,
+  PROFILE_SEND_SENSOR_DATA,
+  PROFILE_WS_CLEANUP,
+  PROFILE_PROCESS_COMMAND,
+  PROFILE_DISPLAY_MIRROR,
+  PROFILE_USB_SERIAL,
+  PROFILE_STAGE_COUNT
+};
+
 // Firmware version
 #define FIRMWARE_VERSION "1.0.0"
 #define FIRMWARE_MODE_LIVE 0
 #define FIRMWARE_MODE_OFFLINE 1
 
-// Configuration structure stored in EEPROM
+// WebSocket clients before the oldest is dropped (AsyncWebSocket's
+// DEFAULT_MAX_WS_CLIENTS on ESP32); discovery reports the free slots
+#define WS_MAX_CLIENTS 8
+#define CLIENT_SLOTS (WS_MAX_CLIENTS + 1)   // And the USB host
+#define HTTP_PORT 80
+
+// Prometheus "le" bounds of the latency histograms: 2^7 .. 2^20 us
+#define LATENCY_PROMETHEUS_MIN_SHIFT 7
+#define LATENCY_PROMETHEUS_MAX_SHIFT 20
+
+// Robot configuration (store record STORE_KEY_CONFIG)
 struct RobotConfig {
-  uint16_t magic;           // Magic number to check if config is valid
   char apSSID[32];          // Access Point SSID (robot name)
   char apPassword[32];      // Access Point password
   char wifiSSID[32];        // Optional: connect to existing WiFi
@@ -127,31 +289,141 @@ struct RobotConfig {
   uint8_t firmwareMode;     // 0 = LIVE, 1 = OFFLINE
 };
 
+// Configuration as laid out in the pre-store EEPROM image
+struct LegacyConfig {
+  uint16_t magic;           // EEPROM_CONFIG_MAGIC if valid
+  RobotConfig config;
+};
+
+// Motor trim added to each side's command (store record STORE_KEY_MOTOR_TRIM)
+struct MotorTrim {
+  int8_t left;
+  int8_t right;
+};
+
+// Raw line sensor range seen during calibration (STORE_KEY_LINE_CALIBRATION)
+struct LineCalibration {
+  uint16_t min[8];
+  uint16_t max[8];
+  uint16_t threshold;
+};
+
+// Line follower gains (STORE_KEY_PID_GAINS); the follower uses kp only so far
+struct PidGains {
+  float kp;
+  float ki;
+  float kd;
+  int16_t speed;
+};
+
+// Group joined for synchronized shows (STORE_KEY_GROUP); empty = none
+struct GroupConfig {
+  char name[GROUP_NAME_MAX + 1];
+};
+
+// Learned lap map and its racing settings (STORE_KEY_LAP); no segments = none
+struct LapRecord {
+  LapMap map;
+  LapParams params;
+};
+static_assert(sizeof(LapRecord) <= KV_MAX_VALUE, "LapRecord does not fit a store record");
+
+// One queued timeline command; gapMs counts from the previous command's
+// due time, or from when the loop first sees a stream's first command
+struct TimelineEntry {
+  uint32_t gapMs;
+  uint8_t flags;   // TIMELINE_FLAG_*
+  char command[TIMELINE_COMMAND_MAX];
+};
+#define TIMELINE_FLAG_START 0x01   // First command of a stream
+#define TIMELINE_FLAG_END   0x02   // Last command of a stream
+
+// An LED, buzzer or display command received while recording, for the loop
+struct SessionAction {
+  uint32_t timeMs;   // millis() on arrival
+  uint8_t length;
+  char command[TIMELINE_COMMAND_MAX];
+};
+
+// Where and how a "display_bitmap" draws; more than one frame animates
+struct SpriteDraw {
+  uint16_t epoch;          // displayEpoch when queued; a later display command wins
+  int16_t x, y;
+  bool centered;           // No x/y given: centered on the screen
+  bool clear;              // Clear the screen first
+  uint32_t frames[SPRITE_FRAMES_MAX];   // Sprite IDs
+  uint8_t frameCount;
+  uint16_t frameMs;
+  bool loop;
+};
+
+// A "display_bitmap" for the loop: a new sprite to store and draw, or
+// stored ones to draw
+struct SpriteRequest {
+  uint32_t clientId;
+  bool upload;
+  SpriteInfo info;         // Upload: id filled in by the loop
+  uint8_t data[SPRITE_DATA_MAX];
+  SpriteDraw draw;
+};
+
+// A received group packet, stamped on arrival for the clock sync
+struct GroupRxSlot {
+  uint64_t receivedUs;
+  uint16_t length;
+  uint8_t ip[4];
+  uint16_t port;
+  uint8_t data[GROUP_PACKET_MAX];
+};
+
 RobotConfig config;
 
 // Default WiFi Configuration - Random SSID format: siroboXXXXX
 const char* DEFAULT_AP_PASSWORD = "siroboayo";
 
 // Generate random SSID like siroboAB123
-String generateRandomSSID() {
-  String ssid = "sirobo";
+void generateRandomSSID(char* ssid, size_t len) {
   const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  char suffix[6];
   for (int i = 0; i < 5; i++) {
-    ssid += chars[random(0, strlen(chars))];
+    suffix[i] = chars[random(0, strlen(chars))];
   }
-  return ssid;
+  suffix[5] = '\0';
+  snprintf(ssid, len, "sirobo%s", suffix);
 }
 
 // =====================================================
 // GLOBAL OBJECTS
 // =====================================================
 
-Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
-Adafruit_MPU6050 mpu;
-CRGB leds[NUM_LEDS];
+hal::Display& display = hal::display();
+LedEngine ledEngine;
+
+FlightRecord flightRecords[FLIGHT_RECORDER_CAPACITY];
+FlightRecorder recorder(flightRecords, FLIGHT_RECORDER_CAPACITY);
+
+const char* const BOOT_PHASE_NAMES[BOOT_PHASE_COUNT] = {
+  "setup", "ready", "imu", "welcome", "station", "done"
+};
+
+const char* const PROFILE_STAGE_NAMES[PROFILE_STAGE_COUNT] = {
+  "loop", "read_sensors", "update_imu", "behaviors", "update_leds",
+  "update_buzzer", "send_sensor_data", "ws_cleanup", "process_command",
+  "display_mirror", "usb_serial"
+};
+Profiler profiler(PROFILE_STAGE_NAMES, PROFILE_STAGE_COUNT);
+
+KvStore store;
 
-AsyncWebServer server(80);
-AsyncWebSocket ws("/ws");
+AssetIndex webApp;
+char webAppIndexText[ASSET_INDEX_SIZE];   // webApp points into it
+
+// Telemetry is built in the loop task, commands and HTTP replies in the
+// AsyncTCP task, so each gets its own arena
+alignas(8) uint8_t telemetryArenaBuffer[JSON_ARENA_SIZE];
+alignas(8) uint8_t commandArenaBuffer[JSON_ARENA_SIZE];
+JsonArena telemetryArena(telemetryArenaBuffer, sizeof(telemetryArenaBuffer));
+JsonArena commandArena(commandArenaBuffer, sizeof(commandArenaBuffer));
 
 // =====================================================
 // GLOBAL VARIABLES
@@ -163,11 +435,22 @@ int motorRightSpeed = 0;
 int motorLeftCalibration = 0;
 int motorRightCalibration = 0;
 int baseSpeed = 150;
+Motor motorLeft;
+Motor motorRight;
+MotorConfig motorConfig = { MOTOR_PWM_FREQUENCY, MOTOR_PWM_RESOLUTION, 0, 0, 0 };
+MotorConfig motorConfigRequest;            // Applied by the loop
+volatile bool motorConfigPending = false;
+uint32_t motorBenchClient = 0;             // "motor_bench" run by the loop
+volatile bool motorBenchPending = false;
+uint32_t lastMotorUpdateUs = 0;
 
 // IMU data
 float yaw = 0, pitch = 0, roll = 0;
 float yawOffset = 0;
+float gyroRate = 0; // deg/s
 unsigned long lastIMUUpdate = 0;
+ImuIntegrator imuIntegrator;
+bool imuReady = false;
 
 // Sensor data
 int lineSensors[8] = {0};
@@ -179,9 +462,113 @@ bool buttons[4] = {false};
 bool lineFollowerEnabled = false;
 int lineFollowerSpeed = 50;
 float lineFollowerKp = 0.5;
+int lineThreshold = LINE_SENSOR_THRESHOLD;
+LineCalibration lineCalibration;
+bool lineCalibrating = false;
+float lineError = 0;
+bool lineLost = false;
+
+// Reactive behaviors (lib/SiroboControl/Behaviors.h); line_follow is
+// enabled through lineFollowerEnabled and uses the line follower settings
+BehaviorEngine behaviors;
+BehaviorId behaviorOwner = BEHAVIOR_NONE;   // Loop: owner last reported
+
+// Lap learning (lib/SiroboControl/LapLearner.h); sets the line follower's
+// speed while it runs
+LapLearner lapLearner;
+LapParams lapRequestParams;                  // Staged by "lap", applied by the loop
+volatile bool lapRequestTuned = false;
+int lapRequestSpeed = 0;                     // "learn": the line follower's speed
+uint32_t lapRequestClient = 0;               // Answered by the loop
+volatile LapRequest lapRequest = LAP_REQUEST_NONE;
+
+// Dead reckoning and motion primitives (lib/SiroboControl/PoseEstimator.h,
+// MotionController.h); the speed model is calibrated against a wall
+PoseEstimator poseEstimator;
+MotionController motion;
+SpeedCalibrator speedCalibrator;
+unsigned long motionStartTime = 0;
+float calibrationHeading = 0;   // Held while calibrating
+float motionRequestX = 0;       // mm: "drive" distance, "goto" target
+float motionRequestY = 0;
+int motionRequestSpeed = 0;
+uint32_t motionRequestClient = 0;   // "speed_calibrate": answered by the loop
+volatile MotionRequest motionRequest = MOTION_REQUEST_NONE;
+float poseResetX = 0;           // "pose" reset, applied and answered by the loop
+float poseResetY = 0;
+float poseResetTheta = 0;
+uint32_t poseResetClient = 0;
+volatile bool poseResetRequested = false;
+unsigned long lastPoseUpdate = 0;
+
+// Driving session: recorded into sessionBuffer, saved to the "session"
+// flash region and replayed from there; the setpoint and heading fields
+// serve the recording and the replay alike
+uint8_t sessionBuffer[SESSION_BUFFER_SIZE];
+SessionWriter sessionWriter;
+SessionReader sessionReader;          // Replay: setpoints and actions
+SessionReader sessionHeadingReader;   // Replay: the next heading sample
+SessionSaver sessionSaver;
+volatile SessionState sessionState = SESSION_IDLE;
+volatile SessionRequest sessionRequest = SESSION_REQUEST_NONE;
+volatile bool sessionRequestHeadingHold = true;
+volatile bool sessionSaved = false;         // The region holds a session
+volatile uint32_t sessionSavedBytes = 0;
+volatile uint32_t sessionSavedMs = 0;
+volatile uint16_t sessionMoves = 0;         // "move" commands received
+volatile uint32_t sessionActionsDropped = 0;
+SessionAction sessionActions[SESSION_ACTION_QUEUE];
+volatile uint8_t sessionActionHead = 0;     // Written by the AsyncTCP task
+volatile uint8_t sessionActionTail = 0;     // Written by the loop
+bool sessionFull = false;                   // Loop state from here on
+bool sessionHeadingHold = true;
+unsigned long sessionStartTime = 0;
+unsigned long sessionLastTick = 0;
+unsigned long sessionLastHeadingTick = 0;
+uint32_t sessionDurationMs = 0;
+uint16_t sessionMovesSeen = 0;
+int sessionLeft = 0, sessionRight = 0;
+uint32_t sessionMotorMs = 0;       // Time of the last setpoint
+float sessionLastTheta = 0;
+int32_t sessionHeading = 0;        // 0.1 deg, counter-clockwise, from the start
+int32_t sessionHeadingFrom = 0;    // Replay: last heading sample passed
+uint32_t sessionHeadingFromMs = 0;
+SessionEvent sessionNext;          // Replay: the events not yet due
+bool sessionNextValid = false;
+SessionEvent sessionHeadingNext;
+bool sessionHeadingNextValid = false;
+
+// OLED sprites
+SpriteCache spriteCache;
+SpriteRequest spriteRequest;                // Filled by processCommand(), taken by the loop
+volatile bool spriteRequestPending = false;
+volatile uint16_t displayEpoch = 0;         // Bumped by every display command
+uint8_t spriteBits[SPRITE_BYTES_MAX];       // Loop state from here on
+SpriteDraw spriteAnimation;
+uint8_t spriteFrame = 0;
+unsigned long spriteFrameAt = 0;
+bool spriteAnimating = false;
+
+// Display mirror: subscribers are set by processCommand() and dropped on
+// disconnect (AsyncTCP task), the loop sends
+struct MirrorClient {
+  uint32_t clientId;
+  volatile bool used;
+  uint8_t fps;
+};
+MirrorClient mirrorClients[CLIENT_SLOTS];
+DisplayMirror displayMirror;
+uint8_t mirrorMessage[MIRROR_MESSAGE_MAX];
+unsigned long mirrorSentAt = 0;
+uint32_t mirrorHeldBack = 0;      // Ticks a full send queue skipped
+
+// USB serial: broadcasts and telemetry also go to the host once it has
+// sent a good frame, until it closes the port
+LinkReader usbReader;
+volatile bool usbActive = false;
+uint32_t usbDropped = 0;          // Frames the host did not take in time
 
 // LED effects
-int ledEffect = 0; // 0=off, 1=solid, 2=rainbow, 3=blink, 4=breathe
 unsigned long lastLEDUpdate = 0;
 
 // Music/Buzzer
@@ -196,11 +583,97 @@ unsigned long nextNoteTime = 0;
 unsigned long lastSensorRead = 0;
 unsigned long lastWebSocketUpdate = 0;
 bool clientConnected = false;
+bool commandReceived = false;
+
+// Storage: StoreKey bits waiting to be committed (set from any task,
+// cleared by the loop), and a pending reboot
+std::atomic<uint16_t> storePending(0);
+unsigned long storeRequestTime = 0;
+volatile bool restartScheduled = false;
+unsigned long restartTime = 0;
+
+// Boot state
+unsigned long bootTimes[BOOT_PHASE_COUNT] = {0};
+uint8_t bootPhasesReached = 0;   // Bit per BootPhase
+
+// WiFi scan state (owned by the loop; requests arrive through the queue)
+hal::WifiNetwork wifiNetworks[WIFI_SCAN_MAX_NETWORKS];
+int wifiNetworkCount = 0;
+int wifiNetworksFound = 0;
+bool wifiScanValid = false;
+bool wifiScanRunning = false;
+bool wifiScanAttempted = false;
+unsigned long wifiScanTime = 0;
+unsigned long wifiScanStartTime = 0;
+uint32_t wifiScanQueue[WIFI_SCAN_QUEUE_SIZE];
+volatile uint8_t wifiScanQueueHead = 0;   // Written by the AsyncTCP task
+volatile uint8_t wifiScanQueueTail = 0;   // Written by the loop
+volatile bool wifiScanRefresh = false;
 
 // OTA Update state
-bool otaInProgress = false;
+volatile bool otaInProgress = false;
+bool otaFailed = false;
 size_t otaContentLength = 0;
-size_t otaReceived = 0;
+unsigned long otaStartTime = 0;
+unsigned long otaDuration = 0;
+unsigned long otaLastProgress = 0;
+OtaStream otaStream(hal::otaWrite);
+
+// UDP: discovery responder and group shows
+int discoverySocket = -1;
+int groupSocket = -1;            // Unicast: time requests and reports
+int groupMulticastSocket = -1;   // Beacons, time replies and shows
+GroupConfig groupConfig;
+GroupRxSlot groupRx[GROUP_RX_SLOTS];
+volatile uint8_t groupRxHead = 0;   // Written by the AsyncUDP task
+volatile uint8_t groupRxTail = 0;   // Written by the loop
+volatile uint32_t groupRxDropped = 0;
+
+// Command timeline: the AsyncTCP task appends whole batches, the loop runs them
+TimelineEntry timeline[TIMELINE_CAPACITY];
+volatile uint8_t timelineHead = 0;   // Written by the AsyncTCP task
+volatile uint8_t timelineTail = 0;   // Written by the loop
+bool timelineStreamOpen = false;     // AsyncTCP: the last batch said "more"
+uint32_t timelinePendingGapMs = 0;   // AsyncTCP: trailing delay of that batch
+volatile uint8_t timelineClearTo = 0;     // AsyncTCP: the head when cleared
+volatile bool timelineClearRequested = false;
+bool timelineDueKnown = false;       // Loop state from here on
+bool timelineWasEmpty = true;
+uint64_t timelineDue = 0;
+uint64_t timelineLastDue = 0;
+volatile uint32_t timelineUnderruns = 0;
+volatile uint32_t timelineSlipMs = 0;     // Time lost to underruns
+volatile uint32_t timelineMaxLateUs = 0;
+volatile uint32_t timelineExecuted = 0;
+
+// Group show state (owned by the loop)
+ClockSync groupClock;
+uint8_t groupController[4] = {0};
+uint16_t groupControllerPort = 0;
+uint8_t groupShowPacket[GROUP_PACKET_MAX];   // The steps point into it
+GroupShow groupShow;
+bool groupShowActive = false;
+bool groupShowReceived = false;   // groupShow.id is set
+uint8_t groupShowNext = 0;
+uint64_t groupShowStart = 0;      // Local clock
+uint16_t groupShowsRun = 0;
+uint32_t groupMaxLateUs = 0;
+
+// Latency measurement (AsyncTCP task): one clock estimate per echo client
+struct EchoClient {
+  uint32_t clientId;
+  bool used;
+  uint32_t seq;            // Last echo answered, for matching its ack
+  uint64_t t1, t2, t3;
+  ClockSync clock;         // Offset = robot clock minus client clock
+};
+EchoClient echoClients[CLIENT_SLOTS];
+LatencyHistogram actuationLatency;   // WebSocket frame to setMotorSpeed()
+LatencyHistogram usbActuationLatency; // USB frame to setMotorSpeed()
+LatencyHistogram echoRoundTrip;      // Network round trip of acked echoes
+uint64_t wsFrameReceivedUs = 0;      // Set while a WebSocket frame is processed
+uint64_t usbFrameReceivedUs = 0;     // The same for USB frames, in the loop
+uint64_t benchFrameReceivedUs = 0;   // Microbench commands, never recorded
 
 // =====================================================
 // FUNCTION PROTOTYPES
@@ -209,58 +682,151 @@ size_t otaReceived = 0;
 void setupPins();
 void setupMotors();
 void setupSensors();
-void setupIMU();
+bool setupIMU();
 void setupDisplay();
 void setupLEDs();
 void setupWiFi();
 void setupWebServer();
 void setupWebSocket();
+void setupUsb();
 void setupOTA();
+void setupWebApp();
+void serveWebApp(hal::HttpRequest* request);
+void setupDiscovery();
+void handleDiscoveryPacket(const uint8_t* data, size_t len, const uint8_t ip[4], uint16_t port);
+void setupGroup();
+void queueGroupPacket(const uint8_t* data, size_t len, const uint8_t ip[4], uint16_t port);
+void updateGroup();
+void sendGroupStatus(JsonArena& arena);
+bool scheduledCommandAllowed(const char* type);
+void queueTimeline(JsonDocument& doc, uint32_t clientId);
+void updateTimeline();
+void startOta(hal::HttpRequest* request, const char* filename);
+void finishOta();
+void drawOtaProgress();
+unsigned long otaKbps();
 
 void readSensors();
 void updateIMU();
 void updateMotors();
 void updateLEDs();
 void updateBuzzer();
-void updateLineFollower();
+void updateBehaviors();
+void sendBehaviorStatus(uint32_t clientId, const char* error);
+void reportLapEvents();
+void applyLapRequest();
+void sendLapStatus(uint32_t clientId, const char* error);
+void updatePose();
+void updateMotion();
+void startMotion();
+void requestMotion(MotionRequest request);
+void applyMotionRequests();
+void cancelMotion(bool stopMotors);
+void finishMotion(const char* event, bool stopMotors);
+void sendPoseStatus(uint32_t clientId, const char* error, JsonArena& arena);
+void reportSpeedCalibration(JsonArena& arena);
+bool sessionActionRecorded(const char* type);
+void captureSessionAction(JsonDocument& doc, uint32_t clientId);
+void updateSession();
+void sendSessionStatus(uint32_t clientId, const char* error);
+void requestWifiScan(uint32_t clientId, bool refresh);
+void updateWifiScan();
+void sendWifiScanResults();
 void sendSensorData();
+void recordFlightSample();
+void sendRecorderStatus(JsonArena& arena);
+void fillProfile(JsonDocument& doc);
+void fillMemory(JsonObject memory);
+size_t writePrometheusMetrics(char* buffer, size_t len);
+void resetEchoClient(uint32_t clientId);
+void handleEcho(JsonDocument& doc, uint32_t clientId);
+void fillLatency(JsonObject latency);
 
-void handleWebSocketMessage(void *arg, uint8_t *data, size_t len);
-void processCommand(JsonDocument& doc);
+bool loopClient(uint32_t clientId);
+JsonArena& commandArenaFor(uint32_t clientId);
+void handleTextMessage(uint32_t clientId, const uint8_t* data, size_t len);
+void handleBinaryMessage(uint32_t clientId, const uint8_t* data, size_t len);
+void processCommand(JsonDocument& doc, uint32_t clientId);
+void sendText(uint32_t clientId, const char* text, size_t len);
+void sendBinary(uint32_t clientId, const uint8_t* data, size_t len);
+void wsSendJson(JsonDocument& doc);
+bool usbSend(uint8_t kind, const uint8_t* data, size_t len);
+void updateUsb();
+void httpSendJson(hal::HttpRequest* request, int code, JsonDocument& doc);
 
 void setMotorSpeed(int left, int right);
+void applyMotorSpeed(int left, int right);
+bool validMotorConfig(const MotorConfig& candidate);
+void sendMotorConfig(uint32_t clientId, const char* error);
+void runMotorBench(uint32_t clientId);
 void robotForward(int speed);
 void robotBackward(int speed);
 void robotTurnLeft(int speed);
 void robotTurnRight(int speed);
 void robotStop();
-void robotRotate(float angle);
+void robotRotate(float angle, bool onLoop);
+void robotDrive(float distanceCm, int speed);
+void robotGoTo(float xCm, float yCm, int speed);
+void robotResetPose();
 
 void setLED(int index, uint8_t r, uint8_t g, uint8_t b);
 void setAllLEDs(uint8_t r, uint8_t g, uint8_t b);
-void setLEDEffect(int effect);
+bool setLEDSequence(JsonDocument& doc);
 
 void playTone(int frequency, int duration);
 void playMelody(const char* melody);
 void stopTone();
 
 int getDistance();
+int measureDistance(uint32_t timeoutUs);
 bool isLineDetected(int sensorIndex);
 bool detectIntersection(const char* type);
 
+void renderText(int line, const char* text);
 void displayText(int line, const char* text);
 void displayNumber(int line, int number);
 void clearDisplay();
+void renderImage(const char* image);
 void displayImage(const char* image);
+void queueSpriteRequest(JsonDocument& doc, uint32_t clientId);
+void queueSpriteUpload(uint32_t clientId, const uint8_t* data, size_t len);
+void sendSpriteReply(uint32_t clientId, uint32_t id, const char* error, SpriteStoreResult result);
+void showSpriteBits(uint8_t width, uint8_t height, const SpriteDraw& draw);
+bool drawSprite(uint32_t id, const SpriteDraw& draw);
+void updateSprites();
+bool setMirrorClient(uint32_t clientId, bool enabled, uint8_t fps);
+void sendMirrorStatus(uint32_t clientId, const char* error);
+void updateMirror();
 void showWelcomeScreen();
+bool updateWelcome(unsigned long elapsed);
 void updateStatusDisplay();
 
+#ifdef SIROBO_MICROBENCH
+void runMicrobench();   // tools/microbench
+#endif
+
+void markBootPhase(BootPhase phase);
+bool bootPhaseReached(BootPhase phase);
+void updateBoot();
+void updateBootImu(unsigned long now);
+void updateBootStation(unsigned long now);
+
+void setupStorage();
+void migrateLegacyStorage();
+bool loadRecord(StoreKey key, uint8_t schema, void* data, size_t size);
+void requestSave(StoreKey key);
+void updateStorage();
+void scheduleRestart(unsigned long delayMs);
+
 void loadCalibration();
 void saveCalibration();
-void autoCalibrateStraight();
+void autoCalibrateStraight(bool onLoop);
+void startLineCalibration();
+void updateLineCalibration();
+bool finishLineCalibration();
 void loadConfig();
 void saveConfig();
-void sendConfig();
+void sendConfig(JsonArena& arena);
 
 // =====================================================
 // SETUP
@@ -276,32 +842,37 @@ void setup() {
   LOG.println("███████║██║██║  ██║╚██████╔╝██████╔╝╚██████╔╝");
   LOG.println("╚══════╝╚═╝╚═╝  ╚═╝ ╚═════╝ ╚═════╝  ╚═════╝ ");
   LOG.printf("\nSirobo Robot v%s - Initializing...\n\n", FIRMWARE_VERSION);
+  markBootPhase(BOOT_SETUP);
   
   // Initialize random seed for SSID generation
-  randomSeed(analogRead(0) + millis());
+  randomSeed(hal::analogRead(0) + hal::millis());
   
-  EEPROM.begin(EEPROM_SIZE);
+  setupStorage();
   
   setupPins();
   setupMotors();
   setupLEDs();
   
-  Wire.begin(I2C_SDA, I2C_SCL);
+  hal::i2cBegin(I2C_SDA, I2C_SCL);
   
   setupDisplay();
-  setupIMU();
   setupSensors();
   
   loadCalibration();
   
+  // Network first: the app can connect while the rest finishes in loop()
   setupWiFi();
   setupWebSocket();
+  setupUsb();
   setupWebServer();
   setupOTA();
+  setupDiscovery();
+  setupGroup();
+  markBootPhase(BOOT_READY);
   
   showWelcomeScreen();
   
-  LOG.println("✓ Sirobo ready!");
+  LOG.printf("✓ Sirobo ready in %lu ms\n", bootTimes[BOOT_READY]);
   LOG.printf("  Mode: %s\n", config.firmwareMode == FIRMWARE_MODE_LIVE ? "LIVE" : "OFFLINE");
 }
 
@@ -310,7 +881,19 @@ void setup() {
 // =====================================================
 
 void loop() {
-  unsigned long currentMillis = millis();
+  PROFILE_SCOPE(profiler, PROFILE_LOOP);
+  unsigned long currentMillis = hal::millis();
+  
+  // IMU settling, station connect and welcome animation after setup()
+  updateBoot();
+  
+  // Group packets, show steps and timeline commands that are due (first,
+  // to start them on time)
+  updateGroup();
+  updateTimeline();
+  
+  // Commands from a USB host
+  updateUsb();
   
   // Read sensors every 20ms (50Hz)
   if (currentMillis - lastSensorRead >= 20) {
@@ -319,35 +902,150 @@ void loop() {
   }
   
   // Update IMU every 10ms (100Hz)
-  if (currentMillis - lastIMUUpdate >= 10) {
+  if (imuReady && currentMillis - lastIMUUpdate >= 10) {
     updateIMU();
     lastIMUUpdate = currentMillis;
+    
+    if (recorder.isCapturing()) {
+      recordFlightSample();
+    }
   }
   
-  // Update line follower
-  if (lineFollowerEnabled) {
-    updateLineFollower();
+  // Pose resets and drive, go-to and calibration requests from commands
+  applyMotionRequests();
+  
+  // Dead reckoning from the gyro yaw and the motor duty
+  if (currentMillis - lastPoseUpdate >= POSE_PERIOD_MS) {
+    updatePose();
   }
   
+  // Behaviors, the line follower among them, arbitrate over the motors
+  updateBehaviors();
+  
+  // Drive / go-to primitives and speed calibration, unless a behavior
+  // took the motors
+  updateMotion();
+  
+  // Record, save or replay a driving session
+  updateSession();
+  
+  // Motor ramps and new PWM settings
+  updateMotors();
+  
   // Update LED effects
   updateLEDs();
   
+  // Store and draw OLED sprites, step animations
+  updateSprites();
+  
+  // Stream the OLED to the clients watching it
+  updateMirror();
+  
   // Update buzzer/music
   updateBuzzer();
   
-  // Send sensor data via WebSocket every 100ms
-  if (currentMillis - lastWebSocketUpdate >= 100) {
-    if (clientConnected) {
+  // Finish background WiFi scans and answer waiting clients
+  updateWifiScan();
+  
+  // Commit batched saves, then reboot if one was requested
+  updateStorage();
+  
+  // Send sensor data via WebSocket every 100ms (paused during an upload)
+  if (!otaInProgress && currentMillis - lastWebSocketUpdate >= 100) {
+    if (clientConnected || usbActive) {
       sendSensorData();
     }
     lastWebSocketUpdate = currentMillis;
   }
   
   // Clean up WebSocket
-  ws.cleanupClients();
+  {
+    PROFILE_SCOPE(profiler, PROFILE_WS_CLEANUP);
+    hal::wsCleanup();
+  }
   
   // Small delay to prevent watchdog issues
-  yield();
+  hal::yield();
+}
+
+// =====================================================
+// BACKGROUND BOOT
+// =====================================================
+
+void markBootPhase(BootPhase phase) {
+  bootTimes[phase] = hal::millis();
+  bootPhasesReached |= 1 << phase;
+}
+
+bool bootPhaseReached(BootPhase phase) {
+  return bootPhasesReached & (1 << phase);
+}
+
+// Finishes what setup() left running: IMU settling, the station connection
+// and the welcome animation, each advancing a little per loop()
+void updateBoot() {
+  if (bootPhaseReached(BOOT_DONE)) return;
+  unsigned long now = hal::millis();
+  
+  if (!bootPhaseReached(BOOT_IMU)) updateBootImu(now);
+  if (!bootPhaseReached(BOOT_STATION)) updateBootStation(now);
+  if (!bootPhaseReached(BOOT_WELCOME) && updateWelcome(now - bootTimes[BOOT_READY])) {
+    markBootPhase(BOOT_WELCOME);
+  }
+  
+  if (bootPhaseReached(BOOT_IMU) && bootPhaseReached(BOOT_STATION) && bootPhaseReached(BOOT_WELCOME)) {
+    markBootPhase(BOOT_DONE);
+    LOG.printf("✓ Boot complete in %lu ms\n", bootTimes[BOOT_DONE]);
+#ifdef SIROBO_MICROBENCH
+    // Hot path timings, once everything they touch is up
+    runMicrobench();
+#endif
+  }
+}
+
+void updateBootImu(unsigned long now) {
+  static bool started = false;
+  static unsigned long settleStart = 0;
+  static unsigned long lastSample = 0;
+  static uint8_t samples = 0;
+  
+  if (!started) {
+    started = true;
+    settleStart = now;
+    if (!setupIMU()) markBootPhase(BOOT_IMU);
+    return;
+  }
+  
+  // Discard the first readings while the sensor settles
+  if (now - settleStart < BOOT_IMU_SETTLE_MS || now - lastSample < 10) return;
+  hal::ImuSample sample;
+  hal::imuRead(sample);
+  lastSample = now;
+  if (++samples < BOOT_IMU_SETTLE_SAMPLES) return;
+  
+  imuReady = true;
+  lastIMUUpdate = now;
+  markBootPhase(BOOT_IMU);
+  LOG.println("✓ IMU configured");
+}
+
+void updateBootStation(unsigned long now) {
+  if (!config.stationMode || strlen(config.wifiSSID) == 0) {
+    markBootPhase(BOOT_STATION);
+    return;
+  }
+  
+  if (hal::wifiStationConnected()) {
+    char ip[16];
+    hal::wifiStationIp(ip, sizeof(ip));
+    LOG.print("✓ Connected to WiFi! IP: ");
+    LOG.println(ip);
+    markBootPhase(BOOT_STATION);
+  } else if (now - bootTimes[BOOT_READY] >= BOOT_STATION_TIMEOUT_MS) {
+    // The WiFi driver keeps retrying; boot just stops waiting for it
+    LOG.println("✗ Failed to connect to WiFi");
+    markBootPhase(BOOT_STATION);
+  }
 }
 
 // =====================================================
@@ -356,37 +1054,37 @@ void loop() {
 
 void setupPins() {
   // Buttons
-  pinMode(BUTTON_1, INPUT_PULLUP);
-  pinMode(BUTTON_2, INPUT_PULLUP);
-  pinMode(BUTTON_3, INPUT_PULLUP);
-  pinMode(BUTTON_4, INPUT_PULLUP);
+  hal::pinMode(BUTTON_1, hal::PIN_INPUT_PULLUP);
+  hal::pinMode(BUTTON_2, hal::PIN_INPUT_PULLUP);
+  hal::pinMode(BUTTON_3, hal::PIN_INPUT_PULLUP);
+  hal::pinMode(BUTTON_4, hal::PIN_INPUT_PULLUP);
   
   // Ultrasonic
-  pinMode(ULTRASONIC_TRIG, OUTPUT);
-  pinMode(ULTRASONIC_ECHO, INPUT);
+  hal::pinMode(ULTRASONIC_TRIG, hal::PIN_OUTPUT);
+  hal::pinMode(ULTRASONIC_ECHO, hal::PIN_INPUT);
   
   // Buzzer
-  pinMode(BUZZER_PIN, OUTPUT);
+  hal::pinMode(BUZZER_PIN, hal::PIN_OUTPUT);
   
   LOG.println("✓ Pins configured");
 }
 
 void setupMotors() {
-  // Motor pins
-  pinMode(MOTOR_LEFT_IN1, OUTPUT);
-  pinMode(MOTOR_LEFT_IN2, OUTPUT);
-  pinMode(MOTOR_RIGHT_IN1, OUTPUT);
-  pinMode(MOTOR_RIGHT_IN2, OUTPUT);
-  
-  // PWM setup for motor enable pins
-  ledcSetup(0, PWM_FREQUENCY, PWM_RESOLUTION);
-  ledcSetup(1, PWM_FREQUENCY, PWM_RESOLUTION);
-  ledcAttachPin(MOTOR_LEFT_EN, 0);
-  ledcAttachPin(MOTOR_RIGHT_EN, 1);
+  MotorConfig saved = motorConfig;
+  if (store.mounted() &&
+      loadRecord(STORE_KEY_MOTOR_CONFIG, STORE_SCHEMA_MOTOR_CONFIG, &saved, sizeof(saved)) &&
+      validMotorConfig(saved)) {
+    motorConfig = saved;
+  }
   
-  robotStop();
+  const MotorPins leftPins = { MOTOR_LEFT_IN1, MOTOR_LEFT_IN2, MOTOR_LEFT_EN, MOTOR_LEFT_CHANNEL };
+  const MotorPins rightPins = { MOTOR_RIGHT_IN1, MOTOR_RIGHT_IN2, MOTOR_RIGHT_EN, MOTOR_RIGHT_CHANNEL };
+  motorLeft.begin(leftPins, motorConfig);
+  motorRight.begin(rightPins, motorConfig);
+  lastMotorUpdateUs = hal::micros();
   
-  LOG.println("✓ Motors configured");
+  LOG.printf("✓ Motors configured: %u Hz, %u bit, deadband %u\n",
+             (unsigned)motorConfig.pwmFrequency, motorConfig.pwmResolution, motorConfig.deadband);
 }
 
 void setupSensors() {
@@ -395,44 +1093,34 @@ void setupSensors() {
   LOG.println("✓ Sensors configured");
 }
 
-void setupIMU() {
-  if (!mpu.begin()) {
+// Starts the IMU; it settles in the background (updateBootImu)
+bool setupIMU() {
+  // Ranges: +-2g, +-250 deg/s, 21Hz bandwidth
+  if (!hal::imuBegin()) {
     LOG.println("✗ MPU6050 not found!");
-    return;
-  }
-  
-  mpu.setAccelerometerRange(MPU6050_RANGE_2_G);
-  mpu.setGyroRange(MPU6050_RANGE_250_DEG);
-  mpu.setFilterBandwidth(MPU6050_BAND_21_HZ);
-  
-  // Initial calibration - take some readings
-  delay(100);
-  sensors_event_t a, g, temp;
-  for (int i = 0; i < 10; i++) {
-    mpu.getEvent(&a, &g, &temp);
-    delay(10);
+    return false;
   }
-  
-  LOG.println("✓ IMU configured");
+  return true;
 }
 
 void setupDisplay() {
-  if (!display.begin(SSD1306_SWITCHCAPVCC, 0x3C)) {
+  if (!display.begin()) {
     LOG.println("✗ OLED not found!");
     return;
   }
   
   display.clearDisplay();
-  display.setTextColor(SSD1306_WHITE);
+  display.setTextColor(hal::WHITE);
   display.display();
+  displayMirror.begin(SCREEN_WIDTH, SCREEN_HEIGHT);
   
   LOG.println("✓ Display configured");
 }
 
 void setupLEDs() {
-  FastLED.addLeds<WS2812, LED_PIN, GRB>(leds, NUM_LEDS);
-  FastLED.setBrightness(128);
-  setAllLEDs(0, 0, 0);
+  hal::ledsBegin(NUM_LEDS);
+  hal::ledsSetBrightness(128);
+  ledEngine.begin(NUM_LEDS);
   
   LOG.println("✓ LEDs configured");
 }
@@ -441,305 +1129,1033 @@ void setupWiFi() {
   // Load configuration from EEPROM
   loadConfig();
   
-  // If station mode enabled and valid credentials, try to connect
+  // If station mode enabled and valid credentials, start connecting;
+  // updateBootStation() follows it up without holding back the AP
   if (config.stationMode && strlen(config.wifiSSID) > 0) {
-    WiFi.mode(WIFI_AP_STA);
-    WiFi.begin(config.wifiSSID, config.wifiPassword);
+    hal::wifiStartStation(config.wifiSSID, config.wifiPassword);
     
     LOG.print("Connecting to WiFi: ");
     LOG.println(config.wifiSSID);
-    
-    int attempts = 0;
-    while (WiFi.status() != WL_CONNECTED && attempts < 20) {
-      delay(500);
-      LOG.print(".");
-      attempts++;
-    }
-    
-    if (WiFi.status() == WL_CONNECTED) {
-      LOG.println();
-      LOG.print("✓ Connected to WiFi! IP: ");
-      LOG.println(WiFi.localIP());
-    } else {
-      LOG.println();
-      LOG.println("✗ Failed to connect to WiFi");
-    }
-  } else {
-    WiFi.mode(WIFI_AP);
   }
   
   // Always start Access Point
-  WiFi.softAP(config.apSSID, config.apPassword);
+  hal::wifiStartAccessPoint(config.apSSID, config.apPassword, config.stationMode && strlen(config.wifiSSID) > 0);
   
-  IPAddress IP = WiFi.softAPIP();
+  char ip[16];
+  hal::wifiAccessPointIp(ip, sizeof(ip));
   LOG.print("✓ WiFi AP started: ");
   LOG.println(config.apSSID);
   LOG.print("  IP Address: ");
-  LOG.println(IP);
+  LOG.println(ip);
 }
 
 void setupWebSocket() {
-  ws.onEvent([](AsyncWebSocket *server, AsyncWebSocketClient *client, 
-                AwsEventType type, void *arg, uint8_t *data, size_t len) {
+  hal::wsBegin("/ws", [](hal::WsEventType type, uint32_t clientId, uint8_t *data, size_t len) {
     switch (type) {
-      case WS_EVT_CONNECT:
-        LOG.printf("WebSocket client #%u connected\n", client->id());
+      case hal::WS_EVENT_CONNECT:
+        LOG.printf("WebSocket client #%u connected\n", clientId);
         clientConnected = true;
+        resetEchoClient(clientId);
         break;
-      case WS_EVT_DISCONNECT:
-        LOG.printf("WebSocket client #%u disconnected\n", client->id());
-        clientConnected = ws.count() > 0;
+      case hal::WS_EVENT_DISCONNECT:
+        LOG.printf("WebSocket client #%u disconnected\n", clientId);
+        clientConnected = hal::wsCount() > 0;
+        resetEchoClient(clientId);
+        setMirrorClient(clientId, false, 0);
         robotStop();
         break;
-      case WS_EVT_DATA:
-        handleWebSocketMessage(arg, data, len);
+      case hal::WS_EVENT_TEXT:
+        handleTextMessage(clientId, data, len);
         break;
-      case WS_EVT_PONG:
-      case WS_EVT_ERROR:
+      case hal::WS_EVENT_BINARY:
+        handleBinaryMessage(clientId, data, len);
         break;
     }
   });
   
-  server.addHandler(&ws);
   LOG.println("✓ WebSocket configured");
 }
 
 void setupWebServer() {
   // CORS headers
-  DefaultHeaders::Instance().addHeader("Access-Control-Allow-Origin", "*");
-  DefaultHeaders::Instance().addHeader("Access-Control-Allow-Methods", "GET, POST, OPTIONS");
-  DefaultHeaders::Instance().addHeader("Access-Control-Allow-Headers", "Content-Type");
-  
-  // Root endpoint
-  server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-    request->send(200, "text/html", 
-      "<!DOCTYPE html><html><head><title>Sirobo</title></head>"
-      "<body style='font-family:sans-serif;text-align:center;padding:50px;'>"
-      "<h1>🤖 Sirobo Robot</h1>"
-      "<p>Robot is online and ready!</p>"
-      "<p>Connect via the Sirobo app.</p>"
-      "</body></html>");
-  });
+  hal::httpDefaultHeader("Access-Control-Allow-Origin", "*");
+  hal::httpDefaultHeader("Access-Control-Allow-Methods", "GET, POST, OPTIONS");
+  hal::httpDefaultHeader("Access-Control-Allow-Headers", "Content-Type");
+  
+  // Root endpoint and every other path: the web app from flash
+  setupWebApp();
+  hal::httpOn("/", hal::HTTP_METHOD_GET, serveWebApp);
+  hal::httpOnNotFound(serveWebApp);
   
-  // Ping endpoint for robot discovery
-  server.on("/ping", HTTP_GET, [](AsyncWebServerRequest *request) {
-    JsonDocument doc;
+  // Ping endpoint for robot discovery (browsers; native clients use the
+  // UDP responder, see DISCOVERY)
+  hal::httpOn("/ping", hal::HTTP_METHOD_GET, [](hal::HttpRequest *request) {
+    char ip[16];
+    hal::wifiAccessPointIp(ip, sizeof(ip));
+    
+    JsonDocument doc(&commandArena);
     doc["device"] = "sirobo";
     doc["name"] = config.apSSID;
     doc["version"] = FIRMWARE_VERSION;
     doc["mode"] = config.firmwareMode == FIRMWARE_MODE_LIVE ? "live" : "offline";
-    doc["ip"] = WiFi.softAPIP().toString();
+    doc["ip"] = ip;
     
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    httpSendJson(request, 200, doc);
   });
   
   // Status endpoint
-  server.on("/status", HTTP_GET, [](AsyncWebServerRequest *request) {
-    JsonDocument doc;
+  hal::httpOn("/status", hal::HTTP_METHOD_GET, [](hal::HttpRequest *request) {
+    JsonDocument doc(&commandArena);
     doc["status"] = "ok";
-    doc["uptime"] = millis();
-    doc["clients"] = ws.count();
-    doc["heap"] = ESP.getFreeHeap();
+    doc["uptime"] = hal::millis();
+    doc["clients"] = hal::wsCount();
+    doc["heap"] = hal::freeHeap();
+    doc["minHeap"] = hal::minFreeHeap();
+    doc["maxBlock"] = hal::largestFreeBlock();
+#ifdef SIROBO_PROFILE
+    doc["loopHz"] = profiler.rate(PROFILE_LOOP);
+#endif
+    
+    httpSendJson(request, 200, doc);
+  });
+  
+  // Loop profiling: JSON, or Prometheus text with ?format=prometheus; ?reset=1 clears
+  hal::httpOn("/metrics", hal::HTTP_METHOD_GET, [](hal::HttpRequest *request) {
+    char format[16] = "json";
+    char reset[4] = "";
+    hal::httpParam(request, "format", false, format, sizeof(format));
+    hal::httpParam(request, "reset", false, reset, sizeof(reset));
+    
+    if (strcmp(format, "prometheus") == 0) {
+      static char text[10240];
+      writePrometheusMetrics(text, sizeof(text));
+      hal::httpSend(request, 200, "text/plain; version=0.0.4", text);
+    } else {
+      JsonDocument doc(&commandArena);
+      fillProfile(doc);
+      fillLatency(doc["latency"].to<JsonObject>());
+      
+      static char output[3072];
+      serializeJson(doc, output, sizeof(output));
+      hal::httpSend(request, 200, "application/json", output);
+    }
     
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    if (reset[0] == '1') {
+      profiler.reset();
+      actuationLatency.reset(hal::millis());
+      usbActuationLatency.reset(hal::millis());
+      echoRoundTrip.reset(hal::millis());
+    }
   });
   
   // Calibration endpoint
-  server.on("/calibration", HTTP_GET, [](AsyncWebServerRequest *request) {
-    JsonDocument doc;
+  hal::httpOn("/calibration", hal::HTTP_METHOD_GET, [](hal::HttpRequest *request) {
+    JsonDocument doc(&commandArena);
     doc["left"] = motorLeftCalibration;
     doc["right"] = motorRightCalibration;
     
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    httpSendJson(request, 200, doc);
+  });
+  
+  // Flight recorder download (binary, see FlightRecorder.h for the format)
+  hal::httpOn("/log", hal::HTTP_METHOD_GET, [](hal::HttpRequest *request) {
+    // Freeze the buffer so the chunks form a consistent snapshot
+    recorder.stop();
+    
+    static const hal::HttpHeader headers[] = {
+      { "Content-Disposition", "attachment; filename=\"sirobo.srfl\"" }
+    };
+    hal::httpSendChunked(request, "application/octet-stream",
+      [](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+        return recorder.readLog(index, buffer, maxLen);
+      }, headers, 1);
   });
   
-  server.begin();
+  hal::httpBegin();
   LOG.println("✓ Web server started");
 }
 
 // =====================================================
-// OTA UPDATE SETUP
+// WEB APP
 // =====================================================
 
-void setupOTA() {
-  // OTA Update endpoint
-  server.on("/update", HTTP_POST, 
-    // Response handler
-    [](AsyncWebServerRequest *request) {
-      bool success = !Update.hasError();
-      AsyncWebServerResponse *response = request->beginResponse(
-        success ? 200 : 500, 
-        "application/json", 
-        success ? "{\"success\":true,\"message\":\"Update successful, rebooting...\"}" 
-                : "{\"success\":false,\"message\":\"Update failed\"}"
-      );
-      response->addHeader("Connection", "close");
-      request->send(response);
-      
-      if (success) {
-        LOG.println("✓ OTA Update successful, rebooting...");
-        delay(500);
-        ESP.restart();
-      }
-    },
-    // Upload handler
-    [](AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
-      if (!index) {
-        LOG.printf("OTA Update starting: %s\n", filename.c_str());
-        otaInProgress = true;
-        otaReceived = 0;
-        
-        // Get content length from header
-        if (request->hasHeader("Content-Length")) {
-          otaContentLength = request->getHeader("Content-Length")->value().toInt();
-        }
-        
-        // Stop motors and show update screen
-        robotStop();
-        display.clearDisplay();
-        display.setTextSize(1);
-        display.setCursor(10, 20);
-        display.println("OTA UPDATE");
-        display.setCursor(10, 35);
-        display.println("Please wait...");
-        display.display();
-        
-        setAllLEDs(255, 165, 0); // Orange
-        
-        if (!Update.begin(UPDATE_SIZE_UNKNOWN)) {
-          LOG.printf("Update.begin failed: %s\n", Update.errorString());
-          Update.printError(LOG);
-        }
-      }
-      
-      if (len) {
-        otaReceived += len;
-        if (Update.write(data, len) != len) {
-          LOG.printf("Update.write failed: %s\n", Update.errorString());
-          Update.printError(LOG);
-        }
-        
-        // Update progress display
-        if (otaContentLength > 0) {
-          int progress = (otaReceived * 100) / otaContentLength;
-          display.fillRect(10, 50, 108, 10, SSD1306_BLACK);
-          display.drawRect(10, 50, 108, 10, SSD1306_WHITE);
-          display.fillRect(12, 52, progress, 6, SSD1306_WHITE);
-          display.display();
-        }
-      }
-      
-      if (final) {
-        if (Update.end(true)) {
-          LOG.printf("OTA Update complete: %u bytes\n", otaReceived);
-          setAllLEDs(0, 255, 0); // Green
-          display.clearDisplay();
-          display.setCursor(10, 30);
-          display.println("UPDATE COMPLETE!");
-          display.display();
-        } else {
-          LOG.printf("Update.end failed: %s\n", Update.errorString());
-          Update.printError(LOG);
-          setAllLEDs(255, 0, 0); // Red
-        }
-        otaInProgress = false;
-      }
-    }
-  );
+void setupWebApp() {
+  if (!hal::fsBegin()) {
+    LOG.println("✗ No filesystem, web app not available");
+    return;
+  }
   
-  // Switch firmware mode endpoint
-  server.on("/mode", HTTP_POST, [](AsyncWebServerRequest *request) {
-    if (request->hasParam("mode", true)) {
-      String mode = request->getParam("mode", true)->value();
-      if (mode == "live") {
-        config.firmwareMode = FIRMWARE_MODE_LIVE;
-      } else if (mode == "offline") {
-        config.firmwareMode = FIRMWARE_MODE_OFFLINE;
-      }
-      saveConfig();
-      
-      JsonDocument doc;
-      doc["success"] = true;
-      doc["mode"] = config.firmwareMode == FIRMWARE_MODE_LIVE ? "live" : "offline";
-      doc["message"] = "Mode changed, rebooting...";
-      
-      String response;
-      serializeJson(doc, response);
-      request->send(200, "application/json", response);
-      
-      delay(500);
-      ESP.restart();
+  size_t len = hal::fsRead(ASSET_INDEX_PATH, webAppIndexText, sizeof(webAppIndexText) - 1);
+  webAppIndexText[len] = '\0';
+  webApp.parse(webAppIndexText);
+  
+  if (len == sizeof(webAppIndexText) - 1 || webApp.skipped()) {
+    LOG.printf("✗ Web app index truncated or invalid (%u entries skipped)\n", (unsigned)webApp.skipped());
+  }
+  LOG.printf("✓ Web app: %u files\n", (unsigned)webApp.count());
+}
+
+// Serves precompressed files with strong ETags and single byte ranges
+void serveWebApp(hal::HttpRequest* request) {
+  char path[ASSET_PATH_MAX];
+  hal::httpPath(request, path, sizeof(path));
+  
+  const Asset* asset = webApp.resolve(path);
+  if (!asset) {
+    if (strcmp(path, "/") == 0) {
+      // Filesystem not uploaded yet
+      hal::httpSend(request, 200, "text/html", 
+        "<!DOCTYPE html><html><head><title>Sirobo</title></head>"
+        "<body style='font-family:sans-serif;text-align:center;padding:50px;'>"
+        "<h1>🤖 Sirobo Robot</h1>"
+        "<p>Robot is online and ready!</p>"
+        "<p>Connect via the Sirobo app.</p>"
+        "</body></html>");
     } else {
-      request->send(400, "application/json", "{\"error\":\"Missing mode parameter\"}");
+      hal::httpSend(request, 404, "text/plain", "Not found");
     }
-  });
+    return;
+  }
   
-  // Get firmware info
-  server.on("/info", HTTP_GET, [](AsyncWebServerRequest *request) {
-    JsonDocument doc;
-    doc["device"] = "sirobo";
-    doc["name"] = config.apSSID;
-    doc["version"] = FIRMWARE_VERSION;
-    doc["mode"] = config.firmwareMode == FIRMWARE_MODE_LIVE ? "live" : "offline";
-    doc["heap"] = ESP.getFreeHeap();
-    doc["uptime"] = millis();
-    doc["chip"] = ESP.getChipModel();
-    
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
-  });
+  char etag[ASSET_ETAG_SIZE + 3];
+  snprintf(etag, sizeof(etag), "\"%s\"", asset->etag);
+  bool gzip = asset->flags & ASSET_FLAG_GZIP;
   
-  LOG.println("✓ OTA Update configured");
+  hal::HttpHeader headers[6];
+  size_t headerCount = 0;
+  headers[headerCount++] = { "ETag", etag };
+  // Hashed names never change; everything else is revalidated with the ETag
+  headers[headerCount++] = { "Cache-Control", asset->flags & ASSET_FLAG_IMMUTABLE
+                             ? "public, max-age=31536000, immutable" : "no-cache" };
+  headers[headerCount++] = { "Accept-Ranges", "bytes" };
+  if (gzip) {
+    headers[headerCount++] = { "Content-Encoding", "gzip" };
+    headers[headerCount++] = { "Vary", "Accept-Encoding" };
+  }
+  
+  char value[128];
+  if (hal::httpHeader(request, "If-None-Match", value, sizeof(value)) &&
+      assetEtagMatches(value, asset->etag)) {
+    hal::httpSend(request, 304, asset->contentType, "", headers, headerCount);
+    return;
+  }
+  // Only gzip is stored; a client without any Accept-Encoding accepts it too
+  if (gzip && hal::httpHeader(request, "Accept-Encoding", value, sizeof(value)) &&
+      !strstr(value, "gzip")) {
+    hal::httpSend(request, 406, "text/plain", "gzip required");
+    return;
+  }
+  
+  uint32_t start = 0;
+  uint32_t length = asset->size;
+  AssetRange range = ASSET_RANGE_NONE;
+  if (hal::httpHeader(request, "Range", value, sizeof(value))) {
+    // If-Range with another version means: send the whole new version
+    char ifRange[32];
+    if (!hal::httpHeader(request, "If-Range", ifRange, sizeof(ifRange)) ||
+        assetEtagMatches(ifRange, asset->etag)) {
+      range = parseAssetRange(value, asset->size, start, length);
+    }
+  }
+  
+  char contentRange[48];
+  if (range == ASSET_RANGE_UNSATISFIABLE) {
+    snprintf(contentRange, sizeof(contentRange), "bytes */%u", (unsigned)asset->size);
+    headers[headerCount++] = { "Content-Range", contentRange };
+    hal::httpSend(request, 416, "text/plain", "", headers, headerCount);
+    return;
+  }
+  if (range == ASSET_RANGE_OK) {
+    snprintf(contentRange, sizeof(contentRange), "bytes %u-%u/%u",
+             (unsigned)start, (unsigned)(start + length - 1), (unsigned)asset->size);
+    headers[headerCount++] = { "Content-Range", contentRange };
+  }
+  
+  char file[sizeof(ASSET_ROOT) + ASSET_PATH_MAX + 3];
+  snprintf(file, sizeof(file), "%s%s%s", ASSET_ROOT, asset->path, gzip ? ".gz" : "");
+  hal::httpSendFile(request, range == ASSET_RANGE_OK ? 206 : 200, file, start, length,
+                    asset->contentType, headers, headerCount);
 }
 
 // =====================================================
-// WEBSOCKET HANDLING
+// DISCOVERY
 // =====================================================
 
-void handleWebSocketMessage(void *arg, uint8_t *data, size_t len) {
-  AwsFrameInfo *info = (AwsFrameInfo*)arg;
-  if (info->final && info->index == 0 && info->len == len && info->opcode == WS_TEXT) {
-    data[len] = 0;
-    
-    JsonDocument doc;
-    DeserializationError error = deserializeJson(doc, (char*)data);
-    
-    if (!error) {
-      processCommand(doc);
-    }
+void setupDiscovery() {
+  discoverySocket = hal::udpBegin(DISCOVERY_PORT, handleDiscoveryPacket);
+  if (discoverySocket < 0) {
+    LOG.println("✗ Discovery responder unavailable");
+  }
+  
+  // <name>.local: lowercase, anything but letters and digits becomes '-'
+  char hostname[sizeof(config.apSSID)];
+  size_t i = 0;
+  for (; config.apSSID[i] && i < sizeof(hostname) - 1; i++) {
+    char c = config.apSSID[i];
+    hostname[i] = isalnum((unsigned char)c) ? tolower((unsigned char)c) : '-';
+  }
+  hostname[i] = '\0';
+  
+  if (hal::mdnsBegin(hostname)) {
+    hal::mdnsAddService("_sirobo", "_tcp", HTTP_PORT);
+    hal::mdnsAddServiceTxt("_sirobo", "_tcp", "name", config.apSSID);
+    hal::mdnsAddServiceTxt("_sirobo", "_tcp", "version", FIRMWARE_VERSION);
+    hal::mdnsAddServiceTxt("_sirobo", "_tcp", "mode", config.firmwareMode == FIRMWARE_MODE_LIVE ? "live" : "offline");
+    LOG.printf("✓ Discovery on UDP %u, mDNS %s.local\n", DISCOVERY_PORT, hostname);
   }
 }
 
-void processCommand(JsonDocument& doc) {
-  const char* type = doc["type"];
+// Runs on the AsyncUDP task; a reply is built per query, nothing is cached
+void handleDiscoveryPacket(const uint8_t* data, size_t len, const uint8_t ip[4], uint16_t port) {
+  uint8_t flags;
+  uint16_t nonce;
+  if (!discoveryParseQuery(data, len, flags, nonce)) return;
   
-  if (strcmp(type, "move") == 0) {
-    int x = doc["x"];
-    int y = doc["y"];
-    
-    // Convert joystick x,y to motor speeds
-    int leftSpeed = constrain(y + x, -100, 100);
-    int rightSpeed = constrain(y - x, -100, 100);
-    
-    setMotorSpeed(map(leftSpeed, -100, 100, -255, 255),
-                  map(rightSpeed, -100, 100, -255, 255));
+  DiscoveryInfo info;
+  snprintf(info.name, sizeof(info.name), "%s", config.apSSID);
+  snprintf(info.firmware, sizeof(info.firmware), "%s", FIRMWARE_VERSION);
+  info.mode = config.firmwareMode;
+  info.httpPort = HTTP_PORT;
+  info.clients = hal::wsCount();
+  info.maxClients = WS_MAX_CLIENTS;
+  if (!discoveryShouldAnswer(info, flags)) return;
+  
+  char address[16];
+  hal::wifiAccessPointIp(address, sizeof(address));
+  discoveryParseIp(address, info.apIp);
+  memset(info.stationIp, 0, sizeof(info.stationIp));
+  if (hal::wifiStationConnected()) {
+    hal::wifiStationIp(address, sizeof(address));
+    discoveryParseIp(address, info.stationIp);
   }
-  else if (strcmp(type, "forward") == 0) {
-    int speed = doc["speed"] | 50;
-    robotForward(speed);
+  
+  uint8_t reply[DISCOVERY_REPLY_MAX];
+  size_t replyLen = discoveryEncodeReply(info, nonce, reply, sizeof(reply));
+  if (replyLen) hal::udpSend(discoverySocket, ip, port, reply, replyLen);
+}
+
+// =====================================================
+// COMMAND TIMELINE
+// =====================================================
+
+// Commands run by the loop (timeline and group show steps) must neither
+// block it (turn, music) nor reply through the AsyncTCP task's arena
+bool scheduledCommandAllowed(const char* type) {
+  static const char* const allowed[] = {
+    "move", "forward", "backward", "stop", "speed", "drive", "goto", "led", "led_all",
+    "led_rainbow", "led_blink", "led_breathe", "led_sequence", "tone", "music_stop",
+    "display_text", "display_clear", "display_image", "display_bitmap"
+  };
+  if (!type) return false;
+  for (const char* name : allowed) {
+    if (strcmp(type, name) == 0) return true;
+  }
+  return false;
+}
+
+static uint8_t timelineDepth() {
+  return (timelineHead + TIMELINE_CAPACITY - timelineTail) % TIMELINE_CAPACITY;
+}
+
+static void fillTimelineStatus(JsonDocument& doc) {
+  uint32_t bufferedMs = 0;
+  for (uint8_t i = timelineTail; i != timelineHead; i = (i + 1) % TIMELINE_CAPACITY) {
+    bufferedMs += timeline[i].gapMs;
+  }
+  doc["type"] = "timeline";
+  doc["depth"] = timelineDepth();
+  doc["free"] = TIMELINE_CAPACITY - 1 - timelineDepth();
+  doc["bufferedMs"] = bufferedMs;
+  doc["executed"] = timelineExecuted;
+  doc["underruns"] = timelineUnderruns;
+  doc["slipMs"] = timelineSlipMs;
+  doc["maxLateUs"] = timelineMaxLateUs;
+}
+
+// { type: "timeline", commands: [...], more: true }: appends the commands,
+// "delay" entries spacing them out. With "more", the next batch continues
+// the same schedule (its first command is due after this batch's trailing
+// delay), so a client can stream ahead. All or nothing: a batch that does
+// not fit is refused and can be retried once "free" allows.
+void queueTimeline(JsonDocument& doc, uint32_t clientId) {
+  JsonArray commands = doc["commands"];
+  const char* error = nullptr;
+  
+  size_t count = 0;
+  size_t space = TIMELINE_CAPACITY - 1 - timelineDepth();
+  for (JsonObject command : commands) {
+    const char* type = command["type"];
+    if (type && strcmp(type, "delay") == 0) continue;
+    if (!scheduledCommandAllowed(type)) error = "command not allowed";
+    else if (measureJson(command) >= TIMELINE_COMMAND_MAX) error = "command too long";
+    count++;
+  }
+  if (!error && count > space) error = "full";
+  
+  if (!error) {
+    uint8_t head = timelineHead;
+    uint8_t last = head;
+    uint32_t gapMs = timelinePendingGapMs;
+    bool first = !timelineStreamOpen;
+    for (JsonObject command : commands) {
+      const char* type = command["type"];
+      if (strcmp(type, "delay") == 0) {
+        int ms = command["ms"] | 0;
+        if (ms > 0) gapMs += ms;
+        continue;
+      }
+      TimelineEntry& entry = timeline[head];
+      entry.gapMs = gapMs;
+      entry.flags = first ? TIMELINE_FLAG_START : 0;
+      serializeJson(command, entry.command, sizeof(entry.command));
+      gapMs = 0;
+      first = false;
+      last = head;
+      head = (head + 1) % TIMELINE_CAPACITY;
+    }
+    
+    timelineStreamOpen = doc["more"] | false;
+    timelinePendingGapMs = timelineStreamOpen ? gapMs : 0;
+    if (count && !timelineStreamOpen) timeline[last].flags |= TIMELINE_FLAG_END;
+    timelineHead = head;   // Publish the batch
+  }
+  
+  JsonDocument response(&commandArenaFor(clientId));
+  fillTimelineStatus(response);
+  response["accepted"] = error ? 0 : count;
+  if (error) response["error"] = error;
+  char output[256];
+  size_t len = serializeJson(response, output, sizeof(output));
+  sendText(clientId, output, len);
+}
+
+static void sendTimelineEvent(const char* event) {
+  JsonDocument doc(&telemetryArena);
+  fillTimelineStatus(doc);
+  doc["event"] = event;
+  wsSendJson(doc);
+}
+
+void updateTimeline() {
+  if (timelineClearRequested) {
+    timelineClearRequested = false;
+    // Drop what was queued before the clear, not a batch sent since. The
+    // loop may already have run past that point if the clear came in while
+    // it was running the queue.
+    uint8_t to = timelineClearTo;
+    uint8_t tail = timelineTail;
+    if ((to + TIMELINE_CAPACITY - tail) % TIMELINE_CAPACITY <= timelineDepth()) {
+      timelineTail = to;
+    }
+    timelineDueKnown = false;
+    timelineWasEmpty = true;
+  }
+  
+  uint64_t now = hal::micros64();
+  while (timelineTail != timelineHead) {
+    // A drive or go-to runs until it arrives: the next gap starts from there
+    if (motion.active() || speedCalibrator.running() || motionRequest != MOTION_REQUEST_NONE) {
+      timelineLastDue = now;
+      timelineDueKnown = false;
+      return;
+    }
+    const TimelineEntry& entry = timeline[timelineTail];
+    
+    if (!timelineDueKnown) {
+      bool start = entry.flags & TIMELINE_FLAG_START;
+      uint64_t anchor = start && now > timelineLastDue ? now : timelineLastDue;
+      timelineDue = anchor + entry.gapMs * 1000ULL;
+      // Nothing was queued when this was due: the client fell behind.
+      // Continue from now rather than rushing through the backlog.
+      if (!start && timelineWasEmpty && timelineDue < now) {
+        timelineUnderruns++;
+        timelineSlipMs += (now - timelineDue) / 1000;
+        timelineDue = now;
+        sendTimelineEvent("underrun");
+      }
+      timelineDueKnown = true;
+      timelineWasEmpty = false;
+    }
+    if (now < timelineDue) return;
+    
+    JsonDocument doc(&telemetryArena);
+    if (!deserializeJson(doc, entry.command)) {
+      processCommand(doc, TIMELINE_CLIENT_ID);
+    }
+    uint64_t late = now - timelineDue;
+    if (late > timelineMaxLateUs) timelineMaxLateUs = late > UINT32_MAX ? UINT32_MAX : (uint32_t)late;
+    timelineExecuted++;
+    timelineLastDue = timelineDue;
+    timelineDueKnown = false;
+    bool end = entry.flags & TIMELINE_FLAG_END;
+    timelineTail = (timelineTail + 1) % TIMELINE_CAPACITY;
+    if (end) sendTimelineEvent("done");
+    now = hal::micros64();
+  }
+  timelineWasEmpty = true;
+}
+
+// =====================================================
+// GROUP SHOWS
+// =====================================================
+
+void setupGroup() {
+  memset(&groupConfig, 0, sizeof(groupConfig));
+  if (store.mounted()) {
+    loadRecord(STORE_KEY_GROUP, STORE_SCHEMA_GROUP, &groupConfig, sizeof(groupConfig));
+    groupConfig.name[GROUP_NAME_MAX] = '\0';
+  }
+  
+  const uint8_t multicastIp[4] = GROUP_MULTICAST_IP;
+  groupMulticastSocket = hal::udpBeginMulticast(multicastIp, GROUP_PORT, queueGroupPacket);
+  groupSocket = hal::udpBegin(0, queueGroupPacket);
+  if (groupMulticastSocket < 0 || groupSocket < 0) {
+    LOG.println("✗ Group shows unavailable");
+    return;
+  }
+  LOG.printf("✓ Group shows on UDP %u, group \"%s\"\n", GROUP_PORT, groupConfig.name);
+}
+
+// Runs on the AsyncUDP task: stamps and copies the packet for the loop
+void queueGroupPacket(const uint8_t* data, size_t len, const uint8_t ip[4], uint16_t port) {
+  uint64_t now = hal::micros64();
+  if (!groupConfig.name[0]) return;
+  
+  uint8_t next = (groupRxHead + 1) % GROUP_RX_SLOTS;
+  if (next == groupRxTail || len > GROUP_PACKET_MAX) {
+    groupRxDropped++;
+    return;
+  }
+  GroupRxSlot& slot = groupRx[groupRxHead];
+  slot.receivedUs = now;
+  slot.length = len;
+  memcpy(slot.ip, ip, 4);
+  slot.port = port;
+  memcpy(slot.data, data, len);
+  groupRxHead = next;
+}
+
+static void sendTimeRequest(const uint8_t ip[4], uint16_t port) {
+  uint8_t packet[32];
+  GroupWriter writer(packet, sizeof(packet));
+  writer.begin(GROUP_TIME_REQUEST, groupConfig.name);
+  writer.u64(hal::micros64());
+  hal::udpSend(groupSocket, ip, port, packet, writer.length());
+}
+
+static void sendGroupReport(uint8_t step, uint64_t lateUs) {
+  uint8_t packet[32];
+  GroupWriter writer(packet, sizeof(packet));
+  writer.begin(GROUP_REPORT, groupConfig.name);
+  writer.u16(groupShow.id);
+  writer.u8(step);
+  writer.u32(lateUs > UINT32_MAX ? UINT32_MAX : (uint32_t)lateUs);
+  hal::udpSend(groupSocket, groupController, groupControllerPort, packet, writer.length());
+}
+
+static void acceptGroupShow(GroupRxSlot& slot, GroupReader& reader) {
+  GroupShow show;
+  if (!groupParseShow(reader, show)) return;
+  // Controllers repeat a show against packet loss
+  if (groupShowReceived && show.id == groupShow.id) return;
+  
+  uint64_t now = hal::micros64();
+  if (!groupClock.synced() || now - groupClock.lastSample() > GROUP_SYNC_STALE_MS * 1000ULL) {
+    LOG.printf("✗ Group show %u ignored: clock not synced\n", show.id);
+    return;
+  }
+  for (uint8_t i = 0; i < show.stepCount; i++) {
+    JsonDocument doc(&telemetryArena);
+    if (deserializeJson(doc, show.steps[i].command, show.steps[i].length) ||
+        !scheduledCommandAllowed(doc["type"])) {
+      LOG.printf("✗ Group show %u ignored: step %u not allowed\n", show.id, i);
+      return;
+    }
+  }
+  
+  // Keep the commands: the slot is reused once the loop moves on
+  memcpy(groupShowPacket, slot.data, slot.length);
+  for (uint8_t i = 0; i < show.stepCount; i++) {
+    show.steps[i].command = (const char*)groupShowPacket + (show.steps[i].command - (const char*)slot.data);
+  }
+  groupShow = show;
+  groupShowReceived = true;
+  groupShowActive = show.stepCount > 0;
+  groupShowNext = 0;
+  groupShowStart = groupClock.toLocal(show.startUs);
+  memcpy(groupController, slot.ip, 4);
+  groupControllerPort = slot.port;
+  
+  long startsIn = (long)((int64_t)(groupShowStart - now) / 1000);
+  LOG.printf("✓ Group show %u: %u steps, starts in %ld ms\n", show.id, show.stepCount, startsIn);
+}
+
+static void handleGroupPacket(GroupRxSlot& slot) {
+  GroupReader reader(slot.data, slot.length);
+  GroupPacketType type;
+  char name[GROUP_NAME_MAX + 1];
+  if (!reader.begin(type, name) || strcmp(name, groupConfig.name) != 0) return;
+  
+  switch (type) {
+    case GROUP_BEACON:
+      // A new controller (or a restarted one) has a clock of its own
+      if (memcmp(groupController, slot.ip, 4) != 0 || groupControllerPort != slot.port) {
+        groupClock.reset();
+        memcpy(groupController, slot.ip, 4);
+        groupControllerPort = slot.port;
+      }
+      sendTimeRequest(slot.ip, slot.port);
+      break;
+    case GROUP_TIME_REPLY: {
+      uint64_t t1 = reader.u64();
+      uint64_t t2 = reader.u64();
+      uint64_t t3 = reader.u64();
+      if (reader.ok()) groupClock.addSample(t1, t2, t3, slot.receivedUs);
+      break;
+    }
+    case GROUP_SHOW:
+      acceptGroupShow(slot, reader);
+      break;
+    default:
+      break;
+  }
+}
+
+static void runGroupShow() {
+  uint64_t now = hal::micros64();
+  while (groupShowNext < groupShow.stepCount) {
+    const GroupStep& step = groupShow.steps[groupShowNext];
+    uint64_t due = groupShowStart + step.offsetMs * 1000ULL;
+    if (now < due) return;
+    
+    JsonDocument doc(&telemetryArena);
+    if (!deserializeJson(doc, step.command, step.length)) {
+      processCommand(doc, GROUP_CLIENT_ID);
+    }
+    uint64_t late = now - due;
+    if (late > groupMaxLateUs) groupMaxLateUs = late > UINT32_MAX ? UINT32_MAX : (uint32_t)late;
+    sendGroupReport(groupShowNext, late);
+    groupShowNext++;
+    now = hal::micros64();
+  }
+  groupShowActive = false;
+  groupShowsRun++;
+}
+
+void updateGroup() {
+  while (groupRxTail != groupRxHead) {
+    handleGroupPacket(groupRx[groupRxTail]);
+    groupRxTail = (groupRxTail + 1) % GROUP_RX_SLOTS;
+  }
+  if (groupShowActive) runGroupShow();
+}
+
+// Called from processCommand(); reads only word-sized loop state
+void sendGroupStatus(JsonArena& arena) {
+  JsonDocument response(&arena);
+  response["type"] = "group";
+  response["group"] = groupConfig.name;
+  response["synced"] = groupClock.synced();
+  response["roundTripUs"] = groupClock.roundTrip();
+  response["active"] = groupShowActive;
+  response["showsRun"] = groupShowsRun;
+  response["maxLateUs"] = groupMaxLateUs;
+  response["dropped"] = groupRxDropped;
+  wsSendJson(response);
+}
+
+// =====================================================
+// OTA UPDATE SETUP
+// =====================================================
+
+void startOta(hal::HttpRequest* request, const char* filename) {
+  LOG.printf("OTA Update starting: %s\n", filename);
+  otaInProgress = true;
+  otaFailed = false;
+  otaStartTime = hal::millis();
+  otaLastProgress = otaStartTime;
+  // Includes the multipart framing: only a fallback for plain images
+  otaContentLength = hal::httpContentLength(request);
+  
+  uint8_t expected[SHA256_DIGEST_SIZE];
+  char hex[SHA256_HEX_SIZE];
+  bool hasDigest = hal::httpParam(request, "sha256", false, hex, sizeof(hex)) &&
+                   sha256FromHex(hex, expected);
+  otaStream.begin(hasDigest ? expected : nullptr);
+  
+  // Stop motors and show update screen
+  robotStop();
+  display.clearDisplay();
+  display.setTextSize(1);
+  display.setCursor(10, 20);
+  display.println("OTA UPDATE");
+  display.setCursor(10, 35);
+  display.println("Please wait...");
+  display.drawRect(10, 50, 108, 10, hal::WHITE);
+  display.display();
+  
+  setAllLEDs(255, 165, 0); // Orange
+  
+  if (!hal::otaBegin()) {
+    LOG.printf("Update.begin failed: %s\n", hal::otaErrorString());
+    otaFailed = true;
+  }
+}
+
+// The new image is only committed once the stream checked its digest
+void finishOta() {
+  otaDuration = hal::millis() - otaStartTime;
+  
+  if (!otaFailed && !otaStream.finish()) {
+    LOG.printf("OTA image rejected: %s\n", otaStream.errorString());
+    hal::otaAbort();
+    otaFailed = true;
+  }
+  if (!otaFailed && !hal::otaEnd()) {
+    LOG.printf("Update.end failed: %s\n", hal::otaErrorString());
+    otaFailed = true;
+  }
+  
+  display.clearDisplay();
+  display.setCursor(10, 30);
+  if (!otaFailed) {
+    LOG.printf("OTA Update complete: %u bytes (%u received) in %lu ms, %lu KB/s%s\n",
+               (unsigned)otaStream.written(), (unsigned)otaStream.received(), otaDuration, otaKbps(),
+               otaStream.verified() ? ", SHA-256 verified" : "");
+    setAllLEDs(0, 255, 0); // Green
+    display.println("UPDATE COMPLETE!");
+  } else {
+    setAllLEDs(255, 0, 0); // Red
+    display.println("UPDATE FAILED");
+  }
+  display.setCursor(10, 45);
+  display.print((int)otaKbps());
+  display.print(" KB/s");
+  display.display();
+  otaInProgress = false;
+}
+
+// Throttled to OTA_PROGRESS_INTERVAL_MS by the caller
+void drawOtaProgress() {
+  size_t done, total;
+  if (otaStream.imageSize()) {
+    done = otaStream.written();
+    total = otaStream.imageSize();
+  } else {
+    done = otaStream.received();
+    total = otaContentLength;
+  }
+  int progress = total ? (done >= total ? 104 : (int)((uint64_t)done * 104 / total)) : 0;
+  
+  display.fillRect(12, 52, progress, 6, hal::WHITE);
+  display.fillRect(10, 35, 108, 10, hal::BLACK);
+  display.setCursor(10, 35);
+  display.print((int)otaKbps());
+  display.print(" KB/s");
+  display.display();
+  otaLastProgress = hal::millis();
+}
+
+// Upload rate (bytes received over the air)
+unsigned long otaKbps() {
+  unsigned long elapsed = (otaInProgress ? hal::millis() - otaStartTime : otaDuration);
+  return elapsed ? (unsigned long)((uint64_t)otaStream.received() * 1000 / 1024 / elapsed) : 0;
+}
+
+void setupOTA() {
+  // OTA Update endpoint: plain .bin (optional ?sha256=<hex>) or a packed
+  // image from tools/otapack, unpacked and verified while it streams in
+  hal::httpOnUpload("/update",
+    // Response handler
+    [](hal::HttpRequest *request) {
+      bool success = !otaFailed && !hal::otaHasError();
+      char digest[SHA256_HEX_SIZE];
+      sha256ToHex(otaStream.digest(), digest);
+      
+      JsonDocument doc(&commandArena);
+      doc["success"] = success;
+      doc["message"] = success ? "Update successful, rebooting..." : "Update failed";
+      if (otaStream.error()) doc["error"] = otaStream.errorString();
+      doc["bytes"] = otaStream.written();
+      doc["received"] = otaStream.received();
+      doc["ms"] = otaDuration;
+      doc["kbps"] = otaKbps();
+      doc["sha256"] = digest;
+      doc["verified"] = otaStream.verified();
+      
+      char output[384];
+      serializeJson(doc, output, sizeof(output));
+      static const hal::HttpHeader headers[] = { { "Connection", "close" } };
+      hal::httpSend(request, success ? 200 : 500, "application/json", output, headers, 1);
+      
+      if (success) {
+        LOG.println("✓ OTA Update successful, rebooting...");
+        scheduleRestart(500);
+      }
+    },
+    // Upload handler
+    [](hal::HttpRequest *request, const char* filename, size_t index, uint8_t *data, size_t len, bool final) {
+      if (!index) {
+        startOta(request, filename);
+      }
+      
+      if (len && !otaFailed) {
+        if (!otaStream.write(data, len)) {
+          LOG.printf("OTA write failed: %s (%s)\n", otaStream.errorString(), hal::otaErrorString());
+          hal::otaAbort();
+          otaFailed = true;
+        }
+        
+        if (hal::millis() - otaLastProgress >= OTA_PROGRESS_INTERVAL_MS) {
+          drawOtaProgress();
+        }
+      }
+      
+      if (final) {
+        finishOta();
+      }
+    }
+  );
+  
+  // Switch firmware mode endpoint
+  hal::httpOn("/mode", hal::HTTP_METHOD_POST, [](hal::HttpRequest *request) {
+    char mode[16];
+    if (hal::httpParam(request, "mode", true, mode, sizeof(mode))) {
+      if (strcmp(mode, "live") == 0) {
+        config.firmwareMode = FIRMWARE_MODE_LIVE;
+      } else if (strcmp(mode, "offline") == 0) {
+        config.firmwareMode = FIRMWARE_MODE_OFFLINE;
+      }
+      saveConfig();
+      
+      JsonDocument doc(&commandArena);
+      doc["success"] = true;
+      doc["mode"] = config.firmwareMode == FIRMWARE_MODE_LIVE ? "live" : "offline";
+      doc["message"] = "Mode changed, rebooting...";
+      
+      httpSendJson(request, 200, doc);
+      
+      scheduleRestart(500);
+    } else {
+      hal::httpSend(request, 400, "application/json", "{\"error\":\"Missing mode parameter\"}");
+    }
+  });
+  
+  // Get firmware info
+  hal::httpOn("/info", hal::HTTP_METHOD_GET, [](hal::HttpRequest *request) {
+    JsonDocument doc(&commandArena);
+    doc["device"] = "sirobo";
+    doc["name"] = config.apSSID;
+    doc["version"] = FIRMWARE_VERSION;
+    doc["mode"] = config.firmwareMode == FIRMWARE_MODE_LIVE ? "live" : "offline";
+    doc["heap"] = hal::freeHeap();
+    doc["uptime"] = hal::millis();
+    doc["chip"] = hal::chipModel();
+    
+    KvStats stats;
+    store.stats(stats);
+    JsonObject storage = doc["storage"].to<JsonObject>();
+    storage["mounted"] = store.mounted();
+    storage["sector"] = stats.activeSector;
+    storage["sectors"] = stats.sectors;
+    storage["used"] = stats.used;
+    storage["sectorSize"] = stats.sectorSize;
+    storage["maxErases"] = stats.maxErases;
+    storage["commits"] = stats.commits;
+    storage["writes"] = stats.writes;
+    storage["unchanged"] = stats.unchanged;
+    storage["corrupt"] = stats.corrupt;
+    
+    // Milliseconds since power-on at which each boot phase completed
+    JsonObject boot = doc["boot"].to<JsonObject>();
+    for (uint8_t i = 0; i < BOOT_PHASE_COUNT; i++) {
+      if (bootPhaseReached((BootPhase)i)) boot[BOOT_PHASE_NAMES[i]] = bootTimes[i];
+    }
+    
+    httpSendJson(request, 200, doc);
+  });
+  
+  LOG.println("✓ OTA Update configured");
+}
+
+// =====================================================
+// WEBSOCKET HANDLING
+// =====================================================
+
+// Pseudo clients whose commands the loop runs: USB, timeline, show and
+// replayed session steps
+bool loopClient(uint32_t clientId) {
+  return clientId == USB_CLIENT_ID || clientId == TIMELINE_CLIENT_ID ||
+         clientId == GROUP_CLIENT_ID || clientId == SESSION_CLIENT_ID ||
+         clientId == MICROBENCH_CLIENT_ID;
+}
+
+// WebSocket commands run in the AsyncTCP task and the rest in the loop, so
+// every document a command builds comes from the arena of the task it runs
+// on
+JsonArena& commandArenaFor(uint32_t clientId) {
+  return loopClient(clientId) ? telemetryArena : commandArena;
+}
+
+// Receipt stamp of the frame being processed; each task has its own
+static uint64_t& frameReceivedUs(uint32_t clientId) {
+  if (clientId == USB_CLIENT_ID) return usbFrameReceivedUs;
+  if (clientId == MICROBENCH_CLIENT_ID) return benchFrameReceivedUs;
+  return wsFrameReceivedUs;
+}
+
+void handleTextMessage(uint32_t clientId, const uint8_t* data, size_t len) {
+  uint64_t& received = frameReceivedUs(clientId);
+  received = hal::micros64();
+  JsonDocument doc(&commandArenaFor(clientId));
+  DeserializationError error = deserializeJson(doc, (const char*)data, len);
+  
+  if (!error) {
+    processCommand(doc, clientId);
+  }
+  received = 0;
+}
+
+// Binary messages, told apart by the first byte:
+//   'D' drive, the joystick in three bytes: 0 u8 'D'  1 i8 x  2 i8 y,
+//       the same as {"type":"move","x":x,"y":y}
+//   'B' sprite upload, see queueSpriteUpload()
+void handleBinaryMessage(uint32_t clientId, const uint8_t* data, size_t len) {
+  if (len == DRIVE_BINARY_LENGTH && data[0] == DRIVE_BINARY_KIND) {
+    uint64_t& received = frameReceivedUs(clientId);
+    received = hal::micros64();
+    JsonDocument doc(&commandArenaFor(clientId));
+    doc["type"] = "move";
+    doc["x"] = (int8_t)data[1];
+    doc["y"] = (int8_t)data[2];
+    processCommand(doc, clientId);
+    received = 0;
+    return;
+  }
+  queueSpriteUpload(clientId, data, len);
+}
+
+// Replies to one client: a WebSocket client or the USB host (pseudo
+// clients such as the timeline get none)
+void sendText(uint32_t clientId, const char* text, size_t len) {
+  if (clientId == USB_CLIENT_ID) {
+    usbSend(LINK_TEXT, (const uint8_t*)text, len);
+  } else {
+    hal::wsText(clientId, text, len);
+  }
+}
+
+void sendBinary(uint32_t clientId, const uint8_t* data, size_t len) {
+  if (clientId == USB_CLIENT_ID) {
+    usbSend(LINK_BINARY, data, len);
+  } else {
+    hal::wsBinary(clientId, data, len);
+  }
+}
+
+// Serialize and broadcast a JSON message to all WebSocket clients and the
+// USB host
+void wsSendJson(JsonDocument& doc) {
+  char output[1024];
+  size_t len = serializeJson(doc, output, sizeof(output));
+  hal::wsTextAll(output, len);
+  if (usbActive) usbSend(LINK_TEXT, (const uint8_t*)output, len);
+}
+
+// =====================================================
+// USB SERIAL
+// =====================================================
+
+void setupUsb() {
+  if (hal::usbBegin()) {
+    LOG.println("✓ USB serial configured");
+  } else {
+    LOG.println("✗ USB serial unavailable");
+  }
+}
+
+bool usbSend(uint8_t kind, const uint8_t* data, size_t len) {
+  uint8_t header[LINK_HEADER];
+  linkHeader(kind, data, len, header);
+  if (hal::usbWrite(header, sizeof(header), data, len)) return true;
+  usbDropped++;
+  return false;
+}
+
+// Runs the frames the host sent since the last call. The host has to hold
+// the port open (DTR set); when it closes it, the robot stops as it does
+// for a WebSocket client that goes away.
+void updateUsb() {
+  PROFILE_SCOPE(profiler, PROFILE_USB_SERIAL);
+  if (!hal::usbConnected()) {
+    if (usbActive) {
+      usbActive = false;
+      usbReader.reset();
+      resetEchoClient(USB_CLIENT_ID);
+      setMirrorClient(USB_CLIENT_ID, false, 0);
+      robotStop();
+      LOG.println("USB host disconnected");
+    }
+    return;
+  }
+  
+  uint8_t chunk[USB_READ_CHUNK];
+  size_t len = hal::usbRead(chunk, sizeof(chunk));
+  for (size_t i = 0; i < len; i++) {
+    if (!usbReader.push(chunk[i])) continue;
+    if (!usbActive) {
+      usbActive = true;
+      LOG.println("USB host connected");
+    }
+    if (usbReader.kind() == LINK_TEXT) {
+      handleTextMessage(USB_CLIENT_ID, usbReader.payload(), usbReader.length());
+    } else {
+      handleBinaryMessage(USB_CLIENT_ID, usbReader.payload(), usbReader.length());
+    }
+  }
+}
+
+void httpSendJson(hal::HttpRequest* request, int code, JsonDocument& doc) {
+  char output[512];
+  serializeJson(doc, output, sizeof(output));
+  hal::httpSend(request, code, "application/json", output);
+}
+
+void processCommand(JsonDocument& doc, uint32_t clientId) {
+  PROFILE_SCOPE(profiler, PROFILE_PROCESS_COMMAND);
+  const char* type = doc["type"];
+  commandReceived = true;
+  
+  // A session being recorded keeps the LED, buzzer and display commands
+  if (sessionState == SESSION_RECORDING && clientId != SESSION_CLIENT_ID && sessionActionRecorded(type)) {
+    captureSessionAction(doc, clientId);
+  }
+  
+  if (strcmp(type, "move") == 0) {
+    int x = doc["x"];
+    int y = doc["y"];
+    sessionMoves++;
+    
+    // Convert joystick x,y to motor speeds
+    int leftSpeed = constrain(y + x, -100, 100);
+    int rightSpeed = constrain(y - x, -100, 100);
+    
+    requestMotion(MOTION_REQUEST_CANCEL);
+    setMotorSpeed(map(leftSpeed, -100, 100, -255, 255),
+                  map(rightSpeed, -100, 100, -255, 255));
+  }
+  else if (strcmp(type, "forward") == 0) {
+    int speed = doc["speed"] | 50;
+    requestMotion(MOTION_REQUEST_CANCEL);
+    robotForward(speed);
   }
   else if (strcmp(type, "backward") == 0) {
     int speed = doc["speed"] | 50;
+    requestMotion(MOTION_REQUEST_CANCEL);
     robotBackward(speed);
   }
   else if (strcmp(type, "stop") == 0) {
+    requestMotion(MOTION_REQUEST_CANCEL);
     robotStop();
   }
   else if (strcmp(type, "speed") == 0) {
@@ -759,13 +2175,29 @@ void processCommand(JsonDocument& doc) {
     setAllLEDs(r, g, b);
   }
   else if (strcmp(type, "led_rainbow") == 0) {
-    setLEDEffect(2);
+    ledEngine.rainbow(doc["index"] | LED_ALL);
   }
   else if (strcmp(type, "led_blink") == 0) {
-    setLEDEffect(3);
+    hal::Rgb color = { (uint8_t)(doc["r"] | 255), (uint8_t)(doc["g"] | 255), (uint8_t)(doc["b"] | 255) };
+    ledEngine.blink(doc["index"] | LED_ALL, color, constrain(doc["ms"] | 500, 20, 10000));
   }
   else if (strcmp(type, "led_breathe") == 0) {
-    setLEDEffect(4);
+    if (doc["r"].is<int>()) {
+      hal::Rgb color = { (uint8_t)(doc["r"] | 0), (uint8_t)(doc["g"] | 0), (uint8_t)(doc["b"] | 0) };
+      ledEngine.breathe(doc["index"] | LED_ALL, color);
+    } else {
+      ledEngine.breathe(doc["index"] | LED_ALL);
+    }
+  }
+  else if (strcmp(type, "led_sequence") == 0) {
+    if (!setLEDSequence(doc)) {
+      JsonDocument response(&commandArenaFor(clientId));
+      response["type"] = "led_sequence";
+      response["error"] = "bad frames";
+      char output[64];
+      size_t len = serializeJson(response, output, sizeof(output));
+      sendText(clientId, output, len);
+    }
   }
   else if (strcmp(type, "music") == 0) {
     const char* melody = doc["melody"];
@@ -781,36 +2213,309 @@ void processCommand(JsonDocument& doc) {
   }
   else if (strcmp(type, "turn") == 0) {
     float angle = doc["angle"];
-    robotRotate(angle);
+    requestMotion(MOTION_REQUEST_CANCEL);
+    robotRotate(angle, loopClient(clientId));
   }
   else if (strcmp(type, "line_follower") == 0) {
     lineFollowerEnabled = doc["enable"];
     if (lineFollowerEnabled) {
       lineFollowerSpeed = doc["speed"] | 50;
+      lineFollowerKp = doc["kp"] | lineFollowerKp;
+    }
+  }
+  else if (strcmp(type, "behavior") == 0) {
+    // { type: "behavior", name, enable, priority, ...parameters }; without
+    // a name only reports. Replies with the status of all behaviors.
+    const char* name = doc["name"];
+    const char* error = nullptr;
+    BehaviorId id = parseBehavior(name);
+    if (name && strcmp(name, "all") == 0) {
+      if (!(doc["enable"] | true)) {
+        lineFollowerEnabled = false;
+        for (uint8_t i = 0; i < BEHAVIOR_COUNT; i++) behaviors.setEnabled((BehaviorId)i, false);
+        robotStop();
+      }
+    } else if (name && id == BEHAVIOR_NONE) {
+      error = "unknown behavior";
+    } else if (name) {
+      if (!doc["priority"].isNull()) behaviors.setPriority(id, doc["priority"]);
+      switch (id) {
+        case BEHAVIOR_STOP_ON_LINE:
+          behaviors.stopOnLine.minSensors = doc["minSensors"] | behaviors.stopOnLine.minSensors;
+          break;
+        case BEHAVIOR_AVOID_OBSTACLE: {
+          AvoidObstacleParams& p = behaviors.avoidObstacle;
+          p.distanceCm = doc["distanceCm"] | p.distanceCm;
+          p.speed = doc["speed"] | p.speed;
+          p.backMs = doc["backMs"] | p.backMs;
+          p.turnMs = doc["turnMs"] | p.turnMs;
+          p.turn = doc["turn"] | p.turn;
+          break;
+        }
+        case BEHAVIOR_FOLLOW_WALL: {
+          FollowWallParams& p = behaviors.followWall;
+          p.distanceCm = doc["distanceCm"] | p.distanceCm;
+          p.speed = doc["speed"] | p.speed;
+          p.gain = doc["gain"] | p.gain;
+          p.side = doc["side"] | p.side;
+          break;
+        }
+        case BEHAVIOR_LINE_FOLLOW:
+          lineFollowerSpeed = doc["speed"] | lineFollowerSpeed;
+          lineFollowerKp = doc["kp"] | lineFollowerKp;
+          break;
+        case BEHAVIOR_FOLLOW_LIGHT: {
+          FollowLightParams& p = behaviors.followLight;
+          p.speed = doc["speed"] | p.speed;
+          p.gain = doc["gain"] | p.gain;
+          p.minLight = doc["minLight"] | p.minLight;
+          break;
+        }
+        default:
+          break;
+      }
+      
+      if (!doc["enable"].isNull()) {
+        bool enable = doc["enable"];
+        bool owned = behaviors.owner() == id;
+        if (id == BEHAVIOR_LINE_FOLLOW) lineFollowerEnabled = enable;
+        else behaviors.setEnabled(id, enable);
+        if (!enable && owned) robotStop();
+      }
+    }
+    sendBehaviorStatus(clientId, error);
+  }
+  else if (strcmp(type, "lap") == 0) {
+    // { type: "lap", action: "learn" | "race" | "stop" | "clear" | "status",
+    //   speed, maxSpeed, grip, brake, lookaheadMs, fullSpeed, lagMs }
+    // The loop applies it and replies: the learner must not change under
+    // its step().
+    const char* action = doc["action"] | "status";
+    
+    bool tuned = false;
+    for (const char* key : { "maxSpeed", "grip", "brake", "lookaheadMs", "fullSpeed", "lagMs" }) {
+      if (!doc[key].isNull()) tuned = true;
+    }
+    // Settings still waiting for the loop are the base for these
+    LapParams params = lapRequestTuned ? lapRequestParams : lapLearner.params;
+    params.maxSpeed = constrain(doc["maxSpeed"] | (int)params.maxSpeed, 1, 100);
+    params.grip = constrain(doc["grip"] | params.grip, 0.1f, 4.0f);
+    params.brake = constrain(doc["brake"] | (int)params.brake, 100, 20000);
+    params.lookaheadMs = constrain(doc["lookaheadMs"] | (int)params.lookaheadMs, 0, 1000);
+    params.fullSpeed = constrain(doc["fullSpeed"] | (int)params.fullSpeed, 50, 5000);
+    params.lagMs = constrain(doc["lagMs"] | (int)params.lagMs, 0, 1000);
+    if (tuned) {
+      lapRequestParams = params;
+      lapRequestTuned = true;
+    }
+    
+    LapRequest request = LAP_REQUEST_STATUS;
+    if (strcmp(action, "learn") == 0) {
+      lapRequestSpeed = doc["speed"] | lineFollowerSpeed;
+      request = LAP_REQUEST_LEARN;
+    } else if (strcmp(action, "race") == 0) {
+      request = LAP_REQUEST_RACE;
+    } else if (strcmp(action, "stop") == 0) {
+      request = LAP_REQUEST_STOP;
+    } else if (strcmp(action, "clear") == 0) {
+      request = LAP_REQUEST_CLEAR;
+    }
+    // A status query does not replace an action still waiting
+    if (request != LAP_REQUEST_STATUS || lapRequest == LAP_REQUEST_NONE) {
+      lapRequestClient = clientId;
+      lapRequest = request;
+    }
+  }
+  else if (strcmp(type, "drive") == 0 || strcmp(type, "goto") == 0) {
+    // { type: "drive", distance: cm (negative backs up), speed: percent }
+    // { type: "goto", x, y: cm in the pose frame, speed: percent }
+    // A "motion" event reports the arrival. Ends a motion or calibration
+    // in progress; no reply, so timelines and shows can run them too.
+    // The loop starts it on its next control tick.
+    motionRequestSpeed = constrain(doc["speed"] | 50, 1, 100);
+    if (type[0] == 'd') {
+      float distanceCm = doc["distance"] | 0.0f;
+      motionRequestX = distanceCm * 10;
+      requestMotion(MOTION_REQUEST_DRIVE);
+    } else {
+      float x = doc["x"] | 0.0f;
+      float y = doc["y"] | 0.0f;
+      motionRequestX = x * 10;
+      motionRequestY = y * 10;
+      requestMotion(MOTION_REQUEST_GOTO);
+    }
+  }
+  else if (strcmp(type, "pose") == 0) {
+    // { type: "pose", action: "reset" | "status", x, y: cm, theta: deg,
+    //   gain, deadband, lagMs (speed model, saved) }
+    const char* action = doc["action"] | "status";
+    
+    bool tuned = false;
+    for (const char* key : { "gain", "deadband", "lagMs" }) {
+      if (!doc[key].isNull()) tuned = true;
+    }
+    if (tuned) {
+      SpeedModel& model = poseEstimator.model;
+      model.gain = constrain(doc["gain"] | model.gain, 10.0f, 10000.0f);
+      model.deadband = constrain(doc["deadband"] | model.deadband, 0.0f, 0.9f);
+      model.lagMs = constrain(doc["lagMs"] | (int)model.lagMs, 0, 1000);
+      requestSave(STORE_KEY_SPEED_MODEL);
+    }
+    
+    if (strcmp(action, "reset") == 0) {
+      // The loop resets the estimate between two updates, then replies
+      float x = doc["x"] | 0.0f;
+      float y = doc["y"] | 0.0f;
+      poseResetX = x * 10;
+      poseResetY = y * 10;
+      poseResetTheta = doc["theta"] | 0.0f;
+      poseResetClient = clientId;
+      poseResetRequested = true;
+    } else {
+      sendPoseStatus(clientId, nullptr, commandArenaFor(clientId));
+    }
+  }
+  else if (strcmp(type, "speed_calibrate") == 0) {
+    // { type: "speed_calibrate", action: "start" | "stop" }: facing a wall
+    // 60-200 cm ahead, drives at it a few times to learn the speed model.
+    // A "speed_calibrate" event reports the result. The loop starts or
+    // stops it and replies.
+    const char* action = doc["action"] | "start";
+    if (strcmp(action, "stop") == 0) {
+      motionRequestClient = clientId;
+      requestMotion(MOTION_REQUEST_STOP);
+    } else if (strcmp(action, "start") == 0) {
+      motionRequestClient = clientId;
+      requestMotion(MOTION_REQUEST_CALIBRATE);
+    } else {
+      sendPoseStatus(clientId, nullptr, commandArenaFor(clientId));
+    }
+  }
+  else if (strcmp(type, "session") == 0) {
+    // { type: "session", action: "record" | "stop" | "play", heading }:
+    // records the live session until "stop" and saves it, or replays the
+    // saved one (holding the recorded heading unless heading is false).
+    // "session" events report the progress; no action: status only.
+    const char* action = doc["action"] | "";
+    const char* error = nullptr;
+    bool starting = strcmp(action, "record") == 0 || strcmp(action, "play") == 0;
+    if (starting && sessionState == SESSION_SAVING) {
+      error = "saving";
+    } else if (strcmp(action, "record") == 0) {
+      sessionRequest = SESSION_REQUEST_RECORD;
+    } else if (strcmp(action, "play") == 0) {
+      if (!sessionSaved) {
+        error = "no session";
+      } else {
+        sessionRequestHeadingHold = doc["heading"] | true;
+        sessionRequest = SESSION_REQUEST_PLAY;
+      }
+    } else if (strcmp(action, "stop") == 0) {
+      sessionRequest = SESSION_REQUEST_STOP;
     }
+    sendSessionStatus(clientId, error);
   }
   else if (strcmp(type, "calibrate") == 0) {
     motorLeftCalibration = doc["left"];
     motorRightCalibration = doc["right"];
   }
+  else if (strcmp(type, "motor_config") == 0) {
+    // PWM, deadband and ramps; omitted fields keep their value. Saved, and
+    // applied by the loop. Replies with the settings (or an error).
+    MotorConfig candidate = motorConfig;
+    candidate.pwmFrequency = doc["pwmFrequency"] | candidate.pwmFrequency;
+    candidate.pwmResolution = doc["pwmResolution"] | candidate.pwmResolution;
+    candidate.deadband = doc["deadband"] | candidate.deadband;
+    candidate.maxAccel = doc["maxAccel"] | candidate.maxAccel;
+    candidate.maxJerk = doc["maxJerk"] | candidate.maxJerk;
+    
+    const char* error = nullptr;
+    if (!validMotorConfig(candidate)) {
+      error = "invalid";
+    } else if (memcmp(&candidate, &motorConfig, sizeof(candidate)) != 0) {
+      motorConfig = candidate;
+      motorConfigRequest = candidate;
+      motorConfigPending = true;
+      requestSave(STORE_KEY_MOTOR_CONFIG);
+    }
+    sendMotorConfig(clientId, error);
+  }
+  else if (strcmp(type, "motor_bench") == 0) {
+    // configure() and the raw pin writes belong to the loop
+    motorBenchClient = clientId;
+    motorBenchPending = true;
+  }
   else if (strcmp(type, "save_calibration") == 0) {
     saveCalibration();
   }
   else if (strcmp(type, "auto_calibrate") == 0) {
-    autoCalibrateStraight();
+    autoCalibrateStraight(loopClient(clientId));
   }
   else if (strcmp(type, "display_text") == 0) {
+    displayEpoch++;
     int line = doc["line"];
     const char* text = doc["text"];
     displayText(line, text);
   }
   else if (strcmp(type, "display_clear") == 0) {
+    displayEpoch++;
     clearDisplay();
   }
   else if (strcmp(type, "display_image") == 0) {
+    displayEpoch++;
     const char* image = doc["image"];
     displayImage(image);
   }
+  else if (strcmp(type, "display_bitmap") == 0) {
+    queueSpriteRequest(doc, clientId);
+  }
+  else if (strcmp(type, "display_mirror") == 0) {
+    // Stream the OLED to this client as binary messages
+    bool enabled = doc["enabled"] | true;
+    int fps = doc["fps"] | MIRROR_FPS_DEFAULT;
+    bool ok = setMirrorClient(clientId, enabled, constrain(fps, 1, MIRROR_FPS_MAX));
+    sendMirrorStatus(clientId, ok ? nullptr : "too many clients");
+  }
+  else if (strcmp(type, "line_calibrate") == 0) {
+    // Sweep the sensor array over line and floor between start and stop
+    const char* action = doc["action"] | "start";
+    bool saved = false;
+    if (strcmp(action, "start") == 0) {
+      startLineCalibration();
+    } else if (strcmp(action, "stop") == 0) {
+      saved = finishLineCalibration();
+    }
+    
+    JsonDocument response(&commandArenaFor(clientId));
+    response["type"] = "line_calibration";
+    response["calibrating"] = lineCalibrating;
+    response["threshold"] = lineThreshold;
+    response["saved"] = saved;
+    wsSendJson(response);
+  }
+  else if (strcmp(type, "timeline") == 0) {
+    queueTimeline(doc, clientId);
+  }
+  else if (strcmp(type, "timeline_clear") == 0) {
+    // The next batch starts a new stream
+    timelineStreamOpen = false;
+    timelinePendingGapMs = 0;
+    timelineClearTo = timelineHead;
+    timelineClearRequested = true;
+  }
+  else if (strcmp(type, "delay") == 0) {
+    // Only meaningful inside a timeline batch; clients that send it on its
+    // own wait themselves
+  }
+  else if (strcmp(type, "group") == 0) {
+    // Join a group for synchronized shows ("" leaves); replies with the status
+    const char* join = doc["join"];
+    if (join) {
+      snprintf(groupConfig.name, sizeof(groupConfig.name), "%s", join);
+      requestSave(STORE_KEY_GROUP);
+    }
+    sendGroupStatus(commandArenaFor(clientId));
+  }
   else if (strcmp(type, "reset_yaw") == 0) {
     yawOffset = yaw;
   }
@@ -842,38 +2547,20 @@ void processCommand(JsonDocument& doc) {
     saveConfig();
     
     // Send confirmation
-    JsonDocument response;
+    JsonDocument response(&commandArenaFor(clientId));
     response["type"] = "config_saved";
     response["success"] = true;
-    String output;
-    serializeJson(response, output);
-    ws.textAll(output);
+    wsSendJson(response);
     
-    // Restart after 2 seconds
-    delay(2000);
-    ESP.restart();
+    // Restart after 2 seconds, once the config is committed
+    scheduleRestart(2000);
   }
   else if (strcmp(type, "get_config") == 0) {
-    sendConfig();
+    sendConfig(commandArenaFor(clientId));
   }
   else if (strcmp(type, "scan_wifi") == 0) {
-    // Scan for WiFi networks
-    int n = WiFi.scanNetworks();
-    JsonDocument response;
-    response["type"] = "wifi_scan";
-    JsonArray networks = response["networks"].to<JsonArray>();
-    
-    for (int i = 0; i < n && i < 10; i++) {
-      JsonObject net = networks.add<JsonObject>();
-      net["ssid"] = WiFi.SSID(i);
-      net["rssi"] = WiFi.RSSI(i);
-      net["secured"] = WiFi.encryptionType(i) != WIFI_AUTH_OPEN;
-    }
-    
-    String output;
-    serializeJson(response, output);
-    ws.textAll(output);
-    WiFi.scanDelete();
+    // Answered from the cache or, once a background scan finishes, by the loop
+    requestWifiScan(clientId, doc["refresh"] | false);
   }
   else if (strcmp(type, "set_mode") == 0) {
     // Set firmware mode (live/offline)
@@ -886,199 +2573,1073 @@ void processCommand(JsonDocument& doc) {
       }
       saveConfig();
       
-      JsonDocument response;
+      JsonDocument response(&commandArenaFor(clientId));
       response["type"] = "mode_changed";
       response["mode"] = config.firmwareMode == FIRMWARE_MODE_LIVE ? "live" : "offline";
       response["reboot"] = true;
-      String output;
-      serializeJson(response, output);
-      ws.textAll(output);
+      wsSendJson(response);
       
-      delay(500);
-      ESP.restart();
+      scheduleRestart(500);
     }
   }
   else if (strcmp(type, "get_info") == 0) {
     // Get robot info
-    JsonDocument response;
+    JsonDocument response(&commandArenaFor(clientId));
     response["type"] = "info";
     response["name"] = config.apSSID;
     response["version"] = FIRMWARE_VERSION;
     response["mode"] = config.firmwareMode == FIRMWARE_MODE_LIVE ? "live" : "offline";
-    response["heap"] = ESP.getFreeHeap();
-    response["uptime"] = millis();
+    response["heap"] = hal::freeHeap();
+    response["uptime"] = hal::millis();
+    JsonObject usb = response["usb"].to<JsonObject>();
+    usb["connected"] = usbActive;
+    usb["frames"] = usbReader.frames();
+    usb["errors"] = usbReader.errors();
+    usb["dropped"] = usbDropped;
+    
+    wsSendJson(response);
+  }
+  else if (strcmp(type, "recorder") == 0) {
+    // Flight recorder control
+    const char* action = doc["action"] | "status";
     
-    String output;
-    serializeJson(response, output);
-    ws.textAll(output);
+    if (strcmp(action, "start") == 0) {
+      recorder.start(FLIGHT_RECORDER_PERIOD_US);
+    }
+    else if (strcmp(action, "arm") == 0) {
+      const char* event = doc["event"] | "command";
+      FlightTrigger trigger = FLIGHT_TRIGGER_COMMAND;
+      if (strcmp(event, "line_lost") == 0) trigger = FLIGHT_TRIGGER_LINE_LOST;
+      else if (strcmp(event, "obstacle") == 0) trigger = FLIGHT_TRIGGER_OBSTACLE;
+      else if (strcmp(event, "line_follower") == 0) trigger = FLIGHT_TRIGGER_LINE_FOLLOWER;
+      
+      recorder.arm(trigger, FLIGHT_RECORDER_PERIOD_US, doc["post"] | (FLIGHT_RECORDER_CAPACITY / 2));
+    }
+    else if (strcmp(action, "trigger") == 0) {
+      recorder.trigger(FLIGHT_TRIGGER_COMMAND);
+    }
+    else if (strcmp(action, "stop") == 0) {
+      recorder.stop();
+    }
+    
+    sendRecorderStatus(commandArenaFor(clientId));
+  }
+  else if (strcmp(type, "profile") == 0) {
+    // Loop profile; action "reset" clears the counters first
+    const char* action = doc["action"] | "get";
+    if (strcmp(action, "reset") == 0) {
+      profiler.reset();
+    }
+    
+    // Too big for the 1 KB reply buffers: one buffer per task, like /metrics
+    static char output[2][PROFILE_REPLY_SIZE];
+    char* buffer = output[loopClient(clientId)];
+    JsonDocument response(&commandArenaFor(clientId));
+    response["type"] = "profile";
+    fillProfile(response);
+    size_t len = serializeJson(response, buffer, PROFILE_REPLY_SIZE);
+    sendText(clientId, buffer, len);
+  }
+  else if (strcmp(type, "echo") == 0) {
+    handleEcho(doc, clientId);
+  }
+  else if (strcmp(type, "ping") == 0) {
+    // Respond to ping
+    JsonDocument response(&commandArenaFor(clientId));
+    response["type"] = "pong";
+    response["device"] = "sirobo";
+    response["name"] = config.apSSID;
+    response["version"] = FIRMWARE_VERSION;
+    
+    wsSendJson(response);
+  }
+}
+
+// =====================================================
+// MOTOR CONTROL
+// =====================================================
+
+void setMotorSpeed(int left, int right) {
+  // Apply calibration
+  applyMotorSpeed(left + motorLeftCalibration, right + motorRightCalibration);
+}
+
+// Calibration already applied (session replay repeats applied setpoints)
+void applyMotorSpeed(int left, int right) {
+  // Constrain values
+  left = constrain(left, -255, 255);
+  right = constrain(right, -255, 255);
+  
+  motorLeftSpeed = left;
+  motorRightSpeed = right;
+  
+  motorLeft.setTarget(left);
+  motorRight.setTarget(right);
+  
+  // First motor command of a frame: the robot's share of the
+  // joystick-to-wheel latency (updateMotors() writes it on its next pass). Only the AsyncTCP task sets the WebSocket
+  // stamp, and it outranks the loop on the single-core S2, so a loop-side
+  // write never runs while one is pending. USB frames run in the loop and
+  // go to their own histogram.
+  if (wsFrameReceivedUs) {
+    actuationLatency.record(hal::micros64() - wsFrameReceivedUs, hal::millis());
+    wsFrameReceivedUs = 0;
+  } else if (usbFrameReceivedUs) {
+    usbActuationLatency.record(hal::micros64() - usbFrameReceivedUs, hal::millis());
+    usbFrameReceivedUs = 0;
+  }
+}
+
+// Runs the ramps at the loop rate and applies "motor_config" changes and
+// "motor_bench" requests
+void updateMotors() {
+  uint32_t now = hal::micros();
+  uint32_t dt = now - lastMotorUpdateUs;
+  lastMotorUpdateUs = now;
+  
+  if (motorConfigPending) {
+    motorConfigPending = false;
+    motorLeft.configure(motorConfigRequest);
+    motorRight.configure(motorConfigRequest);
+  }
+  if (motorBenchPending) {
+    motorBenchPending = false;
+    runMotorBench(motorBenchClient);
+  }
+  motorLeft.update(dt);
+  motorRight.update(dt);
+}
+
+bool validMotorConfig(const MotorConfig& candidate) {
+  return candidate.pwmResolution >= 1 && candidate.pwmResolution <= 14 &&
+         candidate.pwmFrequency >= 100 &&
+         candidate.pwmFrequency <= motorMaxPwmFrequency(candidate.pwmResolution) &&
+         candidate.deadband < MOTOR_COMMAND_MAX;
+}
+
+void sendMotorConfig(uint32_t clientId, const char* error) {
+  JsonDocument response(&commandArenaFor(clientId));
+  response["type"] = "motor_config";
+  response["pwmFrequency"] = motorConfig.pwmFrequency;
+  response["pwmResolution"] = motorConfig.pwmResolution;
+  response["maxPwmFrequency"] = motorMaxPwmFrequency(motorConfig.pwmResolution);
+  response["deadband"] = motorConfig.deadband;
+  response["maxAccel"] = motorConfig.maxAccel;
+  response["maxJerk"] = motorConfig.maxJerk;
+  if (error) response["error"] = error;
+  char output[256];
+  size_t len = serializeJson(response, output, sizeof(output));
+  sendText(clientId, output, len);
+}
+
+// The output stage as it was before lib/MotorDriver, for runMotorBench()
+static void legacyMotorWrite(int left, int right) {
+  if (left > 0) {
+    hal::digitalWrite(MOTOR_LEFT_IN1, true);
+    hal::digitalWrite(MOTOR_LEFT_IN2, false);
+  } else if (left < 0) {
+    hal::digitalWrite(MOTOR_LEFT_IN1, false);
+    hal::digitalWrite(MOTOR_LEFT_IN2, true);
+  } else {
+    hal::digitalWrite(MOTOR_LEFT_IN1, false);
+    hal::digitalWrite(MOTOR_LEFT_IN2, false);
+  }
+  hal::pwmWrite(MOTOR_LEFT_CHANNEL, abs(left));
+  
+  if (right > 0) {
+    hal::digitalWrite(MOTOR_RIGHT_IN1, true);
+    hal::digitalWrite(MOTOR_RIGHT_IN2, false);
+  } else if (right < 0) {
+    hal::digitalWrite(MOTOR_RIGHT_IN1, false);
+    hal::digitalWrite(MOTOR_RIGHT_IN2, true);
+  } else {
+    hal::digitalWrite(MOTOR_RIGHT_IN1, false);
+    hal::digitalWrite(MOTOR_RIGHT_IN2, false);
+  }
+  hal::pwmWrite(MOTOR_RIGHT_CHANNEL, abs(right));
+}
+
+// Average cycles of one call writing both motors
+static uint32_t benchMotorWrites(bool legacy, bool changing) {
+  uint32_t start = hal::cycleCount();
+  for (int i = 0; i < MOTOR_BENCH_CALLS; i++) {
+    int command = changing ? (i & 1 ? 1 : -1) : 0;
+    if (legacy) {
+      legacyMotorWrite(command, command);
+    } else {
+      motorLeft.setTarget(command);
+      motorRight.setTarget(command);
+      motorLeft.update(0);
+      motorRight.update(0);
+    }
+  }
+  return (hal::cycleCount() - start) / MOTOR_BENCH_CALLS;
+}
+
+// Cycles per setMotorSpeed() output stage, old code against Motor, with
+// the same command every call (the line follower's common case) and with
+// one that changes every call. The changing commands flip between +1 and
+// -1, far too short a pulse to turn a wheel; the motors must be stopped.
+// Runs on the loop.
+void runMotorBench(uint32_t clientId) {
+  JsonDocument response(&telemetryArena);
+  response["type"] = "motor_bench";
+  if (motorLeft.target() || motorRight.target() || motorLeft.output() || motorRight.output()) {
+    response["error"] = "motors running";
+  } else {
+    // Ramps would defer the writes to the loop
+    MotorConfig saved = motorConfig;
+    MotorConfig direct = motorConfig;
+    direct.maxAccel = 0;
+    motorLeft.configure(direct);
+    motorRight.configure(direct);
+    
+    response["calls"] = MOTOR_BENCH_CALLS;
+    response["cpuMHz"] = hal::cycleFrequency() / 1000000UL;
+    response["legacySameCycles"] = benchMotorWrites(true, false);
+    response["legacyChangingCycles"] = benchMotorWrites(true, true);
+    response["driverSameCycles"] = benchMotorWrites(false, false);
+    response["driverChangingCycles"] = benchMotorWrites(false, true);
+    
+    // configure() rewrites the pins and duty the old code left behind
+    motorLeft.configure(saved);
+    motorRight.configure(saved);
+    robotStop();
+  }
+  char output[256];
+  size_t len = serializeJson(response, output, sizeof(output));
+  sendText(clientId, output, len);
+}
+
+void robotForward(int speedPercent) {
+  int speed = map(speedPercent, 0, 100, 0, 255);
+  setMotorSpeed(speed, speed);
+}
+
+void robotBackward(int speedPercent) {
+  int speed = map(speedPercent, 0, 100, 0, 255);
+  setMotorSpeed(-speed, -speed);
+}
+
+void robotTurnLeft(int speedPercent) {
+  int speed = map(speedPercent, 0, 100, 0, 255);
+  setMotorSpeed(-speed, speed);
+}
+
+void robotTurnRight(int speedPercent) {
+  int speed = map(speedPercent, 0, 100, 0, 255);
+  setMotorSpeed(speed, -speed);
+}
+
+void robotStop() {
+  setMotorSpeed(0, 0);
+  // At once, past any ramp and the trim
+  motorLeft.stop();
+  motorRight.stop();
+}
+
+// Blocking helpers wait with this. Only updateMotors() writes the motors,
+// and the loop runs it while an AsyncTCP-side helper sleeps; one running
+// on the loop has to run it itself.
+static void waitDriving(unsigned long ms, bool onLoop) {
+  if (!onLoop) {
+    hal::delay(ms);
+    return;
+  }
+  unsigned long start = hal::millis();
+  do {
+    updateMotors();
+    hal::delay(ms < 10 ? ms : 10);
+  } while (hal::millis() - start < ms);
+}
+
+void robotRotate(float targetAngle, bool onLoop) {
+  float startYaw = yaw - yawOffset;
+  float targetYaw = startYaw + targetAngle;
+  
+  int direction = targetAngle > 0 ? 1 : -1;
+  int speed = 100;
+  
+  setMotorSpeed(speed * direction, -speed * direction);
+  
+  unsigned long startTime = hal::millis();
+  while (hal::millis() - startTime < 5000) { // Timeout 5 seconds
+    updateIMU();
+    float currentYaw = yaw - yawOffset;
+    
+    if (direction > 0 && currentYaw >= targetYaw) break;
+    if (direction < 0 && currentYaw <= targetYaw) break;
+    
+    waitDriving(10, onLoop);
+  }
+  
+  robotStop();
+}
+
+// Blocking, for compiled programs like robotRotate(): runs the motion to
+// its end (or MOTION_TIMEOUT_MS)
+static void waitForMotion() {
+  startMotion();
+  while (motion.active()) {
+    hal::delay(POSE_PERIOD_MS);
+    updateIMU();
+    updatePose();
+    updateMotion();
+    updateMotors();
+  }
+}
+
+void robotDrive(float distanceCm, int speed) {
+  motion.drive(poseEstimator.pose(), distanceCm * 10, speed);
+  waitForMotion();
+}
+
+void robotGoTo(float xCm, float yCm, int speed) {
+  motion.goTo(poseEstimator.pose(), xCm * 10, yCm * 10, speed);
+  waitForMotion();
+}
+
+// Here becomes (0, 0), facing along x
+void robotResetPose() {
+  poseEstimator.reset(0, 0, 0, yaw);
+}
+
+// =====================================================
+// DEAD RECKONING
+// =====================================================
+
+void updatePose() {
+  unsigned long now = hal::millis();
+  // Long stalls (boot, a blocking command) count as one tick
+  unsigned long elapsed = now - lastPoseUpdate;
+  lastPoseUpdate = now;
+  float dt = (elapsed > 100 ? 100 : elapsed) / 1000.0f;
+  poseEstimator.update(dt, motorLeft.level(), motorRight.level(), yaw);
+}
+
+// Sets up the motion just given to `motion`
+void startMotion() {
+  motionStartTime = hal::millis();
+  // Slowest command that still moves the robot: a little past the speed
+  // model's deadband, through the motor deadband mapping
+  float duty = poseEstimator.model.deadband + 0.08f;
+  int deadband = motorConfig.deadband;
+  int command = (int)((duty * 255 - deadband) * 255 / (255 - deadband));
+  motion.params.minCommand = constrain(command, 30, 255);
+}
+
+// Hands a motion command to the loop (any task). A newer request replaces
+// one still waiting; each ends a motion, speed calibration or session
+// replay in progress.
+void requestMotion(MotionRequest request) {
+  if (sessionState == SESSION_REPLAYING) sessionRequest = SESSION_REQUEST_CANCEL;
+  motionRequest = request;
+}
+
+// Top of the control tick: pose resets, then motion requests
+void applyMotionRequests() {
+  if (poseResetRequested) {
+    poseResetRequested = false;
+    poseEstimator.reset(poseResetX, poseResetY, poseResetTheta, yaw);
+    sendPoseStatus(poseResetClient, nullptr, telemetryArena);
+  }
+  
+  MotionRequest request = motionRequest;
+  if (request == MOTION_REQUEST_NONE) return;
+  motionRequest = MOTION_REQUEST_NONE;
+  cancelMotion(request != MOTION_REQUEST_CANCEL);
+  
+  const char* error = nullptr;
+  switch (request) {
+    case MOTION_REQUEST_DRIVE:
+      motion.drive(poseEstimator.pose(), motionRequestX, motionRequestSpeed);
+      startMotion();
+      break;
+    case MOTION_REQUEST_GOTO:
+      motion.goTo(poseEstimator.pose(), motionRequestX, motionRequestY, motionRequestSpeed);
+      startMotion();
+      break;
+    case MOTION_REQUEST_CALIBRATE:
+      if (!speedCalibrator.start(hal::millis(), distance)) {
+        error = "no wall";
+      } else {
+        calibrationHeading = poseEstimator.pose().theta;
+      }
+      sendPoseStatus(motionRequestClient, error, telemetryArena);
+      break;
+    case MOTION_REQUEST_STOP:
+      sendPoseStatus(motionRequestClient, nullptr, telemetryArena);
+      break;
+    default:
+      break;
+  }
+}
+
+// Stops a motion or speed calibration in progress (loop only). Without
+// stopMotors the motors are left to the command that ended it.
+void cancelMotion(bool stopMotors) {
+  if (motion.active()) finishMotion("cancelled", stopMotors);
+  if (speedCalibrator.running()) {
+    speedCalibrator.stop();
+    if (stopMotors) robotStop();
+    reportSpeedCalibration(telemetryArena);
+  }
+}
+
+void finishMotion(const char* event, bool stopMotors) {
+  motion.cancel();
+  if (stopMotors) robotStop();
+  
+  const Pose& pose = poseEstimator.pose();
+  JsonDocument doc(&telemetryArena);
+  doc["type"] = "motion";
+  doc["event"] = event;
+  doc["x"] = roundf(pose.x) / 10;
+  doc["y"] = roundf(pose.y) / 10;
+  doc["theta"] = roundf(pose.theta * 10) / 10;
+  doc["targetX"] = roundf(motion.targetX()) / 10;
+  doc["targetY"] = roundf(motion.targetY()) / 10;
+  wsSendJson(doc);
+}
+
+void updateMotion() {
+  if (speedCalibrator.running()) {
+    if (behaviorOwner != BEHAVIOR_NONE) {
+      cancelMotion(true);
+      return;
+    }
+    int command = speedCalibrator.step(hal::millis());
+    if (!speedCalibrator.running()) {
+      robotStop();
+      if (speedCalibrator.state() == SPEED_CAL_DONE) {
+        SpeedModel model = speedCalibrator.result();
+        model.lagMs = poseEstimator.model.lagMs;
+        poseEstimator.model = model;
+        requestSave(STORE_KEY_SPEED_MODEL);
+      }
+      reportSpeedCalibration(telemetryArena);
+      return;
+    }
+    // Keep facing the wall
+    int limit = abs(command) / 2;
+    float error = wrapDegrees(calibrationHeading - poseEstimator.pose().theta);
+    int turn = constrain((int)(motion.params.headingGain * error), -limit, limit);
+    setMotorSpeed(command - turn, command + turn);
+    return;
+  }
+  
+  if (!motion.active()) return;
+  if (behaviorOwner != BEHAVIOR_NONE) {
+    finishMotion("interrupted", true);
+    return;
+  }
+  if (hal::millis() - motionStartTime >= MOTION_TIMEOUT_MS) {
+    finishMotion("timeout", true);
+    return;
+  }
+  
+  int left, right;
+  float lag = poseEstimator.model.lagMs / 1000.0f;
+  if (motion.step(poseEstimator.pose(), poseEstimator.speed(), lag, left, right)) {
+    finishMotion("done", true);
+  } else {
+    setMotorSpeed(left, right);
   }
-  else if (strcmp(type, "ping") == 0) {
-    // Respond to ping
-    JsonDocument response;
-    response["type"] = "pong";
-    response["device"] = "sirobo";
-    response["name"] = config.apSSID;
-    response["version"] = FIRMWARE_VERSION;
-    
-    String output;
-    serializeJson(response, output);
-    ws.textAll(output);
+}
+
+// Broadcasts the end of a speed calibration
+void reportSpeedCalibration(JsonArena& arena) {
+  JsonDocument doc(&arena);
+  doc["type"] = "speed_calibrate";
+  bool done = speedCalibrator.state() == SPEED_CAL_DONE;
+  doc["event"] = done ? "done" : "failed";
+  if (!done) doc["error"] = speedCalibrator.error();
+  
+  // Runs as [duty %, mm/s]
+  JsonArray runs = doc["runs"].to<JsonArray>();
+  for (uint8_t i = 0; i < speedCalibrator.runs(); i++) {
+    JsonArray run = runs.add<JsonArray>();
+    run.add(roundf(speedCalibrator.runDuty(i) * 1000) / 10);
+    run.add((int)roundf(speedCalibrator.runSpeed(i)));
   }
+  if (done) {
+    doc["gain"] = poseEstimator.model.gain;
+    doc["deadband"] = poseEstimator.model.deadband;
+  }
+  wsSendJson(doc);
+}
+
+// Pose, motion and speed model, to one client, from the caller's task arena
+void sendPoseStatus(uint32_t clientId, const char* error, JsonArena& arena) {
+  JsonDocument response(&arena);
+  response["type"] = "pose";
+  if (error) response["error"] = error;
+  
+  const Pose& pose = poseEstimator.pose();
+  response["x"] = roundf(pose.x) / 10;
+  response["y"] = roundf(pose.y) / 10;
+  response["theta"] = roundf(pose.theta * 10) / 10;
+  response["speed"] = (int)roundf(poseEstimator.speed());
+  response["odometer"] = roundf(poseEstimator.odometer()) / 10;
+  response["motion"] = motionStateName(motion.state());
+  response["calibration"] = speedCalStateName(speedCalibrator.state());
+  
+  const SpeedModel& model = poseEstimator.model;
+  response["gain"] = model.gain;
+  response["deadband"] = model.deadband;
+  response["lagMs"] = model.lagMs;
+  response["calibrationRuns"] = model.runs;
+  
+  char output[384];
+  size_t len = serializeJson(response, output, sizeof(output));
+  sendText(clientId, output, len);
 }
 
 // =====================================================
-// MOTOR CONTROL
+// DRIVING SESSIONS
 // =====================================================
 
-void setMotorSpeed(int left, int right) {
-  // Apply calibration
-  left += motorLeftCalibration;
-  right += motorRightCalibration;
-  
-  // Constrain values
-  left = constrain(left, -255, 255);
-  right = constrain(right, -255, 255);
-  
-  motorLeftSpeed = left;
-  motorRightSpeed = right;
+// Commands a recording keeps; the motors are recorded as setpoints
+bool sessionActionRecorded(const char* type) {
+  static const char* const recorded[] = {
+    "led", "led_all", "led_rainbow", "led_blink", "led_breathe", "led_sequence", "tone",
+    "music_stop", "display_text", "display_clear", "display_image", "display_bitmap"
+  };
+  if (!type) return false;
+  for (const char* name : recorded) {
+    if (strcmp(type, name) == 0) return true;
+  }
+  return false;
+}
+
+void captureSessionAction(JsonDocument& doc, uint32_t clientId) {
+  if (measureJson(doc) >= TIMELINE_COMMAND_MAX) {
+    sessionActionsDropped++;
+    return;
+  }
   
-  // Left motor
-  if (left > 0) {
-    digitalWrite(MOTOR_LEFT_IN1, HIGH);
-    digitalWrite(MOTOR_LEFT_IN2, LOW);
-  } else if (left < 0) {
-    digitalWrite(MOTOR_LEFT_IN1, LOW);
-    digitalWrite(MOTOR_LEFT_IN2, HIGH);
-  } else {
-    digitalWrite(MOTOR_LEFT_IN1, LOW);
-    digitalWrite(MOTOR_LEFT_IN2, LOW);
+  // Timeline steps, show steps and USB commands run in the loop, which
+  // owns the recording
+  if (loopClient(clientId)) {
+    char command[TIMELINE_COMMAND_MAX];
+    size_t len = serializeJson(doc, command, sizeof(command));
+    if (!sessionWriter.action(hal::millis() - sessionStartTime, command, len)) sessionFull = true;
+    return;
   }
-  ledcWrite(0, abs(left));
   
-  // Right motor
-  if (right > 0) {
-    digitalWrite(MOTOR_RIGHT_IN1, HIGH);
-    digitalWrite(MOTOR_RIGHT_IN2, LOW);
-  } else if (right < 0) {
-    digitalWrite(MOTOR_RIGHT_IN1, LOW);
-    digitalWrite(MOTOR_RIGHT_IN2, HIGH);
-  } else {
-    digitalWrite(MOTOR_RIGHT_IN1, LOW);
-    digitalWrite(MOTOR_RIGHT_IN2, LOW);
+  uint8_t head = sessionActionHead;
+  uint8_t next = (head + 1) % SESSION_ACTION_QUEUE;
+  if (next == sessionActionTail) {
+    sessionActionsDropped++;
+    return;
   }
-  ledcWrite(1, abs(right));
+  SessionAction& entry = sessionActions[head];
+  entry.timeMs = hal::millis();
+  entry.length = serializeJson(doc, entry.command, sizeof(entry.command));
+  sessionActionHead = next;   // Publish the entry
 }
 
-void robotForward(int speedPercent) {
-  int speed = map(speedPercent, 0, 100, 0, 255);
-  setMotorSpeed(speed, speed);
+static void sendSessionEvent(const char* event, const char* error) {
+  static const char* states[] = {"idle", "recording", "saving", "replaying"};
+  
+  JsonDocument doc(&telemetryArena);
+  doc["type"] = "session";
+  doc["event"] = event;
+  if (error) doc["error"] = error;
+  doc["state"] = states[sessionState];
+  // The recording until it is saved, then the saved session
+  bool recording = sessionState == SESSION_RECORDING || sessionState == SESSION_SAVING;
+  doc["bytes"] = recording ? sessionWriter.size() : sessionSavedBytes;
+  doc["durationMs"] = recording ? sessionDurationMs : sessionSavedMs;
+  wsSendJson(doc);
 }
 
-void robotBackward(int speedPercent) {
-  int speed = map(speedPercent, 0, 100, 0, 255);
-  setMotorSpeed(-speed, -speed);
+// Bytes a recording can take: the buffer, or less with a smaller partition
+static size_t sessionCapacity() {
+  size_t capacity = sessionFlashCapacity();
+  return capacity < sizeof(sessionBuffer) ? capacity : sizeof(sessionBuffer);
 }
 
-void robotTurnLeft(int speedPercent) {
-  int speed = map(speedPercent, 0, 100, 0, 255);
-  setMotorSpeed(-speed, speed);
+// Unwraps the pose heading into sessionHeading
+static void trackSessionHeading() {
+  float theta = roundf(poseEstimator.pose().theta * 10) / 10;
+  sessionHeading += (int32_t)roundf(wrapDegrees(theta - sessionLastTheta) * 10);
+  sessionLastTheta = theta;
 }
 
-void robotTurnRight(int speedPercent) {
-  int speed = map(speedPercent, 0, 100, 0, 255);
-  setMotorSpeed(speed, -speed);
+static void startSessionRecording() {
+  sessionWriter.begin(sessionBuffer, sessionCapacity());
+  sessionStartTime = hal::millis();
+  sessionLastTick = sessionStartTime - SESSION_TICK_MS;
+  sessionLastHeadingTick = sessionStartTime;
+  sessionDurationMs = 0;
+  sessionFull = false;
+  sessionActionTail = sessionActionHead;
+  sessionActionsDropped = 0;
+  sessionMovesSeen = sessionMoves;
+  sessionLeft = sessionRight = 0;
+  sessionMotorMs = 0;
+  sessionHeading = 0;
+  sessionLastTheta = roundf(poseEstimator.pose().theta * 10) / 10;
+  sessionState = SESSION_RECORDING;
+  sendSessionEvent("recording", nullptr);
 }
 
-void robotStop() {
-  setMotorSpeed(0, 0);
+// Ends the recording and starts saving it
+static void stopSessionRecording(const char* event) {
+  sessionDurationMs = hal::millis() - sessionStartTime;
+  if (sessionSaver.begin(sessionWriter.data(), sessionWriter.size(), sessionDurationMs)) {
+    sessionSaved = false;
+    sessionState = SESSION_SAVING;
+    sendSessionEvent(event, nullptr);
+  } else {
+    sessionState = SESSION_IDLE;
+    sendSessionEvent("failed", "no session partition");
+  }
 }
 
-void robotRotate(float targetAngle) {
-  float startYaw = yaw - yawOffset;
-  float targetYaw = startYaw + targetAngle;
+static void recordSessionTick(unsigned long now) {
+  uint32_t t = now - sessionStartTime;
   
-  int direction = targetAngle > 0 ? 1 : -1;
-  int speed = 100;
+  // Queued commands first: they arrived before this tick
+  while (sessionActionTail != sessionActionHead) {
+    const SessionAction& entry = sessionActions[sessionActionTail];
+    uint32_t at = entry.timeMs - sessionStartTime;
+    if (!sessionWriter.action(at > t ? 0 : at, entry.command, entry.length)) sessionFull = true;
+    sessionActionTail = (sessionActionTail + 1) % SESSION_ACTION_QUEUE;
+  }
   
-  setMotorSpeed(speed * direction, -speed * direction);
+  uint16_t moves = sessionMoves;
+  uint16_t burst = moves - sessionMovesSeen;
+  sessionMovesSeen = moves;
+  int left = motorLeftSpeed, right = motorRightSpeed;
+  if (left != sessionLeft || right != sessionRight) {
+    bool bridge = burst >= SESSION_BURST_MOVES && t - sessionMotorMs >= SESSION_STALL_MS;
+    if (sessionWriter.motor(t, left, right, bridge)) {
+      sessionLeft = left;
+      sessionRight = right;
+      sessionMotorMs = t;
+    } else {
+      sessionFull = true;
+    }
+  }
   
-  unsigned long startTime = millis();
-  while (millis() - startTime < 5000) { // Timeout 5 seconds
-    updateIMU();
-    float currentYaw = yaw - yawOffset;
-    
-    if (direction > 0 && currentYaw >= targetYaw) break;
-    if (direction < 0 && currentYaw <= targetYaw) break;
-    
-    delay(10);
+  // The heading, while moving, for the replay to hold
+  if (now - sessionLastHeadingTick >= SESSION_HEADING_MS) {
+    sessionLastHeadingTick = now;
+    int32_t before = sessionHeading;
+    trackSessionHeading();
+    if ((sessionLeft || sessionRight || sessionHeading != before) &&
+        !sessionWriter.heading(t, sessionHeading)) {
+      sessionFull = true;
+    }
+  }
+  
+  sessionDurationMs = t;
+  if (sessionFull) stopSessionRecording("full");
+}
+
+// Loads the saved session; the reply to "play" already went out
+static void startSessionReplay() {
+  size_t len = 0;
+  uint32_t durationMs = 0;
+  if (!sessionLoad(sessionBuffer, sizeof(sessionBuffer), len, durationMs)) {
+    sendSessionEvent("failed", "corrupt");
+    return;
   }
+  if (motion.active()) finishMotion("cancelled", true);
   
+  sessionReader.begin(sessionBuffer, len);
+  sessionHeadingReader.begin(sessionBuffer, len);
+  sessionNextValid = sessionReader.next(sessionNext);
+  sessionHeadingNextValid = false;
+  while (sessionHeadingReader.next(sessionHeadingNext)) {
+    if (sessionHeadingNext.kind == SESSION_HEADING) {
+      sessionHeadingNextValid = true;
+      break;
+    }
+  }
+  sessionHeadingFrom = 0;
+  sessionHeadingFromMs = 0;
+  sessionHeadingHold = sessionRequestHeadingHold;
+  sessionStartTime = hal::millis();
+  sessionLastTick = sessionStartTime - SESSION_TICK_MS;
+  sessionLeft = sessionRight = 0;
+  sessionMotorMs = 0;
+  sessionHeading = 0;
+  sessionLastTheta = roundf(poseEstimator.pose().theta * 10) / 10;
+  sessionState = SESSION_REPLAYING;
+  sendSessionEvent("playing", nullptr);
+}
+
+static void finishSessionReplay(const char* event) {
   robotStop();
+  sessionState = SESSION_IDLE;
+  sendSessionEvent(event, nullptr);
 }
 
-// =====================================================
-// LINE FOLLOWER
-// =====================================================
+static void replaySessionEvent(const SessionEvent& event) {
+  switch (event.kind) {
+    case SESSION_MOTOR:
+    case SESSION_BRIDGE:
+      sessionLeft = event.left;
+      sessionRight = event.right;
+      sessionMotorMs = event.timeMs;
+      break;
+    case SESSION_ACTION: {
+      JsonDocument doc(&telemetryArena);
+      if (!deserializeJson(doc, event.text, event.textLength)) {
+        processCommand(doc, SESSION_CLIENT_ID);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+// The recorded heading at t, between the samples around it
+static float sessionTargetHeading(uint32_t t) {
+  while (sessionHeadingNextValid && sessionHeadingNext.timeMs <= t) {
+    sessionHeadingFrom = sessionHeadingNext.heading;
+    sessionHeadingFromMs = sessionHeadingNext.timeMs;
+    sessionHeadingNextValid = false;
+    while (sessionHeadingReader.next(sessionHeadingNext)) {
+      if (sessionHeadingNext.kind == SESSION_HEADING) {
+        sessionHeadingNextValid = true;
+        break;
+      }
+    }
+  }
+  float heading = sessionHeadingFrom;
+  if (sessionHeadingNextValid) {
+    float f = (float)(t - sessionHeadingFromMs) / (sessionHeadingNext.timeMs - sessionHeadingFromMs);
+    heading += (sessionHeadingNext.heading - sessionHeadingFrom) * f;
+  }
+  return heading / 10;
+}
 
-void updateLineFollower() {
-  if (!lineFollowerEnabled) return;
+static void replaySessionTick(unsigned long now) {
+  uint32_t t = now - sessionStartTime;
+  while (sessionNextValid && sessionNext.timeMs <= t) {
+    replaySessionEvent(sessionNext);
+    sessionNextValid = sessionReader.next(sessionNext);
+  }
+  if (!sessionNextValid && (sessionReader.corrupt() || t >= sessionSavedMs)) {
+    finishSessionReplay(sessionReader.corrupt() ? "corrupt" : "done");
+    return;
+  }
   
-  // Calculate line position (weighted average)
-  long weightedSum = 0;
-  long totalValue = 0;
+  // Across a WiFi stall, ramp to the setpoint that ended it
+  float left = sessionLeft, right = sessionRight;
+  if (sessionNextValid && sessionNext.kind == SESSION_BRIDGE) {
+    uint32_t due = sessionNext.timeMs;
+    uint32_t from = due - sessionMotorMs > SESSION_BRIDGE_MAX_MS ? due - SESSION_BRIDGE_MAX_MS : sessionMotorMs;
+    if (t > from) {
+      float f = (float)(t - from) / (due - from);
+      left += (sessionNext.left - left) * f;
+      right += (sessionNext.right - right) * f;
+    }
+  }
   
-  for (int i = 0; i < 8; i++) {
-    int value = lineSensors[i] > 500 ? 1000 : 0;
-    weightedSum += (long)value * (i * 1000);
-    totalValue += value;
+  // Steer back onto the recorded heading against drift
+  trackSessionHeading();
+  float target = sessionTargetHeading(t);
+  if (sessionHeadingHold && (left != 0 || right != 0)) {
+    float error = target - sessionHeading / 10.0f;
+    float limit = fmaxf(fabsf(left), fabsf(right)) / 2;
+    float turn = constrain(SESSION_HEADING_GAIN * error, -limit, limit);
+    left -= turn;
+    right += turn;
+  }
+  applyMotorSpeed((int)roundf(left), (int)roundf(right));
+}
+
+void updateSession() {
+  SessionRequest request = sessionRequest;
+  if (request != SESSION_REQUEST_NONE) {
+    sessionRequest = SESSION_REQUEST_NONE;
+    if (sessionState == SESSION_RECORDING) {
+      if (request != SESSION_REQUEST_CANCEL) stopSessionRecording("stopped");
+    } else if (sessionState == SESSION_REPLAYING) {
+      if (request != SESSION_REQUEST_PLAY) {
+        finishSessionReplay(request == SESSION_REQUEST_CANCEL ? "cancelled" : "stopped");
+      }
+    }
+    // A new start waits for the save to finish (the buffer is in flash use)
+    if (sessionState == SESSION_IDLE) {
+      if (request == SESSION_REQUEST_RECORD) startSessionRecording();
+      else if (request == SESSION_REQUEST_PLAY && sessionSaved) startSessionReplay();
+    }
   }
   
-  if (totalValue == 0) {
-    // No line detected - could be at intersection or lost
-    return;
+  switch (sessionState) {
+    case SESSION_SAVING:
+      sessionSaver.step();
+      if (!sessionSaver.busy()) {
+        sessionState = SESSION_IDLE;
+        if (sessionSaver.failed()) {
+          sendSessionEvent("failed", "flash");
+        } else {
+          sessionSavedBytes = sessionWriter.size();
+          sessionSavedMs = sessionDurationMs;
+          sessionSaved = true;
+          sendSessionEvent("saved", nullptr);
+        }
+      }
+      break;
+      
+    case SESSION_REPLAYING:
+      if (behaviorOwner != BEHAVIOR_NONE) {
+        finishSessionReplay("interrupted");
+        break;
+      }
+      // fall through
+    case SESSION_RECORDING: {
+      unsigned long now = hal::millis();
+      if (now - sessionLastTick < SESSION_TICK_MS) break;
+      sessionLastTick = now;
+      if (sessionState == SESSION_RECORDING) recordSessionTick(now);
+      else replaySessionTick(now);
+      break;
+    }
+      
+    default:
+      break;
   }
+}
+
+// Recording, replay and the saved session, to one client
+void sendSessionStatus(uint32_t clientId, const char* error) {
+  static const char* states[] = {"idle", "recording", "saving", "replaying"};
   
-  float position = (float)weightedSum / totalValue;
-  float center = 3500; // Center position (0-7000)
-  float error = position - center;
+  JsonDocument response(&commandArenaFor(clientId));
+  response["type"] = "session";
+  if (error) response["error"] = error;
+  response["state"] = states[sessionState];
+  response["bytes"] = sessionWriter.size();
+  response["capacity"] = sessionCapacity();
+  response["events"] = sessionWriter.events();
+  response["durationMs"] = sessionDurationMs;
+  response["dropped"] = sessionActionsDropped;
+  if (sessionSaved) {
+    JsonObject saved = response["saved"].to<JsonObject>();
+    saved["bytes"] = sessionSavedBytes;
+    saved["durationMs"] = sessionSavedMs;
+  }
   
-  // PD control
-  int correction = error * lineFollowerKp;
+  char output[256];
+  size_t len = serializeJson(response, output, sizeof(output));
+  sendText(clientId, output, len);
+}
+
+// =====================================================
+// LINE FOLLOWER
+// =====================================================
+
+void updateBehaviors() {
+  PROFILE_SCOPE(profiler, PROFILE_BEHAVIORS);
+  behaviors.setEnabled(BEHAVIOR_LINE_FOLLOW, lineFollowerEnabled);
   
-  int baseSpd = map(lineFollowerSpeed, 0, 100, 0, 200);
-  int leftSpeed = baseSpd + correction;
-  int rightSpeed = baseSpd - correction;
+  applyLapRequest();
+  BehaviorId owner = BEHAVIOR_NONE;
+  if (!lineFollowerEnabled && lapLearner.state() != LAP_IDLE) lapLearner.stop();
+  if (behaviors.anyEnabled()) {
+    LineFollowerParams line = { lineFollowerSpeed, lineFollowerKp, lineThreshold, false };
+    if (lapLearner.state() != LAP_IDLE) {
+      // The start marker would pull the robot onto the bar
+      line.straightOnWide = true;
+      LapInput lap = { hal::millis(), yaw, lineSensors, lineThreshold, lineLost, lineError };
+      line.speed = lapLearner.step(lap, lineFollowerSpeed);
+      reportLapEvents();
+    }
+    BehaviorInput input = { lineSensors, lineThreshold, ldrLeft, ldrRight, distance, hal::millis() };
+    int left = 0, right = 0;
+    owner = behaviors.step(input, line, left, right);
+    
+    if (owner != BEHAVIOR_NONE) {
+      setMotorSpeed(left, right);
+    } else if (behaviorOwner != BEHAVIOR_NONE && behaviors.enabled(behaviorOwner)) {
+      // Released, e.g. the obstacle is gone: stop rather than keep its
+      // last command. A behavior switched off leaves the motors to the
+      // command that did it.
+      robotStop();
+    }
+    
+    if (lineFollowerEnabled) {
+      const LineFollowerOutput& out = behaviors.lineOutput();
+      lineLost = out.lineLost;
+      if (!out.lineLost) lineError = out.error;
+    }
+  }
   
-  setMotorSpeed(constrain(leftSpeed, -255, 255), 
-                constrain(rightSpeed, -255, 255));
+  if (owner != behaviorOwner) {
+    behaviorOwner = owner;
+    JsonDocument doc(&telemetryArena);
+    doc["type"] = "behavior";
+    doc["owner"] = behaviorName(owner);
+    wsSendJson(doc);
+  }
 }
 
-bool detectIntersection(const char* type) {
-  bool leftEdge = lineSensors[0] > 500;
-  bool rightEdge = lineSensors[7] > 500;
-  bool center = false;
+// Status of every behavior, to one client
+void sendBehaviorStatus(uint32_t clientId, const char* error) {
+  JsonDocument response(&commandArenaFor(clientId));
+  response["type"] = "behavior";
+  response["owner"] = behaviorName(behaviors.owner());
+  if (error) response["error"] = error;
   
-  for (int i = 2; i < 6; i++) {
-    if (lineSensors[i] > 500) {
-      center = true;
-      break;
+  JsonObject list = response["behaviors"].to<JsonObject>();
+  for (uint8_t i = 0; i < BEHAVIOR_COUNT; i++) {
+    BehaviorId id = (BehaviorId)i;
+    JsonObject entry = list[behaviorName(id)].to<JsonObject>();
+    entry["enabled"] = id == BEHAVIOR_LINE_FOLLOW ? lineFollowerEnabled : behaviors.enabled(id);
+    entry["priority"] = behaviors.priority(id);
+    switch (id) {
+      case BEHAVIOR_STOP_ON_LINE:
+        entry["minSensors"] = behaviors.stopOnLine.minSensors;
+        break;
+      case BEHAVIOR_AVOID_OBSTACLE:
+        entry["distanceCm"] = behaviors.avoidObstacle.distanceCm;
+        entry["speed"] = behaviors.avoidObstacle.speed;
+        entry["backMs"] = behaviors.avoidObstacle.backMs;
+        entry["turnMs"] = behaviors.avoidObstacle.turnMs;
+        entry["turn"] = behaviors.avoidObstacle.turn;
+        break;
+      case BEHAVIOR_FOLLOW_WALL:
+        entry["distanceCm"] = behaviors.followWall.distanceCm;
+        entry["speed"] = behaviors.followWall.speed;
+        entry["gain"] = behaviors.followWall.gain;
+        entry["side"] = behaviors.followWall.side;
+        break;
+      case BEHAVIOR_LINE_FOLLOW:
+        entry["speed"] = lineFollowerSpeed;
+        entry["kp"] = lineFollowerKp;
+        break;
+      case BEHAVIOR_FOLLOW_LIGHT:
+        entry["speed"] = behaviors.followLight.speed;
+        entry["gain"] = behaviors.followLight.gain;
+        entry["minLight"] = behaviors.followLight.minLight;
+        break;
+      default:
+        break;
     }
   }
   
-  if (strcmp(type, "left") == 0) {
-    return leftEdge && center && !rightEdge;
+  char output[1024];
+  size_t len = serializeJson(response, output, sizeof(output));
+  sendText(clientId, output, len);
+}
+
+// Broadcasts what the lap learner saw this tick
+void reportLapEvents() {
+  uint8_t events = lapLearner.takeEvents();
+  if (!events) return;
+  if (events & LAP_EVENT_LEARNED) requestSave(STORE_KEY_LAP);
+  
+  JsonDocument doc(&telemetryArena);
+  doc["type"] = "lap";
+  if (events & LAP_EVENT_FAILED) doc["event"] = "failed";
+  else if (events & LAP_EVENT_LEARNED) doc["event"] = "learned";
+  else if (events & LAP_EVENT_LAP) doc["event"] = "lap";
+  else doc["event"] = "marker";
+  doc["state"] = lapStateName(lapLearner.state());
+  doc["laps"] = lapLearner.laps();
+  doc["lastLapMs"] = lapLearner.lastLapMs();
+  doc["bestLapMs"] = lapLearner.bestLapMs();
+  if (events & LAP_EVENT_LEARNED) {
+    doc["segments"] = lapLearner.map().count;
+    doc["lengthMm"] = lapLearner.map().lengthMm;
   }
-  else if (strcmp(type, "right") == 0) {
-    return rightEdge && center && !leftEdge;
+  wsSendJson(doc);
+}
+
+// Applies a "lap" command and answers it; runs on the loop
+void applyLapRequest() {
+  LapRequest request = lapRequest;
+  if (request == LAP_REQUEST_NONE) return;
+  lapRequest = LAP_REQUEST_NONE;
+  const char* error = nullptr;
+  
+  if (lapRequestTuned) {
+    lapRequestTuned = false;
+    lapLearner.setParams(lapRequestParams);
+    requestSave(STORE_KEY_LAP);
   }
-  else if (strcmp(type, "t") == 0) {
-    return leftEdge && rightEdge && center;
+  
+  switch (request) {
+    case LAP_REQUEST_LEARN:
+      if (bootPhaseReached(BOOT_IMU) && !imuReady) {
+        // Bends are learned from the gyro
+        error = "no imu";
+      } else {
+        lineFollowerSpeed = lapRequestSpeed;
+        lapLearner.learn();
+        lineFollowerEnabled = true;
+      }
+      break;
+    case LAP_REQUEST_RACE:
+      if (!lapLearner.race()) {
+        error = "no map";
+      } else {
+        lineFollowerEnabled = true;
+      }
+      break;
+    case LAP_REQUEST_STOP:
+      lapLearner.stop();
+      lineFollowerEnabled = false;
+      robotStop();
+      break;
+    case LAP_REQUEST_CLEAR: {
+      LapMap none = {};
+      lapLearner.stop();
+      lapLearner.setMap(none);
+      requestSave(STORE_KEY_LAP);
+      break;
+    }
+    default:
+      break;
   }
-  else if (strcmp(type, "cross") == 0) {
-    return leftEdge && rightEdge && center;
+  sendLapStatus(lapRequestClient, error);
+}
+
+// Lap learner state, settings and map, to one client; runs on the loop
+void sendLapStatus(uint32_t clientId, const char* error) {
+  JsonDocument response(&telemetryArena);
+  response["type"] = "lap";
+  response["state"] = lapStateName(lapLearner.state());
+  if (error) response["error"] = error;
+  response["laps"] = lapLearner.laps();
+  response["lastLapMs"] = lapLearner.lastLapMs();
+  response["bestLapMs"] = lapLearner.bestLapMs();
+  response["scale"] = lapLearner.scale();
+  
+  const LapParams& params = lapLearner.params;
+  response["maxSpeed"] = params.maxSpeed;
+  response["grip"] = params.grip;
+  response["brake"] = params.brake;
+  response["lookaheadMs"] = params.lookaheadMs;
+  response["fullSpeed"] = params.fullSpeed;
+  response["lagMs"] = params.lagMs;
+  
+  // Segments as [length mm, turn deg]
+  const LapMap& map = lapLearner.map();
+  response["lengthMm"] = map.lengthMm;
+  response["learnSpeed"] = map.learnSpeed;
+  JsonArray segments = response["segments"].to<JsonArray>();
+  for (uint8_t i = 0; i < map.count; i++) {
+    JsonArray segment = segments.add<JsonArray>();
+    segment.add(map.segments[i].lengthMm);
+    segment.add(map.segments[i].turn / 10.0f);
   }
   
-  return false;
+  char output[1536];
+  size_t len = serializeJson(response, output, sizeof(output));
+  sendText(clientId, output, len);
+}
+
+bool detectIntersection(const char* type) {
+  return intersectionMatches(lineSensors, parseIntersectionType(type), lineThreshold);
 }
 
 // =====================================================
@@ -1086,50 +3647,66 @@ bool detectIntersection(const char* type) {
 // =====================================================
 
 void readSensors() {
+  PROFILE_SCOPE(profiler, PROFILE_READ_SENSORS);
   // Line sensors
-  lineSensors[0] = analogRead(LINE_SENSOR_1);
-  lineSensors[1] = analogRead(LINE_SENSOR_2);
-  lineSensors[2] = analogRead(LINE_SENSOR_3);
-  lineSensors[3] = analogRead(LINE_SENSOR_4);
-  lineSensors[4] = analogRead(LINE_SENSOR_5);
-  lineSensors[5] = analogRead(LINE_SENSOR_6);
-  lineSensors[6] = analogRead(LINE_SENSOR_7);
-  lineSensors[7] = analogRead(LINE_SENSOR_8);
+  lineSensors[0] = hal::analogRead(LINE_SENSOR_1);
+  lineSensors[1] = hal::analogRead(LINE_SENSOR_2);
+  lineSensors[2] = hal::analogRead(LINE_SENSOR_3);
+  lineSensors[3] = hal::analogRead(LINE_SENSOR_4);
+  lineSensors[4] = hal::analogRead(LINE_SENSOR_5);
+  lineSensors[5] = hal::analogRead(LINE_SENSOR_6);
+  lineSensors[6] = hal::analogRead(LINE_SENSOR_7);
+  lineSensors[7] = hal::analogRead(LINE_SENSOR_8);
+  
+  if (lineCalibrating) {
+    updateLineCalibration();
+  }
   
   // LDR sensors
-  ldrLeft = analogRead(LDR_LEFT);
-  ldrRight = analogRead(LDR_RIGHT);
+  ldrLeft = hal::analogRead(LDR_LEFT);
+  ldrRight = hal::analogRead(LDR_RIGHT);
   
   // Buttons (active low)
-  buttons[0] = !digitalRead(BUTTON_1);
-  buttons[1] = !digitalRead(BUTTON_2);
-  buttons[2] = !digitalRead(BUTTON_3);
-  buttons[3] = !digitalRead(BUTTON_4);
+  buttons[0] = !hal::digitalRead(BUTTON_1);
+  buttons[1] = !hal::digitalRead(BUTTON_2);
+  buttons[2] = !hal::digitalRead(BUTTON_3);
+  buttons[3] = !hal::digitalRead(BUTTON_4);
   
   // Distance sensor (non-blocking would be better)
   static unsigned long lastDistanceRead = 0;
-  if (millis() - lastDistanceRead > 100) {
-    distance = getDistance();
-    lastDistanceRead = millis();
+  bool fast = behaviors.enabled(BEHAVIOR_AVOID_OBSTACLE) || behaviors.enabled(BEHAVIOR_FOLLOW_WALL) ||
+              speedCalibrator.running();
+  if (hal::millis() - lastDistanceRead >= (fast ? DISTANCE_FAST_PERIOD_MS : DISTANCE_PERIOD_MS)) {
+    distance = measureDistance(fast ? DISTANCE_FAST_TIMEOUT_US : DISTANCE_TIMEOUT_US);
+    lastDistanceRead = hal::millis();
+    if (speedCalibrator.running()) {
+      float duty = (fabsf(motorLeft.level()) + fabsf(motorRight.level())) / 2;
+      speedCalibrator.sample(lastDistanceRead, distance, duty);
+    }
   }
 }
 
 int getDistance() {
-  digitalWrite(ULTRASONIC_TRIG, LOW);
-  delayMicroseconds(2);
-  digitalWrite(ULTRASONIC_TRIG, HIGH);
-  delayMicroseconds(10);
-  digitalWrite(ULTRASONIC_TRIG, LOW);
+  return measureDistance(DISTANCE_TIMEOUT_US);
+}
+
+// Centimeters, BEHAVIOR_NO_ECHO_CM when nothing echoed within timeoutUs
+int measureDistance(uint32_t timeoutUs) {
+  hal::digitalWrite(ULTRASONIC_TRIG, false);
+  hal::delayMicroseconds(2);
+  hal::digitalWrite(ULTRASONIC_TRIG, true);
+  hal::delayMicroseconds(10);
+  hal::digitalWrite(ULTRASONIC_TRIG, false);
   
-  long duration = pulseIn(ULTRASONIC_ECHO, HIGH, 30000);
+  long duration = hal::pulseIn(ULTRASONIC_ECHO, true, timeoutUs);
   int dist = duration * 0.034 / 2;
   
-  return (dist > 400 || dist == 0) ? 400 : dist;
+  return (dist > BEHAVIOR_NO_ECHO_CM || dist == 0) ? BEHAVIOR_NO_ECHO_CM : dist;
 }
 
 bool isLineDetected(int sensorIndex) {
   if (sensorIndex < 0 || sensorIndex > 7) return false;
-  return lineSensors[sensorIndex] > 500;
+  return lineSensors[sensorIndex] > lineThreshold;
 }
 
 // =====================================================
@@ -1137,20 +3714,22 @@ bool isLineDetected(int sensorIndex) {
 // =====================================================
 
 void updateIMU() {
-  sensors_event_t a, g, temp;
-  mpu.getEvent(&a, &g, &temp);
+  PROFILE_SCOPE(profiler, PROFILE_UPDATE_IMU);
+  if (!imuReady) return;
   
-  // Simple complementary filter for yaw
-  static float gyroYaw = 0;
-  float dt = 0.01; // 10ms
+  hal::ImuSample sample;
+  if (!hal::imuRead(sample)) return;
   
-  gyroYaw += g.gyro.z * dt * (180.0 / M_PI);
-  yaw = gyroYaw;
+  ImuReading reading = {
+    sample.ax, sample.ay, sample.az,
+    sample.gx, sample.gy, sample.gz
+  };
+  Attitude att = imuIntegrator.update(reading, 0.01); // 10ms
   
-  // Pitch and roll from accelerometer
-  pitch = atan2(a.acceleration.x, sqrt(a.acceleration.y * a.acceleration.y + 
-                                        a.acceleration.z * a.acceleration.z)) * 180.0 / M_PI;
-  roll = atan2(a.acceleration.y, a.acceleration.z) * 180.0 / M_PI;
+  gyroRate = att.yawRate;
+  yaw = att.yaw;
+  pitch = att.pitch;
+  roll = att.roll;
 }
 
 // =====================================================
@@ -1158,68 +3737,43 @@ void updateIMU() {
 // =====================================================
 
 void setLED(int index, uint8_t r, uint8_t g, uint8_t b) {
-  if (index >= 0 && index < NUM_LEDS) {
-    leds[index] = CRGB(r, g, b);
-    FastLED.show();
-  }
-  ledEffect = 1;
+  ledEngine.solid(index, hal::Rgb{ r, g, b });
 }
 
 void setAllLEDs(uint8_t r, uint8_t g, uint8_t b) {
-  for (int i = 0; i < NUM_LEDS; i++) {
-    leds[i] = CRGB(r, g, b);
-  }
-  FastLED.show();
-  ledEffect = 1;
+  ledEngine.solid(LED_ALL, hal::Rgb{ r, g, b });
 }
 
-void setLEDEffect(int effect) {
-  ledEffect = effect;
+// {"frames": [[ms, r, g, b, fade], ...], "index": n, "loop": true}; false if
+// the list is missing, empty or longer than LED_KEYFRAMES_MAX
+bool setLEDSequence(JsonDocument& doc) {
+  JsonArrayConst list = doc["frames"];
+  if (list.isNull() || list.size() > LED_KEYFRAMES_MAX) return false;
+  
+  LedKeyframe frames[LED_KEYFRAMES_MAX];
+  uint8_t count = 0;
+  for (JsonArrayConst frame : list) {
+    LedKeyframe& key = frames[count++];
+    key.ms = constrain(frame[0] | 0, 0, 65535);
+    key.color = hal::Rgb{ (uint8_t)(frame[1] | 0), (uint8_t)(frame[2] | 0), (uint8_t)(frame[3] | 0) };
+    key.flags = (frame[4] | false) ? LED_FADE : 0;
+  }
+  return ledEngine.sequence(doc["index"] | LED_ALL, frames, count, doc["loop"] | true);
 }
 
 void updateLEDs() {
-  if (millis() - lastLEDUpdate < 20) return;
-  lastLEDUpdate = millis();
-  
-  switch (ledEffect) {
-    case 2: // Rainbow
-      {
-        static uint8_t hue = 0;
-        for (int i = 0; i < NUM_LEDS; i++) {
-          leds[i] = CHSV(hue + (i * 30), 255, 255);
-        }
-        hue++;
-        FastLED.show();
-      }
-      break;
-      
-    case 3: // Blink
-      {
-        static bool blinkState = false;
-        static unsigned long lastBlink = 0;
-        if (millis() - lastBlink > 500) {
-          blinkState = !blinkState;
-          for (int i = 0; i < NUM_LEDS; i++) {
-            leds[i] = blinkState ? CRGB::White : CRGB::Black;
-          }
-          FastLED.show();
-          lastBlink = millis();
-        }
-      }
-      break;
-      
-    case 4: // Breathe
-      {
-        static int brightness = 0;
-        static int direction = 5;
-        brightness += direction;
-        if (brightness >= 255 || brightness <= 0) {
-          direction = -direction;
-        }
-        FastLED.setBrightness(brightness);
-        FastLED.show();
-      }
-      break;
+  PROFILE_SCOPE(profiler, PROFILE_UPDATE_LEDS);
+  // Solid colors need no work until something changes
+  if (!ledEngine.changed() && !ledEngine.animating()) return;
+  if (!ledEngine.changed() && hal::millis() - lastLEDUpdate < LED_FRAME_MS) return;
+  // The last frame is still going out; try again next pass
+  if (hal::ledsBusy()) return;
+  lastLEDUpdate = hal::millis();
+  
+  // Sent only when the composited frame differs from the one shown
+  if (ledEngine.render(lastLEDUpdate)) {
+    hal::ledsShow(ledEngine.frame(), ledEngine.count());
+    ledEngine.shown();
   }
 }
 
@@ -1229,7 +3783,7 @@ void updateLEDs() {
 
 void playTone(int frequency, int duration) {
   if (frequency > 0) {
-    tone(BUZZER_PIN, frequency, duration);
+    hal::tone(BUZZER_PIN, frequency, duration);
   }
 }
 
@@ -1240,7 +3794,7 @@ void playMelody(const char* melody) {
     int durations[] = {150, 150, 150, 150, 300, 150, 300};
     for (int i = 0; i < 7; i++) {
       playTone(notes[i], durations[i]);
-      delay(durations[i] + 50);
+      hal::delay(durations[i] + 50);
     }
   }
   else if (strcmp(melody, "victory") == 0) {
@@ -1248,12 +3802,12 @@ void playMelody(const char* melody) {
     int durations[] = {150, 150, 150, 300, 150, 150, 500};
     for (int i = 0; i < 7; i++) {
       playTone(notes[i], durations[i]);
-      delay(durations[i] + 50);
+      hal::delay(durations[i] + 50);
     }
   }
   else if (strcmp(melody, "error") == 0) {
     playTone(200, 200);
-    delay(100);
+    hal::delay(100);
     playTone(150, 400);
   }
   else if (strcmp(melody, "startup") == 0) {
@@ -1261,72 +3815,360 @@ void playMelody(const char* melody) {
     int durations[] = {100, 100, 100, 300};
     for (int i = 0; i < 4; i++) {
       playTone(notes[i], durations[i]);
-      delay(durations[i] + 20);
+      hal::delay(durations[i] + 20);
+    }
+  }
+}
+
+void stopTone() {
+  hal::noTone(BUZZER_PIN);
+}
+
+void updateBuzzer() {
+  PROFILE_SCOPE(profiler, PROFILE_UPDATE_BUZZER);
+  // For non-blocking melody playback (if needed)
+}
+
+// =====================================================
+// DISPLAY
+// =====================================================
+
+// render*() draw into the framebuffer only; display*() also push it to
+// the OLED
+void renderText(int line, const char* text) {
+  display.setTextSize(1);
+  display.setCursor(0, line * 16);
+  display.print(text);
+}
+
+void displayText(int line, const char* text) {
+  renderText(line, text);
+  display.display();
+}
+
+void displayNumber(int line, int number) {
+  char buffer[16];
+  sprintf(buffer, "%d", number);
+  displayText(line, buffer);
+}
+
+void clearDisplay() {
+  display.clearDisplay();
+  display.display();
+}
+
+void renderImage(const char* image) {
+  display.clearDisplay();
+  
+  if (strcmp(image, "happy") == 0) {
+    // Draw happy face
+    display.drawCircle(42, 32, 20, hal::WHITE);  // Left eye
+    display.drawCircle(86, 32, 20, hal::WHITE);  // Right eye
+    display.fillCircle(42, 32, 5, hal::WHITE);
+    display.fillCircle(86, 32, 5, hal::WHITE);
+  }
+  else if (strcmp(image, "sad") == 0) {
+    display.drawCircle(42, 32, 20, hal::WHITE);
+    display.drawCircle(86, 32, 20, hal::WHITE);
+    display.fillCircle(42, 38, 5, hal::WHITE);
+    display.fillCircle(86, 38, 5, hal::WHITE);
+  }
+  else if (strcmp(image, "heart") == 0) {
+    // Draw heart shape
+    display.fillCircle(54, 25, 15, hal::WHITE);
+    display.fillCircle(74, 25, 15, hal::WHITE);
+    display.fillTriangle(40, 30, 88, 30, 64, 55, hal::WHITE);
+  }
+  else if (strcmp(image, "robot") == 0) {
+    // Draw robot face
+    display.drawRect(24, 10, 80, 44, hal::WHITE);
+    display.fillRect(34, 20, 20, 15, hal::WHITE);
+    display.fillRect(74, 20, 20, 15, hal::WHITE);
+    display.drawLine(44, 45, 84, 45, hal::WHITE);
+  }
+}
+
+void displayImage(const char* image) {
+  renderImage(image);
+  display.display();
+}
+
+// =====================================================
+// OLED SPRITES
+// =====================================================
+
+// {"type": "display_bitmap", ...} with either
+//   "width", "height", "data" (base64), "encoding" ("raw", "rle",
+//   "heatshrink" with "window"/"lookahead"): store and draw a new sprite
+//   "id" (8 hex digits) or "frames" (IDs, "ms" apart, "loop"): draw stored ones
+// plus "x", "y" (else centered) and "clear" (default true)
+void queueSpriteRequest(JsonDocument& doc, uint32_t clientId) {
+  displayEpoch++;
+  if (spriteRequestPending) {
+    sendSpriteReply(clientId, SPRITE_NONE, "busy", SPRITE_FAILED);
+    return;
+  }
+  
+  SpriteRequest& request = spriteRequest;
+  request.clientId = clientId;
+  request.upload = doc["data"].is<const char*>();
+  SpriteDraw& draw = request.draw;
+  draw.epoch = displayEpoch;
+  draw.centered = !doc["x"].is<int>() && !doc["y"].is<int>();
+  draw.x = doc["x"] | 0;
+  draw.y = doc["y"] | 0;
+  draw.clear = doc["clear"] | true;
+  draw.frameMs = constrain(doc["ms"] | 200, SPRITE_FRAME_MS_MIN, 60000);
+  draw.loop = doc["loop"] | true;
+  draw.frameCount = 0;
+  
+  if (request.upload) {
+    const char* encoding = doc["encoding"] | "raw";
+    SpriteInfo& info = request.info;
+    size_t length = 0;
+    info.width = constrain(doc["width"] | 0, 0, SPRITE_WIDTH_MAX);
+    info.height = constrain(doc["height"] | 0, 0, SPRITE_HEIGHT_MAX);
+    info.encoding = strcmp(encoding, "rle") == 0 ? SPRITE_RLE
+                  : strcmp(encoding, "heatshrink") == 0 ? SPRITE_HEATSHRINK : SPRITE_RAW;
+    info.params = ((doc["window"] | 8) & 0x0F) << 4 | ((doc["lookahead"] | 4) & 0x0F);
+    if (!base64Decode(doc["data"], request.data, sizeof(request.data), length)) {
+      sendSpriteReply(clientId, SPRITE_NONE, "bad image", SPRITE_FAILED);
+      return;
+    }
+    info.length = length;
+  } else {
+    JsonArrayConst frames = doc["frames"];
+    if (frames.isNull()) {
+      draw.frames[draw.frameCount++] = strtoul(doc["id"] | "", nullptr, 16);
+    }
+    for (JsonVariantConst frame : frames) {
+      if (draw.frameCount == SPRITE_FRAMES_MAX) {
+        sendSpriteReply(clientId, SPRITE_NONE, "too many frames", SPRITE_FAILED);
+        return;
+      }
+      draw.frames[draw.frameCount++] = strtoul(frame | "", nullptr, 16);
+    }
+    if (draw.frameCount == 0) {
+      sendSpriteReply(clientId, SPRITE_NONE, "no frames", SPRITE_FAILED);
+      return;
     }
   }
+  spriteRequestPending = true;
 }
 
-void stopTone() {
-  noTone(BUZZER_PIN);
+// Binary upload, for images that do not fit a text message well:
+//   0 u8 'B'  1 u8 encoding  2 u8 width  3 u8 height  4 u8 params
+//   5 u8 flags (SPRITE_BINARY_*)  6 i16 x  8 i16 y  10 data
+void queueSpriteUpload(uint32_t clientId, const uint8_t* data, size_t len) {
+  commandReceived = true;
+  if (len < SPRITE_BINARY_HEADER || data[0] != SPRITE_BINARY_KIND) return;
+  displayEpoch++;
+  if (spriteRequestPending || len - SPRITE_BINARY_HEADER > SPRITE_DATA_MAX) {
+    sendSpriteReply(clientId, SPRITE_NONE, spriteRequestPending ? "busy" : "bad image", SPRITE_FAILED);
+    return;
+  }
+  
+  SpriteRequest& request = spriteRequest;
+  request.clientId = clientId;
+  request.upload = true;
+  request.info.encoding = (SpriteEncoding)data[1];
+  request.info.width = data[2];
+  request.info.height = data[3];
+  request.info.params = data[4];
+  request.info.length = len - SPRITE_BINARY_HEADER;
+  memcpy(request.data, data + SPRITE_BINARY_HEADER, request.info.length);
+  
+  SpriteDraw& draw = request.draw;
+  draw.epoch = displayEpoch;
+  draw.clear = !(data[5] & SPRITE_BINARY_KEEP);
+  draw.centered = !(data[5] & SPRITE_BINARY_AT);
+  draw.x = (int16_t)(data[6] | data[7] << 8);
+  draw.y = (int16_t)(data[8] | data[9] << 8);
+  draw.frameCount = 0;
+  spriteRequestPending = true;
 }
 
-void updateBuzzer() {
-  // For non-blocking melody playback (if needed)
+void sendSpriteReply(uint32_t clientId, uint32_t id, const char* error, SpriteStoreResult result) {
+  JsonDocument response(&commandArenaFor(clientId));
+  response["type"] = "display_bitmap";
+  if (id != SPRITE_NONE) {
+    char hex[9];
+    snprintf(hex, sizeof(hex), "%08lx", (unsigned long)id);
+    response["id"] = hex;
+  }
+  if (error) {
+    response["error"] = error;
+  } else {
+    response["stored"] = result != SPRITE_FAILED;
+    response["new"] = result == SPRITE_STORED;
+  }
+  char output[128];
+  size_t len = serializeJson(response, output, sizeof(output));
+  sendText(clientId, output, len);
 }
 
-// =====================================================
-// DISPLAY
-// =====================================================
-
-void displayText(int line, const char* text) {
-  display.setTextSize(1);
-  display.setCursor(0, line * 16);
-  display.print(text);
+// Blits the decoded sprite in spriteBits straight into the display buffer
+// and pushes it
+void showSpriteBits(uint8_t width, uint8_t height, const SpriteDraw& draw) {
+  uint8_t* frame = display.getBuffer();
+  if (!frame) return;
+  
+  if (draw.clear) display.clearDisplay();
+  int16_t x = draw.centered ? (SCREEN_WIDTH - width) / 2 : draw.x;
+  int16_t y = draw.centered ? (SCREEN_HEIGHT - height) / 2 : draw.y;
+  spriteBlit(frame, SCREEN_WIDTH, SCREEN_HEIGHT, spriteBits, width, height, x, y);
   display.display();
 }
 
-void displayNumber(int line, int number) {
-  char buffer[16];
-  sprintf(buffer, "%d", number);
-  displayText(line, buffer);
+bool drawSprite(uint32_t id, const SpriteDraw& draw) {
+  SpriteInfo info;
+  if (!spriteCache.load(id, spriteBits, info)) return false;
+  showSpriteBits(info.width, info.height, draw);
+  return true;
 }
 
-void clearDisplay() {
-  display.clearDisplay();
-  display.display();
+// Takes a queued "display_bitmap" and steps the animation. A display
+// command queued later supersedes both.
+void updateSprites() {
+  if (spriteRequestPending) {
+    SpriteRequest& request = spriteRequest;
+    uint32_t id = request.upload ? SPRITE_NONE : request.draw.frames[0];
+    SpriteStoreResult result = SPRITE_KNOWN;
+    const char* error = nullptr;
+    
+    if (request.upload) {
+      // The ID is the image's hash, so an image sent again is not stored twice
+      if (!spriteDecode(request.info, request.data, spriteBits)) {
+        error = "bad image";
+      } else {
+        id = spriteHash(request.info.width, request.info.height, spriteBits);
+        request.info.id = id;
+        result = spriteCache.store(request.info, request.data);
+      }
+    } else if (!spriteCache.contains(id)) {
+      error = "unknown id";
+    }
+    
+    if (!error && request.draw.epoch == displayEpoch) {
+      spriteAnimating = false;
+      if (request.upload) {
+        // Decoded already, even if it could not be kept
+        showSpriteBits(request.info.width, request.info.height, request.draw);
+      } else if (!drawSprite(id, request.draw)) {
+        error = "unknown id";
+      } else if (request.draw.frameCount > 1) {
+        spriteAnimation = request.draw;
+        spriteFrame = 0;
+        spriteFrameAt = hal::millis();
+        spriteAnimating = true;
+      }
+    }
+    // Drawing stored sprites only answers when something is wrong
+    if (error || request.upload) sendSpriteReply(request.clientId, id, error, result);
+    spriteRequestPending = false;
+  }
+  
+  if (!spriteAnimating) return;
+  if (spriteAnimation.epoch != displayEpoch) {
+    spriteAnimating = false;
+    return;
+  }
+  unsigned long now = hal::millis();
+  if (now - spriteFrameAt < spriteAnimation.frameMs) return;
+  spriteFrameAt = now;
+  
+  if (++spriteFrame == spriteAnimation.frameCount) {
+    if (!spriteAnimation.loop) {
+      spriteAnimating = false;
+      return;
+    }
+    spriteFrame = 0;
+  }
+  // A frame dropped from the cache since is skipped
+  drawSprite(spriteAnimation.frames[spriteFrame], spriteAnimation);
 }
 
-void displayImage(const char* image) {
-  display.clearDisplay();
-  
-  if (strcmp(image, "happy") == 0) {
-    // Draw happy face
-    display.drawCircle(42, 32, 20, SSD1306_WHITE);  // Left eye
-    display.drawCircle(86, 32, 20, SSD1306_WHITE);  // Right eye
-    display.fillCircle(42, 32, 5, SSD1306_WHITE);
-    display.fillCircle(86, 32, 5, SSD1306_WHITE);
+// =====================================================
+// DISPLAY MIRROR
+// =====================================================
+
+// Subscribes or unsubscribes a client; subscribing (again) starts the
+// stream over with a key frame, which is also how a client that missed a
+// message catches up. False when every slot is taken.
+bool setMirrorClient(uint32_t clientId, bool enabled, uint8_t fps) {
+  MirrorClient* free = nullptr;
+  for (MirrorClient& client : mirrorClients) {
+    if (client.used && client.clientId == clientId) {
+      client.used = enabled;
+      client.fps = fps;
+      if (enabled) displayMirror.restart();
+      return true;
+    }
+    if (!client.used && !free) free = &client;
   }
-  else if (strcmp(image, "sad") == 0) {
-    display.drawCircle(42, 32, 20, SSD1306_WHITE);
-    display.drawCircle(86, 32, 20, SSD1306_WHITE);
-    display.fillCircle(42, 38, 5, SSD1306_WHITE);
-    display.fillCircle(86, 38, 5, SSD1306_WHITE);
+  if (!enabled) return true;
+  if (!free) return false;
+  free->clientId = clientId;
+  free->fps = fps;
+  free->used = true;
+  displayMirror.restart();
+  return true;
+}
+
+void sendMirrorStatus(uint32_t clientId, const char* error) {
+  JsonDocument response(&commandArenaFor(clientId));
+  response["type"] = "display_mirror";
+  bool enabled = false;
+  uint8_t fps = 0;
+  for (const MirrorClient& client : mirrorClients) {
+    if (client.used && client.clientId == clientId) {
+      enabled = true;
+      fps = client.fps;
+    }
   }
-  else if (strcmp(image, "heart") == 0) {
-    // Draw heart shape
-    display.fillCircle(54, 25, 15, SSD1306_WHITE);
-    display.fillCircle(74, 25, 15, SSD1306_WHITE);
-    display.fillTriangle(40, 30, 88, 30, 64, 55, SSD1306_WHITE);
+  response["enabled"] = enabled;
+  if (enabled) response["fps"] = fps;
+  if (error) response["error"] = error;
+  response["width"] = SCREEN_WIDTH;
+  response["height"] = SCREEN_HEIGHT;
+  response["frames"] = displayMirror.frames();
+  response["keyFrames"] = displayMirror.keyFrames();
+  response["bytes"] = displayMirror.bytes();
+  response["heldBack"] = mirrorHeldBack;
+  char output[192];
+  size_t len = serializeJson(response, output, sizeof(output));
+  sendText(clientId, output, len);
+}
+
+// Sends the OLED buffer when it changed, at the rate the most eager
+// subscriber asked for. While a client's send queue is full the tick is
+// skipped rather than a message dropped, since every message codes against
+// the one before it. A frame caught half drawn by another task is put
+// right by the next message.
+void updateMirror() {
+  PROFILE_SCOPE(profiler, PROFILE_DISPLAY_MIRROR);
+  uint8_t fps = 0;
+  for (const MirrorClient& client : mirrorClients) {
+    if (client.used && client.fps > fps) fps = client.fps;
   }
-  else if (strcmp(image, "robot") == 0) {
-    // Draw robot face
-    display.drawRect(24, 10, 80, 44, SSD1306_WHITE);
-    display.fillRect(34, 20, 20, 15, SSD1306_WHITE);
-    display.fillRect(74, 20, 20, 15, SSD1306_WHITE);
-    display.drawLine(44, 45, 84, 45, SSD1306_WHITE);
+  if (fps == 0) return;
+  
+  unsigned long now = hal::millis();
+  if (now - mirrorSentAt < 1000UL / fps) return;
+  uint8_t* frame = display.getBuffer();
+  if (!frame || !displayMirror.changed(frame)) return;
+  for (const MirrorClient& client : mirrorClients) {
+    if (client.used && client.clientId != USB_CLIENT_ID && !hal::wsWritable(client.clientId)) {
+      mirrorHeldBack++;
+      return;
+    }
   }
   
-  display.display();
+  mirrorSentAt = now;
+  size_t len = displayMirror.pack(frame, mirrorMessage);
+  for (const MirrorClient& client : mirrorClients) {
+    if (client.used) sendBinary(client.clientId, mirrorMessage, len);
+  }
 }
 
 void showWelcomeScreen() {
@@ -1338,20 +4180,48 @@ void showWelcomeScreen() {
   display.setCursor(25, 35);
   display.println("Robot Ready!");
   display.setCursor(20, 50);
-  display.println(WiFi.softAPIP().toString());
+  char ip[16];
+  hal::wifiAccessPointIp(ip, sizeof(ip));
+  display.println(ip);
   display.display();
   
-  // Play startup melody
-  playMelody("startup");
+  // Startup melody and LED flash follow from loop() (updateWelcome)
+}
+
+// Welcome animation timeline, relative to the end of setup()
+struct WelcomeStep {
+  uint16_t atMs;
+  uint16_t toneHz;    // 0 = no tone
+  uint16_t toneMs;
+  bool setLeds;
+  hal::Rgb color;
+};
+
+static const WelcomeStep WELCOME_STEPS[] = {
+  {    0, 262, 100, false, {   0,   0,   0 } },  // Startup melody
+  {  120, 330, 100, false, {   0,   0,   0 } },
+  {  240, 392, 100, false, {   0,   0,   0 } },
+  {  360, 523, 300, false, {   0,   0,   0 } },
+  {  680,   0,   0, true,  {   0, 255,   0 } },  // LED flash
+  {  880,   0,   0, true,  {   0,   0, 255 } },
+  { 1080,   0,   0, true,  { 255,   0,   0 } },
+  { 1280,   0,   0, true,  {   0,   0,   0 } }
+};
+
+// Plays the steps that are due; true once the animation is over. The first
+// command from the app cuts it short so it never overrides the user.
+bool updateWelcome(unsigned long elapsed) {
+  static uint8_t step = 0;
+  const uint8_t count = sizeof(WELCOME_STEPS) / sizeof(WELCOME_STEPS[0]);
+  
+  if (commandReceived) return true;
   
-  // Flash LEDs
-  setAllLEDs(0, 255, 0);
-  delay(200);
-  setAllLEDs(0, 0, 255);
-  delay(200);
-  setAllLEDs(255, 0, 0);
-  delay(200);
-  setAllLEDs(0, 0, 0);
+  while (step < count && elapsed >= WELCOME_STEPS[step].atMs) {
+    const WelcomeStep& s = WELCOME_STEPS[step++];
+    if (s.toneHz) playTone(s.toneHz, s.toneMs);
+    if (s.setLeds) setAllLEDs(s.color.r, s.color.g, s.color.b);
+  }
+  return step >= count;
 }
 
 void updateStatusDisplay() {
@@ -1360,11 +4230,13 @@ void updateStatusDisplay() {
   
   display.setCursor(0, 0);
   display.print("IP: ");
-  display.println(WiFi.softAPIP().toString());
+  char ip[16];
+  hal::wifiAccessPointIp(ip, sizeof(ip));
+  display.println(ip);
   
   display.setCursor(0, 12);
   display.print("Clients: ");
-  display.println(ws.count());
+  display.println((int)hal::wsCount());
   
   display.setCursor(0, 24);
   display.print("Yaw: ");
@@ -1379,7 +4251,7 @@ void updateStatusDisplay() {
   display.setCursor(0, 48);
   display.print("Line: ");
   for (int i = 0; i < 8; i++) {
-    display.print(lineSensors[i] > 500 ? "1" : "0");
+    display.print(lineSensors[i] > lineThreshold ? "1" : "0");
   }
   
   display.display();
@@ -1390,25 +4262,91 @@ void updateStatusDisplay() {
 // =====================================================
 
 void loadCalibration() {
-  motorLeftCalibration = (int8_t)EEPROM.read(EEPROM_CALIBRATION_ADDR);
-  motorRightCalibration = (int8_t)EEPROM.read(EEPROM_CALIBRATION_ADDR + 1);
+  MotorTrim trim = { 0, 0 };
+  if (store.mounted()) {
+    loadRecord(STORE_KEY_MOTOR_TRIM, STORE_SCHEMA_MOTOR_TRIM, &trim, sizeof(trim));
+  } else {
+    hal::storageRead(EEPROM_CALIBRATION_ADDR, &trim, sizeof(trim));
+  }
+  motorLeftCalibration = trim.left;
+  motorRightCalibration = trim.right;
   
   // Validate
   if (motorLeftCalibration < -50 || motorLeftCalibration > 50) motorLeftCalibration = 0;
   if (motorRightCalibration < -50 || motorRightCalibration > 50) motorRightCalibration = 0;
   
-  LOG.printf("✓ Calibration loaded: L=%d, R=%d\n", motorLeftCalibration, motorRightCalibration);
+  PidGains gains = { lineFollowerKp, 0, 0, (int16_t)lineFollowerSpeed };
+  if (loadRecord(STORE_KEY_PID_GAINS, STORE_SCHEMA_PID_GAINS, &gains, sizeof(gains))) {
+    lineFollowerKp = gains.kp;
+    lineFollowerSpeed = gains.speed;
+  }
+  
+  if (loadRecord(STORE_KEY_LINE_CALIBRATION, STORE_SCHEMA_LINE_CALIBRATION, &lineCalibration, sizeof(lineCalibration))) {
+    lineThreshold = lineCalibration.threshold;
+  }
+  
+  LapRecord lap = { {}, lapLearner.params };
+  if (loadRecord(STORE_KEY_LAP, STORE_SCHEMA_LAP, &lap, sizeof(lap))) {
+    lapLearner.params = lap.params;
+    lapLearner.setMap(lap.map);
+  }
+  
+  SpeedModel model = poseEstimator.model;
+  if (loadRecord(STORE_KEY_SPEED_MODEL, STORE_SCHEMA_SPEED_MODEL, &model, sizeof(model)) &&
+      model.gain > 0 && model.deadband >= 0 && model.deadband < 1) {
+    poseEstimator.model = model;
+  }
+  
+  LOG.printf("✓ Calibration loaded: L=%d, R=%d, Kp=%.2f, threshold=%d\n",
+             motorLeftCalibration, motorRightCalibration, lineFollowerKp, lineThreshold);
 }
 
+// Motor trim and line follower gains; written by updateStorage()
 void saveCalibration() {
-  EEPROM.write(EEPROM_CALIBRATION_ADDR, (uint8_t)motorLeftCalibration);
-  EEPROM.write(EEPROM_CALIBRATION_ADDR + 1, (uint8_t)motorRightCalibration);
-  EEPROM.commit();
+  requestSave(STORE_KEY_MOTOR_TRIM);
+  requestSave(STORE_KEY_PID_GAINS);
   
   LOG.printf("✓ Calibration saved: L=%d, R=%d\n", motorLeftCalibration, motorRightCalibration);
 }
 
-void autoCalibrateStraight() {
+void startLineCalibration() {
+  for (int i = 0; i < 8; i++) {
+    lineCalibration.min[i] = 0xFFFF;
+    lineCalibration.max[i] = 0;
+  }
+  lineCalibrating = true;
+}
+
+void updateLineCalibration() {
+  for (int i = 0; i < 8; i++) {
+    if (lineSensors[i] < lineCalibration.min[i]) lineCalibration.min[i] = lineSensors[i];
+    if (lineSensors[i] > lineCalibration.max[i]) lineCalibration.max[i] = lineSensors[i];
+  }
+}
+
+// Threshold halfway between floor and line, averaged over the sensors that
+// saw both; false (threshold unchanged) if none did
+bool finishLineCalibration() {
+  if (!lineCalibrating) return false;
+  lineCalibrating = false;
+  
+  long sum = 0;
+  int count = 0;
+  for (int i = 0; i < 8; i++) {
+    if (lineCalibration.max[i] < lineCalibration.min[i] + LINE_CALIBRATION_MIN_SPAN) continue;
+    sum += (lineCalibration.min[i] + lineCalibration.max[i]) / 2;
+    count++;
+  }
+  if (count == 0) return false;
+  
+  lineThreshold = sum / count;
+  lineCalibration.threshold = lineThreshold;
+  requestSave(STORE_KEY_LINE_CALIBRATION);
+  LOG.printf("✓ Line threshold calibrated: %d (%d sensors)\n", lineThreshold, count);
+  return true;
+}
+
+void autoCalibrateStraight(bool onLoop) {
   LOG.println("Starting auto-calibration...");
   
   // Reset yaw
@@ -1421,11 +4359,11 @@ void autoCalibrateStraight() {
   
   setMotorSpeed(testSpeed, testSpeed);
   
-  delay(500); // Let it stabilize
+  waitDriving(500, onLoop); // Let it stabilize
   
   // Measure yaw drift over 2 seconds
   float startYaw = yaw - yawOffset;
-  delay(2000);
+  waitDriving(2000, onLoop);
   updateIMU();
   float endYaw = yaw - yawOffset;
   
@@ -1452,7 +4390,8 @@ void autoCalibrateStraight() {
 // =====================================================
 
 void sendSensorData() {
-  JsonDocument doc;
+  PROFILE_SCOPE(profiler, PROFILE_SEND_SENSOR_DATA);
+  JsonDocument doc(&telemetryArena);
   
   doc["battery"] = 100; // TODO: Implement battery monitoring
   
@@ -1475,13 +4414,18 @@ void sendSensorData() {
     btns.add(buttons[i]);
   }
   
+  doc["behavior"] = behaviorName(behaviorOwner);
+  
+  // cm and degrees, to 0.1
+  const Pose& pose = poseEstimator.pose();
+  doc["pose"]["x"] = roundf(pose.x) / 10;
+  doc["pose"]["y"] = roundf(pose.y) / 10;
+  doc["pose"]["theta"] = roundf(pose.theta * 10) / 10;
+  
   doc["motorCalibration"]["left"] = motorLeftCalibration;
   doc["motorCalibration"]["right"] = motorRightCalibration;
   
-  String output;
-  serializeJson(doc, output);
-  
-  ws.textAll(output);
+  wsSendJson(doc);
 }
 
 // =====================================================
@@ -1489,15 +4433,20 @@ void sendSensorData() {
 // =====================================================
 
 void loadConfig() {
-  EEPROM.get(EEPROM_CONFIG_ADDR, config);
+  bool loaded = false;
+  if (store.mounted()) {
+    loaded = loadRecord(STORE_KEY_CONFIG, STORE_SCHEMA_CONFIG, &config, sizeof(config));
+  } else {
+    LegacyConfig legacy;
+    hal::storageRead(EEPROM_CONFIG_ADDR, &legacy, sizeof(legacy));
+    loaded = legacy.magic == EEPROM_CONFIG_MAGIC;
+    if (loaded) config = legacy.config;
+  }
   
-  // Check if config is valid (magic number)
-  if (config.magic != EEPROM_CONFIG_MAGIC) {
+  if (!loaded) {
     // Initialize with defaults
     LOG.println("No valid config found, generating new SSID");
-    config.magic = EEPROM_CONFIG_MAGIC;
-    String randomSSID = generateRandomSSID();
-    strncpy(config.apSSID, randomSSID.c_str(), 31);
+    generateRandomSSID(config.apSSID, sizeof(config.apSSID));
     strncpy(config.apPassword, DEFAULT_AP_PASSWORD, 31);
     config.wifiSSID[0] = '\0';
     config.wifiPassword[0] = '\0';
@@ -1510,16 +4459,13 @@ void loadConfig() {
              config.firmwareMode == FIRMWARE_MODE_LIVE ? "LIVE" : "OFFLINE");
 }
 
+// Written by updateStorage() (immediately before a scheduled restart)
 void saveConfig() {
-  config.magic = EEPROM_CONFIG_MAGIC;
-  EEPROM.put(EEPROM_CONFIG_ADDR, config);
-  EEPROM.commit();
-  
-  LOG.println("✓ Config saved to EEPROM");
+  requestSave(STORE_KEY_CONFIG);
 }
 
-void sendConfig() {
-  JsonDocument doc;
+void sendConfig(JsonArena& arena) {
+  JsonDocument doc(&arena);
   doc["type"] = "config";
   doc["robotName"] = config.apSSID;
   doc["apPassword"] = "********"; // Don't send actual password
@@ -1529,12 +4475,539 @@ void sendConfig() {
   doc["version"] = FIRMWARE_VERSION;
   
   // Add IP addresses
-  doc["apIP"] = WiFi.softAPIP().toString();
-  if (WiFi.status() == WL_CONNECTED) {
-    doc["stationIP"] = WiFi.localIP().toString();
+  char ip[16];
+  hal::wifiAccessPointIp(ip, sizeof(ip));
+  doc["apIP"] = ip;
+  if (hal::wifiStationConnected()) {
+    hal::wifiStationIp(ip, sizeof(ip));
+    doc["stationIP"] = ip;
+  }
+  
+  wsSendJson(doc);
+}
+
+// =====================================================
+// PERSISTENT STORAGE
+// =====================================================
+
+void setupStorage() {
+  // Legacy EEPROM image: source of the one-time migration and the fallback
+  hal::storageBegin(EEPROM_SIZE);
+  
+  // Recorded driving session, in its own partition
+  size_t sessionBytes = 0;
+  uint32_t sessionMs = 0;
+  if (sessionSavedInfo(sessionBytes, sessionMs)) {
+    sessionSavedBytes = sessionBytes;
+    sessionSavedMs = sessionMs;
+    sessionSaved = true;
+    LOG.printf("✓ Saved session: %u bytes, %u ms\n", (unsigned)sessionBytes, (unsigned)sessionMs);
+  }
+  
+  // OLED sprites, in their own partition
+  spriteCache.begin();
+  if (spriteCache.capacity() > 0) {
+    LOG.printf("✓ Sprites: %u stored\n", spriteCache.count());
+  }
+  
+  if (!store.begin()) {
+    LOG.println("✗ No store partition, using EEPROM (flash over USB to add it)");
+    return;
+  }
+  
+  KvStats stats;
+  store.stats(stats);
+  LOG.printf("✓ Store mounted: sector %u/%u, %u bytes used\n",
+             stats.activeSector, stats.sectors, (unsigned)stats.used);
+  if (stats.corrupt) LOG.printf("  %u damaged records skipped\n", (unsigned)stats.corrupt);
+  
+  if (!store.contains(STORE_KEY_CONFIG)) migrateLegacyStorage();
+}
+
+// Imports the pre-store EEPROM layout into the store, once
+void migrateLegacyStorage() {
+  LegacyConfig legacy;
+  hal::storageRead(EEPROM_CONFIG_ADDR, &legacy, sizeof(legacy));
+  if (legacy.magic != EEPROM_CONFIG_MAGIC) return;
+  
+  MotorTrim trim;
+  hal::storageRead(EEPROM_CALIBRATION_ADDR, &trim, sizeof(trim));
+  
+  store.put(STORE_KEY_CONFIG, STORE_SCHEMA_CONFIG, &legacy.config, sizeof(legacy.config));
+  store.put(STORE_KEY_MOTOR_TRIM, STORE_SCHEMA_MOTOR_TRIM, &trim, sizeof(trim));
+  if (store.commit()) {
+    LOG.println("✓ EEPROM settings migrated to the store");
+  }
+}
+
+// Reads a record over data, which holds the defaults. A shorter record of
+// the same schema (written before fields were appended) only fills its
+// part; a different schema is left for the caller to convert.
+bool loadRecord(StoreKey key, uint8_t schema, void* data, size_t size) {
+  uint8_t value[KV_MAX_VALUE];
+  uint8_t stored;
+  size_t len = store.get(key, value, sizeof(value), &stored);
+  if (len == 0 || stored != schema) return false;
+  
+  memcpy(data, value, len < size ? len : size);
+  return true;
+}
+
+// Marks a record as changed; may be called from any task
+void requestSave(StoreKey key) {
+  storeRequestTime = hal::millis();
+  storePending.fetch_or(1 << key);
+}
+
+static bool putRecord(StoreKey key) {
+  switch (key) {
+    case STORE_KEY_CONFIG:
+      return store.put(key, STORE_SCHEMA_CONFIG, &config, sizeof(config));
+    case STORE_KEY_MOTOR_TRIM: {
+      MotorTrim trim = { (int8_t)motorLeftCalibration, (int8_t)motorRightCalibration };
+      return store.put(key, STORE_SCHEMA_MOTOR_TRIM, &trim, sizeof(trim));
+    }
+    case STORE_KEY_LINE_CALIBRATION:
+      return store.put(key, STORE_SCHEMA_LINE_CALIBRATION, &lineCalibration, sizeof(lineCalibration));
+    case STORE_KEY_PID_GAINS: {
+      PidGains gains = { lineFollowerKp, 0, 0, (int16_t)lineFollowerSpeed };
+      return store.put(key, STORE_SCHEMA_PID_GAINS, &gains, sizeof(gains));
+    }
+    case STORE_KEY_GROUP:
+      return store.put(key, STORE_SCHEMA_GROUP, &groupConfig, sizeof(groupConfig));
+    case STORE_KEY_MOTOR_CONFIG:
+      return store.put(key, STORE_SCHEMA_MOTOR_CONFIG, &motorConfig, sizeof(motorConfig));
+    case STORE_KEY_LAP: {
+      LapRecord record = { lapLearner.map(), lapLearner.params };
+      return store.put(key, STORE_SCHEMA_LAP, &record, sizeof(record));
+    }
+    case STORE_KEY_SPEED_MODEL:
+      return store.put(key, STORE_SCHEMA_SPEED_MODEL, &poseEstimator.model, sizeof(poseEstimator.model));
+  }
+  return false;
+}
+
+// Without a store partition, config and motor trim go to the old EEPROM layout
+static void saveLegacy(uint16_t pending) {
+  if (pending & (1 << STORE_KEY_CONFIG)) {
+    LegacyConfig legacy = { EEPROM_CONFIG_MAGIC, config };
+    hal::storageWrite(EEPROM_CONFIG_ADDR, &legacy, sizeof(legacy));
+  }
+  if (pending & (1 << STORE_KEY_MOTOR_TRIM)) {
+    MotorTrim trim = { (int8_t)motorLeftCalibration, (int8_t)motorRightCalibration };
+    hal::storageWrite(EEPROM_CALIBRATION_ADDR, &trim, sizeof(trim));
+  }
+  hal::storageCommit();
+}
+
+void updateStorage() {
+  unsigned long now = hal::millis();
+  uint16_t pending = storePending.load();
+  
+  if (pending && (restartScheduled || now - storeRequestTime >= STORE_COMMIT_DELAY_MS)) {
+    // Only the bits taken here: a request that lands meanwhile stays set
+    storePending.fetch_and((uint16_t)~pending);
+    
+    if (store.mounted()) {
+      for (uint8_t key = 1; key < 16; key++) {
+        if (pending & (1 << key)) putRecord((StoreKey)key);
+      }
+      if (!store.commit()) LOG.println("✗ Store commit failed");
+    } else {
+      saveLegacy(pending);
+    }
+  }
+  
+  if (restartScheduled && (long)(now - restartTime) >= 0) {
+    hal::restart();
+  }
+}
+
+// Reboots from the loop once pending saves are committed
+void scheduleRestart(unsigned long delayMs) {
+  restartTime = hal::millis() + delayMs;
+  restartScheduled = true;
+}
+
+// =====================================================
+// WIFI SCAN
+// =====================================================
+
+// Called from the AsyncTCP task: only queues the request, so a scan never
+// blocks the WebSocket callbacks
+void requestWifiScan(uint32_t clientId, bool refresh) {
+  uint8_t next = (wifiScanQueueHead + 1) % WIFI_SCAN_QUEUE_SIZE;
+  if (next == wifiScanQueueTail) return; // Queue full, already plenty of waiters
+  
+  wifiScanQueue[wifiScanQueueHead] = clientId;
+  if (refresh) wifiScanRefresh = true;
+  wifiScanQueueHead = next;
+}
+
+void updateWifiScan() {
+  unsigned long now = hal::millis();
+  
+  if (wifiScanRunning) {
+    int found = hal::wifiScanComplete();
+    if (found == hal::WIFI_SCAN_BUSY) return;
+    
+    wifiScanRunning = false;
+    if (found >= 0) {
+      wifiNetworksFound = found;
+      wifiNetworkCount = 0;
+      for (int i = 0; i < found && wifiNetworkCount < WIFI_SCAN_MAX_NETWORKS; i++) {
+        if (hal::wifiScanResult(i, wifiNetworks[wifiNetworkCount])) wifiNetworkCount++;
+      }
+      wifiScanValid = true;
+      wifiScanTime = now;
+    } else {
+      LOG.println("✗ WiFi scan failed");
+    }
+    hal::wifiScanDelete();
+    
+    // Whatever the outcome, the waiting clients get an answer now
+    sendWifiScanResults();
+    return;
+  }
+  
+  if (wifiScanQueueTail == wifiScanQueueHead) return;
+  
+  bool fresh = wifiScanValid && now - wifiScanTime < WIFI_SCAN_CACHE_MS && !wifiScanRefresh;
+  bool allowed = !wifiScanAttempted || now - wifiScanStartTime >= WIFI_SCAN_MIN_INTERVAL_MS;
+  
+  if (!fresh && allowed) {
+    wifiScanAttempted = true;
+    wifiScanStartTime = now;
+    wifiScanRefresh = false;
+    if (hal::wifiScanStart()) {
+      wifiScanRunning = true;
+      return;
+    }
+    LOG.println("✗ WiFi scan could not start");
+  } else if (!fresh && !wifiScanValid) {
+    return; // Rate-limited with nothing cached: wait for the next slot
+  }
+  
+  // Fresh cache, or a stale one while rate-limited
+  wifiScanRefresh = false;
+  sendWifiScanResults();
+}
+
+// Answers every queued request with the cached results
+void sendWifiScanResults() {
+  JsonDocument doc(&telemetryArena);
+  doc["type"] = "wifi_scan";
+  doc["count"] = wifiScanValid ? wifiNetworksFound : 0;
+  doc["ageMs"] = wifiScanValid ? hal::millis() - wifiScanTime : 0;
+  if (!wifiScanValid) doc["error"] = "scan failed";
+  
+  JsonArray networks = doc["networks"].to<JsonArray>();
+  for (int i = 0; i < wifiNetworkCount && wifiScanValid; i++) {
+    JsonObject net = networks.add<JsonObject>();
+    net["ssid"] = wifiNetworks[i].ssid;
+    net["rssi"] = wifiNetworks[i].rssi;
+    net["secured"] = wifiNetworks[i].secured;
+  }
+  
+  // Up to WIFI_SCAN_MAX_NETWORKS entries of at most ~80 bytes each
+  static char output[WIFI_SCAN_MAX_NETWORKS * 96 + 128];
+  size_t len = serializeJson(doc, output, sizeof(output));
+  
+  while (wifiScanQueueTail != wifiScanQueueHead) {
+    sendText(wifiScanQueue[wifiScanQueueTail], output, len);
+    wifiScanQueueTail = (wifiScanQueueTail + 1) % WIFI_SCAN_QUEUE_SIZE;
+  }
+}
+
+// =====================================================
+// FLIGHT RECORDER
+// =====================================================
+
+void recordFlightSample() {
+  // Event triggers (the armed event fires once, then post-trigger samples follow)
+  switch (recorder.armedEvent()) {
+    case FLIGHT_TRIGGER_LINE_LOST:
+      if (lineFollowerEnabled && lineLost) recorder.trigger(FLIGHT_TRIGGER_LINE_LOST);
+      break;
+    case FLIGHT_TRIGGER_OBSTACLE:
+      if (distance < FLIGHT_RECORDER_OBSTACLE_CM) recorder.trigger(FLIGHT_TRIGGER_OBSTACLE);
+      break;
+    case FLIGHT_TRIGGER_LINE_FOLLOWER:
+      if (lineFollowerEnabled) recorder.trigger(FLIGHT_TRIGGER_LINE_FOLLOWER);
+      break;
+    default:
+      break;
   }
   
-  String output;
-  serializeJson(doc, output);
-  ws.textAll(output);
-}
\ No newline at end of file
+  FlightRecord record;
+  record.timeUs = hal::micros();
+  for (int i = 0; i < 8; i++) {
+    record.line[i] = lineSensors[i];
+  }
+  record.ldr[0] = ldrLeft;
+  record.ldr[1] = ldrRight;
+  // Yaw is unwrapped and would saturate the field within a lap or two
+  record.yaw = roundf(wrapDegrees(yaw - yawOffset) * 100.0f);
+  record.gyroZ = constrain(gyroRate * 100.0f, -32768.0f, 32767.0f);
+  record.motorLeft = motorLeftSpeed;
+  record.motorRight = motorRightSpeed;
+  record.error = lineError;
+  record.distance = distance;
+  record.flags = 0;
+  if (lineFollowerEnabled) record.flags |= FLIGHT_FLAG_LINE_FOLLOWER;
+  if (lineLost) record.flags |= FLIGHT_FLAG_LINE_LOST;
+  record.reserved = 0;
+  
+  recorder.push(record);
+}
+
+void sendRecorderStatus(JsonArena& arena) {
+  static const char* states[] = {"idle", "recording", "triggered", "stopped"};
+  
+  JsonDocument doc(&arena);
+  doc["type"] = "recorder_status";
+  doc["state"] = states[recorder.state()];
+  doc["count"] = recorder.count();
+  doc["capacity"] = recorder.capacity();
+  doc["periodUs"] = FLIGHT_RECORDER_PERIOD_US;
+  doc["bytes"] = recorder.logSize();
+  
+  wsSendJson(doc);
+}
+
+// =====================================================
+// LATENCY
+// =====================================================
+
+// Echo slot of a client; a new client takes a free slot (all taken only
+// happens past CLIENT_SLOTS, then the first one is reused)
+static EchoClient& echoClientFor(uint32_t clientId) {
+  EchoClient* free = nullptr;
+  for (EchoClient& client : echoClients) {
+    if (client.used && client.clientId == clientId) return client;
+    if (!client.used && !free) free = &client;
+  }
+  
+  EchoClient& client = free ? *free : echoClients[0];
+  client.used = true;
+  client.clientId = clientId;
+  client.seq = 0;
+  client.clock.reset();
+  return client;
+}
+
+void resetEchoClient(uint32_t clientId) {
+  for (EchoClient& client : echoClients) {
+    if (client.used && client.clientId == clientId) client.used = false;
+  }
+}
+
+// { type: "echo", seq, t1, ack: { seq, t4 } }: t1 is the client's send
+// time on any microsecond clock. The reply (to this client only) adds the
+// robot's frame receipt t2 and send t3 on hal::micros64(). The client
+// acks a reply with the time t4 it arrived in its next echo, completing
+// an NTP-style exchange: the robot then keeps a clock offset per client
+// and a histogram of network round trips.
+void handleEcho(JsonDocument& doc, uint32_t clientId) {
+  uint64_t t2 = frameReceivedUs(clientId);
+  EchoClient& client = echoClientFor(clientId);
+  
+  JsonObject ack = doc["ack"];
+  uint32_t ackSeq = ack["seq"] | 0UL;
+  uint64_t t4 = ack["t4"] | 0ULL;
+  if (client.seq != 0 && ackSeq == client.seq && t4 >= client.t1) {
+    uint64_t roundTrip = (t4 - client.t1) - (client.t3 - client.t2);
+    echoRoundTrip.record(roundTrip > UINT32_MAX ? UINT32_MAX : (uint32_t)roundTrip, hal::millis());
+    client.clock.addSample(client.t1, client.t2, client.t3, t4);
+  }
+  
+  uint32_t seq = doc["seq"] | 0UL;
+  uint64_t t1 = doc["t1"] | 0ULL;
+  
+  JsonDocument response(&commandArenaFor(clientId));
+  response["type"] = "echo";
+  response["seq"] = seq;
+  response["t1"] = t1;
+  response["t2"] = t2;
+  if (client.clock.synced()) {
+    response["offsetUs"] = -client.clock.offset();   // Client minus robot
+    response["rttUs"] = client.clock.roundTrip();
+  }
+  
+  // As late as possible; serializing the number itself is not counted
+  uint64_t t3 = hal::micros64();
+  response["t3"] = t3;
+  char output[256];
+  size_t len = serializeJson(response, output, sizeof(output));
+  sendText(clientId, output, len);
+  
+  client.seq = seq;
+  client.t1 = t1;
+  client.t2 = t2;
+  client.t3 = t3;
+}
+
+static void fillLatencySummary(JsonObject out, const LatencyHistogram& histogram) {
+  LatencySummary summary;
+  histogram.summary(summary);
+  out["count"] = summary.count;
+  out["minUs"] = summary.minUs;
+  out["avgUs"] = summary.count ? (uint32_t)(summary.sumUs / summary.count) : 0;
+  out["p50Us"] = summary.p50Us;
+  out["p90Us"] = summary.p90Us;
+  out["p99Us"] = summary.p99Us;
+  out["maxUs"] = summary.maxUs;
+}
+
+void fillLatency(JsonObject latency) {
+  latency["windowMs"] = LATENCY_WINDOW_MS;
+  fillLatencySummary(latency["actuation"].to<JsonObject>(), actuationLatency);
+  fillLatencySummary(latency["usbActuation"].to<JsonObject>(), usbActuationLatency);
+  fillLatencySummary(latency["echoRtt"].to<JsonObject>(), echoRoundTrip);
+  
+  JsonArray clients = latency["clients"].to<JsonArray>();
+  for (const EchoClient& client : echoClients) {
+    if (!client.used || !client.clock.synced()) continue;
+    JsonObject entry = clients.add<JsonObject>();
+    entry["id"] = client.clientId;
+    entry["offsetUs"] = -client.clock.offset();
+    entry["rttUs"] = client.clock.roundTrip();
+  }
+}
+
+// =====================================================
+// PROFILING
+// =====================================================
+
+void fillProfile(JsonDocument& doc) {
+#ifdef SIROBO_PROFILE
+  doc["enabled"] = true;
+#else
+  doc["enabled"] = false;
+#endif
+  doc["uptime"] = hal::millis();
+  doc["heap"] = hal::freeHeap();
+  doc["cpuMHz"] = hal::cycleFrequency() / 1000000UL;
+  doc["windowMs"] = profiler.sinceResetMs();
+  doc["loopHz"] = profiler.rate(PROFILE_LOOP);
+  fillMemory(doc["memory"].to<JsonObject>());
+  
+  JsonObject stages = doc["stages"].to<JsonObject>();
+  for (uint8_t i = 0; i < profiler.stageCount(); i++) {
+    ProfileSummary summary;
+    profiler.summary(i, summary);
+    
+    JsonObject stage = stages[profiler.stageName(i)].to<JsonObject>();
+    stage["count"] = summary.count;
+    stage["minUs"] = summary.minUs;
+    stage["avgUs"] = summary.avgUs;
+    stage["maxUs"] = summary.maxUs;
+    stage["p99Us"] = summary.p99Us;
+    stage["totalMs"] = summary.totalMs;
+    stage["allocations"] = summary.allocations;
+  }
+}
+
+// Share of the free heap not usable by a single allocation, in percent
+static float heapFragmentation() {
+  uint32_t free = hal::freeHeap();
+  if (free == 0) return 0;
+  return 100.0f - hal::largestFreeBlock() * 100.0f / free;
+}
+
+static void fillArena(JsonObject out, const JsonArena& arena) {
+  out["capacity"] = arena.capacity();
+  out["highWater"] = arena.highWater();
+  out["failures"] = arena.failures();
+}
+
+void fillMemory(JsonObject memory) {
+  ProfileSummary loopSummary;
+  profiler.summary(PROFILE_LOOP, loopSummary);
+  
+  memory["free"] = hal::freeHeap();
+  memory["minFree"] = hal::minFreeHeap();
+  memory["largestBlock"] = hal::largestFreeBlock();
+  memory["fragmentation"] = heapFragmentation();
+  memory["allocations"] = hal::allocationCount();
+  memory["allocPerLoop"] = loopSummary.count ? (float)loopSummary.allocations / loopSummary.count : 0.0f;
+  fillArena(memory["telemetryArena"].to<JsonObject>(), telemetryArena);
+  fillArena(memory["commandArena"].to<JsonObject>(), commandArena);
+}
+
+// printf into buffer at used, advancing used (output stops when full)
+static void appendf(char* buffer, size_t len, size_t& used, const char* format, ...) {
+  if (used >= len) return;
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buffer + used, len - used, format, args);
+  va_end(args);
+  if (n > 0) used += n;
+}
+
+static void appendLatencyHistogram(char* buffer, size_t len, size_t& used, const char* name,
+                                   const LatencyHistogram& histogram) {
+  LatencySummary summary;
+  histogram.summary(summary);
+  appendf(buffer, len, used, "# TYPE %s histogram\n", name);
+  for (uint8_t shift = LATENCY_PROMETHEUS_MIN_SHIFT; shift <= LATENCY_PROMETHEUS_MAX_SHIFT; shift++) {
+    uint32_t bound = 1UL << shift;
+    appendf(buffer, len, used, "%s_bucket{le=\"%u\"} %u\n", name, (unsigned)bound, (unsigned)histogram.countBelow(bound));
+  }
+  appendf(buffer, len, used, "%s_bucket{le=\"+Inf\"} %u\n", name, (unsigned)summary.count);
+  appendf(buffer, len, used, "%s_sum %llu\n%s_count %u\n", name, (unsigned long long)summary.sumUs, name, (unsigned)summary.count);
+}
+
+size_t writePrometheusMetrics(char* buffer, size_t len) {
+  size_t used = 0;
+  appendf(buffer, len, used, "# TYPE sirobo_uptime_ms gauge\nsirobo_uptime_ms %u\n", (unsigned)hal::millis());
+  appendf(buffer, len, used, "# TYPE sirobo_heap_free_bytes gauge\nsirobo_heap_free_bytes %u\n", (unsigned)hal::freeHeap());
+  appendf(buffer, len, used, "# TYPE sirobo_heap_min_free_bytes gauge\nsirobo_heap_min_free_bytes %u\n", (unsigned)hal::minFreeHeap());
+  appendf(buffer, len, used, "# TYPE sirobo_heap_largest_block_bytes gauge\nsirobo_heap_largest_block_bytes %u\n", (unsigned)hal::largestFreeBlock());
+  appendf(buffer, len, used, "# TYPE sirobo_heap_fragmentation_percent gauge\nsirobo_heap_fragmentation_percent %.1f\n", heapFragmentation());
+  appendf(buffer, len, used, "# TYPE sirobo_heap_allocations_total counter\nsirobo_heap_allocations_total %u\n", (unsigned)hal::allocationCount());
+  appendf(buffer, len, used, "# TYPE sirobo_json_arena_high_water_bytes gauge\n");
+  appendf(buffer, len, used, "sirobo_json_arena_high_water_bytes{arena=\"telemetry\"} %u\n", (unsigned)telemetryArena.highWater());
+  appendf(buffer, len, used, "sirobo_json_arena_high_water_bytes{arena=\"command\"} %u\n", (unsigned)commandArena.highWater());
+  appendf(buffer, len, used, "# TYPE sirobo_json_arena_failures_total counter\n");
+  appendf(buffer, len, used, "sirobo_json_arena_failures_total{arena=\"telemetry\"} %u\n", (unsigned)telemetryArena.failures());
+  appendf(buffer, len, used, "sirobo_json_arena_failures_total{arena=\"command\"} %u\n", (unsigned)commandArena.failures());
+  appendf(buffer, len, used, "# TYPE sirobo_loop_rate_hz gauge\nsirobo_loop_rate_hz %.1f\n", profiler.rate(PROFILE_LOOP));
+  
+  appendf(buffer, len, used, "# TYPE sirobo_stage_calls_total counter\n");
+  for (uint8_t i = 0; i < profiler.stageCount(); i++) {
+    ProfileSummary summary;
+    profiler.summary(i, summary);
+    appendf(buffer, len, used, "sirobo_stage_calls_total{stage=\"%s\"} %u\n", profiler.stageName(i), (unsigned)summary.count);
+  }
+  
+  appendf(buffer, len, used, "# TYPE sirobo_stage_allocations_total counter\n");
+  for (uint8_t i = 0; i < profiler.stageCount(); i++) {
+    ProfileSummary summary;
+    profiler.summary(i, summary);
+    appendf(buffer, len, used, "sirobo_stage_allocations_total{stage=\"%s\"} %u\n", profiler.stageName(i), (unsigned)summary.allocations);
+  }
+  
+  appendf(buffer, len, used, "# TYPE sirobo_stage_duration_us gauge\n");
+  for (uint8_t i = 0; i < profiler.stageCount(); i++) {
+    ProfileSummary summary;
+    profiler.summary(i, summary);
+    const char* name = profiler.stageName(i);
+    appendf(buffer, len, used, "sirobo_stage_duration_us{stage=\"%s\",stat=\"min\"} %.2f\n", name, summary.minUs);
+    appendf(buffer, len, used, "sirobo_stage_duration_us{stage=\"%s\",stat=\"avg\"} %.2f\n", name, summary.avgUs);
+    appendf(buffer, len, used, "sirobo_stage_duration_us{stage=\"%s\",stat=\"p99\"} %.2f\n", name, summary.p99Us);
+    appendf(buffer, len, used, "sirobo_stage_duration_us{stage=\"%s\",stat=\"max\"} %.2f\n", name, summary.maxUs);
+  }
+  
+  appendLatencyHistogram(buffer, len, used, "sirobo_actuation_latency_us", actuationLatency);
+  appendLatencyHistogram(buffer, len, used, "sirobo_usb_actuation_latency_us", usbActuationLatency);
+  appendLatencyHistogram(buffer, len, used, "sirobo_echo_rtt_us", echoRoundTrip);
+  appendf(buffer, len, used, "# TYPE sirobo_client_clock_offset_us gauge\n");
+  for (const EchoClient& client : echoClients) {
+    if (!client.used || !client.clock.synced()) continue;
+    appendf(buffer, len, used, "sirobo_client_clock_offset_us{client=\"%u\"} %lld\n",
+            (unsigned)client.clientId, (long long)-client.clock.offset());
+  }
+  
+  return used < len ? used : len - 1;
+}
@@ -0,0 +1,559 @@
+/*
+ * assetpack - pack the built web app for the robot's filesystem
+ *
+ * Usage:
+ *   cd website && npm run build
+ *   cd ../wemosS2mini
+ *   assetpack ../website/dist [data/www]
+ *   pio run -t uploadfs
+ *
+ * Copies every file under the input directory to the output directory
+ * (default data/www, PlatformIO's data_dir), gzip-compressed as <name>.gz
+ * when that saves at least 10%, and writes the assets.idx index the
+ * firmware serves from (format in wemosS2mini/lib/AssetIndex/AssetIndex.h).
+ * Files under /assets/ (Vite's content-hashed output) are marked immutable.
+ * Output is deterministic, so unchanged files keep their ETag.
+ *
+ * Afterwards the output is checked against the input: the index is parsed
+ * with the firmware's own parser and every file is read back, its size and
+ * ETag compared and its gzip stream inflated. Any mismatch exits with 1.
+ * Files from the previous index that are no longer part of the app are
+ * removed from the output directory.
+ *
+ * Build with `pio run -e assetpack` (binary in .pio/build/assetpack/program).
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <AssetIndex.h>
+#include <Sha256.h>
+
+#define FS_PARTITION_SIZE 0x150000  // spiffs partition in partitions.csv
+#define MIN_SAVING_PERCENT 10       // Keep a gzip copy only if it is this much smaller
+#define WINDOW_SIZE 32768
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define HASH_CHAIN_LIMIT 128
+
+typedef std::vector<uint8_t> Bytes;
+
+// =====================================================
+// CRC-32 (gzip trailer)
+// =====================================================
+
+static uint32_t crc32(const Bytes& data) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (uint8_t byte : data) {
+    crc ^= byte;
+    for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+  }
+  return ~crc;
+}
+
+// =====================================================
+// DEFLATE (fixed Huffman codes, RFC 1951)
+// =====================================================
+
+static const uint16_t LENGTH_BASE[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115,
+  131, 163, 195, 227, 258
+};
+static const uint8_t LENGTH_EXTRA[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t DISTANCE_BASE[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537,
+  2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t DISTANCE_EXTRA[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// LSB-first bit stream, as deflate stores everything but Huffman codes
+struct BitWriter {
+  Bytes& out;
+  uint32_t bits = 0;
+  uint8_t count = 0;
+
+  explicit BitWriter(Bytes& buffer) : out(buffer) {}
+
+  void put(uint32_t value, uint8_t width) {
+    bits |= value << count;
+    count += width;
+    while (count >= 8) {
+      out.push_back(bits);
+      bits >>= 8;
+      count -= 8;
+    }
+  }
+
+  // Huffman codes go most significant bit first
+  void putCode(uint32_t code, uint8_t width) {
+    uint32_t reversed = 0;
+    for (uint8_t i = 0; i < width; i++) reversed |= ((code >> i) & 1) << (width - 1 - i);
+    put(reversed, width);
+  }
+
+  void finish() {
+    if (count) out.push_back(bits);
+    bits = 0;
+    count = 0;
+  }
+};
+
+static void putSymbol(BitWriter& writer, uint16_t symbol) {
+  if (symbol < 144) writer.putCode(0x30 + symbol, 8);
+  else if (symbol < 256) writer.putCode(0x190 + symbol - 144, 9);
+  else if (symbol < 280) writer.putCode(symbol - 256, 7);
+  else writer.putCode(0xC0 + symbol - 280, 8);
+}
+
+static void putMatch(BitWriter& writer, size_t length, size_t distance) {
+  uint8_t code = 28;
+  while (LENGTH_BASE[code] > length) code--;
+  putSymbol(writer, 257 + code);
+  writer.put(length - LENGTH_BASE[code], LENGTH_EXTRA[code]);
+
+  code = 29;
+  while (DISTANCE_BASE[code] > distance) code--;
+  writer.putCode(code, 5);
+  writer.put(distance - DISTANCE_BASE[code], DISTANCE_EXTRA[code]);
+}
+
+static size_t longestMatch(const Bytes& in, size_t pos, const std::vector<int32_t>& head,
+                           const std::vector<int32_t>& prev, size_t& distance) {
+  size_t best = 0;
+  if (pos + MIN_MATCH > in.size()) return 0;
+  size_t limit = std::min((size_t)MAX_MATCH, in.size() - pos);
+  uint32_t hash = (in[pos] << 16 | in[pos + 1] << 8 | in[pos + 2]) * 2654435761u >> 17;
+  int32_t candidate = head[hash];
+  for (int tries = 0; candidate >= 0 && pos - candidate <= WINDOW_SIZE && tries < HASH_CHAIN_LIMIT; tries++) {
+    size_t length = 0;
+    while (length < limit && in[candidate + length] == in[pos + length]) length++;
+    if (length > best) {
+      best = length;
+      distance = pos - candidate;
+      if (length == limit) break;
+    }
+    candidate = prev[candidate];
+  }
+  return best >= MIN_MATCH ? best : 0;
+}
+
+// One final fixed-Huffman block, LZ77 with one-step lazy matching
+static void deflate(const Bytes& in, Bytes& out) {
+  std::vector<int32_t> head(1 << 15, -1);
+  std::vector<int32_t> prev(in.size(), -1);
+  BitWriter writer(out);
+  writer.put(1, 1);  // BFINAL
+  writer.put(1, 2);  // BTYPE = fixed Huffman
+
+  auto insert = [&](size_t pos) {
+    if (pos + MIN_MATCH > in.size()) return;
+    uint32_t hash = (in[pos] << 16 | in[pos + 1] << 8 | in[pos + 2]) * 2654435761u >> 17;
+    prev[pos] = head[hash];
+    head[hash] = pos;
+  };
+
+  size_t pos = 0;
+  while (pos < in.size()) {
+    size_t distance = 0;
+    size_t length = longestMatch(in, pos, head, prev, distance);
+    insert(pos);
+    if (length) {
+      // A longer match one byte later wins over this one
+      size_t nextDistance = 0;
+      size_t next = longestMatch(in, pos + 1, head, prev, nextDistance);
+      if (next > length) {
+        putSymbol(writer, in[pos]);
+        pos++;
+        continue;
+      }
+      putMatch(writer, length, distance);
+      for (size_t i = 1; i < length; i++) insert(pos + i);
+      pos += length;
+    } else {
+      putSymbol(writer, in[pos]);
+      pos++;
+    }
+  }
+  putSymbol(writer, 256);
+  writer.finish();
+}
+
+static void gzip(const Bytes& in, Bytes& out) {
+  // No name and mtime 0: identical input gives identical output
+  static const uint8_t header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 2, 3 };
+  out.assign(header, header + sizeof(header));
+  deflate(in, out);
+  uint32_t crc = crc32(in);
+  uint32_t size = in.size();
+  for (int i = 0; i < 4; i++) out.push_back(crc >> (i * 8));
+  for (int i = 0; i < 4; i++) out.push_back(size >> (i * 8));
+}
+
+// =====================================================
+// INFLATE (check only: stored and fixed-Huffman blocks)
+// =====================================================
+
+struct BitReader {
+  const Bytes& in;
+  size_t pos;
+  uint8_t bit = 0;
+
+  BitReader(const Bytes& buffer, size_t start) : in(buffer), pos(start) {}
+
+  bool get(uint8_t width, uint32_t& value) {
+    value = 0;
+    for (uint8_t i = 0; i < width; i++) {
+      if (pos >= in.size()) return false;
+      value |= ((in[pos] >> bit) & 1) << i;
+      if (++bit == 8) {
+        bit = 0;
+        pos++;
+      }
+    }
+    return true;
+  }
+
+  bool getCode(uint8_t width, uint32_t& code) {
+    for (uint8_t i = 0; i < width; i++) {
+      uint32_t b;
+      if (!get(1, b)) return false;
+      code = (code << 1) | b;
+    }
+    return true;
+  }
+};
+
+static bool readSymbol(BitReader& reader, uint16_t& symbol) {
+  uint32_t code = 0;
+  if (!reader.getCode(7, code)) return false;
+  if (code <= 0x17) {
+    symbol = 256 + code;
+    return true;
+  }
+  if (!reader.getCode(1, code)) return false;
+  if (code >= 0x30 && code <= 0xBF) symbol = code - 0x30;
+  else if (code >= 0xC0 && code <= 0xC7) symbol = 280 + code - 0xC0;
+  else {
+    if (!reader.getCode(1, code)) return false;
+    symbol = 144 + code - 0x190;
+  }
+  return true;
+}
+
+static bool gunzip(const Bytes& in, Bytes& out) {
+  if (in.size() < 18 || in[0] != 0x1F || in[1] != 0x8B || in[2] != 8 || in[3] != 0) return false;
+  BitReader reader(in, 10);
+  out.clear();
+
+  uint32_t final = 0;
+  while (!final) {
+    uint32_t type;
+    if (!reader.get(1, final) || !reader.get(2, type)) return false;
+    if (type == 0) {
+      if (reader.bit) {
+        reader.bit = 0;
+        reader.pos++;
+      }
+      if (reader.pos + 4 > in.size()) return false;
+      size_t len = in[reader.pos] | in[reader.pos + 1] << 8;
+      reader.pos += 4;
+      if (reader.pos + len > in.size()) return false;
+      out.insert(out.end(), in.begin() + reader.pos, in.begin() + reader.pos + len);
+      reader.pos += len;
+      continue;
+    }
+    if (type != 1) return false;
+
+    uint16_t symbol;
+    while (readSymbol(reader, symbol) && symbol != 256) {
+      if (symbol < 256) {
+        out.push_back(symbol);
+        continue;
+      }
+      uint32_t extra, distanceCode = 0;
+      if (symbol > 285 || !reader.get(LENGTH_EXTRA[symbol - 257], extra)) return false;
+      size_t length = LENGTH_BASE[symbol - 257] + extra;
+      if (!reader.getCode(5, distanceCode) || distanceCode > 29 ||
+          !reader.get(DISTANCE_EXTRA[distanceCode], extra)) {
+        return false;
+      }
+      size_t distance = DISTANCE_BASE[distanceCode] + extra;
+      if (distance > out.size()) return false;
+      for (size_t i = 0; i < length; i++) out.push_back(out[out.size() - distance]);
+    }
+    if (symbol != 256) return false;
+  }
+
+  size_t trailer = reader.pos + (reader.bit ? 1 : 0);
+  if (trailer + 8 != in.size()) return false;
+  uint32_t crc = 0, size = 0;
+  for (int i = 0; i < 4; i++) crc |= (uint32_t)in[trailer + i] << (i * 8);
+  for (int i = 0; i < 4; i++) size |= (uint32_t)in[trailer + 4 + i] << (i * 8);
+  return crc == crc32(out) && size == out.size();
+}
+
+// =====================================================
+// FILES
+// =====================================================
+
+struct PackedFile {
+  std::string path;   // URL path
+  Bytes source;
+  Bytes stored;
+  bool gzip;
+  std::string etag;
+  const char* type;
+};
+
+static const char* contentType(const std::string& path) {
+  static const char* const types[][2] = {
+    { ".html", "text/html; charset=utf-8" },
+    { ".js", "text/javascript; charset=utf-8" },
+    { ".mjs", "text/javascript; charset=utf-8" },
+    { ".css", "text/css; charset=utf-8" },
+    { ".json", "application/json" },
+    { ".webmanifest", "application/manifest+json" },
+    { ".svg", "image/svg+xml" },
+    { ".png", "image/png" },
+    { ".jpg", "image/jpeg" },
+    { ".jpeg", "image/jpeg" },
+    { ".gif", "image/gif" },
+    { ".webp", "image/webp" },
+    { ".ico", "image/x-icon" },
+    { ".woff", "font/woff" },
+    { ".woff2", "font/woff2" },
+    { ".ttf", "font/ttf" },
+    { ".wasm", "application/wasm" },
+    { ".mp3", "audio/mpeg" },
+    { ".wav", "audio/wav" },
+    { ".ogg", "audio/ogg" },
+    { ".txt", "text/plain; charset=utf-8" },
+    { ".xml", "application/xml" }
+  };
+  size_t dot = path.rfind('.');
+  if (dot != std::string::npos) {
+    for (auto& entry : types) {
+      if (strcasecmp(path.c_str() + dot, entry[0]) == 0) return entry[1];
+    }
+  }
+  return "application/octet-stream";
+}
+
+static bool readFile(const std::string& path, Bytes& data) {
+  FILE* in = fopen(path.c_str(), "rb");
+  if (!in) return false;
+  data.clear();
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) data.insert(data.end(), buffer, buffer + n);
+  fclose(in);
+  return true;
+}
+
+static bool writeFile(const std::string& path, const void* data, size_t len) {
+  FILE* out = fopen(path.c_str(), "wb");
+  if (!out) return false;
+  bool ok = fwrite(data, 1, len, out) == len;
+  return fclose(out) == 0 && ok;
+}
+
+static bool makeDirs(const std::string& path) {
+  for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+    std::string dir = path.substr(0, slash);
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    if (slash == std::string::npos) return true;
+  }
+}
+
+static bool collect(const std::string& root, const std::string& relative, std::vector<PackedFile>& files) {
+  DIR* dir = opendir((root + relative).c_str());
+  if (!dir) return false;
+  std::vector<std::string> names;
+  while (struct dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] != '.') names.push_back(entry->d_name);
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+
+  for (const std::string& name : names) {
+    std::string path = relative + "/" + name;
+    struct stat st;
+    if (stat((root + path).c_str(), &st) != 0) continue;
+    if (S_ISDIR(st.st_mode)) {
+      if (!collect(root, path, files)) return false;
+      continue;
+    }
+    PackedFile file;
+    file.path = path;
+    if (!readFile(root + path, file.source)) return false;
+    files.push_back(file);
+  }
+  return true;
+}
+
+static std::string etagOf(const Bytes& data) {
+  Sha256 sha;
+  uint8_t digest[SHA256_DIGEST_SIZE];
+  char hex[SHA256_HEX_SIZE];
+  sha.update(data.data(), data.size());
+  sha.finish(digest);
+  sha256ToHex(digest, hex);
+  return std::string(hex, ASSET_ETAG_SIZE);
+}
+
+// Removes what the previous index listed but the new one does not
+static void removeStale(const std::string& outDir, const std::vector<PackedFile>& files) {
+  static char text[1 << 16];
+  FILE* in = fopen((outDir + "/assets.idx").c_str(), "rb");
+  if (!in) return;
+  size_t n = fread(text, 1, sizeof(text) - 1, in);
+  fclose(in);
+  text[n] = '\0';
+
+  static AssetIndex previous;
+  previous.parse(text);
+  for (size_t i = 0; i < previous.count(); i++) {
+    const Asset& asset = previous.at(i);
+    std::string stored = std::string(asset.path) + (asset.flags & ASSET_FLAG_GZIP ? ".gz" : "");
+    bool kept = false;
+    for (const PackedFile& file : files) {
+      if (file.path + (file.gzip ? ".gz" : "") == stored) kept = true;
+    }
+    if (!kept && remove((outDir + stored).c_str()) == 0) printf("removed %s\n", stored.c_str());
+  }
+}
+
+static bool check(const std::string& outDir, const std::vector<PackedFile>& files) {
+  static char text[1 << 16];
+  FILE* in = fopen((outDir + "/assets.idx").c_str(), "rb");
+  if (!in) return false;
+  size_t n = fread(text, 1, sizeof(text) - 1, in);
+  fclose(in);
+  text[n] = '\0';
+
+  static AssetIndex index;
+  if (index.parse(text) != files.size() || index.skipped()) {
+    fprintf(stderr, "check: index lists %zu of %zu files (%zu lines skipped)\n",
+            index.count(), files.size(), index.skipped());
+    return false;
+  }
+
+  for (const PackedFile& file : files) {
+    const Asset* asset = index.find(file.path.c_str());
+    Bytes stored, unpacked;
+    if (!asset || !readFile(outDir + file.path + (file.gzip ? ".gz" : ""), stored)) {
+      fprintf(stderr, "check: %s missing\n", file.path.c_str());
+      return false;
+    }
+    bool gzipped = asset->flags & ASSET_FLAG_GZIP;
+    if (stored.size() != asset->size || etagOf(stored) != asset->etag || gzipped != file.gzip) {
+      fprintf(stderr, "check: %s does not match its index entry\n", file.path.c_str());
+      return false;
+    }
+    if (gzipped ? !gunzip(stored, unpacked) || unpacked != file.source : stored != file.source) {
+      fprintf(stderr, "check: %s does not unpack to the original\n", file.path.c_str());
+      return false;
+    }
+  }
+  if (index.resolve("/") == nullptr) {
+    fprintf(stderr, "check: no /index.html\n");
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "usage: %s <website/dist> [data/www]\n", argv[0]);
+    return 2;
+  }
+  std::string inDir = argv[1];
+  std::string outDir = argc > 2 ? argv[2] : "data" ASSET_ROOT;
+  while (inDir.size() > 1 && inDir.back() == '/') inDir.pop_back();
+  while (outDir.size() > 1 && outDir.back() == '/') outDir.pop_back();
+
+  std::vector<PackedFile> files;
+  if (!collect(inDir, "", files)) {
+    perror(inDir.c_str());
+    return 1;
+  }
+  if (files.size() > ASSET_MAX_COUNT) {
+    fprintf(stderr, "%zu files, the firmware serves at most %d\n", files.size(), ASSET_MAX_COUNT);
+    return 1;
+  }
+
+  std::string index = "# path size etag flags content-type\n";
+  size_t sourceTotal = 0, storedTotal = 0;
+  for (PackedFile& file : files) {
+    if (file.path.size() >= ASSET_PATH_MAX || file.path.find(' ') != std::string::npos) {
+      fprintf(stderr, "%s: name too long or contains a space\n", file.path.c_str());
+      return 1;
+    }
+    Bytes compressed;
+    gzip(file.source, compressed);
+    file.gzip = compressed.size() * 100 <= file.source.size() * (100 - MIN_SAVING_PERCENT);
+    file.stored = file.gzip ? compressed : file.source;
+    file.etag = etagOf(file.stored);
+    file.type = contentType(file.path);
+
+    std::string flags;
+    if (file.gzip) flags += 'g';
+    if (file.path.compare(0, 8, "/assets/") == 0) flags += 'i';
+    if (flags.empty()) flags = "-";
+
+    char line[ASSET_PATH_MAX + 128];
+    snprintf(line, sizeof(line), "%s %zu %s %s %s\n", file.path.c_str(), file.stored.size(),
+             file.etag.c_str(), flags.c_str(), file.type);
+    index += line;
+    sourceTotal += file.source.size();
+    storedTotal += file.stored.size();
+  }
+  if (index.size() >= ASSET_INDEX_SIZE) {
+    fprintf(stderr, "index is %zu bytes, the firmware reads at most %d\n", index.size(), ASSET_INDEX_SIZE - 1);
+    return 1;
+  }
+
+  if (!makeDirs(outDir)) {
+    perror(outDir.c_str());
+    return 1;
+  }
+  removeStale(outDir, files);
+  for (const PackedFile& file : files) {
+    std::string path = outDir + file.path + (file.gzip ? ".gz" : "");
+    if (!makeDirs(path.substr(0, path.rfind('/'))) ||
+        !writeFile(path, file.stored.data(), file.stored.size())) {
+      perror(path.c_str());
+      return 1;
+    }
+    // Drop the other variant an earlier run may have left
+    if (file.gzip) remove((outDir + file.path).c_str());
+    else remove((outDir + file.path + ".gz").c_str());
+    printf("%-48s %8zu -> %8zu %s\n", file.path.c_str(), file.source.size(), file.stored.size(),
+           file.gzip ? "gzip" : "stored");
+  }
+  if (!writeFile(outDir + "/assets.idx", index.data(), index.size())) {
+    perror((outDir + "/assets.idx").c_str());
+    return 1;
+  }
+
+  if (!check(outDir, files)) return 1;
+
+  printf("%zu files, %zu -> %zu bytes (%.1f%%), checked\n", files.size(), sourceTotal, storedTotal,
+         sourceTotal ? storedTotal * 100.0 / sourceTotal : 100.0);
+  if (storedTotal + index.size() > FS_PARTITION_SIZE * 9 / 10) {
+    printf("warning: close to the %u KB filesystem partition\n", FS_PARTITION_SIZE / 1024);
+  }
+  return 0;
+}
@@ -0,0 +1,412 @@
+/*
+ * discover - find robots on the LAN with the UDP discovery protocol
+ *
+ * Usage:
+ *   discover [--to host[:port]]... [--timeout ms] [--expect n] [--free]
+ *   discover --bench <robots> [--rounds n]
+ *
+ * Broadcasts one query (to 255.255.255.255:4210 unless --to names targets)
+ * and lists every robot that answers: name, address, firmware, mode and
+ * WebSocket clients. The query is repeated every RETRY_MS until --timeout
+ * (default 1000 ms) or until --expect robots have answered, since WiFi
+ * drops the odd broadcast. --free asks only robots with a free client slot
+ * to answer. Exits 1 if fewer than --expect (default 1) robots were found.
+ *
+ * --bench starts <robots> simulated robots on 127.0.0.1, each with a UDP
+ * responder and an HTTP /ping endpoint, and times finding all of them both
+ * ways: one UDP query each (loopback has no broadcast, so the query is sent
+ * to every port) against the best case of the old HTTP sweep, every /ping
+ * fetched at once with no dead addresses to time out on.
+ *
+ * Build with `pio run -e discover` (binary in .pio/build/discover/program).
+ * The packet format is documented in wemosS2mini/lib/Discovery/Discovery.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Discovery.h>
+
+#define RETRY_MS 250
+#define BENCH_ROUND_TIMEOUT_MS 2000
+
+static uint64_t nowMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool sameAddress(const sockaddr_in& a, const sockaddr_in& b) {
+  return a.sin_addr.s_addr == b.sin_addr.s_addr && a.sin_port == b.sin_port;
+}
+
+static bool parseTarget(const char* text, sockaddr_in& addr) {
+  std::string host = text;
+  uint16_t port = DISCOVERY_PORT;
+  size_t colon = host.rfind(':');
+  if (colon != std::string::npos) {
+    port = atoi(host.c_str() + colon + 1);
+    host.resize(colon);
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) == 1) return true;
+
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  struct addrinfo* result = nullptr;
+  if (getaddrinfo(host.c_str(), nullptr, &hints, &result) != 0) return false;
+  addr.sin_addr = ((sockaddr_in*)result->ai_addr)->sin_addr;
+  freeaddrinfo(result);
+  return true;
+}
+
+static int openUdp(bool broadcast) {
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  int one = 1;
+  if (broadcast) setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+  return fd;
+}
+
+// =====================================================
+// DISCOVERY CLIENT
+// =====================================================
+
+struct Found {
+  sockaddr_in from;
+  DiscoveryInfo info;
+  double rttMs;
+};
+
+// Queries targets until expect robots answered or timeoutMs passed
+static std::vector<Found> discover(int fd, const std::vector<sockaddr_in>& targets, uint8_t flags,
+                                   size_t expect, uint32_t timeoutMs) {
+  uint16_t nonce = nowMicros() & 0xFFFF;
+  uint8_t query[DISCOVERY_QUERY_SIZE];
+  discoveryEncodeQuery(flags, nonce, query, sizeof(query));
+
+  std::vector<Found> found;
+  uint64_t start = nowMicros();
+  uint64_t deadline = start + timeoutMs * 1000ULL;
+  uint64_t nextSend = start;
+
+  while (found.size() < expect || expect == 0) {
+    uint64_t now = nowMicros();
+    if (now >= deadline) break;
+    if (now >= nextSend) {
+      for (const sockaddr_in& target : targets) {
+        sendto(fd, query, sizeof(query), 0, (const sockaddr*)&target, sizeof(target));
+      }
+      nextSend = now + RETRY_MS * 1000ULL;
+    }
+
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int waitMs = (int)((std::min(deadline, nextSend) - now + 999) / 1000);
+    if (::poll(&pfd, 1, waitMs) <= 0) continue;
+
+    uint8_t buffer[1500];
+    sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    ssize_t n = recvfrom(fd, buffer, sizeof(buffer), 0, (sockaddr*)&from, &fromLen);
+    if (n <= 0) continue;
+
+    Found entry;
+    uint16_t replyNonce;
+    if (!discoveryParseReply(buffer, n, entry.info, replyNonce) || replyNonce != nonce) continue;
+    bool duplicate = false;
+    for (const Found& other : found) duplicate |= sameAddress(other.from, from);
+    if (duplicate) continue;
+    entry.from = from;
+    entry.rttMs = (nowMicros() - start) / 1000.0;
+    found.push_back(entry);
+  }
+  return found;
+}
+
+static void printFound(const std::vector<Found>& found) {
+  printf("%-20s %-21s %-8s %-7s %-7s %s\n", "name", "address", "firmware", "mode", "clients", "ms");
+  for (const Found& entry : found) {
+    const uint8_t* ip = entry.info.stationIp[0] ? entry.info.stationIp : entry.info.apIp;
+    char address[32];
+    snprintf(address, sizeof(address), "%u.%u.%u.%u:%u", ip[0], ip[1], ip[2], ip[3], entry.info.httpPort);
+    char clients[16];
+    snprintf(clients, sizeof(clients), "%u/%u", entry.info.clients, entry.info.maxClients);
+    printf("%-20s %-21s %-8s %-7s %-7s %.1f\n", entry.info.name, address, entry.info.firmware,
+           entry.info.mode == 0 ? "live" : "offline", clients, entry.rttMs);
+  }
+}
+
+// =====================================================
+// BENCHMARK
+// =====================================================
+
+struct SimRobot {
+  int udpFd;
+  int httpFd;
+  uint16_t udpPort;
+  uint16_t httpPort;
+  DiscoveryInfo info;
+};
+
+static int bindLoopback(int type, uint16_t& port) {
+  int fd = socket(AF_INET, type | SOCK_CLOEXEC, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+      (type == SOCK_STREAM && listen(fd, 64) < 0) ||
+      getsockname(fd, (sockaddr*)&addr, &len) < 0) {
+    perror("bench: bind");
+    exit(1);
+  }
+  port = ntohs(addr.sin_port);
+  return fd;
+}
+
+// Answers both protocols for every robot until stop is set
+static void serveRobots(std::vector<SimRobot>& robots, std::atomic<bool>& stop) {
+  std::vector<pollfd> fds;
+  for (const SimRobot& robot : robots) {
+    fds.push_back({ robot.udpFd, POLLIN, 0 });
+    fds.push_back({ robot.httpFd, POLLIN, 0 });
+  }
+
+  while (!stop) {
+    if (::poll(fds.data(), fds.size(), 50) <= 0) continue;
+    for (size_t i = 0; i < fds.size(); i++) {
+      if (!(fds[i].revents & POLLIN)) continue;
+      SimRobot& robot = robots[i / 2];
+      uint8_t buffer[1500];
+
+      if (i % 2 == 0) {
+        sockaddr_in from;
+        socklen_t fromLen = sizeof(from);
+        ssize_t n = recvfrom(robot.udpFd, buffer, sizeof(buffer), 0, (sockaddr*)&from, &fromLen);
+        uint8_t flags;
+        uint16_t nonce;
+        if (n <= 0 || !discoveryParseQuery(buffer, n, flags, nonce)) continue;
+        if (!discoveryShouldAnswer(robot.info, flags)) continue;
+        uint8_t reply[DISCOVERY_REPLY_MAX];
+        size_t len = discoveryEncodeReply(robot.info, nonce, reply, sizeof(reply));
+        sendto(robot.udpFd, reply, len, 0, (sockaddr*)&from, fromLen);
+      } else {
+        int fd = accept(robot.httpFd, nullptr, nullptr);
+        if (fd < 0) continue;
+        std::string request;
+        while (request.find("\r\n\r\n") == std::string::npos) {
+          ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+          if (n <= 0) break;
+          request.append((const char*)buffer, n);
+        }
+        char body[160];
+        int bodyLen = snprintf(body, sizeof(body),
+                               "{\"device\":\"sirobo\",\"name\":\"%s\",\"version\":\"%s\","
+                               "\"mode\":\"live\",\"ip\":\"127.0.0.1\"}",
+                               robot.info.name, robot.info.firmware);
+        char response[320];
+        int len = snprintf(response, sizeof(response),
+                           "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                           "Content-Length: %d\r\nConnection: close\r\n\r\n%s", bodyLen, body);
+        send(fd, response, len, MSG_NOSIGNAL);
+        close(fd);
+      }
+    }
+  }
+}
+
+// Fetches /ping from every robot at once; returns how many answered
+static size_t httpSweep(const std::vector<SimRobot>& robots) {
+  std::vector<pollfd> fds;
+  std::vector<bool> sent(robots.size(), false);
+  for (const SimRobot& robot : robots) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(robot.httpPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    connect(fd, (sockaddr*)&addr, sizeof(addr));
+    fds.push_back({ fd, POLLOUT, 0 });
+  }
+
+  static const char request[] = "GET /ping HTTP/1.1\r\nHost: robot\r\nConnection: close\r\n\r\n";
+  size_t open = fds.size();
+  size_t answered = 0;
+  uint64_t deadline = nowMicros() + BENCH_ROUND_TIMEOUT_MS * 1000ULL;
+  while (open > 0 && nowMicros() < deadline) {
+    if (::poll(fds.data(), fds.size(), 100) <= 0) continue;
+    for (size_t i = 0; i < fds.size(); i++) {
+      pollfd& pfd = fds[i];
+      if (pfd.fd < 0 || !pfd.revents) continue;
+      if (!sent[i] && (pfd.revents & POLLOUT)) {
+        send(pfd.fd, request, sizeof(request) - 1, MSG_NOSIGNAL);
+        sent[i] = true;
+        pfd.events = POLLIN;
+        continue;
+      }
+      char buffer[512];
+      ssize_t n = recv(pfd.fd, buffer, sizeof(buffer), 0);
+      if (n > 0 && strncmp(buffer, "HTTP/1.1 200", 12) == 0) answered++;
+      if (n > 0 && n == (ssize_t)sizeof(buffer)) continue;
+      close(pfd.fd);
+      pfd.fd = -1;
+      open--;
+    }
+  }
+  for (pollfd& pfd : fds) {
+    if (pfd.fd >= 0) close(pfd.fd);
+  }
+  return answered;
+}
+
+static void printStats(const char* label, std::vector<double>& ms, size_t failures) {
+  std::sort(ms.begin(), ms.end());
+  if (ms.empty()) {
+    printf("%-5s no complete round\n", label);
+    return;
+  }
+  printf("%-5s min %.2f  median %.2f  max %.2f ms", label, ms.front(), ms[ms.size() / 2], ms.back());
+  if (failures) printf("  (%zu incomplete rounds)", failures);
+  printf("\n");
+}
+
+static int bench(size_t count, size_t rounds) {
+  std::vector<SimRobot> robots(count);
+  std::vector<sockaddr_in> targets;
+  for (size_t i = 0; i < count; i++) {
+    SimRobot& robot = robots[i];
+    robot.udpFd = bindLoopback(SOCK_DGRAM, robot.udpPort);
+    robot.httpFd = bindLoopback(SOCK_STREAM, robot.httpPort);
+    memset(&robot.info, 0, sizeof(robot.info));
+    snprintf(robot.info.name, sizeof(robot.info.name), "SiroboBench%03zu", i);
+    snprintf(robot.info.firmware, sizeof(robot.info.firmware), "bench");
+    robot.info.apIp[0] = 127;
+    robot.info.apIp[3] = 1;
+    robot.info.httpPort = robot.httpPort;
+    robot.info.maxClients = 8;
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(robot.udpPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    targets.push_back(addr);
+  }
+
+  std::atomic<bool> stop(false);
+  std::thread server(serveRobots, std::ref(robots), std::ref(stop));
+
+  int fd = openUdp(false);
+  std::vector<double> udpMs, httpMs;
+  size_t udpFailures = 0, httpFailures = 0;
+  for (size_t round = 0; round < rounds; round++) {
+    uint64_t start = nowMicros();
+    size_t found = discover(fd, targets, 0, count, BENCH_ROUND_TIMEOUT_MS).size();
+    if (found == count) udpMs.push_back((nowMicros() - start) / 1000.0);
+    else udpFailures++;
+
+    start = nowMicros();
+    found = httpSweep(robots);
+    if (found == count) httpMs.push_back((nowMicros() - start) / 1000.0);
+    else httpFailures++;
+  }
+
+  stop = true;
+  server.join();
+  close(fd);
+  for (SimRobot& robot : robots) {
+    close(robot.udpFd);
+    close(robot.httpFd);
+  }
+
+  printf("%zu robots, %zu rounds, time to find all:\n", count, rounds);
+  printStats("udp", udpMs, udpFailures);
+  printStats("http", httpMs, httpFailures);
+  return udpFailures ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+  std::vector<sockaddr_in> targets;
+  uint32_t timeoutMs = 1000;
+  size_t expect = 1;
+  bool expectGiven = false;
+  uint8_t flags = 0;
+  size_t benchRobots = 0;
+  size_t rounds = 20;
+  bool usage = false;
+
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "--to") == 0 && hasValue) {
+      sockaddr_in addr;
+      if (!parseTarget(argv[++i], addr)) {
+        fprintf(stderr, "cannot resolve %s\n", argv[i]);
+        return 2;
+      }
+      targets.push_back(addr);
+    } else if (strcmp(argv[i], "--timeout") == 0 && hasValue) {
+      timeoutMs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--expect") == 0 && hasValue) {
+      expect = atoi(argv[++i]);
+      expectGiven = true;
+    } else if (strcmp(argv[i], "--free") == 0) {
+      flags |= DISCOVERY_FLAG_FREE_ONLY;
+    } else if (strcmp(argv[i], "--bench") == 0 && hasValue) {
+      benchRobots = atoi(argv[++i]);
+      if (benchRobots == 0) usage = true;
+    } else if (strcmp(argv[i], "--rounds") == 0 && hasValue) {
+      rounds = atoi(argv[++i]);
+    } else {
+      usage = true;
+    }
+  }
+  if (usage) {
+    fprintf(stderr, "usage: %s [--to host[:port]]... [--timeout ms] [--expect n] [--free]\n"
+                    "       %s --bench <robots> [--rounds n]\n", argv[0], argv[0]);
+    return 2;
+  }
+
+  if (benchRobots) return bench(benchRobots, rounds);
+
+  if (targets.empty()) {
+    sockaddr_in addr;
+    parseTarget("255.255.255.255", addr);
+    targets.push_back(addr);
+  }
+
+  int fd = openUdp(true);
+  if (fd < 0) {
+    perror("socket");
+    return 1;
+  }
+  // Without --expect, listen for the whole timeout: there may be more robots
+  std::vector<Found> found = discover(fd, targets, flags, expectGiven ? expect : 0, timeoutMs);
+  close(fd);
+
+  printFound(found);
+  printf("%zu robot%s\n", found.size(), found.size() == 1 ? "" : "s");
+  return found.size() >= expect ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+/*
+ * flightlog - convert a Sirobo flight recorder log to CSV
+ *
+ * Usage:
+ *   curl -o run.srfl http://192.168.4.1/log
+ *   flightlog run.srfl [run.csv]
+ *
+ * Writes CSV to stdout when no output file is given. Build with
+ * `pio run -e flightlog` (binary in .pio/build/flightlog/program).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <FlightRecorder.h>
+
+static const char* triggerName(uint8_t source) {
+  switch (source) {
+    case FLIGHT_TRIGGER_COMMAND: return "command";
+    case FLIGHT_TRIGGER_LINE_LOST: return "line_lost";
+    case FLIGHT_TRIGGER_OBSTACLE: return "obstacle";
+    case FLIGHT_TRIGGER_LINE_FOLLOWER: return "line_follower";
+    default: return "none";
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <log.srfl> [out.csv]\n", argv[0]);
+    return 2;
+  }
+
+  FILE* in = fopen(argv[1], "rb");
+  if (!in) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  FlightLogHeader header;
+  if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != FLIGHT_LOG_MAGIC) {
+    fprintf(stderr, "%s: not a Sirobo flight log\n", argv[1]);
+    fclose(in);
+    return 1;
+  }
+  if (header.version != FLIGHT_LOG_VERSION || header.recordSize != sizeof(FlightRecord)) {
+    fprintf(stderr, "%s: unsupported log version %u (record size %u)\n",
+            argv[1], header.version, header.recordSize);
+    fclose(in);
+    return 1;
+  }
+
+  FILE* out = stdout;
+  if (argc > 2) {
+    out = fopen(argv[2], "w");
+    if (!out) {
+      perror(argv[2]);
+      fclose(in);
+      return 1;
+    }
+  }
+
+  fprintf(out, "t_ms,line0,line1,line2,line3,line4,line5,line6,line7,"
+               "ldr_left,ldr_right,yaw_deg,gyro_z_dps,motor_left,motor_right,"
+               "error,distance_cm,line_follower,line_lost,trigger\n");
+
+  FlightRecord record;
+  uint32_t decoded = 0;
+  uint32_t startUs = 0;
+  while (decoded < header.recordCount && fread(&record, sizeof(record), 1, in) == 1) {
+    if (decoded == 0) startUs = record.timeUs;
+
+    // Unsigned subtraction handles micros() wrapping during a capture
+    fprintf(out, "%.3f", (uint32_t)(record.timeUs - startUs) / 1000.0);
+    for (int i = 0; i < 8; i++) {
+      fprintf(out, ",%u", record.line[i]);
+    }
+    fprintf(out, ",%u,%u,%.2f,%.2f,%d,%d,%d,%u,%d,%d,%d\n",
+            record.ldr[0], record.ldr[1],
+            record.yaw / 100.0, record.gyroZ / 100.0,
+            record.motorLeft, record.motorRight, record.error, record.distance,
+            (record.flags & FLIGHT_FLAG_LINE_FOLLOWER) ? 1 : 0,
+            (record.flags & FLIGHT_FLAG_LINE_LOST) ? 1 : 0,
+            (record.flags & FLIGHT_FLAG_TRIGGER) ? 1 : 0);
+    decoded++;
+  }
+
+  fclose(in);
+  if (out != stdout) fclose(out);
+
+  fprintf(stderr, "%u/%u records, period %u us, trigger %s",
+          decoded, header.recordCount, header.periodUs, triggerName(header.triggerSource));
+  if (header.triggerIndex != FLIGHT_LOG_NO_TRIGGER) {
+    fprintf(stderr, " at record %u", header.triggerIndex);
+  }
+  fprintf(stderr, "\n");
+
+  return decoded == header.recordCount ? 0 : 1;
+}
@@ -0,0 +1,402 @@
+/*
+ * groupshow - start a synchronized show on a group of robots
+ *
+ * Usage:
+ *   groupshow <group> <show file> [--sync ms] [--start-in ms] [--repeat n] [--interface ip]
+ *   groupshow --skew-test <robots> --sim <program> [--rounds n]
+ *
+ * Robots join a group with the WebSocket command
+ * { type: "group", join: "<group>" }. groupshow beacons to the group for
+ * --sync ms (default 2000) so every member can measure its clock offset,
+ * then multicasts the show (--repeat times, default 3, against packet
+ * loss) to start --start-in ms later (default 500). While the show runs it
+ * collects the members' step reports and prints, per step, how many robots
+ * ran it and the spread of their report arrival times: the start skew as
+ * seen from the controller, network jitter included.
+ *
+ * Show file: one step per line, "<offset ms> <command JSON>", '#' starts a
+ * comment. Only commands that do not block or reply are accepted by the
+ * robots (see groupCommandAllowed() in main.cpp), e.g.
+ *   0    {"type":"led_all","r":255,"g":0,"b":0}
+ *   500  {"type":"forward","speed":60}
+ *   1500 {"type":"stop"}
+ *
+ * --skew-test starts <robots> native simulators (--sim, the program built
+ * by `pio run -e native`) a little apart so their clocks differ, joins them
+ * to a test group, runs a built-in show --rounds times (default 5) over
+ * loopback multicast and reports the worst skew per round. Exits 1 if a
+ * robot missed a step.
+ *
+ * Build with `pio run -e groupshow` (binary in .pio/build/groupshow/program).
+ * The packet format is documented in wemosS2mini/lib/GroupSync/GroupSync.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <GroupSync.h>
+
+#define BEACON_INTERVAL_MS 250
+#define REPEAT_INTERVAL_MS 20
+#define REPORT_GRACE_MS 500     // Wait for reports after the last step
+#define SKEW_TEST_GROUP "skewtest"
+#define SKEW_TEST_BOOT_MS 1500
+
+static uint64_t nowMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+struct ShowStep {
+  uint32_t offsetMs;
+  std::string command;
+};
+
+struct StepResult {
+  std::vector<uint64_t> arrivals;   // Controller clock
+  uint32_t maxLateUs = 0;           // Worst lateness a robot reported
+};
+
+struct Controller {
+  int fd = -1;
+  sockaddr_in group;
+  std::string name;
+  std::map<uint64_t, uint64_t> members;   // Address:port -> last time request
+  uint16_t showId = 0;
+  std::vector<StepResult> results;
+};
+
+static uint64_t addressKey(const sockaddr_in& addr) {
+  return (uint64_t)addr.sin_addr.s_addr << 16 | addr.sin_port;
+}
+
+static bool openController(Controller& ctl, const char* interfaceIp) {
+  ctl.fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (ctl.fd < 0) return false;
+
+  struct in_addr interface;
+  interface.s_addr = htonl(INADDR_ANY);
+  if (interfaceIp && inet_pton(AF_INET, interfaceIp, &interface) != 1) return false;
+  if (interface.s_addr != htonl(INADDR_ANY)) {
+    setsockopt(ctl.fd, IPPROTO_IP, IP_MULTICAST_IF, &interface, sizeof(interface));
+  }
+  uint8_t ttl = 1, loop = 1;
+  setsockopt(ctl.fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+  setsockopt(ctl.fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+
+  const uint8_t groupIp[4] = GROUP_MULTICAST_IP;
+  memset(&ctl.group, 0, sizeof(ctl.group));
+  ctl.group.sin_family = AF_INET;
+  ctl.group.sin_port = htons(GROUP_PORT);
+  memcpy(&ctl.group.sin_addr.s_addr, groupIp, 4);
+  return true;
+}
+
+static void sendBeacon(Controller& ctl) {
+  uint8_t packet[64];
+  GroupWriter writer(packet, sizeof(packet));
+  writer.begin(GROUP_BEACON, ctl.name.c_str());
+  writer.u64(nowMicros());
+  sendto(ctl.fd, packet, writer.length(), 0, (sockaddr*)&ctl.group, sizeof(ctl.group));
+}
+
+static void handlePacket(Controller& ctl, const uint8_t* data, size_t len, uint64_t receivedUs,
+                         const sockaddr_in& from) {
+  GroupReader reader(data, len);
+  GroupPacketType type;
+  char name[GROUP_NAME_MAX + 1];
+  if (!reader.begin(type, name) || ctl.name != name) return;
+
+  if (type == GROUP_TIME_REQUEST) {
+    uint64_t t1 = reader.u64();
+    if (!reader.ok()) return;
+    ctl.members[addressKey(from)] = receivedUs;
+
+    uint8_t packet[64];
+    GroupWriter writer(packet, sizeof(packet));
+    writer.begin(GROUP_TIME_REPLY, ctl.name.c_str());
+    writer.u64(t1);
+    writer.u64(receivedUs);
+    writer.u64(nowMicros());
+    sendto(ctl.fd, packet, writer.length(), 0, (const sockaddr*)&from, sizeof(from));
+  } else if (type == GROUP_REPORT) {
+    uint16_t id = reader.u16();
+    uint8_t step = reader.u8();
+    uint32_t lateUs = reader.u32();
+    if (!reader.ok() || id != ctl.showId || step >= ctl.results.size()) return;
+    StepResult& result = ctl.results[step];
+    result.arrivals.push_back(receivedUs);
+    result.maxLateUs = std::max(result.maxLateUs, lateUs);
+  }
+}
+
+// Beacons and answers the group until untilUs; sends packet at each of sendAt
+static void serve(Controller& ctl, uint64_t untilUs, uint64_t& nextBeacon,
+                  const std::vector<uint8_t>* packet = nullptr, std::vector<uint64_t> sendAt = {}) {
+  while (true) {
+    uint64_t now = nowMicros();
+    if (now >= untilUs) break;
+    if (now >= nextBeacon) {
+      sendBeacon(ctl);
+      nextBeacon = now + BEACON_INTERVAL_MS * 1000ULL;
+    }
+    if (packet && !sendAt.empty() && now >= sendAt.front()) {
+      sendto(ctl.fd, packet->data(), packet->size(), 0, (sockaddr*)&ctl.group, sizeof(ctl.group));
+      sendAt.erase(sendAt.begin());
+    }
+
+    uint64_t wake = std::min(untilUs, nextBeacon);
+    if (packet && !sendAt.empty()) wake = std::min(wake, sendAt.front());
+    struct pollfd pfd = { ctl.fd, POLLIN, 0 };
+    if (::poll(&pfd, 1, (int)((wake - now + 999) / 1000)) <= 0) continue;
+
+    uint8_t buffer[GROUP_PACKET_MAX];
+    sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    ssize_t n = recvfrom(ctl.fd, buffer, sizeof(buffer), 0, (sockaddr*)&from, &fromLen);
+    if (n > 0) handlePacket(ctl, buffer, n, nowMicros(), from);
+  }
+}
+
+static bool loadShow(const char* path, std::vector<ShowStep>& steps) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  char line[GROUP_PACKET_MAX];
+  int lineNumber = 0;
+  while (fgets(line, sizeof(line), file)) {
+    lineNumber++;
+    line[strcspn(line, "\r\n")] = '\0';
+    char* p = line + strspn(line, " \t");
+    if (!*p || *p == '#') continue;
+
+    char* end;
+    unsigned long offset = strtoul(p, &end, 10);
+    char* command = end + strspn(end, " \t");
+    if (end == p || *command != '{' || (!steps.empty() && offset < steps.back().offsetMs)) {
+      fprintf(stderr, "%s:%d: expected \"<offset ms> <command JSON>\" in offset order\n", path, lineNumber);
+      fclose(file);
+      return false;
+    }
+    steps.push_back({ (uint32_t)offset, command });
+  }
+  fclose(file);
+  if (steps.empty() || steps.size() > GROUP_SHOW_MAX_STEPS) {
+    fprintf(stderr, "%s: a show has 1 to %d steps\n", path, GROUP_SHOW_MAX_STEPS);
+    return false;
+  }
+  return true;
+}
+
+// Runs one show; returns the worst skew in us, or -1 if a member missed a step
+static long long runShow(Controller& ctl, const std::vector<ShowStep>& steps, uint32_t syncMs,
+                         uint32_t startInMs, int repeat, bool verbose) {
+  uint64_t nextBeacon = 0;
+  serve(ctl, nowMicros() + syncMs * 1000ULL, nextBeacon);
+
+  // Members that asked for the time during the last second are expected
+  uint64_t now = nowMicros();
+  size_t expected = 0;
+  for (const auto& member : ctl.members) {
+    if (now - member.second < 1000000) expected++;
+  }
+
+  GroupShow show;
+  show.id = (uint16_t)(now ^ (now >> 16));
+  if (show.id == ctl.showId) show.id++;
+  show.startUs = now + startInMs * 1000ULL;
+  show.stepCount = steps.size();
+  for (size_t i = 0; i < steps.size(); i++) {
+    show.steps[i] = { steps[i].offsetMs, steps[i].command.data(), (uint16_t)steps[i].command.size() };
+  }
+  std::vector<uint8_t> packet(GROUP_PACKET_MAX);
+  size_t len = groupEncodeShow(ctl.name.c_str(), show, packet.data(), packet.size());
+  if (!len) {
+    fprintf(stderr, "show does not fit in one %d-byte packet\n", GROUP_PACKET_MAX);
+    return -1;
+  }
+  packet.resize(len);
+
+  ctl.showId = show.id;
+  ctl.results.assign(steps.size(), StepResult());
+  std::vector<uint64_t> sendAt;
+  for (int i = 0; i < repeat; i++) sendAt.push_back(now + i * REPEAT_INTERVAL_MS * 1000ULL);
+  uint64_t end = show.startUs + (steps.back().offsetMs + REPORT_GRACE_MS) * 1000ULL;
+  serve(ctl, end, nextBeacon, &packet, sendAt);
+
+  long long worstSkew = 0;
+  bool complete = expected > 0;
+  if (verbose) printf("show %u: %zu members synced\n%-5s %-8s %-7s %-10s %s\n", show.id, expected,
+                      "step", "at ms", "robots", "skew ms", "late ms");
+  for (size_t i = 0; i < steps.size(); i++) {
+    const StepResult& result = ctl.results[i];
+    long long skew = 0;
+    if (!result.arrivals.empty()) {
+      auto range = std::minmax_element(result.arrivals.begin(), result.arrivals.end());
+      skew = (long long)(*range.second - *range.first);
+    }
+    worstSkew = std::max(worstSkew, skew);
+    if (result.arrivals.size() < expected) complete = false;
+    if (verbose) printf("%-5zu %-8u %zu/%-5zu %-10.2f %.2f\n", i, steps[i].offsetMs, result.arrivals.size(),
+                        expected, skew / 1000.0, result.maxLateUs / 1000.0);
+  }
+  return complete ? worstSkew : -1;
+}
+
+// =====================================================
+// SKEW TEST
+// =====================================================
+
+static int skewTest(size_t robots, const char* program, int rounds) {
+  char script[] = "/tmp/groupshow-XXXXXX";
+  int scriptFd = mkstemp(script);
+  if (scriptFd < 0) {
+    perror("mkstemp");
+    return 1;
+  }
+  // After setup(): script events at 0 run before the WebSocket handler exists
+  dprintf(scriptFd, "100 ws {\"type\":\"group\",\"join\":\"%s\"}\n", SKEW_TEST_GROUP);
+  close(scriptFd);
+
+  // Ports of their own for HTTP and discovery; the group port is shared
+  uint16_t basePort = 20000 + (getpid() % 2000) * 10;
+  std::vector<pid_t> children;
+  for (size_t i = 0; i < robots; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      int null = open("/dev/null", O_WRONLY);
+      dup2(null, STDOUT_FILENO);
+      dup2(null, STDERR_FILENO);
+      std::string httpPort = std::to_string(basePort + i * 2);
+      std::string udpPort = std::to_string(basePort + i * 2 + 1);
+      execl(program, program, "--port", httpPort.c_str(), "--udp-port", udpPort.c_str(),
+            "--flash", "/dev/null", "--storage", "/dev/null", "--script", script, (char*)nullptr);
+      _exit(127);
+    }
+    children.push_back(pid);
+    // Staggered starts: each simulator's clock counts from its own start
+    usleep(50000 + rand() % 100000);
+  }
+  usleep(SKEW_TEST_BOOT_MS * 1000);
+
+  Controller ctl;
+  ctl.name = SKEW_TEST_GROUP;
+  if (!openController(ctl, "127.0.0.1")) {
+    perror("socket");
+    return 1;
+  }
+  std::vector<ShowStep> steps;
+  const char* colors[] = { "\"r\":255,\"g\":0,\"b\":0", "\"r\":0,\"g\":255,\"b\":0", "\"r\":0,\"g\":0,\"b\":255" };
+  for (int i = 0; i < 6; i++) {
+    steps.push_back({ (uint32_t)i * 100, std::string("{\"type\":\"led_all\",") + colors[i % 3] + "}" });
+  }
+  steps.push_back({ 600, "{\"type\":\"stop\"}" });
+
+  std::vector<double> skews;
+  int failures = 0;
+  for (int round = 0; round < rounds; round++) {
+    long long skew = runShow(ctl, steps, round == 0 ? 2000 : 500, 300, 3, false);
+    if (skew < 0) {
+      printf("round %d: a robot missed a step\n", round);
+      failures++;
+    } else {
+      printf("round %d: skew %.2f ms\n", round, skew / 1000.0);
+      skews.push_back(skew / 1000.0);
+    }
+  }
+  size_t members = ctl.members.size();
+  close(ctl.fd);
+
+  for (pid_t pid : children) kill(pid, SIGTERM);
+  for (pid_t pid : children) waitpid(pid, nullptr, 0);
+  unlink(script);
+
+  printf("%zu robots (%zu synced), %d rounds", robots, members, rounds);
+  if (!skews.empty()) {
+    std::sort(skews.begin(), skews.end());
+    printf(", skew median %.2f ms, max %.2f ms", skews[skews.size() / 2], skews.back());
+  }
+  printf("\n");
+  return failures || members < robots ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+  const char* groupName = nullptr;
+  const char* showPath = nullptr;
+  const char* interfaceIp = nullptr;
+  const char* simProgram = nullptr;
+  uint32_t syncMs = 2000;
+  uint32_t startInMs = 500;
+  int repeat = 3;
+  size_t skewRobots = 0;
+  int rounds = 5;
+  bool usage = false;
+
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "--sync") == 0 && hasValue) {
+      syncMs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--start-in") == 0 && hasValue) {
+      startInMs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--repeat") == 0 && hasValue) {
+      repeat = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--interface") == 0 && hasValue) {
+      interfaceIp = argv[++i];
+    } else if (strcmp(argv[i], "--skew-test") == 0 && hasValue) {
+      skewRobots = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--sim") == 0 && hasValue) {
+      simProgram = argv[++i];
+    } else if (strcmp(argv[i], "--rounds") == 0 && hasValue) {
+      rounds = atoi(argv[++i]);
+    } else if (!groupName && argv[i][0] != '-') {
+      groupName = argv[i];
+    } else if (!showPath && argv[i][0] != '-') {
+      showPath = argv[i];
+    } else {
+      usage = true;
+    }
+  }
+
+  if (skewRobots && simProgram && !groupName) return skewTest(skewRobots, simProgram, rounds);
+  if (usage || !groupName || !showPath || strlen(groupName) > GROUP_NAME_MAX) {
+    fprintf(stderr, "usage: %s <group> <show file> [--sync ms] [--start-in ms] [--repeat n] [--interface ip]\n"
+                    "       %s --skew-test <robots> --sim <program> [--rounds n]\n", argv[0], argv[0]);
+    return 2;
+  }
+
+  std::vector<ShowStep> steps;
+  if (!loadShow(showPath, steps)) return 1;
+
+  Controller ctl;
+  ctl.name = groupName;
+  if (!openController(ctl, interfaceIp)) {
+    fprintf(stderr, "cannot open the multicast socket\n");
+    return 1;
+  }
+  long long skew = runShow(ctl, steps, syncMs, startInMs, repeat, true);
+  close(ctl.fd);
+  if (skew < 0) {
+    printf("not every synced robot reported every step\n");
+    return 1;
+  }
+  printf("worst skew %.2f ms\n", skew / 1000.0);
+  return 0;
+}
@@ -0,0 +1,522 @@
+/*
+ * latency - WebSocket round-trip and clock-offset load generator
+ *
+ * Usage:
+ *   latency <host[:port]> [--clients n] [--rate hz] [--duration ms]
+ *           [--move] [--max-p99 ms]
+ *   latency --usb <device> [--rate hz] [--duration ms] [--move] [--max-p99 ms]
+ *
+ * Opens --clients WebSocket connections (default 1) to ws://host/ws and
+ * sends "echo" requests on each at --rate per second (default 20) for
+ * --duration ms (default 5000). Every request acks the previous reply, so
+ * the robot builds its own per-client clock offset and round-trip
+ * histogram while this side measures:
+ *
+ *   rtt      t4 - t1, request sent to reply received
+ *   robot    t3 - t2, frame receipt to reply on the robot
+ *   offset   client minus robot clock, from the fastest exchange
+ *
+ * --move sends a joystick "move" before each echo, like the app's live
+ * control, so the robot also records frame-to-wheel latency. At the end
+ * the percentiles are printed for all clients together, followed by the
+ * robot's "latency" section of /metrics.
+ *
+ * --usb sends the same requests over the robot's USB serial port instead
+ * (/dev/ttyACM0, or the simulator's --usb pty), framed as in
+ * lib/SerialLink, as the one client; --move then uses the binary drive
+ * message. The /metrics section is not printed.
+ *
+ * Exits 1 if a client could not connect, no echo came back, or the RTT
+ * p99 is above --max-p99.
+ *
+ * Build with `pio run -e latency` (binary in .pio/build/latency/program).
+ * The echo protocol is documented in firmware/README.md.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <SerialLink.h>
+
+#define REPLY_TIMEOUT_MS 1000
+#define FRAME_MAX 4096
+
+static uint64_t nowMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static std::string host;
+static uint16_t port = 80;
+static const char* usbDevice = nullptr;
+
+static int connectTcp() {
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* result = nullptr;
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+  if (getaddrinfo(host.c_str(), service, &hints, &result) != 0) return -1;
+
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd >= 0 && connect(fd, result->ai_addr, result->ai_addrlen) != 0) {
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(result);
+  if (fd >= 0) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
+static bool sendAll(int fd, const void* data, size_t len) {
+  const uint8_t* p = (const uint8_t*)data;
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool waitReadable(int fd, int timeoutMs) {
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  return ::poll(&pfd, 1, timeoutMs) > 0;
+}
+
+// A connection to the robot that carries JSON text both ways
+class Link {
+public:
+  virtual ~Link() {}
+  virtual bool open() = 0;
+  virtual bool sendText(const char* text, size_t len) = 0;
+  // Joystick position, as the app's live control sends it
+  virtual bool sendMove(int x, int y) = 0;
+  // Next text message, false on timeout or close
+  virtual bool readText(std::string& text, int timeoutMs) = 0;
+};
+
+// =====================================================
+// WEBSOCKET CLIENT
+// =====================================================
+
+class WsClient : public Link {
+public:
+  ~WsClient() { if (_fd >= 0) close(_fd); }
+
+  bool open() override {
+    _fd = connectTcp();
+    if (_fd < 0) return false;
+
+    // The key is not checked by this client, so any base64 will do
+    char request[256];
+    int n = snprintf(request, sizeof(request),
+      "GET /ws HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+      "Sec-WebSocket-Key: c2lyb2JvLWxhdGVuY3kxMg==\r\nSec-WebSocket-Version: 13\r\n\r\n",
+      host.c_str());
+    if (!sendAll(_fd, request, n)) return false;
+
+    std::string headers;
+    char c;
+    while (headers.find("\r\n\r\n") == std::string::npos) {
+      if (!waitReadable(_fd, REPLY_TIMEOUT_MS) || recv(_fd, &c, 1, 0) != 1) return false;
+      headers += c;
+    }
+    return headers.compare(0, 12, "HTTP/1.1 101") == 0;
+  }
+
+  // One masked text frame (clients must mask)
+  bool sendText(const char* text, size_t len) override {
+    uint8_t frame[FRAME_MAX + 8];
+    if (len > FRAME_MAX) return false;
+    size_t pos = 0;
+    frame[pos++] = 0x81;
+    if (len < 126) {
+      frame[pos++] = 0x80 | len;
+    } else {
+      frame[pos++] = 0x80 | 126;
+      frame[pos++] = len >> 8;
+      frame[pos++] = len;
+    }
+    uint8_t mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    memcpy(frame + pos, mask, 4);
+    pos += 4;
+    for (size_t i = 0; i < len; i++) frame[pos++] = text[i] ^ mask[i % 4];
+    return sendAll(_fd, frame, pos);
+  }
+
+  bool sendMove(int x, int y) override {
+    char message[64];
+    int len = snprintf(message, sizeof(message), "{\"type\":\"move\",\"x\":%d,\"y\":%d}", x, y);
+    return sendText(message, len);
+  }
+
+  // Next text frame into text (NUL-terminated), false on timeout or close
+  bool readText(std::string& text, int timeoutMs) override {
+    uint64_t deadline = nowMicros() + timeoutMs * 1000ULL;
+    while (true) {
+      if (frameReady(text)) return true;
+      int waitMs = (int)((deadline > nowMicros() ? deadline - nowMicros() : 0) / 1000);
+      if (waitMs <= 0 || !waitReadable(_fd, waitMs)) return false;
+      char buffer[4096];
+      ssize_t n = recv(_fd, buffer, sizeof(buffer), 0);
+      if (n <= 0) return false;
+      _buffer.append(buffer, n);
+    }
+  }
+
+private:
+  // Takes one complete frame off the buffer; non-text frames are skipped
+  bool frameReady(std::string& text) {
+    while (_buffer.size() >= 2) {
+      const uint8_t* p = (const uint8_t*)_buffer.data();
+      uint8_t opcode = p[0] & 0x0F;
+      uint64_t len = p[1] & 0x7F;
+      size_t header = 2;
+      if (len == 126) {
+        if (_buffer.size() < 4) return false;
+        len = (uint64_t)p[2] << 8 | p[3];
+        header = 4;
+      } else if (len == 127) {
+        if (_buffer.size() < 10) return false;
+        len = 0;
+        for (int i = 0; i < 8; i++) len = len << 8 | p[2 + i];
+        header = 10;
+      }
+      if (_buffer.size() < header + len) return false;
+
+      bool isText = opcode == 0x1;
+      if (isText) text.assign(_buffer, header, len);
+      _buffer.erase(0, header + len);
+      if (isText) return true;
+    }
+    return false;
+  }
+
+  int _fd = -1;
+  std::string _buffer;
+};
+
+// =====================================================
+// USB SERIAL CLIENT
+// =====================================================
+
+class UsbClient : public Link {
+public:
+  ~UsbClient() { if (_fd >= 0) close(_fd); }
+
+  // Raw bytes; opening the port sets DTR, which the robot waits for
+  bool open() override {
+    _fd = ::open(usbDevice, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (_fd < 0) return false;
+    struct termios tio;
+    if (tcgetattr(_fd, &tio) == 0) {
+      cfmakeraw(&tio);
+      tcsetattr(_fd, TCSANOW, &tio);
+    }
+    tcflush(_fd, TCIFLUSH);
+    return true;
+  }
+
+  bool sendText(const char* text, size_t len) override {
+    return sendFrame(LINK_TEXT, (const uint8_t*)text, len);
+  }
+
+  // The binary drive message: 'D', i8 x, i8 y
+  bool sendMove(int x, int y) override {
+    uint8_t message[3] = { 'D', (uint8_t)(int8_t)x, (uint8_t)(int8_t)y };
+    return sendFrame(LINK_BINARY, message, sizeof(message));
+  }
+
+  // Binary frames (display mirror) are skipped
+  bool readText(std::string& text, int timeoutMs) override {
+    uint64_t deadline = nowMicros() + timeoutMs * 1000ULL;
+    while (true) {
+      while (_pending < _buffer.size()) {
+        if (_reader.push(_buffer[_pending++]) && _reader.kind() == LINK_TEXT) {
+          text.assign((const char*)_reader.payload(), _reader.length());
+          return true;
+        }
+      }
+      int waitMs = (int)((deadline > nowMicros() ? deadline - nowMicros() : 0) / 1000);
+      if (waitMs <= 0 || !waitReadable(_fd, waitMs)) return false;
+      uint8_t buffer[4096];
+      ssize_t n = read(_fd, buffer, sizeof(buffer));
+      if (n <= 0) return false;
+      _buffer.assign(buffer, buffer + n);
+      _pending = 0;
+    }
+  }
+
+private:
+  bool sendFrame(uint8_t kind, const uint8_t* payload, size_t len) {
+    if (len > LINK_PAYLOAD_MAX) return false;
+    uint8_t frame[LINK_HEADER + LINK_PAYLOAD_MAX];
+    linkHeader(kind, payload, len, frame);
+    memcpy(frame + LINK_HEADER, payload, len);
+    const uint8_t* p = frame;
+    size_t left = LINK_HEADER + len;
+    while (left > 0) {
+      ssize_t n = write(_fd, p, left);
+      if (n <= 0) return false;
+      p += n;
+      left -= n;
+    }
+    return true;
+  }
+
+  int _fd = -1;
+  LinkReader _reader;
+  std::vector<uint8_t> _buffer;
+  size_t _pending = 0;
+};
+
+// Unsigned number after "key": in a flat JSON reply, 0 if missing
+static uint64_t jsonNumber(const std::string& json, const char* key) {
+  std::string needle = std::string("\"") + key + "\":";
+  size_t at = json.find(needle);
+  if (at == std::string::npos) return 0;
+  return strtoull(json.c_str() + at + needle.size(), nullptr, 10);
+}
+
+// =====================================================
+// LOAD
+// =====================================================
+
+struct ClientResult {
+  bool connected = false;
+  uint32_t sent = 0;
+  uint32_t lost = 0;
+  std::vector<uint32_t> rttUs;
+  std::vector<uint32_t> robotUs;
+  int64_t offsetUs = 0;          // Client minus robot, fastest exchange
+  uint32_t bestRttUs = UINT32_MAX;
+};
+
+static void runClient(int index, double rate, uint32_t durationMs, bool move, ClientResult& result) {
+  WsClient ws;
+  UsbClient usb;
+  Link& link = usbDevice ? (Link&)usb : (Link&)ws;
+  if (!link.open()) return;
+  result.connected = true;
+
+  uint64_t period = (uint64_t)(1e6 / rate);
+  uint64_t start = nowMicros();
+  uint64_t next = start;
+  uint32_t ackSeq = 0;
+  uint64_t ackT4 = 0;
+  std::string reply;
+
+  for (uint32_t seq = 1; nowMicros() - start < durationMs * 1000ULL; seq++) {
+    uint64_t now = nowMicros();
+    if (next > now) usleep(next - now);
+    next += period;
+
+    char message[256];
+    int len;
+    if (move) {
+      // A slow circle, different per client
+      link.sendMove(40 * ((seq + index * 7) % 20 < 10 ? 1 : -1), 60);
+    }
+
+    uint64_t t1 = nowMicros();
+    if (ackSeq) {
+      len = snprintf(message, sizeof(message),
+        "{\"type\":\"echo\",\"seq\":%u,\"t1\":%llu,\"ack\":{\"seq\":%u,\"t4\":%llu}}",
+        seq, (unsigned long long)t1, ackSeq, (unsigned long long)ackT4);
+    } else {
+      len = snprintf(message, sizeof(message), "{\"type\":\"echo\",\"seq\":%u,\"t1\":%llu}",
+        seq, (unsigned long long)t1);
+    }
+    if (!link.sendText(message, len)) break;
+    result.sent++;
+
+    // Telemetry is broadcast on the same socket; wait for our reply
+    bool answered = false;
+    uint64_t deadline = t1 + REPLY_TIMEOUT_MS * 1000ULL;
+    while (!answered && nowMicros() < deadline) {
+      if (!link.readText(reply, (int)((deadline - nowMicros()) / 1000) + 1)) break;
+      if (reply.find("\"type\":\"echo\"") == std::string::npos) continue;
+      if (jsonNumber(reply, "seq") != seq) continue;
+      answered = true;
+    }
+    if (!answered) {
+      result.lost++;
+      ackSeq = 0;
+      continue;
+    }
+
+    uint64_t t4 = nowMicros();
+    uint64_t t2 = jsonNumber(reply, "t2");
+    uint64_t t3 = jsonNumber(reply, "t3");
+    uint32_t robotUs = t3 >= t2 ? (uint32_t)(t3 - t2) : 0;
+    uint32_t rttUs = (uint32_t)(t4 - t1);
+    result.rttUs.push_back(rttUs);
+    result.robotUs.push_back(robotUs);
+
+    uint32_t wire = rttUs - std::min(rttUs, robotUs);
+    if (wire < result.bestRttUs) {
+      result.bestRttUs = wire;
+      result.offsetUs = ((int64_t)(t1 - t2) + (int64_t)(t4 - t3)) / 2;
+    }
+    ackSeq = seq;
+    ackT4 = t4;
+  }
+}
+
+static uint32_t percentile(std::vector<uint32_t>& sorted, double p) {
+  if (sorted.empty()) return 0;
+  size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+  return sorted[index];
+}
+
+static void printStats(const char* name, std::vector<uint32_t>& values) {
+  std::sort(values.begin(), values.end());
+  uint64_t sum = 0;
+  for (uint32_t v : values) sum += v;
+  printf("%-6s n=%zu  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f  avg %.2f ms\n", name, values.size(),
+         percentile(values, 0.5) / 1000.0, percentile(values, 0.9) / 1000.0,
+         percentile(values, 0.99) / 1000.0, values.empty() ? 0.0 : values.back() / 1000.0,
+         values.empty() ? 0.0 : sum / 1000.0 / values.size());
+}
+
+// The robot's own view: GET /metrics and print its "latency" object
+static void printRobotLatency() {
+  int fd = connectTcp();
+  if (fd < 0) return;
+  char request[128];
+  int n = snprintf(request, sizeof(request), "GET /metrics HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n", host.c_str());
+  std::string response;
+  if (sendAll(fd, request, n)) {
+    char buffer[4096];
+    ssize_t got;
+    while ((got = recv(fd, buffer, sizeof(buffer), 0)) > 0) response.append(buffer, got);
+  }
+  close(fd);
+
+  size_t at = response.find("\"latency\":");
+  if (at == std::string::npos) return;
+  int depth = 0;
+  size_t end = at;
+  for (; end < response.size(); end++) {
+    if (response[end] == '{') depth++;
+    if (response[end] == '}' && --depth == 0) break;
+  }
+  printf("robot  %s\n", response.substr(at, end + 1 - at).c_str());
+}
+
+static void usage() {
+  fprintf(stderr,
+    "usage: latency <host[:port]> [--clients n] [--rate hz] [--duration ms]\n"
+    "               [--move] [--max-p99 ms]\n"
+    "       latency --usb <device> [--rate hz] [--duration ms] [--move] [--max-p99 ms]\n");
+}
+
+int main(int argc, char** argv) {
+  int first = 2;
+  if (argc >= 3 && strcmp(argv[1], "--usb") == 0) {
+    usbDevice = argv[2];
+    first = 3;
+  } else if (argc < 2 || argv[1][0] == '-') {
+    usage();
+    return 2;
+  } else {
+    host = argv[1];
+    size_t colon = host.rfind(':');
+    if (colon != std::string::npos) {
+      port = atoi(host.c_str() + colon + 1);
+      host.resize(colon);
+    }
+  }
+
+  int clients = 1;
+  double rate = 20;
+  uint32_t durationMs = 5000;
+  bool move = false;
+  double maxP99Ms = 0;
+  for (int i = first; i < argc; i++) {
+    if (strcmp(argv[i], "--clients") == 0 && i + 1 < argc) clients = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) rate = atof(argv[++i]);
+    else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) durationMs = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--move") == 0) move = true;
+    else if (strcmp(argv[i], "--max-p99") == 0 && i + 1 < argc) maxP99Ms = atof(argv[++i]);
+    else {
+      usage();
+      return 2;
+    }
+  }
+  if (clients < 1 || rate <= 0 || (usbDevice && clients != 1)) {
+    usage();
+    return 2;
+  }
+
+  std::vector<ClientResult> results(clients);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < clients; i++) {
+    threads.emplace_back(runClient, i, rate, durationMs, move, std::ref(results[i]));
+  }
+  for (std::thread& thread : threads) thread.join();
+
+  bool ok = true;
+  uint32_t sent = 0;
+  uint32_t lost = 0;
+  std::vector<uint32_t> rtt;
+  std::vector<uint32_t> robot;
+  for (int i = 0; i < clients; i++) {
+    ClientResult& r = results[i];
+    if (!r.connected) {
+      if (usbDevice) {
+        fprintf(stderr, "could not open %s\n", usbDevice);
+      } else {
+        fprintf(stderr, "client %d: could not connect to ws://%s:%u/ws\n", i, host.c_str(), port);
+      }
+      ok = false;
+      continue;
+    }
+    sent += r.sent;
+    lost += r.lost;
+    rtt.insert(rtt.end(), r.rttUs.begin(), r.rttUs.end());
+    robot.insert(robot.end(), r.robotUs.begin(), r.robotUs.end());
+    if (!r.rttUs.empty()) {
+      printf("client %d: offset %+.3f ms (client minus robot, measured over %.3f ms)\n",
+             i, r.offsetUs / 1000.0, r.bestRttUs / 1000.0);
+    }
+  }
+
+  printf("%u echoes from %d client(s) at %.0f Hz, %u lost\n", sent, clients, rate, lost);
+  printStats("rtt", rtt);
+  printStats("robot", robot);
+  if (!usbDevice) printRobotLatency();
+
+  if (rtt.empty()) {
+    fprintf(stderr, "no echo replies\n");
+    ok = false;
+  } else if (maxP99Ms > 0 && percentile(rtt, 0.99) > maxP99Ms * 1000) {
+    fprintf(stderr, "rtt p99 %.2f ms above --max-p99 %.2f ms\n", percentile(rtt, 0.99) / 1000.0, maxP99Ms);
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
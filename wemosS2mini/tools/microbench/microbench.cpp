@@ -0,0 +1,369 @@
+/*
+ * microbench - per-call cost of the firmware's hot paths
+ *
+ * Built into the unchanged firmware (setup()/loop()) with
+ * -DSIROBO_MICROBENCH: once the boot completes, runMicrobench() times
+ *
+ *   command_move        JSON parse and processCommand() of a "move"
+ *   command_led_all     the same for "led_all"
+ *   send_sensor_data    telemetry serialization and broadcast
+ *   line_follower_step  lineFollowerStep() over centered, off-center,
+ *                       crossing and lost frames
+ *   update_imu          updateIMU(): sample read and attitude integration
+ *   detect_intersection detectIntersection() over the same frames
+ *   render_text         four lines of text into a cleared framebuffer
+ *   render_image        the built-in faces, into the framebuffer only
+ *
+ * with hal::cycleCount(): CCOUNT on the robot, host nanoseconds in the
+ * simulator. Each sample times a batch of calls; the report gives the
+ * per-call min, median, p90 and max as JSON, so runs of two firmware
+ * versions can be compared.
+ *
+ * Native (simulated board, virtual time):
+ *   microbench [options]
+ *     --samples <n>             samples per benchmark (default 1000)
+ *     --filter <text>           only benchmarks whose name contains text
+ *     --label <text>            recorded in the report, e.g. the git revision
+ *     --json <file>             write the report there (default stdout)
+ *     --baseline <file>         compare medians with an earlier report
+ *     --max-regression <pct>    slower than the baseline by more than this
+ *                               fails (default 25)
+ *
+ * Exits 1 when a benchmark regressed past --max-regression or is missing
+ * from the report.
+ *
+ * On the robot, `pio run -e microbench_s2 -t upload` and the report is
+ * printed on the log UART after boot, one JSON line between
+ * "microbench: begin" and "microbench: end". The robot then runs normally.
+ * command_move would drive the wheels there, so it only runs with
+ * -DSIROBO_MICROBENCH_MOTORS (the robot on a stand).
+ *
+ * Build with `pio run -e microbench`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include <algorithm>
+#include <string>
+
+#include <Hal.h>
+#include <LineFollower.h>
+
+#ifndef ARDUINO
+#include <unistd.h>
+#include <HalSim.h>
+#include <ArduinoJson.h>
+#endif
+
+#define MICROBENCH_SAMPLES_MAX 1000
+#define MICROBENCH_REPORT_SIZE 4096
+// MICROBENCH_CLIENT_ID in src/main.cpp: commands run on the loop's JSON
+// arena, replies go nowhere and the actuation latency histograms stay clean
+#define BENCH_CLIENT_ID 0xFFFFFFFBUL
+
+// Firmware under test (src/main.cpp)
+void setup();
+void loop();
+void handleTextMessage(uint32_t clientId, const uint8_t* data, size_t len);
+void sendSensorData();
+void updateIMU();
+bool detectIntersection(const char* type);
+void renderText(int line, const char* text);
+void renderImage(const char* image);
+void clearDisplay();
+extern bool imuReady;
+extern int lineSensors[LINE_SENSOR_COUNT];
+extern hal::Display& display;
+
+// =====================================================
+// BENCHMARKS
+// =====================================================
+
+// Centered, left, right, a crossing and no line, leftmost sensor first
+static const int lineFrames[][LINE_SENSOR_COUNT] = {
+  { 80, 90, 120, 900, 950, 110, 90, 70 },
+  { 850, 920, 300, 100, 90, 80, 70, 60 },
+  { 60, 70, 80, 90, 100, 400, 910, 880 },
+  { 900, 920, 940, 950, 960, 930, 910, 890 },
+  { 60, 70, 80, 90, 100, 90, 80, 70 }
+};
+#define LINE_FRAME_COUNT (sizeof(lineFrames) / sizeof(lineFrames[0]))
+
+// Results go here so the compiler keeps the calls
+static volatile int sink;
+
+static void sendCommand(const char* json) {
+  handleTextMessage(BENCH_CLIENT_ID, (const uint8_t*)json, strlen(json));
+}
+
+static void benchMove(uint32_t i) {
+  static const char* const commands[] = {
+    "{\"type\":\"move\",\"x\":20,\"y\":60}",
+    "{\"type\":\"move\",\"x\":-35,\"y\":80}"
+  };
+  sendCommand(commands[i & 1]);
+}
+
+static void benchLedAll(uint32_t i) {
+  static const char* const commands[] = {
+    "{\"type\":\"led_all\",\"r\":255,\"g\":120,\"b\":0}",
+    "{\"type\":\"led_all\",\"r\":0,\"g\":80,\"b\":255}"
+  };
+  sendCommand(commands[i & 1]);
+}
+
+static void benchSensorData(uint32_t) { sendSensorData(); }
+
+static void benchLineFollower(uint32_t i) {
+  static const LineFollowerParams params = { 60, 0.5f, LINE_SENSOR_THRESHOLD, false };
+  LineFollowerOutput out = lineFollowerStep(lineFrames[i % LINE_FRAME_COUNT], params);
+  sink = out.left + out.right;
+}
+
+static void benchImu(uint32_t) { updateIMU(); }
+
+static void benchIntersection(uint32_t i) {
+  static const char* const types[] = { "left", "right", "t", "cross" };
+  memcpy(lineSensors, lineFrames[i % LINE_FRAME_COUNT], sizeof(lineFrames[0]));
+  sink = detectIntersection(types[i % 4]);
+}
+
+static void benchText(uint32_t i) {
+  char score[24];
+  snprintf(score, sizeof(score), "Skor: %lu", (unsigned long)i);
+  display.clearDisplay();
+  renderText(0, "Sirobo");
+  renderText(1, "Jarak: 23 cm");
+  renderText(2, "Garis: kiri");
+  renderText(3, score);
+}
+
+static void benchImage(uint32_t i) {
+  static const char* const images[] = { "happy", "sad", "heart", "robot" };
+  renderImage(images[i % 4]);
+}
+
+struct Benchmark {
+  const char* name;
+  void (*run)(uint32_t i);
+  uint16_t batch;   // Calls per sample, so short calls outweigh the timer
+};
+
+static const Benchmark benchmarks[] = {
+  { "command_move", benchMove, 1 },
+  { "command_led_all", benchLedAll, 1 },
+  { "send_sensor_data", benchSensorData, 1 },
+  { "line_follower_step", benchLineFollower, 16 },
+  { "update_imu", benchImu, 1 },
+  { "detect_intersection", benchIntersection, 16 },
+  { "render_text", benchText, 1 },
+  { "render_image", benchImage, 1 }
+};
+
+// =====================================================
+// HARNESS
+// =====================================================
+
+static uint32_t sampleCount = MICROBENCH_SAMPLES_MAX;
+static const char* filter = nullptr;
+static const char* label = "";
+static uint32_t samples[MICROBENCH_SAMPLES_MAX];
+static char report[MICROBENCH_REPORT_SIZE];
+static size_t reportLength = 0;
+static bool reportReady = false;
+
+static void append(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(report + reportLength, sizeof(report) - reportLength, format, args);
+  va_end(args);
+  if (n > 0) reportLength = std::min(reportLength + n, sizeof(report) - 1);
+}
+
+static double toNs(uint32_t cycles, uint16_t batch) {
+  return cycles * 1e9 / hal::cycleFrequency() / batch;
+}
+
+static bool skipped(const Benchmark& bench) {
+  if (filter && !strstr(bench.name, filter)) return true;
+#if defined(ARDUINO) && !defined(SIROBO_MICROBENCH_MOTORS)
+  // Alternating "move" commands would drive the robot off the desk
+  if (bench.run == benchMove) return true;
+#endif
+  // Without an IMU updateIMU() returns at once
+  return bench.run == benchImu && !imuReady;
+}
+
+void runMicrobench() {
+#ifdef ARDUINO
+  const char* platform = "esp32s2";
+#else
+  const char* platform = "native";
+#endif
+  reportLength = 0;
+  append("{\"suite\":\"microbench\",\"label\":\"%s\",\"platform\":\"%s\",\"cpuHz\":%lu,\"samples\":%lu,"
+         "\"results\":[", label, platform, (unsigned long)hal::cycleFrequency(),
+         (unsigned long)sampleCount);
+
+  bool first = true;
+  for (const Benchmark& bench : benchmarks) {
+    if (skipped(bench)) continue;
+    // Warm up caches and the arenas, then measure
+    for (uint32_t i = 0; i < 8; i++) bench.run(i);
+    for (uint32_t s = 0; s < sampleCount; s++) {
+      uint32_t start = hal::cycleCount();
+      for (uint16_t b = 0; b < bench.batch; b++) bench.run(s * bench.batch + b);
+      samples[s] = hal::cycleCount() - start;
+    }
+    std::sort(samples, samples + sampleCount);
+    uint32_t median = samples[sampleCount / 2];
+    append("%s{\"name\":\"%s\",\"batch\":%u,\"minNs\":%.1f,\"medianNs\":%.1f,\"p90Ns\":%.1f,\"maxNs\":%.1f,"
+           "\"medianCycles\":%lu}", first ? "" : ",", bench.name, bench.batch,
+           toNs(samples[0], bench.batch), toNs(median, bench.batch),
+           toNs(samples[sampleCount * 9 / 10], bench.batch), toNs(samples[sampleCount - 1], bench.batch),
+           (unsigned long)(median / bench.batch));
+    first = false;
+    // Lets the idle task run (one core on the S2: the task watchdog)
+    hal::delay(1);
+  }
+  append("]}");
+
+  // Leave the robot as the benchmarks found it
+  sendCommand("{\"type\":\"stop\"}");
+  sendCommand("{\"type\":\"led_all\",\"r\":0,\"g\":0,\"b\":0}");
+  clearDisplay();
+
+#ifdef ARDUINO
+  LOG.println("microbench: begin");
+  LOG.println(report);
+  LOG.println("microbench: end");
+#endif
+  reportReady = true;
+}
+
+// =====================================================
+// NATIVE ENTRY POINT
+// =====================================================
+
+#ifndef ARDUINO
+
+static JsonObject findResult(JsonDocument& report, const char* name) {
+  for (JsonObject result : report["results"].as<JsonArray>()) {
+    if (strcmp(result["name"] | "", name) == 0) return result;
+  }
+  return JsonObject();
+}
+
+// Median per benchmark of an earlier report against this one; false if
+// one got slower than allowed or is gone
+static bool compareBaseline(const char* path, double maxRegression, FILE* out) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    fprintf(stderr, "microbench: cannot read %s\n", path);
+    return false;
+  }
+  std::string text;
+  char buffer[1024];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) text.append(buffer, n);
+  fclose(file);
+
+  JsonDocument baseline, current;
+  if (deserializeJson(baseline, text.c_str(), text.size()) || deserializeJson(current, report)) {
+    fprintf(stderr, "microbench: %s is not a report\n", path);
+    return false;
+  }
+
+  bool ok = true;
+  fprintf(out, "%-20s %12s %12s %8s\n", "benchmark", "baseline ns", "now ns", "change");
+  for (JsonObject before : baseline["results"].as<JsonArray>()) {
+    const char* name = before["name"] | "";
+    if (filter && !strstr(name, filter)) continue;
+    JsonObject now = findResult(current, name);
+    if (now.isNull()) {
+      fprintf(out, "%-20s %12.1f %12s\n", name, before["medianNs"].as<double>(), "missing");
+      ok = false;
+      continue;
+    }
+    double was = before["medianNs"], is = now["medianNs"];
+    double change = was > 0 ? (is - was) * 100 / was : 0;
+    bool regressed = change > maxRegression;
+    fprintf(out, "%-20s %12.1f %12.1f %+7.1f%%%s\n", name, was, is, change, regressed ? "  REGRESSED" : "");
+    if (regressed) ok = false;
+  }
+  return ok;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: microbench [--samples n] [--filter text] [--label text] [--json file]\n"
+                  "                  [--baseline file] [--max-regression pct]\n");
+}
+
+int main(int argc, char** argv) {
+  const char* json = nullptr;
+  const char* baseline = nullptr;
+  double maxRegression = 25;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (strcmp(arg, "--samples") == 0 && hasValue) {
+      sampleCount = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(arg, "--filter") == 0 && hasValue) {
+      filter = argv[++i];
+    } else if (strcmp(arg, "--label") == 0 && hasValue) {
+      label = argv[++i];
+    } else if (strcmp(arg, "--json") == 0 && hasValue) {
+      json = argv[++i];
+    } else if (strcmp(arg, "--baseline") == 0 && hasValue) {
+      baseline = argv[++i];
+    } else if (strcmp(arg, "--max-regression") == 0 && hasValue) {
+      maxRegression = atof(argv[++i]);
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (sampleCount < 1 || sampleCount > MICROBENCH_SAMPLES_MAX) {
+    fprintf(stderr, "microbench: --samples is 1 to %d\n", MICROBENCH_SAMPLES_MAX);
+    return 2;
+  }
+
+  hal::sim::useVirtualTime(true);
+  hal::sim::setNetworkPort(0);
+  hal::sim::setStoragePath("/dev/null");
+  hal::sim::setFlashPath("/dev/null");
+  // Level, at rest: the IMU settles and updateIMU() has a sample to read
+  hal::sim::setImu({ 0, 0, 9.81f, 0, 0, 0 });
+
+  // The firmware logs to stdout
+  fflush(stdout);
+  FILE* out = fdopen(dup(fileno(stdout)), "w");
+  if (!out || !freopen("/dev/null", "w", stdout)) return 2;
+
+  setup();
+  while (!reportReady && hal::sim::nowMicros() < 30000000ULL) {
+    loop();
+    hal::sim::advanceMicros(1000);
+  }
+  if (!reportReady) {
+    fprintf(stderr, "microbench: the firmware did not finish booting\n");
+    return 1;
+  }
+
+  FILE* target = json ? fopen(json, "w") : out;
+  if (!target) {
+    fprintf(stderr, "microbench: cannot write %s\n", json);
+    return 2;
+  }
+  fprintf(target, "%s\n", report);
+  if (target != out) fclose(target);
+
+  bool ok = baseline ? compareBaseline(baseline, maxRegression, stderr) : true;
+  fclose(out);
+  return ok ? 0 : 1;
+}
+
+#endif
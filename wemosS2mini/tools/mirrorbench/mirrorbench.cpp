@@ -0,0 +1,228 @@
+/*
+ * mirrorbench - display mirror message sizes for typical OLED screens
+ *
+ * Runs the unchanged firmware (setup()/loop()) on the simulated board in
+ * virtual time and subscribes to the display mirror over the WebSocket.
+ * Each scene draws screens the way a program does (display_text,
+ * display_image, display_clear) and the binary messages the firmware sends
+ * are measured. Every message is also applied to a copy of the screen, the
+ * way the app does, and checked against the firmware's framebuffer.
+ *
+ * Usage:
+ *   mirrorbench [options]
+ *     --fps <n>             mirror rate asked for (default 10)
+ *     --step <us>           virtual time per loop() (default 1000)
+ *     --csv <file>          also write the results as CSV
+ *
+ * Exits non-zero when a message does not reproduce the screen, or one is
+ * missing.
+ *
+ * Build with `pio run -e mirrorbench`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <HalSim.h>
+#include <DisplayMirror.h>
+#include <board.h>
+
+#define BOOT_US 2000000ULL       // Welcome animation over
+#define SCENE_US 300000ULL       // Per screen, long enough for one message
+#define FRAME_BYTES (SCREEN_WIDTH * SCREEN_HEIGHT / 8)
+#define COUNTER_STEPS 20
+
+void setup();
+void loop();
+
+struct BenchOptions {
+  int fps = 10;
+  uint32_t stepUs = 1000;
+  const char* csv = nullptr;
+};
+
+// The screen as a client sees it, kept by the binary message hook
+static uint8_t mirrored[FRAME_BYTES];
+static uint32_t messages = 0;
+static uint32_t messageBytes = 0;
+static uint32_t keyMessages = 0;
+static uint32_t rawMessages = 0;
+static uint32_t mismatches = 0;
+static uint32_t gaps = 0;
+static bool sequenceSeen = false;
+static uint16_t nextSequence = 0;
+
+static void onWsBinary(uint32_t, const uint8_t* data, size_t len) {
+  if (len < MIRROR_HEADER || data[0] != MIRROR_KIND) return;
+  uint16_t sequence = data[2] | (data[3] << 8);
+  if (sequenceSeen && sequence != nextSequence) gaps++;
+  sequenceSeen = true;
+  nextSequence = sequence + 1;
+
+  messages++;
+  messageBytes += len;
+  if (data[1] & MIRROR_KEY) keyMessages++;
+  if (data[1] & MIRROR_RAW) rawMessages++;
+  // Sent from the loop, so the framebuffer still holds what was packed
+  if (!mirrorUnpack(data, len, mirrored, sizeof(mirrored)) ||
+      memcmp(mirrored, hal::display().getBuffer(), sizeof(mirrored)) != 0) {
+    mismatches++;
+  }
+}
+
+static void run(uint64_t us, uint32_t stepUs) {
+  uint64_t end = hal::sim::nowMicros() + us;
+  while (hal::sim::nowMicros() < end) {
+    loop();
+    hal::sim::advanceMicros(stepUs);
+  }
+}
+
+struct SceneResult {
+  const char* name;
+  uint32_t messages;
+  uint32_t bytes;
+  bool key;
+  bool raw;
+};
+
+// Sends the commands (NULL-terminated), then lets the mirror catch up
+static SceneResult scene(const char* name, const char* const* commands, const BenchOptions& options) {
+  uint32_t messagesBefore = messages, bytesBefore = messageBytes;
+  uint32_t keysBefore = keyMessages, rawBefore = rawMessages;
+  for (const char* const* command = commands; *command; command++) {
+    hal::sim::injectWsText(0, *command);
+  }
+  run(SCENE_US, options.stepUs);
+  return { name, messages - messagesBefore, messageBytes - bytesBefore, keyMessages != keysBefore,
+           rawMessages != rawBefore };
+}
+
+static void usage() {
+  fprintf(stderr, "usage: mirrorbench [--fps n] [--step us] [--csv file]\n");
+}
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (strcmp(arg, "--fps") == 0 && hasValue) {
+      options.fps = atoi(argv[++i]);
+    } else if (strcmp(arg, "--step") == 0 && hasValue) {
+      options.stepUs = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(arg, "--csv") == 0 && hasValue) {
+      options.csv = argv[++i];
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (options.stepUs == 0 || options.fps < 1) {
+    usage();
+    return 2;
+  }
+
+  hal::sim::useVirtualTime(true);
+  hal::sim::setNetworkPort(0);
+  hal::sim::setStoragePath("/dev/null");
+  hal::sim::setFlashPath("/dev/null");
+  hal::sim::setWsBinaryHook(onWsBinary);
+
+  // The firmware logs to stdout
+  fflush(stdout);
+  FILE* out = fdopen(dup(fileno(stdout)), "w");
+  if (!out || !freopen("/dev/null", "w", stdout)) return 2;
+
+  setup();
+  run(BOOT_US, options.stepUs);
+
+  char subscribe[64];
+  snprintf(subscribe, sizeof(subscribe), "{\"type\":\"display_mirror\",\"fps\":%d}", options.fps);
+  const char* const subscribeOnly[] = { subscribe, nullptr };
+  const char* const nothing[] = { nullptr };
+  const char* const clear[] = { "{\"type\":\"display_clear\"}", nullptr };
+  const char* const oneLine[] = { "{\"type\":\"display_text\",\"line\":0,\"text\":\"Halo!\"}", nullptr };
+  const char* const fourLines[] = {
+    "{\"type\":\"display_clear\"}",
+    "{\"type\":\"display_text\",\"line\":0,\"text\":\"Sirobo\"}",
+    "{\"type\":\"display_text\",\"line\":1,\"text\":\"Jarak: 23 cm\"}",
+    "{\"type\":\"display_text\",\"line\":2,\"text\":\"Garis: kiri\"}",
+    "{\"type\":\"display_text\",\"line\":3,\"text\":\"Skor: 120\"}",
+    nullptr
+  };
+  const char* const happy[] = { "{\"type\":\"display_image\",\"image\":\"happy\"}", nullptr };
+  const char* const sad[] = { "{\"type\":\"display_image\",\"image\":\"sad\"}", nullptr };
+  const char* const heart[] = { "{\"type\":\"display_image\",\"image\":\"heart\"}", nullptr };
+  const char* const robot[] = { "{\"type\":\"display_image\",\"image\":\"robot\"}", nullptr };
+
+  SceneResult results[16];
+  int count = 0;
+  results[count++] = scene("welcome screen", subscribeOnly, options);
+  results[count++] = scene("clear", clear, options);
+  results[count++] = scene("text, 1 line", oneLine, options);
+  results[count++] = scene("text, 4 lines", fourLines, options);
+  results[count++] = scene("text, 4 lines (key)", subscribeOnly, options);
+
+  // A counter redrawn on a cleared screen, as a program loop does
+  SceneResult counter = { "counter update", 0, 0, false, false };
+  for (int step = 1; step <= COUNTER_STEPS; step++) {
+    char text[80];
+    snprintf(text, sizeof(text), "{\"type\":\"display_text\",\"line\":1,\"text\":\"Skor: %d\"}", step * 7);
+    const char* const commands[] = { "{\"type\":\"display_clear\"}", text, nullptr };
+    SceneResult result = scene("", commands, options);
+    counter.messages += result.messages;
+    counter.bytes += result.bytes;
+  }
+  results[count++] = counter;
+
+  results[count++] = scene("face happy", happy, options);
+  results[count++] = scene("face happy (key)", subscribeOnly, options);
+  results[count++] = scene("face happy -> sad", sad, options);
+  results[count++] = scene("face heart", heart, options);
+  results[count++] = scene("face robot", robot, options);
+  results[count++] = scene("face robot (key)", subscribeOnly, options);
+  results[count++] = scene("unchanged", nothing, options);
+
+  // Worst case, outside the firmware: noise does not code
+  {
+    static DisplayMirror noise;
+    static uint8_t frame[FRAME_BYTES], message[MIRROR_MESSAGE_MAX], check[FRAME_BYTES];
+    srand(1);
+    for (uint8_t& b : frame) b = rand();
+    noise.begin(SCREEN_WIDTH, SCREEN_HEIGHT);
+    size_t len = noise.pack(frame, message);
+    if (!mirrorUnpack(message, len, check, sizeof(check)) || memcmp(check, frame, sizeof(frame)) != 0) {
+      mismatches++;
+    }
+    results[count++] = { "noise (synthetic, key)", 1, (uint32_t)len, true, (message[1] & MIRROR_RAW) != 0 };
+  }
+
+  fprintf(out, "%-24s %8s %8s %7s\n", "screen", "messages", "bytes", "of 1 KB");
+  for (int i = 0; i < count; i++) {
+    const SceneResult& r = results[i];
+    uint32_t each = r.messages ? r.bytes / r.messages : 0;
+    fprintf(out, "%-24s %8lu %8lu %6.1f%%%s\n", r.name, (unsigned long)r.messages, (unsigned long)each,
+            100.0 * each / FRAME_BYTES, r.raw ? "  raw" : "");
+  }
+  fprintf(out, "\n%lu messages, %lu bytes, %lu key frames; %lu mismatched, %lu missing\n",
+          (unsigned long)messages, (unsigned long)messageBytes, (unsigned long)keyMessages,
+          (unsigned long)mismatches, (unsigned long)gaps);
+
+  if (options.csv) {
+    FILE* csv = fopen(options.csv, "w");
+    if (csv) {
+      fprintf(csv, "screen,messages,bytes_each,key,raw\n");
+      for (int i = 0; i < count; i++) {
+        const SceneResult& r = results[i];
+        fprintf(csv, "%s,%lu,%lu,%d,%d\n", r.name, (unsigned long)r.messages,
+                (unsigned long)(r.messages ? r.bytes / r.messages : 0), r.key, r.raw);
+      }
+      fclose(csv);
+    }
+  }
+  fclose(out);
+  return mismatches || gaps ? 1 : 0;
+}
@@ -0,0 +1,237 @@
+/*
+ * otapack - pack a firmware image for streaming OTA
+ *
+ * Usage:
+ *   otapack firmware.bin [firmware.sota] [-w bits] [-l bits] [--store]
+ *   curl -F "firmware=@firmware.sota" http://192.168.4.1/update
+ *
+ * Compresses the image with heatshrink (default window 11 bits, lookahead
+ * 4 bits) and prepends an OtaImageHeader carrying its SHA-256, so the robot
+ * can unpack and verify it while flashing. --store packs it uncompressed
+ * (digest check only), as happens anyway when compression does not help. The result is decoded again with the firmware's own
+ * decoder before it is written. Build with `pio run -e otapack` (binary in
+ * .pio/build/otapack/program). The format is documented in
+ * wemosS2mini/lib/OtaStream/OtaStream.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include <OtaStream.h>
+
+#define HASH_CHAIN_LIMIT 256   // Match candidates tried per position
+#define UPLOAD_CHUNK 1436      // One TCP segment, as the upload handler sees it
+
+struct BitWriter {
+  std::vector<uint8_t>& out;
+  uint32_t bits = 0;
+  uint8_t count = 0;
+
+  explicit BitWriter(std::vector<uint8_t>& buffer) : out(buffer) {}
+
+  void put(uint32_t value, uint8_t width) {
+    while (width--) {
+      bits = (bits << 1) | ((value >> width) & 1);
+      if (++count == 8) {
+        out.push_back(bits);
+        bits = 0;
+        count = 0;
+      }
+    }
+  }
+
+  void finish() {
+    if (count) out.push_back(bits << (8 - count));
+  }
+};
+
+// Greedy LZSS over a 2-byte hash chain; a back-reference is used whenever
+// it is shorter than the literals it replaces
+static void heatshrinkEncode(const std::vector<uint8_t>& in, uint8_t windowBits,
+                             uint8_t lookaheadBits, std::vector<uint8_t>& out) {
+  const size_t window = (size_t)1 << windowBits;
+  const size_t maxLength = (size_t)1 << lookaheadBits;
+  const size_t backrefBits = 1 + windowBits + lookaheadBits;
+  std::vector<int32_t> head(1 << 16, -1);
+  std::vector<int32_t> prev(in.size(), -1);
+  BitWriter writer(out);
+
+  auto insert = [&](size_t pos) {
+    if (pos + 1 >= in.size()) return;
+    uint16_t hash = in[pos] << 8 | in[pos + 1];
+    prev[pos] = head[hash];
+    head[hash] = pos;
+  };
+
+  size_t pos = 0;
+  while (pos < in.size()) {
+    size_t bestLength = 0, bestDistance = 0;
+    if (pos + 1 < in.size()) {
+      uint16_t hash = in[pos] << 8 | in[pos + 1];
+      size_t limit = in.size() - pos < maxLength ? in.size() - pos : maxLength;
+      int32_t candidate = head[hash];
+      for (int tries = 0; candidate >= 0 && pos - candidate <= window && tries < HASH_CHAIN_LIMIT; tries++) {
+        size_t length = 0;
+        while (length < limit && in[candidate + length] == in[pos + length]) length++;
+        if (length > bestLength) {
+          bestLength = length;
+          bestDistance = pos - candidate;
+          if (length == limit) break;
+        }
+        candidate = prev[candidate];
+      }
+    }
+
+    if (bestLength * 9 > backrefBits) {
+      writer.put(0, 1);
+      writer.put(bestDistance - 1, windowBits);
+      writer.put(bestLength - 1, lookaheadBits);
+      for (size_t i = 0; i < bestLength; i++) insert(pos + i);
+      pos += bestLength;
+    } else {
+      writer.put(1, 1);
+      writer.put(in[pos], 8);
+      insert(pos);
+      pos++;
+    }
+  }
+  writer.finish();
+}
+
+// Round-trip check through the firmware decoder
+static const std::vector<uint8_t>* verifyExpected;
+static size_t verifyOffset;
+static bool verifySink(const uint8_t* data, size_t len) {
+  if (verifyOffset + len > verifyExpected->size() ||
+      memcmp(data, verifyExpected->data() + verifyOffset, len) != 0) {
+    return false;
+  }
+  verifyOffset += len;
+  return true;
+}
+
+static OtaStream verifier(verifySink);
+
+static bool readFile(const char* path, std::vector<uint8_t>& data) {
+  FILE* in = fopen(path, "rb");
+  if (!in) return false;
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) data.insert(data.end(), buffer, buffer + n);
+  fclose(in);
+  return true;
+}
+
+int main(int argc, char** argv) {
+  const char* inPath = nullptr;
+  const char* outPath = nullptr;
+  int windowBits = 11;
+  int lookaheadBits = 4;
+  bool store = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+      windowBits = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+      lookaheadBits = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--store") == 0) {
+      store = true;
+    } else if (!inPath) {
+      inPath = argv[i];
+    } else if (!outPath) {
+      outPath = argv[i];
+    } else {
+      inPath = nullptr;
+      break;
+    }
+  }
+  if (!inPath) {
+    fprintf(stderr, "usage: %s <firmware.bin> [out.sota] [-w bits] [-l bits] [--store]\n", argv[0]);
+    return 2;
+  }
+  if (windowBits < OTA_MIN_WINDOW_BITS || windowBits > OTA_MAX_WINDOW_BITS ||
+      lookaheadBits < OTA_MIN_LOOKAHEAD_BITS || lookaheadBits > OTA_MAX_LOOKAHEAD_BITS ||
+      lookaheadBits >= windowBits) {
+    fprintf(stderr, "window bits must be %d..%d, lookahead bits %d..%d and below the window\n",
+            OTA_MIN_WINDOW_BITS, OTA_MAX_WINDOW_BITS, OTA_MIN_LOOKAHEAD_BITS, OTA_MAX_LOOKAHEAD_BITS);
+    return 2;
+  }
+
+  std::vector<uint8_t> image;
+  if (!readFile(inPath, image)) {
+    perror(inPath);
+    return 1;
+  }
+
+  std::vector<uint8_t> payload;
+  if (store) {
+    payload = image;
+  } else {
+    heatshrinkEncode(image, windowBits, lookaheadBits, payload);
+    // Incompressible input: storing is smaller and skips the decoder
+    if (payload.size() >= image.size()) {
+      payload = image;
+      store = true;
+    }
+  }
+
+  OtaImageHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = OTA_IMAGE_MAGIC;
+  header.version = OTA_IMAGE_VERSION;
+  header.compression = store ? OTA_COMPRESSION_NONE : OTA_COMPRESSION_HEATSHRINK;
+  header.windowBits = store ? 0 : windowBits;
+  header.lookaheadBits = store ? 0 : lookaheadBits;
+  header.imageSize = image.size();
+  header.payloadSize = payload.size();
+  Sha256 sha;
+  sha.update(image.data(), image.size());
+  sha.finish(header.sha256);
+
+  // Decode in upload-sized chunks, as the robot will
+  verifyExpected = &image;
+  verifyOffset = 0;
+  verifier.begin();
+  bool ok = verifier.write((const uint8_t*)&header, sizeof(header));
+  for (size_t offset = 0; ok && offset < payload.size(); offset += UPLOAD_CHUNK) {
+    size_t len = payload.size() - offset < UPLOAD_CHUNK ? payload.size() - offset : UPLOAD_CHUNK;
+    ok = verifier.write(payload.data() + offset, len);
+  }
+  if (!ok || !verifier.finish()) {
+    fprintf(stderr, "%s: round trip failed (%s)\n", inPath, verifier.errorString());
+    return 1;
+  }
+
+  std::string defaultOut;
+  if (!outPath) {
+    defaultOut = inPath;
+    size_t dot = defaultOut.rfind('.');
+    if (dot != std::string::npos && defaultOut.find('/', dot) == std::string::npos) defaultOut.resize(dot);
+    defaultOut += ".sota";
+    outPath = defaultOut.c_str();
+  }
+  FILE* out = fopen(outPath, "wb");
+  if (!out) {
+    perror(outPath);
+    return 1;
+  }
+  bool written = fwrite(&header, sizeof(header), 1, out) == 1 &&
+                 fwrite(payload.data(), 1, payload.size(), out) == payload.size();
+  if (fclose(out) != 0 || !written) {
+    perror(outPath);
+    return 1;
+  }
+
+  char hex[SHA256_HEX_SIZE];
+  sha256ToHex(header.sha256, hex);
+  size_t total = sizeof(header) + payload.size();
+  printf("%s: %zu -> %zu bytes (%.1f%%), %s\n", outPath, image.size(), total,
+         image.empty() ? 100.0 : total * 100.0 / image.size(),
+         store ? "stored" : "heatshrink");
+  printf("sha256 %s\n", hex);
+  return 0;
+}
@@ -0,0 +1,271 @@
+/*
+ * posebench - dead reckoning and motion primitives against simulator truth
+ *
+ * Runs the unchanged firmware (setup()/loop()) on the simulated board in
+ * virtual time, on an empty arena with the robot facing a wall
+ * (lib/SiroboSim). Over the WebSocket it calibrates the speed model against
+ * the wall, resets the pose and runs a course of drive and go-to moves.
+ * After each move has come to rest, the firmware's pose estimate is
+ * compared with where the simulated robot really is, and with where it was
+ * sent.
+ *
+ * Usage:
+ *   posebench [options]
+ *     --no-calibrate        keep the firmware's default speed model
+ *     --speed <percent>     speed of the moves (default 50)
+ *     --max-error <mm>      largest estimate error that passes (default 50)
+ *     --mismatch <gain>     right motor gain relative to the left (default 0.95)
+ *     --deadband <duty>     motor deadband, 0..1 (default 0.15)
+ *     --lag <ms>            motor time constant (default 60)
+ *     --max-speed <mm/s>    at full duty (default 800)
+ *     --gyro-bias <dps>     (default 0.5)
+ *     --gyro-noise <dps>    (default 0.1)
+ *     --seed <n>            noise seed (default 1)
+ *     --step <us>           virtual time per loop() (default 1000)
+ *
+ * Exits non-zero when calibration fails, a move does not finish or an
+ * estimate is off by more than --max-error.
+ *
+ * Build with `pio run -e posebench`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include <HalSim.h>
+#include <SimWorld.h>
+
+#define ARENA_WIDTH 4000.0f
+#define ARENA_HEIGHT 3000.0f
+#define START_X 2300.0f            // Wall ~1.65 m ahead of the sensor
+#define BOOT_US 2000000ULL         // IMU settling
+#define SETTLE_US 500000ULL        // After a move, until the robot is at rest
+#define MOVE_TIMEOUT_US 30000000ULL
+#define CALIBRATION_TIMEOUT_US 60000000ULL
+
+void setup();
+void loop();
+
+struct BenchOptions {
+  bool calibrate = true;
+  int speed = 50;
+  double maxError = 50;
+  DriveParams drive = defaultDriveParams();
+  SensorParams sensors = defaultSensorParams();
+  uint32_t seed = 1;
+  uint32_t stepUs = 1000;
+};
+
+struct Move {
+  const char* kind;   // "drive" or "goto"
+  float a, b;         // cm: distance, or x and y
+};
+
+// A square lesson: out and back, then around a 50 cm square
+static const Move COURSE[] = {
+  { "drive", 100, 0 },
+  { "drive", -50, 0 },
+  { "goto", 50, 50 },
+  { "goto", 0, 50 },
+  { "goto", 0, 0 },
+  { "goto", 50, 0 },
+  { "drive", 30, 0 },
+};
+
+// Last message of interest from the firmware, filled by the WebSocket hook
+static char lastMessage[1024];
+static bool messageSeen = false;
+static const char* awaitedType = nullptr;
+
+static void onWsSend(uint32_t, const char* text, size_t len) {
+  if (!awaitedType || messageSeen) return;
+  char needle[48];
+  snprintf(needle, sizeof(needle), "\"type\":\"%s\"", awaitedType);
+  if (len >= sizeof(lastMessage) || !memmem(text, len, needle, strlen(needle))) return;
+  memcpy(lastMessage, text, len);
+  lastMessage[len] = '\0';
+  messageSeen = true;
+}
+
+static bool jsonNumber(const char* text, const char* key, double& out) {
+  char needle[48];
+  snprintf(needle, sizeof(needle), "\"%s\":", key);
+  const char* at = strstr(text, needle);
+  if (!at) return false;
+  out = atof(at + strlen(needle));
+  return true;
+}
+
+static void run(uint64_t us, uint32_t stepUs) {
+  uint64_t end = hal::sim::nowMicros() + us;
+  while (hal::sim::nowMicros() < end) {
+    loop();
+    hal::sim::advanceMicros(stepUs);
+  }
+}
+
+// Sends a command and runs until a message of `type` comes back
+static bool request(const char* command, const char* type, uint64_t timeoutUs, uint32_t stepUs) {
+  awaitedType = type;
+  messageSeen = false;
+  hal::sim::injectWsText(0, command);
+  uint64_t end = hal::sim::nowMicros() + timeoutUs;
+  while (!messageSeen && hal::sim::nowMicros() < end) {
+    loop();
+    hal::sim::advanceMicros(stepUs);
+  }
+  awaitedType = nullptr;
+  return messageSeen;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: posebench [--no-calibrate] [--speed pct] [--max-error mm] [--mismatch gain]\n"
+          "                 [--deadband duty] [--lag ms] [--max-speed mm/s] [--gyro-bias dps]\n"
+          "                 [--gyro-noise dps] [--seed n] [--step us]\n");
+}
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (strcmp(arg, "--no-calibrate") == 0) {
+      options.calibrate = false;
+    } else if (strcmp(arg, "--speed") == 0 && hasValue) {
+      options.speed = atoi(argv[++i]);
+    } else if (strcmp(arg, "--max-error") == 0 && hasValue) {
+      options.maxError = atof(argv[++i]);
+    } else if (strcmp(arg, "--mismatch") == 0 && hasValue) {
+      options.drive.rightGain = atof(argv[++i]);
+    } else if (strcmp(arg, "--deadband") == 0 && hasValue) {
+      options.drive.deadband = atof(argv[++i]);
+    } else if (strcmp(arg, "--lag") == 0 && hasValue) {
+      options.drive.timeConstant = atof(argv[++i]) / 1000.0f;
+    } else if (strcmp(arg, "--max-speed") == 0 && hasValue) {
+      options.drive.maxSpeed = atof(argv[++i]);
+    } else if (strcmp(arg, "--gyro-bias") == 0 && hasValue) {
+      options.sensors.gyroBias = atof(argv[++i]) * M_PI / 180.0;
+    } else if (strcmp(arg, "--gyro-noise") == 0 && hasValue) {
+      options.sensors.gyroNoise = atof(argv[++i]) * M_PI / 180.0;
+    } else if (strcmp(arg, "--seed") == 0 && hasValue) {
+      options.seed = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(arg, "--step") == 0 && hasValue) {
+      options.stepUs = strtoul(argv[++i], nullptr, 10);
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (options.stepUs == 0 || options.speed < 1) {
+    usage();
+    return 2;
+  }
+
+  Track arena;
+  arena.loadArena(ARENA_WIDTH, ARENA_HEIGHT, { START_X, ARENA_HEIGHT / 2, 0 });
+
+  hal::sim::useVirtualTime(true);
+  hal::sim::setNetworkPort(0);
+  hal::sim::setStoragePath("/dev/null");
+  hal::sim::setFlashPath("/dev/null");
+  hal::sim::setWsSendHook(onWsSend);
+
+  // The firmware logs to stdout
+  fflush(stdout);
+  FILE* out = fdopen(dup(fileno(stdout)), "w");
+  if (!out || !freopen("/dev/null", "w", stdout)) return 2;
+
+  SimWorld world(arena, options.drive, options.sensors, options.seed);
+  world.attach();
+  setup();
+  run(BOOT_US, options.stepUs);
+
+  int failures = 0;
+  const DriveParams& d = options.drive;
+  if (options.calibrate) {
+    bool answered = request("{\"type\":\"speed_calibrate\",\"action\":\"start\"}",
+                            "speed_calibrate", CALIBRATION_TIMEOUT_US, options.stepUs);
+    double gain = 0, deadband = 0;
+    if (!answered || !strstr(lastMessage, "\"done\"") || !jsonNumber(lastMessage, "gain", gain) ||
+        !jsonNumber(lastMessage, "deadband", deadband)) {
+      fprintf(out, "calibration failed: %s\n", answered ? lastMessage : "timeout");
+      fclose(out);
+      return 1;
+    }
+    // Mean of both wheels, as the estimator models them
+    double trueGain = d.maxSpeed * (d.leftGain + d.rightGain) / 2 / (1 - d.deadband);
+    fprintf(out, "speed model: gain %.0f mm/s (true %.0f), deadband %.3f (true %.3f)\n",
+            gain, trueGain, deadband, d.deadband);
+    fprintf(out, "calibration runs: %s\n", strstr(lastMessage, "\"runs\"") ? strstr(lastMessage, "\"runs\"") + 7 : "?");
+    run(SETTLE_US, options.stepUs);
+  }
+
+  // Pose frame: where the robot stands now
+  request("{\"type\":\"pose\",\"action\":\"reset\"}", "pose", 100000, options.stepUs);
+  TrackPose origin = world.robot().pose();
+
+  fprintf(out, "%-16s %8s %8s %8s %8s %8s %8s %8s %8s\n", "move", "true_x", "true_y", "true_th",
+          "est_x", "est_y", "est_th", "est_mm", "target_mm");
+
+  double worstEstimate = 0, sumTarget = 0;
+  int moves = 0;
+  for (const Move& move : COURSE) {
+    char command[128];
+    char label[32];
+    if (move.kind[0] == 'd') {
+      snprintf(command, sizeof(command), "{\"type\":\"drive\",\"distance\":%g,\"speed\":%d}",
+               move.a, options.speed);
+      snprintf(label, sizeof(label), "drive %g", move.a);
+    } else {
+      snprintf(command, sizeof(command), "{\"type\":\"goto\",\"x\":%g,\"y\":%g,\"speed\":%d}",
+               move.a, move.b, options.speed);
+      snprintf(label, sizeof(label), "goto %g,%g", move.a, move.b);
+    }
+
+    bool answered = request(command, "motion", MOVE_TIMEOUT_US, options.stepUs);
+    double targetX = 0, targetY = 0;
+    if (!answered || !strstr(lastMessage, "\"done\"") || !jsonNumber(lastMessage, "targetX", targetX) ||
+        !jsonNumber(lastMessage, "targetY", targetY)) {
+      fprintf(out, "%-16s failed: %s\n", label, answered ? lastMessage : "timeout");
+      failures++;
+      break;
+    }
+    run(SETTLE_US, options.stepUs);
+
+    double x = 0, y = 0, theta = 0;
+    if (!request("{\"type\":\"pose\"}", "pose", 100000, options.stepUs) ||
+        !jsonNumber(lastMessage, "x", x) || !jsonNumber(lastMessage, "y", y) ||
+        !jsonNumber(lastMessage, "theta", theta)) {
+      fprintf(out, "%-16s no pose\n", label);
+      failures++;
+      break;
+    }
+
+    // Truth in the pose frame, cm and degrees
+    const TrackPose& now = world.robot().pose();
+    float dx = now.x - origin.x, dy = now.y - origin.y;
+    float c = cosf(origin.heading), s = sinf(origin.heading);
+    double trueX = (dx * c + dy * s) / 10, trueY = (-dx * s + dy * c) / 10;
+    double trueTheta = remainder((now.heading - origin.heading) * 180 / M_PI, 360);
+
+    double estimateMm = hypot(x - trueX, y - trueY) * 10;
+    double targetMm = hypot(targetX - trueX, targetY - trueY) * 10;
+    fprintf(out, "%-16s %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n", label, trueX, trueY,
+            trueTheta, x, y, theta, estimateMm, targetMm);
+
+    if (estimateMm > worstEstimate) worstEstimate = estimateMm;
+    sumTarget += targetMm;
+    moves++;
+  }
+
+  if (worstEstimate > options.maxError) failures++;
+  fprintf(out, "posebench: %d moves, worst estimate error %.1f mm, mean target error %.1f mm, %s\n",
+          moves, worstEstimate, moves ? sumTarget / moves : 0, failures ? "FAILED" : "ok");
+  fclose(out);
+  world.detach();
+  return failures ? 1 : 0;
+}
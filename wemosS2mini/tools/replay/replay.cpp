@@ -0,0 +1,365 @@
+/*
+ * replay - run the control algorithms over a recorded sensor trace
+ *
+ * Feeds every sample of a trace through lineFollowerStep(),
+ * classifyIntersection() and ImuIntegrator exactly as the firmware does,
+ * and writes the resulting motor commands and events as CSV. With
+ * --golden the output is compared against a previous run instead, so a
+ * change to the control code can be regression-tested against a library
+ * of real runs.
+ *
+ * Usage:
+ *   replay <trace.srfl|trace.csv> [options]
+ *     -o <file>            write output CSV (default: stdout unless --golden)
+ *     --golden <file>      compare against golden output, exit 1 on mismatch
+ *     --tolerance <v>      numeric tolerance for --golden (default 0.01)
+ *     --speed <percent>    line follower speed (default 50)
+ *     --kp <gain>          line follower gain (default 0.5)
+ *     --threshold <raw>    line sensor threshold (default 500)
+ *     --dt <seconds>       IMU step (default: log period, 0.01 for CSV)
+ *
+ * Traces are flight recorder logs (GET /log) or CSV with the columns
+ * written by tools/flightlog; columns ax, ay, az (m/s^2) are used when present.
+ *
+ * Build with `pio run -e replay`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <FlightRecorder.h>
+#include <LineFollower.h>
+#include <ImuIntegrator.h>
+
+struct TraceSample {
+  double tMs;
+  int line[LINE_SENSOR_COUNT];
+  float gyroZ;       // deg/s
+  float ax, ay, az;  // m/s^2
+};
+
+struct Trace {
+  std::vector<TraceSample> samples;
+  double periodS;
+};
+
+// =====================================================
+// TRACE LOADING
+// =====================================================
+
+static bool loadBinaryTrace(FILE* in, Trace& trace) {
+  FlightLogHeader header;
+  if (fread(&header, sizeof(header), 1, in) != 1 ||
+      header.version != FLIGHT_LOG_VERSION || header.recordSize != sizeof(FlightRecord)) {
+    return false;
+  }
+
+  trace.periodS = header.periodUs > 0 ? header.periodUs / 1e6 : 0.01;
+  trace.samples.reserve(header.recordCount);
+
+  FlightRecord record;
+  uint32_t startUs = 0;
+  for (uint32_t n = 0; n < header.recordCount && fread(&record, sizeof(record), 1, in) == 1; n++) {
+    if (n == 0) startUs = record.timeUs;
+
+    TraceSample s;
+    s.tMs = (uint32_t)(record.timeUs - startUs) / 1000.0;
+    for (int i = 0; i < LINE_SENSOR_COUNT; i++) {
+      s.line[i] = record.line[i];
+    }
+    s.gyroZ = record.gyroZ / 100.0f;
+    // The recorder does not keep acceleration; assume the robot is level
+    s.ax = 0;
+    s.ay = 0;
+    s.az = 9.81f;
+    trace.samples.push_back(s);
+  }
+  return true;
+}
+
+static int splitCsv(char* line, char** fields, int maxFields) {
+  int n = 0;
+  char* p = line;
+  while (n < maxFields) {
+    fields[n++] = p;
+    char* comma = strchr(p, ',');
+    if (!comma) break;
+    *comma = '\0';
+    p = comma + 1;
+  }
+  // Strip line ending from the last field
+  char* last = fields[n - 1];
+  last[strcspn(last, "\r\n")] = '\0';
+  return n;
+}
+
+static bool loadCsvTrace(FILE* in, Trace& trace) {
+  enum { MAX_FIELDS = 64 };
+  char buffer[1024];
+  char* fields[MAX_FIELDS];
+
+  if (!fgets(buffer, sizeof(buffer), in)) return false;
+  int columns = splitCsv(buffer, fields, MAX_FIELDS);
+
+  int colTime = -1, colGyro = -1, colAx = -1, colAy = -1, colAz = -1;
+  int colLine[LINE_SENSOR_COUNT];
+  for (int i = 0; i < LINE_SENSOR_COUNT; i++) colLine[i] = -1;
+
+  for (int c = 0; c < columns; c++) {
+    const char* name = fields[c];
+    if (strcmp(name, "t_ms") == 0) colTime = c;
+    else if (strcmp(name, "gyro_z_dps") == 0) colGyro = c;
+    else if (strcmp(name, "ax") == 0) colAx = c;
+    else if (strcmp(name, "ay") == 0) colAy = c;
+    else if (strcmp(name, "az") == 0) colAz = c;
+    else if (strncmp(name, "line", 4) == 0 && name[4] >= '0' && name[4] < '0' + LINE_SENSOR_COUNT && !name[5]) {
+      colLine[name[4] - '0'] = c;
+    }
+  }
+
+  if (colTime < 0) return false;
+  for (int i = 0; i < LINE_SENSOR_COUNT; i++) {
+    if (colLine[i] < 0) return false;
+  }
+
+  trace.periodS = 0.01;
+  while (fgets(buffer, sizeof(buffer), in)) {
+    if (splitCsv(buffer, fields, MAX_FIELDS) != columns) continue;
+
+    TraceSample s;
+    s.tMs = atof(fields[colTime]);
+    for (int i = 0; i < LINE_SENSOR_COUNT; i++) {
+      s.line[i] = atoi(fields[colLine[i]]);
+    }
+    s.gyroZ = colGyro >= 0 ? atof(fields[colGyro]) : 0;
+    s.ax = colAx >= 0 ? atof(fields[colAx]) : 0;
+    s.ay = colAy >= 0 ? atof(fields[colAy]) : 0;
+    s.az = colAz >= 0 ? atof(fields[colAz]) : 9.81f;
+    trace.samples.push_back(s);
+  }
+  return true;
+}
+
+static bool loadTrace(const char* path, Trace& trace) {
+  FILE* in = fopen(path, "rb");
+  if (!in) {
+    perror(path);
+    return false;
+  }
+
+  uint32_t magic = 0;
+  bool ok;
+  if (fread(&magic, sizeof(magic), 1, in) == 1 && magic == FLIGHT_LOG_MAGIC) {
+    rewind(in);
+    ok = loadBinaryTrace(in, trace);
+  } else {
+    rewind(in);
+    ok = loadCsvTrace(in, trace);
+  }
+  fclose(in);
+
+  if (!ok) fprintf(stderr, "%s: unrecognized trace format\n", path);
+  return ok;
+}
+
+// =====================================================
+// REPLAY
+// =====================================================
+
+static void replay(const Trace& trace, const LineFollowerParams& params, double dt,
+                   std::string& out) {
+  ImuIntegrator imu;
+  int left = 0, right = 0;
+  float error = 0;
+  bool wasLost = false;
+  IntersectionType lastShape = INTERSECTION_NONE;
+  char row[160];
+
+  out += "t_ms,error,motor_left,motor_right,yaw_deg,event\n";
+
+  for (const TraceSample& s : trace.samples) {
+    ImuReading reading = { s.ax, s.ay, s.az, 0, 0, (float)(s.gyroZ * M_PI / 180.0) };
+    Attitude att = imu.update(reading, dt);
+
+    // The firmware keeps the previous motor command while the line is lost
+    LineFollowerOutput lf = lineFollowerStep(s.line, params);
+    if (!lf.lineLost) {
+      left = lf.left;
+      right = lf.right;
+      error = lf.error;
+    }
+
+    // Events are reported on change only
+    const char* event = "";
+    IntersectionType shape = classifyIntersection(s.line, params.threshold);
+    if (lf.lineLost != wasLost) {
+      event = lf.lineLost ? "line_lost" : "line_found";
+    } else if (shape != lastShape && shape != INTERSECTION_NONE) {
+      event = intersectionName(shape);
+    }
+    wasLost = lf.lineLost;
+    lastShape = shape;
+
+    snprintf(row, sizeof(row), "%.3f,%.1f,%d,%d,%.2f,%s\n",
+             s.tMs, error, left, right, att.yaw, event);
+    out += row;
+  }
+}
+
+// =====================================================
+// GOLDEN COMPARISON
+// =====================================================
+
+static bool fieldsEqual(const char* a, const char* b, double tolerance) {
+  if (strcmp(a, b) == 0) return true;
+
+  char* endA;
+  char* endB;
+  double va = strtod(a, &endA);
+  double vb = strtod(b, &endB);
+  if (endA == a || endB == b || *endA || *endB) return false;
+  return fabs(va - vb) <= tolerance;
+}
+
+static int compareGolden(const std::string& output, const char* goldenPath, double tolerance) {
+  FILE* golden = fopen(goldenPath, "r");
+  if (!golden) {
+    perror(goldenPath);
+    return -1;
+  }
+
+  enum { MAX_FIELDS = 16, MAX_REPORTED = 10 };
+  char expected[256];
+  char actual[256];
+  char expectedFieldsBuf[256];
+  char actualFieldsBuf[256];
+  char* expectedFields[MAX_FIELDS];
+  char* actualFields[MAX_FIELDS];
+  int mismatches = 0;
+  int lineNo = 0;
+  size_t pos = 0;
+
+  while (true) {
+    bool haveExpected = fgets(expected, sizeof(expected), golden) != nullptr;
+    bool haveActual = pos < output.size();
+    if (!haveExpected && !haveActual) break;
+    lineNo++;
+
+    if (haveActual) {
+      size_t end = output.find('\n', pos);
+      size_t len = end - pos;
+      if (len >= sizeof(actual)) len = sizeof(actual) - 1;
+      memcpy(actual, output.data() + pos, len);
+      actual[len] = '\0';
+      pos = end + 1;
+    }
+
+    if (haveExpected) expected[strcspn(expected, "\r\n")] = '\0';
+
+    bool same = haveExpected && haveActual;
+    if (same) {
+      // Split copies so the original lines stay printable
+      strcpy(expectedFieldsBuf, expected);
+      strcpy(actualFieldsBuf, actual);
+      int ne = splitCsv(expectedFieldsBuf, expectedFields, MAX_FIELDS);
+      int na = splitCsv(actualFieldsBuf, actualFields, MAX_FIELDS);
+      same = ne == na;
+      for (int i = 0; same && i < ne; i++) {
+        same = fieldsEqual(expectedFields[i], actualFields[i], tolerance);
+      }
+    }
+
+    if (!same) {
+      if (mismatches < MAX_REPORTED) {
+        fprintf(stderr, "line %d differs\n  golden: %s\n  actual: %s\n", lineNo,
+                haveExpected ? expected : "<missing>", haveActual ? actual : "<missing>");
+      }
+      mismatches++;
+    }
+  }
+
+  fclose(golden);
+  return mismatches;
+}
+
+// =====================================================
+// MAIN
+// =====================================================
+
+int main(int argc, char** argv) {
+  const char* tracePath = nullptr;
+  const char* outPath = nullptr;
+  const char* goldenPath = nullptr;
+  double tolerance = 0.01;
+  double dt = 0;
+  LineFollowerParams params = { 50, 0.5f, LINE_SENSOR_THRESHOLD, false };
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (strcmp(arg, "-o") == 0 && hasValue) outPath = argv[++i];
+    else if (strcmp(arg, "--golden") == 0 && hasValue) goldenPath = argv[++i];
+    else if (strcmp(arg, "--tolerance") == 0 && hasValue) tolerance = atof(argv[++i]);
+    else if (strcmp(arg, "--speed") == 0 && hasValue) params.speed = atoi(argv[++i]);
+    else if (strcmp(arg, "--kp") == 0 && hasValue) params.kp = atof(argv[++i]);
+    else if (strcmp(arg, "--threshold") == 0 && hasValue) params.threshold = atoi(argv[++i]);
+    else if (strcmp(arg, "--dt") == 0 && hasValue) dt = atof(argv[++i]);
+    else if (arg[0] != '-' && !tracePath) tracePath = arg;
+    else {
+      fprintf(stderr, "unknown argument: %s\n", arg);
+      return 2;
+    }
+  }
+
+  if (!tracePath) {
+    fprintf(stderr, "usage: %s <trace.srfl|trace.csv> [-o out.csv] [--golden golden.csv] "
+                    "[--tolerance v] [--speed pct] [--kp gain] [--threshold raw] [--dt s]\n", argv[0]);
+    return 2;
+  }
+
+  Trace trace;
+  if (!loadTrace(tracePath, trace)) return 1;
+  if (dt <= 0) dt = trace.periodS;
+
+  std::string output;
+  output.reserve(trace.samples.size() * 48 + 64);
+
+  auto start = std::chrono::steady_clock::now();
+  replay(trace, params, dt, output);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  double elapsedMs = std::chrono::duration<double, std::milli>(elapsed).count();
+
+  double traceS = trace.samples.size() * dt;
+  fprintf(stderr, "%zu samples (%.1f s of trace) replayed in %.2f ms\n",
+          trace.samples.size(), traceS, elapsedMs);
+
+  if (outPath) {
+    FILE* out = fopen(outPath, "w");
+    if (!out) {
+      perror(outPath);
+      return 1;
+    }
+    fwrite(output.data(), 1, output.size(), out);
+    fclose(out);
+  } else if (!goldenPath) {
+    fwrite(output.data(), 1, output.size(), stdout);
+  }
+
+  if (goldenPath) {
+    int mismatches = compareGolden(output, goldenPath, tolerance);
+    if (mismatches < 0) return 1;
+    if (mismatches > 0) {
+      fprintf(stderr, "%d line(s) differ from %s\n", mismatches, goldenPath);
+      return 1;
+    }
+    fprintf(stderr, "matches %s\n", goldenPath);
+  }
+
+  return 0;
+}
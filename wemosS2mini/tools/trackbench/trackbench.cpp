@@ -0,0 +1,379 @@
+/*
+ * trackbench - closed-loop line follower benchmark on simulated tracks
+ *
+ * Runs the unchanged firmware (setup()/loop()) on the simulated board in
+ * virtual time, with a differential-drive model driving the sensors
+ * (lib/SiroboSim). For each track the robot starts on the line, the line
+ * follower is enabled over the WebSocket and the run continues until the
+ * requested number of laps, the time limit or the robot leaving the track.
+ * Every track runs in its own process, so firmware state never leaks
+ * between runs.
+ *
+ * Usage:
+ *   trackbench [track ...] [options]
+ *     track                 built-in name or .track file (default: all built-in)
+ *     --list                list the built-in tracks
+ *     --laps <n>            laps per track (default 3)
+ *     --timeout <s>         simulated time limit per track (default 150)
+ *     --speed <percent>     line follower speed (default 50)
+ *     --kp <gain>           line follower gain (default: firmware default)
+ *     --calibrate <l>,<r>   motor calibration sent before the run
+ *     --mismatch <gain>     right motor gain relative to the left (default 0.95)
+ *     --deadband <duty>     motor deadband, 0..1 (default 0.15)
+ *     --lag <ms>            motor time constant (default 60)
+ *     --gyro-bias <dps>     (default 0.5)
+ *     --gyro-noise <dps>    (default 0.1)
+ *     --seed <n>            noise seed (default 1)
+ *     --step <us>           virtual time per loop() (default 1000)
+ *     --learn               lap learning: built-in tracks get a start marker,
+ *                           the first lap from it is learned and the rest
+ *                           raced with the speed profile
+ *     --max-speed <percent> lap learning speed on straights (default: firmware)
+ *     --grip <factor>       lap learning grip (default: firmware)
+ *     --csv <file>          also write the results as CSV
+ *
+ * Exits non-zero when a track was not completed.
+ *
+ * Build with `pio run -e trackbench`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <HalSim.h>
+#include <SimWorld.h>
+
+#define OFF_TRACK_MM 150          // cross-track error that counts as off the track
+#define OFF_TRACK_LIMIT_MS 2000   // ... for this long ends the run
+#define METRIC_PERIOD_US 10000    // metrics sampled every 10 ms
+
+void setup();
+void loop();
+
+struct BenchOptions {
+  int laps = 3;
+  double timeoutS = 150;
+  int speed = 50;
+  float kp = -1;
+  bool calibrate = false;
+  int calibrateLeft = 0, calibrateRight = 0;
+  DriveParams drive = defaultDriveParams();
+  SensorParams sensors = defaultSensorParams();
+  uint32_t seed = 1;
+  uint32_t stepUs = 1000;
+  bool learn = false;
+  int maxSpeed = -1;
+  float grip = -1;
+};
+
+// Written by the child process through a pipe
+struct TrackResult {
+  int laps;
+  double lapTimes[16];
+  double xteSumSq;
+  double xteMax;
+  uint32_t samples;
+  uint32_t lostSamples;
+  double simSeconds;
+  double wallSeconds;
+  char status[16];
+};
+
+static double wallNow() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void sendCommand(const char* json) {
+  hal::sim::injectWsText(0, json);
+}
+
+static TrackResult runTrack(const Track& track, const BenchOptions& options) {
+  TrackResult result;
+  memset(&result, 0, sizeof(result));
+  strcpy(result.status, "timeout");
+
+  hal::sim::useVirtualTime(true);
+  hal::sim::setNetworkPort(0);
+  hal::sim::setStoragePath("/dev/null");
+  hal::sim::setFlashPath("/dev/null");
+
+  SimWorld world(track, options.drive, options.sensors, options.seed);
+  world.attach();
+  setup();
+
+  char command[128];
+  if (options.calibrate) {
+    snprintf(command, sizeof(command), "{\"type\":\"calibrate\",\"left\":%d,\"right\":%d}",
+             options.calibrateLeft, options.calibrateRight);
+    sendCommand(command);
+  }
+  if (options.kp >= 0) {
+    snprintf(command, sizeof(command), "{\"type\":\"line_follower\",\"enable\":true,\"speed\":%d,\"kp\":%g}",
+             options.speed, options.kp);
+  } else {
+    snprintf(command, sizeof(command), "{\"type\":\"line_follower\",\"enable\":true,\"speed\":%d}",
+             options.speed);
+  }
+  sendCommand(command);
+
+  if (options.learn) {
+    int length = snprintf(command, sizeof(command), "{\"type\":\"lap\",\"action\":\"learn\"");
+    if (options.maxSpeed > 0) {
+      length += snprintf(command + length, sizeof(command) - length, ",\"maxSpeed\":%d", options.maxSpeed);
+    }
+    if (options.grip > 0) {
+      length += snprintf(command + length, sizeof(command) - length, ",\"grip\":%g", options.grip);
+    }
+    snprintf(command + length, sizeof(command) - length, "}");
+    sendCommand(command);
+  }
+
+  uint64_t startUs = hal::sim::nowMicros();
+  uint64_t endUs = startUs + (uint64_t)(options.timeoutS * 1e6);
+  uint64_t nextMetricUs = startUs;
+  uint64_t lastLapUs = startUs;
+  uint64_t offTrackSinceUs = 0;
+
+  size_t hint = TRACK_NO_HINT;
+  float startArc = 0, lastArc = 0;
+  double progress = 0;
+  bool first = true;
+  double wallStart = wallNow();
+
+  while (hal::sim::nowMicros() < endUs) {
+    loop();
+    hal::sim::advanceMicros(options.stepUs);
+
+    uint64_t now = hal::sim::nowMicros();
+    if (now < nextMetricUs) continue;
+    nextMetricUs += METRIC_PERIOD_US;
+
+    if (!track.hasCenterline()) continue;
+
+    // Cross-track error is measured at the line array, where the controller looks
+    float arc;
+    float xte = track.project(world.robot().lineArrayCenter(), hint, arc);
+    if (first) {
+      startArc = lastArc = arc;
+      first = false;
+    }
+
+    // Unwrap arc length into distance driven along the line
+    float delta = arc - lastArc;
+    if (track.closed()) {
+      float length = track.length();
+      if (delta > length / 2) delta -= length;
+      if (delta < -length / 2) delta += length;
+    }
+    progress += delta;
+    lastArc = arc;
+
+    result.samples++;
+    result.xteSumSq += (double)xte * xte;
+    if (xte > result.xteMax) result.xteMax = xte;
+    if (xte > track.lineWidth() / 2) result.lostSamples++;
+
+    if (xte > OFF_TRACK_MM) {
+      if (!offTrackSinceUs) offTrackSinceUs = now;
+      if (now - offTrackSinceUs >= OFF_TRACK_LIMIT_MS * 1000ULL) {
+        strcpy(result.status, "off_track");
+        break;
+      }
+    } else {
+      offTrackSinceUs = 0;
+    }
+
+    double lapLength = track.closed() ? track.length() : track.length() - startArc;
+    if (progress >= lapLength * (result.laps + 1)) {
+      if (result.laps < 16) result.lapTimes[result.laps] = (now - lastLapUs) / 1e6;
+      result.laps++;
+      lastLapUs = now;
+      if (result.laps >= options.laps || !track.closed()) {
+        strcpy(result.status, "ok");
+        break;
+      }
+    }
+  }
+
+  result.wallSeconds = wallNow() - wallStart;
+  result.simSeconds = (hal::sim::nowMicros() - startUs) / 1e6;
+  world.detach();
+  return result;
+}
+
+// Runs one track in a child process so every run starts from a fresh firmware
+static bool runIsolated(const Track& track, const BenchOptions& options, TrackResult& result) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    return false;
+  }
+
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  }
+
+  if (pid == 0) {
+    close(fds[0]);
+    // The firmware logs to stdout
+    if (!freopen("/dev/null", "w", stdout)) _exit(2);
+    TrackResult r = runTrack(track, options);
+    ssize_t n = write(fds[1], &r, sizeof(r));
+    _exit(n == (ssize_t)sizeof(r) ? 0 : 2);
+  }
+
+  close(fds[1]);
+  ssize_t n = read(fds[0], &result, sizeof(result));
+  close(fds[0]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return n == (ssize_t)sizeof(result) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: trackbench [track ...] [--list] [--laps n] [--timeout s] [--speed pct]\n"
+          "                  [--kp gain] [--calibrate l,r] [--mismatch gain] [--deadband duty]\n"
+          "                  [--lag ms] [--gyro-bias dps] [--gyro-noise dps] [--seed n]\n"
+          "                  [--step us] [--learn] [--max-speed pct] [--grip factor]\n"
+          "                  [--csv file]\n");
+}
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+  std::vector<std::string> trackNames;
+  const char* csvPath = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (strcmp(arg, "--list") == 0) {
+      for (const char* const* name = Track::builtinNames(); *name; name++) printf("%s\n", *name);
+      return 0;
+    } else if (strcmp(arg, "--laps") == 0 && hasValue) {
+      options.laps = atoi(argv[++i]);
+    } else if (strcmp(arg, "--timeout") == 0 && hasValue) {
+      options.timeoutS = atof(argv[++i]);
+    } else if (strcmp(arg, "--speed") == 0 && hasValue) {
+      options.speed = atoi(argv[++i]);
+    } else if (strcmp(arg, "--kp") == 0 && hasValue) {
+      options.kp = atof(argv[++i]);
+    } else if (strcmp(arg, "--calibrate") == 0 && hasValue) {
+      options.calibrate = sscanf(argv[++i], "%d,%d", &options.calibrateLeft, &options.calibrateRight) == 2;
+      if (!options.calibrate) {
+        usage();
+        return 2;
+      }
+    } else if (strcmp(arg, "--mismatch") == 0 && hasValue) {
+      options.drive.rightGain = atof(argv[++i]);
+    } else if (strcmp(arg, "--deadband") == 0 && hasValue) {
+      options.drive.deadband = atof(argv[++i]);
+    } else if (strcmp(arg, "--lag") == 0 && hasValue) {
+      options.drive.timeConstant = atof(argv[++i]) / 1000.0f;
+    } else if (strcmp(arg, "--gyro-bias") == 0 && hasValue) {
+      options.sensors.gyroBias = atof(argv[++i]) * M_PI / 180.0;
+    } else if (strcmp(arg, "--gyro-noise") == 0 && hasValue) {
+      options.sensors.gyroNoise = atof(argv[++i]) * M_PI / 180.0;
+    } else if (strcmp(arg, "--seed") == 0 && hasValue) {
+      options.seed = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(arg, "--step") == 0 && hasValue) {
+      options.stepUs = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(arg, "--learn") == 0) {
+      options.learn = true;
+    } else if (strcmp(arg, "--max-speed") == 0 && hasValue) {
+      options.maxSpeed = atoi(argv[++i]);
+    } else if (strcmp(arg, "--grip") == 0 && hasValue) {
+      options.grip = atof(argv[++i]);
+    } else if (strcmp(arg, "--csv") == 0 && hasValue) {
+      csvPath = argv[++i];
+    } else if (arg[0] == '-') {
+      usage();
+      return 2;
+    } else {
+      trackNames.push_back(arg);
+    }
+  }
+
+  if (options.laps < 1 || options.stepUs == 0) {
+    usage();
+    return 2;
+  }
+  if (trackNames.empty()) {
+    for (const char* const* name = Track::builtinNames(); *name; name++) trackNames.push_back(*name);
+  }
+
+  FILE* csv = nullptr;
+  if (csvPath) {
+    csv = fopen(csvPath, "w");
+    if (!csv) {
+      perror(csvPath);
+      return 1;
+    }
+    fprintf(csv, "track,status,laps,best_lap_s,mean_lap_s,xte_rms_mm,xte_max_mm,"
+                 "off_line_pct,sim_s,wall_s,speedup\n");
+  }
+
+  printf("%-16s %-9s %4s %8s %8s %10s %10s %8s %7s %8s %8s\n", "track", "status", "laps",
+         "best_s", "mean_s", "xte_rms_mm", "xte_max_mm", "off_pct", "sim_s", "wall_ms", "speedup");
+
+  int failures = 0;
+  double totalSim = 0, totalWall = 0;
+  for (const std::string& name : trackNames) {
+    Track track;
+    bool loaded = strchr(name.c_str(), '.') || strchr(name.c_str(), '/')
+                    ? track.load(name.c_str())
+                    : track.loadBuiltin(name.c_str(), options.learn);
+    if (!loaded) {
+      fprintf(stderr, "unknown track: %s\n", name.c_str());
+      failures++;
+      continue;
+    }
+
+    TrackResult r;
+    if (!runIsolated(track, options, r)) {
+      fprintf(stderr, "%s: simulation failed\n", name.c_str());
+      failures++;
+      continue;
+    }
+
+    double best = 0, sum = 0;
+    int timed = r.laps < 16 ? r.laps : 16;
+    for (int i = 0; i < timed; i++) {
+      if (i == 0 || r.lapTimes[i] < best) best = r.lapTimes[i];
+      sum += r.lapTimes[i];
+    }
+    double mean = timed ? sum / timed : 0;
+    double rms = r.samples ? sqrt(r.xteSumSq / r.samples) : 0;
+    double offPct = r.samples ? 100.0 * r.lostSamples / r.samples : 0;
+    double speedup = r.wallSeconds > 0 ? r.simSeconds / r.wallSeconds : 0;
+
+    printf("%-16s %-9s %4d %8.2f %8.2f %10.1f %10.1f %8.1f %7.1f %8.1f %7.0fx\n",
+           track.name(), r.status, r.laps, best, mean, rms, r.xteMax, offPct,
+           r.simSeconds, r.wallSeconds * 1000, speedup);
+    if (csv) {
+      fprintf(csv, "%s,%s,%d,%.3f,%.3f,%.2f,%.2f,%.2f,%.3f,%.4f,%.0f\n", track.name(), r.status,
+              r.laps, best, mean, rms, r.xteMax, offPct, r.simSeconds, r.wallSeconds, speedup);
+    }
+
+    if (strcmp(r.status, "ok") != 0) failures++;
+    totalSim += r.simSeconds;
+    totalWall += r.wallSeconds;
+  }
+
+  if (csv) fclose(csv);
+  fflush(stdout);
+  fprintf(stderr, "trackbench: %.1f s simulated in %.2f s (%.0fx real time), %d failed\n",
+          totalSim, totalWall, totalWall > 0 ? totalSim / totalWall : 0, failures);
+  return failures ? 1 : 0;
+}